@@ -0,0 +1,425 @@
+#include "lightundocommand.h"
+#include "undocommandpool.h"
+#include "undocommandpool_p.h"
+#include "undoserializer_p.h"
+
+#include <algorithm>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class LightUndoCommand
+    \brief The LightUndoCommand class is the base class of all commands stored on a UndoStack.
+    \since 5.7
+
+    LightUndoCommand provides the same undo(), redo(), id(), mergeWith() and
+    child command semantics as UndoCommand, but does not derive from QObject.
+    It stores its text and child commands inline and needs a single allocation,
+    which makes it the better choice for applications that push very large
+    numbers of commands, such as one command per mouse move during a drag.
+
+    UndoCommand derives from both QObject and LightUndoCommand, in the same way
+    that QGraphicsObject derives from QObject and QGraphicsItem. Use UndoCommand
+    when the command needs signals, slots or properties, and LightUndoCommand
+    otherwise. Both kinds of commands can be pushed on the same UndoStack. A
+    LightUndoCommand can be the child of an UndoCommand, but an UndoCommand can
+    only be the child of another UndoCommand, since its constructors take an
+    UndoCommand parent.
+
+    \sa UndoCommand, UndoStack
+*/
+
+/*!
+    Constructs a LightUndoCommand object with the given \a parent and \a text.
+
+    If \a parent is not null, this command is appended to parent's child list.
+    The parent command then owns this command and will delete it in its
+    destructor.
+
+    \sa ~LightUndoCommand()
+*/
+
+LightUndoCommand::LightUndoCommand(const QString &text, LightUndoCommand *parent) :
+    m_text(text)
+{
+    if (parent != 0)
+        parent->m_childCommands.append(this);
+}
+
+/*!
+    Constructs a LightUndoCommand object with parent \a parent.
+
+    If \a parent is not null, this command is appended to parent's child list.
+    The parent command then owns this command and will delete it in its
+    destructor.
+
+    \sa ~LightUndoCommand()
+*/
+
+LightUndoCommand::LightUndoCommand(LightUndoCommand *parent)
+{
+    if (parent != 0)
+        parent->m_childCommands.append(this);
+}
+
+/*!
+    Destroys the LightUndoCommand object and all child commands.
+
+    \sa LightUndoCommand()
+*/
+
+LightUndoCommand::~LightUndoCommand()
+{
+    qDeleteAll(m_childCommands);
+}
+
+/*!
+    Returns the ID of this command.
+
+    A command ID is used in command compression. It must be an integer unique to
+    this command's class, or -1 if the command doesn't support compression.
+
+    If the command supports compression this function must be overridden in the
+    derived class to return the correct ID. The base implementation returns -1.
+
+    UndoStack::push() will only try to merge two commands if they have the
+    same ID, and the ID is not -1.
+
+    \sa mergeWith(), UndoStack::push()
+*/
+
+int LightUndoCommand::id() const
+{
+    return -1;
+}
+
+/*!
+    Attempts to merge this command with \a command. Returns \c true on
+    success; otherwise returns \c false.
+
+    If this function returns \c true, calling this command's redo() must have the same
+    effect as redoing both this command and \a command.
+    Similarly, calling this command's undo() must have the same effect as undoing
+    \a command and this command.
+
+    UndoStack will only try to merge two commands if they have the same id, and
+    the id is not -1.
+
+    The default implementation returns \c false.
+
+    \sa id(), UndoStack::push()
+*/
+
+bool LightUndoCommand::mergeWith(const LightUndoCommand *command)
+{
+    Q_UNUSED(command);
+    return false;
+}
+
+/*!
+    Returns the approximate number of bytes this command keeps alive, such as
+    the pixels of a pasted bitmap or the text of a deleted paragraph.
+
+    UndoStack sums the costs of its commands into UndoStack::memoryUsage and
+    evicts the oldest commands when the total exceeds UndoStack::memoryLimit.
+    The stack queries the cost when the command is pushed, after another command
+    has been merged into it, and, for a macro, when UndoStack::endMacro() is
+    called. The value must not change at other times.
+
+    The default implementation returns the sum of the costs of the child commands,
+    which is 0 for a command without children.
+
+    \sa UndoStack::memoryLimit
+*/
+
+qint64 LightUndoCommand::cost() const
+{
+    qint64 total = 0;
+    for (int i = 0; i < m_childCommands.size(); ++i)
+        total += m_childCommands.at(i)->cost();
+    return total;
+}
+
+/*!
+    \variable LightUndoCommand::AllResources
+
+    A resource key that stands for every resource of the document. A command whose
+    resources() contain it conflicts with all other commands.
+*/
+
+const quint64 LightUndoCommand::AllResources;
+
+/*!
+    Returns keys of the parts of the document that this command reads or modifies,
+    such as the ids of the shapes it moves. The keys are chosen by the application;
+    two commands conflict if they share a key.
+
+    UndoStack::undoSelectively() uses the keys to find out whether a command can be
+    undone without undoing the commands pushed after it. The stack queries them when
+    the command has been pushed, after another command has been merged into it, and
+    when it removes the command. The keys must not change at other times, except that
+    merging may add keys.
+
+    The default implementation returns the keys of the child commands. For a command
+    without children, it returns AllResources, which makes the command conflict with
+    every other command.
+
+    \sa UndoStack::canUndoSelectively()
+*/
+
+QVector<quint64> LightUndoCommand::resources() const
+{
+    if (m_childCommands.isEmpty())
+        return QVector<quint64>() << AllResources;
+
+    QVector<quint64> keys;
+    for (int i = 0; i < m_childCommands.size(); ++i)
+        keys += m_childCommands.at(i)->resources();
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+/*!
+    \typedef LightUndoCommand::LoadFunction
+
+    A function that creates a command from the data that save() wrote to \a stream,
+    and returns it, or returns 0 if the data cannot be read. It is registered for a
+    type of command with registerType().
+*/
+
+/*!
+    Registers \a load as the function that recreates commands whose typeId() is
+    \a typeId. \a typeId must be 0 or greater. Registering another function for the
+    same \a typeId replaces the previous one. This function is thread-safe.
+
+    The stack writes a command to disk, to hibernate it (see
+    UndoStack::hibernationTimeout) or when UndoStack::save() is called, only if a load
+    function is registered for its type and for the types of all of its children.
+
+    \code
+    int MoveCommand::typeId() const { return 1; }
+
+    void MoveCommand::save(QDataStream &stream) const
+    {
+        stream << m_itemId << m_delta;
+    }
+
+    static LightUndoCommand *loadMoveCommand(QDataStream &stream)
+    {
+        int itemId;
+        QPointF delta;
+        stream >> itemId >> delta;
+        return new MoveCommand(itemId, delta);
+    }
+
+    LightUndoCommand::registerType(1, loadMoveCommand);
+    \endcode
+
+    \since 5.7
+    \sa typeId(), save()
+*/
+
+void LightUndoCommand::registerType(int typeId, LoadFunction load)
+{
+    if (Q_UNLIKELY(typeId < 0)) {
+        qWarning("LightUndoCommand::registerType(): invalid type id %d", typeId);
+        return;
+    }
+    UndoCommandSerializer::registerType(typeId, load);
+}
+
+/*!
+    Returns an ID unique to this command's class among the classes that can be written
+    to disk, or -1 if the command cannot be written to disk.
+
+    The default implementation returns -1.
+
+    \since 5.7
+    \sa save(), registerType()
+*/
+
+int LightUndoCommand::typeId() const
+{
+    return -1;
+}
+
+/*!
+    Writes the state of this command, which the function registered for typeId() reads
+    back, to \a stream. The text and the child commands are written by the stack and
+    need not be written here.
+
+    The default implementation writes nothing.
+
+    \since 5.7
+    \sa typeId(), registerType()
+*/
+
+void LightUndoCommand::save(QDataStream &stream) const
+{
+    Q_UNUSED(stream);
+}
+
+/*!
+    Applies a change to the document. This function must be implemented in
+    the derived class. Calling UndoStack::push(),
+    UndoStack::undo() or UndoStack::redo() from this function leads to
+    undefined beahavior.
+
+    The default implementation calls redo() on all child commands.
+
+    \sa undo()
+*/
+
+void LightUndoCommand::redo()
+{
+    for (int i = 0; i < m_childCommands.size(); ++i)
+        m_childCommands.at(i)->redo();
+}
+
+/*!
+    Reverts a change to the document. After undo() is called, the state of
+    the document should be the same as before redo() was called. This function must
+    be implemented in the derived class. Calling UndoStack::push(),
+    UndoStack::undo() or UndoStack::redo() from this function leads to
+    undefined beahavior.
+
+    The default implementation calls undo() on all child commands in reverse order.
+
+    \sa redo()
+*/
+
+void LightUndoCommand::undo()
+{
+    for (int i = m_childCommands.size() - 1; i >= 0; --i)
+        m_childCommands.at(i)->undo();
+}
+
+/*!
+    Returns a short text string describing what this command does; for example,
+    "insert text".
+
+    \sa setText(), UndoStack::undoText(), UndoStack::redoText()
+*/
+
+QString LightUndoCommand::text() const
+{
+    return m_text;
+}
+
+/*!
+    Sets the command's text to \a text.
+
+    The specified text should be a short user-readable string describing what this
+    command does.
+
+    Unlike UndoCommand::setText(), this function does not emit any signal. When
+    the command is an UndoCommand, call UndoCommand::setText() instead so that
+    UndoCommand::textChanged() is emitted.
+
+    \sa text()
+*/
+
+void LightUndoCommand::setText(const QString &text)
+{
+    m_text = text;
+}
+
+/*!
+    Returns the number of child commands in this command.
+
+    \sa child()
+*/
+
+int LightUndoCommand::childCount() const
+{
+    return m_childCommands.count();
+}
+
+/*!
+    Returns the child command at \a index.
+
+    \sa childCount(), UndoStack::command()
+*/
+
+const LightUndoCommand *LightUndoCommand::child(int index) const
+{
+    if (index < 0 || index >= m_childCommands.count())
+        return 0;
+    return m_childCommands.at(index);
+}
+
+/*!
+    Returns this command cast to an UndoCommand if it is one, or 0 if it is a
+    plain LightUndoCommand.
+
+    UndoCommand reimplements this function; there is no need to reimplement
+    it in other subclasses.
+*/
+
+UndoCommand *LightUndoCommand::toUndoCommand()
+{
+    return 0;
+}
+
+/*!
+    \overload
+*/
+
+const UndoCommand *LightUndoCommand::toUndoCommand() const
+{
+    return const_cast<LightUndoCommand *>(this)->toUndoCommand();
+}
+
+/*!
+    Allocates \a size bytes for a command on the heap.
+*/
+
+void *LightUndoCommand::operator new(std::size_t size)
+{
+    return UndoCommandPoolPrivate::allocateFrom(0, size);
+}
+
+/*!
+    \overload
+
+    Allocates \a size bytes for a command from \a pool. If \a pool is 0, the
+    command is allocated on the heap.
+
+    \code
+    stack->push(new (stack->commandPool()) MoveCommand(item, delta));
+    \endcode
+
+    \sa UndoCommandPool, UndoStack::commandPool()
+*/
+
+void *LightUndoCommand::operator new(std::size_t size, UndoCommandPool *pool)
+{
+    return UndoCommandPoolPrivate::allocateFrom(pool != 0 ? UndoCommandPoolPrivate::get(pool) : 0,
+                                                size);
+}
+
+/*!
+    Frees the \a size bytes of the command at \a ptr, returning them to the
+    pool they were allocated from, if any.
+*/
+
+void LightUndoCommand::operator delete(void *ptr, std::size_t size)
+{
+    Q_UNUSED(size);
+    UndoCommandPoolPrivate::deallocate(ptr);
+}
+
+/*!
+    \overload
+
+    Called only if the constructor of a command allocated from \a pool throws.
+*/
+
+void LightUndoCommand::operator delete(void *ptr, UndoCommandPool *pool)
+{
+    Q_UNUSED(pool);
+    UndoCommandPoolPrivate::deallocate(ptr);
+}
+
+QT_END_NAMESPACE
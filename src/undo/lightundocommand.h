@@ -0,0 +1,66 @@
+#ifndef LIGHTUNDOCOMMAND_H
+#define LIGHTUNDOCOMMAND_H
+
+#include <QtCore/qstring.h>
+#include <QtCore/qvector.h>
+#include <QtUndo/undo_global.h>
+
+#include <cstddef>
+
+QT_BEGIN_NAMESPACE
+
+class QDataStream;
+class UndoCommand;
+class UndoCommandPool;
+
+class Q_UNDO_EXPORT LightUndoCommand
+{
+public:
+    explicit LightUndoCommand(LightUndoCommand *parent = nullptr);
+    explicit LightUndoCommand(const QString &text, LightUndoCommand *parent = nullptr);
+    virtual ~LightUndoCommand();
+
+    virtual void undo();
+    virtual void redo();
+
+    QString text() const;
+    void setText(const QString &text);
+
+    virtual int id() const;
+    virtual bool mergeWith(const LightUndoCommand *other);
+
+    virtual qint64 cost() const;
+
+    static const quint64 AllResources = ~quint64(0);
+    virtual QVector<quint64> resources() const;
+
+    typedef LightUndoCommand *(*LoadFunction)(QDataStream &stream);
+    static void registerType(int typeId, LoadFunction load);
+    virtual int typeId() const;
+    virtual void save(QDataStream &stream) const;
+
+    int childCount() const;
+    const LightUndoCommand *child(int index) const;
+
+    virtual UndoCommand *toUndoCommand();
+    const UndoCommand *toUndoCommand() const;
+
+    static void *operator new(std::size_t size);
+    static void *operator new(std::size_t size, UndoCommandPool *pool);
+    static void operator delete(void *ptr, std::size_t size);
+    static void operator delete(void *ptr, UndoCommandPool *pool);
+
+private:
+    Q_DISABLE_COPY(LightUndoCommand)
+    friend class UndoStack;
+    friend class UndoStackPrivate;
+    friend class UndoInverseCommand;
+    friend class UndoCommandSerializer;
+
+    QString m_text;
+    QVector<LightUndoCommand*> m_childCommands;
+};
+
+QT_END_NAMESPACE
+
+#endif // LIGHTUNDOCOMMAND_H
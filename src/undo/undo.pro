@@ -9,13 +9,39 @@ DEFINES += QT_NO_CAST_TO_ASCII QT_NO_CAST_FROM_ASCII
 DEFINES += UNDO_LIBRARY
 
 HEADERS += undo_global.h \
+    lightundocommand.h \
+    undoblobstore.h \
+    undoblobstore_p.h \
+    undocheckpointhandler.h \
+    undocommandpool.h \
+    undocommandpool_p.h \
+    undocompression_p.h \
+    undocompressioncodec.h \
+    undohibernation_p.h \
+    undojournal_p.h \
+    undomappedhistory_p.h \
+    undoreclaimer_p.h \
+    undoringbuffer_p.h \
+    undoserializer_p.h \
     undocommand.h \
     undocommand_p.h \
     undostack.h \
     undostack_p.h \
-    undogroup.h
+    undogroup.h \
+    undogroup_p.h
 
-SOURCES += undocommand.cpp \
+SOURCES += lightundocommand.cpp \
+    undoblobstore.cpp \
+    undocheckpointhandler.cpp \
+    undocommandpool.cpp \
+    undocompression.cpp \
+    undocompressioncodec.cpp \
+    undocommand.cpp \
+    undohibernation.cpp \
+    undojournal.cpp \
+    undomappedhistory.cpp \
+    undoreclaimer.cpp \
+    undoserializer.cpp \
     undostack.cpp \
     undogroup.cpp
 
@@ -0,0 +1,327 @@
+#include "undoblobstore.h"
+#include "undoblobstore_p.h"
+
+QT_BEGIN_NAMESPACE
+
+UndoBlobStorePrivate::UndoBlobStorePrivate() :
+    referenceCount(0),
+    storedBytes(0),
+    referencedBytes(0),
+    orphaned(false)
+{
+}
+
+UndoBlobStorePrivate::~UndoBlobStorePrivate()
+{
+    Q_ASSERT(blobs.isEmpty());
+}
+
+/*
+    Returns the blob holding \a data with a new reference to it, creating the blob
+    if the store does not hold the same bytes yet.
+*/
+UndoBlobData *UndoBlobStorePrivate::acquire(const QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+    UndoBlobData *blob = blobs.value(data);
+    if (blob != 0) {
+        ++blob->ref;
+    } else {
+        blob = new UndoBlobData(this, data);
+        blobs.insert(blob->data, blob);
+        storedBytes += data.size();
+    }
+    ++referenceCount;
+    referencedBytes += data.size();
+    return blob;
+}
+
+void UndoBlobStorePrivate::ref(UndoBlobData *blob)
+{
+    UndoBlobStorePrivate *store = blob->store;
+    QMutexLocker locker(&store->mutex);
+    ++blob->ref;
+    ++store->referenceCount;
+    store->referencedBytes += blob->data.size();
+}
+
+/*
+    Drops a reference to \a blob, which is deleted with its last reference. Called
+    from whichever thread deletes the command holding the reference, for example the
+    reclaimer of a stack in DeferredReclamation mode.
+*/
+void UndoBlobStorePrivate::release(UndoBlobData *blob)
+{
+    UndoBlobStorePrivate *store = blob->store;
+    bool deleteStore = false;
+    {
+        QMutexLocker locker(&store->mutex);
+        --store->referenceCount;
+        store->referencedBytes -= blob->data.size();
+        if (--blob->ref == 0) {
+            store->blobs.remove(blob->data);
+            store->storedBytes -= blob->data.size();
+            delete blob;
+            deleteStore = store->orphaned && store->blobs.isEmpty();
+        }
+    }
+    if (deleteStore)
+        delete store;
+}
+
+/*!
+    \class UndoBlob
+    \brief The UndoBlob class is a handle to a payload held by an UndoBlobStore.
+    \since 5.7
+
+    A blob is obtained from UndoBlobStore::insert(). Copying a handle is cheap and
+    adds a reference to the same blob; the blob is freed when its last handle is
+    destroyed. The data of a blob never changes.
+
+    Handles can be copied and destroyed from any thread, and may outlive the store
+    they came from.
+
+    \sa UndoBlobStore
+*/
+
+/*!
+    \fn UndoBlob::UndoBlob()
+
+    Constructs a null handle.
+*/
+
+/*!
+    Constructs a copy of \a other, which refers to the same blob.
+*/
+
+UndoBlob::UndoBlob(const UndoBlob &other) :
+    d(other.d)
+{
+    if (d != 0)
+        UndoBlobStorePrivate::ref(d);
+}
+
+/*!
+    Makes this handle refer to the blob of \a other, releasing the blob it referred
+    to before.
+*/
+
+UndoBlob &UndoBlob::operator=(const UndoBlob &other)
+{
+    UndoBlob copy(other);
+    swap(copy);
+    return *this;
+}
+
+/*!
+    Destroys the handle. The blob is freed if this was its last handle.
+*/
+
+UndoBlob::~UndoBlob()
+{
+    if (d != 0)
+        UndoBlobStorePrivate::release(d);
+}
+
+/*!
+    \fn void UndoBlob::swap(UndoBlob &other)
+
+    Swaps this handle with \a other.
+*/
+
+/*!
+    \fn bool UndoBlob::isNull() const
+
+    Returns \c true if the handle refers to no blob.
+*/
+
+/*!
+    Returns the data of the blob, or an empty array if the handle is null. The data
+    is shared, not copied.
+*/
+
+QByteArray UndoBlob::data() const
+{
+    return d != 0 ? d->data : QByteArray();
+}
+
+/*!
+    Returns the size of the data of the blob in bytes.
+*/
+
+int UndoBlob::size() const
+{
+    return d != 0 ? d->data.size() : 0;
+}
+
+/*!
+    \fn bool UndoBlob::operator==(const UndoBlob &other) const
+
+    Returns \c true if this handle and \a other refer to the same blob. Two handles
+    from the same store refer to the same blob if and only if their data is equal.
+*/
+
+/*!
+    \fn bool UndoBlob::operator!=(const UndoBlob &other) const
+
+    Returns \c true if this handle and \a other refer to different blobs.
+*/
+
+/*!
+    \class UndoBlobStore
+    \brief The UndoBlobStore class stores identical command payloads only once.
+    \since 5.7
+
+    Commands often hold the same bytes as other commands: an asset that is pasted
+    repeatedly, or the state after one command that is the state before the next.
+    Instead of keeping its own copy, a command can put its payload into a store with
+    insert() and keep the returned UndoBlob. The store keeps one copy of each
+    distinct payload and counts the handles to it:
+
+    \code
+    class PasteCommand : public LightUndoCommand
+    {
+    public:
+        PasteCommand(Canvas *canvas, UndoBlobStore *store, const QByteArray &image)
+            : m_canvas(canvas), m_image(store->insert(image)) {}
+        void redo() override { m_canvas->paste(m_image.data()); }
+        ...
+    private:
+        Canvas *m_canvas;
+        UndoBlob m_image;
+    };
+    \endcode
+
+    A payload is freed when the last command holding it is deleted, whether the
+    stack deletes it because it was truncated, evicted by an undo or memory limit,
+    or cleared.
+
+    Each UndoStack provides a store through UndoStack::blobStore(), and each UndoGroup
+    provides one that its stacks can share through UndoGroup::blobStore(). A store can
+    also be created on its own.
+
+    The cost() of a command is not aware of sharing; a command that wants the memory
+    limit to account for shared payloads only once can divide the size of its blobs
+    accordingly. Commands that are saved, hibernated or compressed write their payload
+    themselves, and insert it again into a store when they are loaded.
+
+    All functions are thread-safe.
+
+    \sa UndoBlob, UndoStack::blobStore(), UndoGroup::blobStore()
+*/
+
+/*!
+    Constructs an empty store.
+*/
+
+UndoBlobStore::UndoBlobStore() :
+    d_ptr(new UndoBlobStorePrivate)
+{
+}
+
+/*!
+    Destroys the store. Blobs that are still referred to by handles stay valid, and
+    are freed with their last handle.
+*/
+
+UndoBlobStore::~UndoBlobStore()
+{
+    Q_D(UndoBlobStore);
+    d->mutex.lock();
+    const bool empty = d->blobs.isEmpty();
+    d->orphaned = !empty;
+    d->mutex.unlock();
+
+    if (empty)
+        delete d;
+}
+
+/*!
+    Returns a handle to a blob holding \a data. If the store already holds the same
+    bytes, the existing blob is returned and \a data is not kept; otherwise \a data
+    is stored, sharing its memory with the caller.
+
+    Looking up a payload hashes all of its bytes.
+
+    \a data must not have been created with QByteArray::fromRawData().
+*/
+
+UndoBlob UndoBlobStore::insert(const QByteArray &data)
+{
+    Q_D(UndoBlobStore);
+    return UndoBlob(d->acquire(data));
+}
+
+/*!
+    Returns the number of distinct blobs in the store.
+*/
+
+int UndoBlobStore::count() const
+{
+    Q_D(const UndoBlobStore);
+    QMutexLocker locker(&d->mutex);
+    return d->blobs.size();
+}
+
+/*!
+    Returns the number of handles to the blobs of the store.
+*/
+
+int UndoBlobStore::referenceCount() const
+{
+    Q_D(const UndoBlobStore);
+    QMutexLocker locker(&d->mutex);
+    return d->referenceCount;
+}
+
+/*!
+    Returns the number of bytes the store holds, counting each distinct blob once.
+*/
+
+qint64 UndoBlobStore::storedBytes() const
+{
+    Q_D(const UndoBlobStore);
+    QMutexLocker locker(&d->mutex);
+    return d->storedBytes;
+}
+
+/*!
+    Returns the number of bytes the handles refer to, counting each blob once per
+    handle. This is the memory the payloads would take without the store.
+*/
+
+qint64 UndoBlobStore::referencedBytes() const
+{
+    Q_D(const UndoBlobStore);
+    QMutexLocker locker(&d->mutex);
+    return d->referencedBytes;
+}
+
+/*!
+    Returns the number of bytes saved by storing identical payloads once, that is
+    referencedBytes() minus storedBytes().
+*/
+
+qint64 UndoBlobStore::savedBytes() const
+{
+    Q_D(const UndoBlobStore);
+    QMutexLocker locker(&d->mutex);
+    return d->referencedBytes - d->storedBytes;
+}
+
+/*!
+    Returns referencedBytes() divided by storedBytes(), or 1 if the store is empty.
+    A ratio of 3 means that the payloads would take three times as much memory
+    without the store.
+*/
+
+qreal UndoBlobStore::dedupeRatio() const
+{
+    Q_D(const UndoBlobStore);
+    QMutexLocker locker(&d->mutex);
+    if (d->storedBytes == 0)
+        return 1;
+    return qreal(d->referencedBytes) / qreal(d->storedBytes);
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,59 @@
+#ifndef UNDOBLOBSTORE_H
+#define UNDOBLOBSTORE_H
+
+#include <QtCore/qbytearray.h>
+#include <QtUndo/undo_global.h>
+
+QT_BEGIN_NAMESPACE
+
+class UndoBlobStorePrivate;
+struct UndoBlobData;
+
+class Q_UNDO_EXPORT UndoBlob
+{
+public:
+    UndoBlob() : d(0) {}
+    UndoBlob(const UndoBlob &other);
+    UndoBlob &operator=(const UndoBlob &other);
+    ~UndoBlob();
+
+    void swap(UndoBlob &other) { qSwap(d, other.d); }
+
+    bool isNull() const { return d == 0; }
+    QByteArray data() const;
+    int size() const;
+
+    bool operator==(const UndoBlob &other) const { return d == other.d; }
+    bool operator!=(const UndoBlob &other) const { return d != other.d; }
+
+private:
+    friend class UndoBlobStore;
+    explicit UndoBlob(UndoBlobData *data) : d(data) {}
+
+    UndoBlobData *d;
+};
+
+class Q_UNDO_EXPORT UndoBlobStore
+{
+public:
+    UndoBlobStore();
+    ~UndoBlobStore();
+
+    UndoBlob insert(const QByteArray &data);
+
+    int count() const;
+    int referenceCount() const;
+    qint64 storedBytes() const;
+    qint64 referencedBytes() const;
+    qint64 savedBytes() const;
+    qreal dedupeRatio() const;
+
+private:
+    Q_DISABLE_COPY(UndoBlobStore)
+    Q_DECLARE_PRIVATE(UndoBlobStore)
+    UndoBlobStorePrivate *d_ptr;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOBLOBSTORE_H
@@ -0,0 +1,56 @@
+#ifndef UNDOBLOBSTORE_P_H
+#define UNDOBLOBSTORE_P_H
+
+#include <QtCore/qhash.h>
+#include <QtCore/qmutex.h>
+
+#include "undoblobstore.h"
+
+QT_BEGIN_NAMESPACE
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// A blob of a store, shared by all UndoBlob handles to it. The data never changes;
+// the reference count is guarded by the mutex of the store, so that a blob whose
+// last handle is going away cannot be handed out again by insert().
+struct UndoBlobData
+{
+    UndoBlobData(UndoBlobStorePrivate *store, const QByteArray &data) :
+        store(store), data(data), ref(1) {}
+
+    UndoBlobStorePrivate *store;
+    QByteArray data;
+    int ref;
+};
+
+class UndoBlobStorePrivate
+{
+public:
+    UndoBlobStorePrivate();
+    ~UndoBlobStorePrivate();
+
+    UndoBlobData *acquire(const QByteArray &data);
+    static void ref(UndoBlobData *blob);
+    static void release(UndoBlobData *blob);
+
+    mutable QMutex mutex;
+    // Keyed by the data of the blob itself, which is shared and not copied.
+    QHash<QByteArray, UndoBlobData*> blobs;
+    int referenceCount;
+    qint64 storedBytes;
+    qint64 referencedBytes;
+    bool orphaned; // the UndoBlobStore is gone; deleted with the last blob
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOBLOBSTORE_P_H
@@ -0,0 +1,63 @@
+#include "undocheckpointhandler.h"
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class UndoCheckpointHandler
+    \brief The UndoCheckpointHandler class saves and restores snapshots of a document
+    so that UndoStack::setIndex() can skip over long runs of commands.
+    \since 5.7
+
+    UndoStack::setIndex() normally undoes or redoes every command between the current
+    index and the target index. When a history slider jumps across hundreds of thousands
+    of commands, that takes a long time. If a checkpoint handler is installed with
+    UndoStack::setCheckpointHandler(), the stack periodically asks it for a snapshot of
+    the document, and a long jump restores the nearest snapshot below the target and only
+    redoes the remaining commands.
+
+    Commands on a stack with a checkpoint handler must be able to redo themselves on a
+    document that was restored from a checkpoint, without the commands in between having
+    been undone or redone. This is the case for commands that refer to the document by
+    value or by stable identifiers rather than by pointers to objects that the restore
+    replaces.
+
+    \sa UndoStack::setCheckpointHandler(), UndoStack::checkpointInterval
+*/
+
+/*!
+    Destroys the checkpoint handler.
+*/
+
+UndoCheckpointHandler::~UndoCheckpointHandler()
+{
+}
+
+/*!
+    \fn QVariant UndoCheckpointHandler::saveCheckpoint()
+
+    Returns a snapshot of the current state of the document. The stack keeps the
+    returned value until the checkpoint can no longer be used, so it should be cheap to
+    copy, for example an implicitly shared value.
+*/
+
+/*!
+    \fn void UndoCheckpointHandler::restoreCheckpoint(const QVariant &checkpoint)
+
+    Restores the document to the state saved in \a checkpoint, which was returned by
+    saveCheckpoint().
+*/
+
+/*!
+    Returns the number of bytes kept alive by \a checkpoint. The stack adds it to
+    UndoStack::memoryUsage, so that checkpoints count against UndoStack::memoryLimit.
+
+    The default implementation returns 0.
+*/
+
+qint64 UndoCheckpointHandler::checkpointCost(const QVariant &checkpoint) const
+{
+    Q_UNUSED(checkpoint);
+    return 0;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,21 @@
+#ifndef UNDOCHECKPOINTHANDLER_H
+#define UNDOCHECKPOINTHANDLER_H
+
+#include <QtCore/qvariant.h>
+#include <QtUndo/undo_global.h>
+
+QT_BEGIN_NAMESPACE
+
+class Q_UNDO_EXPORT UndoCheckpointHandler
+{
+public:
+    virtual ~UndoCheckpointHandler();
+
+    virtual QVariant saveCheckpoint() = 0;
+    virtual void restoreCheckpoint(const QVariant &checkpoint) = 0;
+    virtual qint64 checkpointCost(const QVariant &checkpoint) const;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOCHECKPOINTHANDLER_H
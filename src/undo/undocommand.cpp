@@ -22,6 +22,11 @@ QT_BEGIN_NAMESPACE
     properties of the stack's undo and redo actions; see
     UndoStack::createUndoAction() and UndoStack::createRedoAction().
 
+    UndoCommand derives from LightUndoCommand, which provides the undo(),
+    redo(), id() and child command machinery without the QObject overhead.
+    Prefer LightUndoCommand for commands that are pushed in very large
+    numbers and have no use for signals, slots or properties.
+
     UndoCommand objects are owned by the stack they were pushed on.
     UndoStack deletes a command if it has been undone and a new command is pushed. For example:
 
@@ -50,7 +55,7 @@ QT_BEGIN_NAMESPACE
     Another way to create macros is to use the convenience functions
     UndoStack::beginMacro() and UndoStack::endMacro().
 
-    \sa UndoStack
+    \sa LightUndoCommand, UndoStack
 */
 
 /*!
@@ -64,11 +69,9 @@ QT_BEGIN_NAMESPACE
 */
 
 UndoCommand::UndoCommand(const QString &text, UndoCommand *parent) :
-    QObject(*(new UndoCommandPrivate), parent)
+    QObject(*(new UndoCommandPrivate), parent),
+    LightUndoCommand(text, parent)
 {
-    if (parent != 0)
-        parent->d_func()->childCommands.append(this);
-    setText(text);
 }
 
 /*!
@@ -82,10 +85,9 @@ UndoCommand::UndoCommand(const QString &text, UndoCommand *parent) :
 */
 
 UndoCommand::UndoCommand(UndoCommand *parent) :
-    QObject(*(new UndoCommandPrivate), parent)
+    QObject(*(new UndoCommandPrivate), parent),
+    LightUndoCommand(parent)
 {
-    if (parent != 0)
-        parent->d_func()->childCommands.append(this);
 }
 
 /*!
@@ -96,28 +98,6 @@ UndoCommand::UndoCommand(UndoCommand *parent) :
 
 UndoCommand::~UndoCommand()
 {
-    Q_D(UndoCommand);
-    qDeleteAll(d->childCommands);
-}
-
-/*!
-    Returns the ID of this command.
-
-    A command ID is used in command compression. It must be an integer unique to
-    this command's class, or -1 if the command doesn't support compression.
-
-    If the command supports compression this function must be overridden in the
-    derived class to return the correct ID. The base implementation returns -1.
-
-    UndoStack::push() will only try to merge two commands if they have the
-    same ID, and the ID is not -1.
-
-    \sa mergeWith(), UndoStack::push()
-*/
-
-int UndoCommand::id() const
-{
-    return -1;
 }
 
 /*!
@@ -146,40 +126,16 @@ bool UndoCommand::mergeWith(const UndoCommand *command)
 }
 
 /*!
-    Applies a change to the document. This function must be implemented in
-    the derived class. Calling UndoStack::push(),
-    UndoStack::undo() or UndoStack::redo() from this function leads to
-    undefined beahavior.
+    \reimp
 
-    The default implementation calls redo() on all child commands.
-
-    \sa undo()
+    Forwards to mergeWith(const UndoCommand *) if \a command is an
+    UndoCommand; lightweight commands are never merged into an UndoCommand.
 */
 
-void UndoCommand::redo()
+bool UndoCommand::mergeWith(const LightUndoCommand *command)
 {
-    Q_D(UndoCommand);
-    for (int i = 0; i < d->childCommands.size(); ++i)
-        d->childCommands.at(i)->redo();
-}
-
-/*!
-    Reverts a change to the document. After undo() is called, the state of
-    the document should be the same as before redo() was called. This function must
-    be implemented in the derived class. Calling UndoStack::push(),
-    UndoStack::undo() or UndoStack::redo() from this function leads to
-    undefined beahavior.
-
-    The default implementation calls undo() on all child commands in reverse order.
-
-    \sa redo()
-*/
-
-void UndoCommand::undo()
-{
-    Q_D(UndoCommand);
-    for (int i = d->childCommands.size() - 1; i >= 0; --i)
-        d->childCommands.at(i)->undo();
+    const UndoCommand *other = command->toUndoCommand();
+    return other != 0 && mergeWith(other);
 }
 
 /*!
@@ -193,8 +149,7 @@ void UndoCommand::undo()
 
 QString UndoCommand::text() const
 {
-    Q_D(const UndoCommand);
-    return d->text;
+    return LightUndoCommand::text();
 }
 
 /*!
@@ -208,42 +163,35 @@ QString UndoCommand::text() const
 
 void UndoCommand::setText(const QString &text)
 {
-    Q_D(UndoCommand);
-    if (text == d->text)
+    if (text == LightUndoCommand::text())
         return;
 
-    d->text = text;
+    LightUndoCommand::setText(text);
     emit textChanged();
 }
 
 /*!
     \since 4.4
 
-    Returns the number of child commands in this command.
+    Returns the child command at \a index, or 0 if there is no such child or
+    the child is a LightUndoCommand that is not an UndoCommand.
 
-    \sa child()
+    \sa childCount(), UndoStack::command()
 */
 
-int UndoCommand::childCount() const
+const UndoCommand *UndoCommand::child(int index) const
 {
-    Q_D(const UndoCommand);
-    return d->childCommands.count();
+    const LightUndoCommand *command = LightUndoCommand::child(index);
+    return command != 0 ? command->toUndoCommand() : 0;
 }
 
 /*!
-    \since 4.4
-
-    Returns the child command at \a index.
-
-    \sa childCount(), UndoStack::command()
+    \reimp
 */
 
-const UndoCommand *UndoCommand::child(int index) const
+UndoCommand *UndoCommand::toUndoCommand()
 {
-    Q_D(const UndoCommand);
-    if (index < 0 || index >= d->childCommands.count())
-        return 0;
-    return d->childCommands.at(index);
+    return this;
 }
 
 QT_END_NAMESPACE
@@ -3,12 +3,13 @@
 
 #include <QObject>
 #include <QtUndo/undo_global.h>
+#include <QtUndo/lightundocommand.h>
 
 QT_BEGIN_NAMESPACE
 
 class UndoCommandPrivate;
 
-class Q_UNDO_EXPORT UndoCommand : public QObject
+class Q_UNDO_EXPORT UndoCommand : public QObject, public LightUndoCommand
 {
     Q_OBJECT
     Q_PROPERTY(QString text READ text WRITE setText NOTIFY textChanged)
@@ -18,19 +19,18 @@ public:
     explicit UndoCommand(const QString &text, UndoCommand *parent = nullptr);
     virtual ~UndoCommand();
 
-    virtual void undo();
-    virtual void redo();
-
     QString text() const;
     QString actionText() const;
     void setText(const QString &text);
 
-    virtual int id() const;
     virtual bool mergeWith(const UndoCommand *other);
+    bool mergeWith(const LightUndoCommand *other) override;
 
-    int childCount() const;
     const UndoCommand *child(int index) const;
 
+    UndoCommand *toUndoCommand() override;
+    using LightUndoCommand::toUndoCommand;
+
 Q_SIGNALS:
     void textChanged();
 
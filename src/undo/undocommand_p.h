@@ -2,12 +2,12 @@
 #define UNDOCOMMAND_P_H
 
 #include <QtCore/private/qobject_p.h>
-#include <QtCore/qvector.h>
-#include <QtCore/qstring.h>
+
+#include "undocommand.h"
 
 QT_BEGIN_NAMESPACE
 
-class UndoCommand;
+class QDataStream;
 
 //
 //  W A R N I N G
@@ -25,17 +25,26 @@ class UndoCommandPrivate : public QObjectPrivate
     Q_DECLARE_PUBLIC(UndoCommand)
 
 public:
-    UndoCommandPrivate() :
-        id(-1)
+    UndoCommandPrivate()
     {
     }
-
-    QVector<UndoCommand*> childCommands;
-    QString text;
-    QString actionText;
-    int id;
 };
 
+// The command that UndoStack::beginMacro() creates. It has a type of its own so
+// that macros can be written to disk; only its text and children are written.
+class UndoMacroCommand : public UndoCommand
+{
+public:
+    enum { TypeId = -2 };
+
+    int typeId() const override { return TypeId; }
+
+    static LightUndoCommand *load(QDataStream &stream)
+    {
+        Q_UNUSED(stream);
+        return new UndoMacroCommand;
+    }
+};
 
 QT_END_NAMESPACE
 
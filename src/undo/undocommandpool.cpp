@@ -0,0 +1,282 @@
+#include "undocommandpool.h"
+#include "undocommandpool_p.h"
+
+#include <cstdlib>
+#include <new>
+
+QT_BEGIN_NAMESPACE
+
+UndoCommandPoolPrivate::UndoCommandPoolPrivate() :
+    bumpPointer(0),
+    bumpEnd(0),
+    bytesInUse(0),
+    liveCount(0),
+    orphaned(false)
+{
+    for (int i = 0; i < SizeClassCount; ++i)
+        freeLists[i] = 0;
+}
+
+UndoCommandPoolPrivate::~UndoCommandPoolPrivate()
+{
+    release();
+}
+
+int UndoCommandPoolPrivate::sizeClass(std::size_t size)
+{
+    return int((qMax<std::size_t>(size, 1) + Granularity - 1) / Granularity) - 1;
+}
+
+UndoCommandPoolPrivate::BlockHeader *UndoCommandPoolPrivate::allocate(std::size_t size)
+{
+    const int sc = sizeClass(size);
+    const int bytes = blockSize(sc);
+
+    QMutexLocker locker(&mutex);
+    void *ptr;
+    if (FreeBlock *block = freeLists[sc]) {
+        freeLists[sc] = block->next;
+        ptr = block;
+    } else {
+        if (bumpEnd - bumpPointer < bytes) {
+            // The tail of the current slab is too small; it is wasted.
+            char *slab = static_cast<char *>(::malloc(SlabSize));
+            Q_CHECK_PTR(slab);
+            slabs.append(slab);
+            bumpPointer = slab;
+            bumpEnd = slab + SlabSize;
+        }
+        ptr = bumpPointer;
+        bumpPointer += bytes;
+    }
+
+    ++liveCount;
+    bytesInUse += bytes;
+    locker.unlock();
+
+    BlockHeader *header = static_cast<BlockHeader *>(ptr);
+    header->pool = this;
+    header->sizeClass = sc;
+    return header;
+}
+
+/*
+    Returns \c true if the pool was orphaned by its UndoCommandPool and this
+    was its last live allocation, in which case the caller must delete it.
+*/
+bool UndoCommandPoolPrivate::free(BlockHeader *block)
+{
+    const int sc = block->sizeClass;
+    FreeBlock *freeBlock = reinterpret_cast<FreeBlock *>(block);
+
+    QMutexLocker locker(&mutex);
+    freeBlock->next = freeLists[sc];
+    freeLists[sc] = freeBlock;
+    bytesInUse -= blockSize(sc);
+    --liveCount;
+    return orphaned && liveCount == 0;
+}
+
+bool UndoCommandPoolPrivate::release()
+{
+    QMutexLocker locker(&mutex);
+    if (liveCount != 0)
+        return false;
+
+    for (char *slab : qAsConst(slabs))
+        ::free(slab);
+    slabs.clear();
+
+    for (int i = 0; i < SizeClassCount; ++i)
+        freeLists[i] = 0;
+    bumpPointer = 0;
+    bumpEnd = 0;
+    bytesInUse = 0;
+    return true;
+}
+
+void *UndoCommandPoolPrivate::allocateFrom(UndoCommandPoolPrivate *pool, std::size_t size)
+{
+    BlockHeader *header;
+    if (pool != 0 && size <= MaxPooledSize) {
+        header = pool->allocate(size);
+    } else {
+        header = static_cast<BlockHeader *>(::operator new(size + HeaderSize));
+        header->pool = 0;
+        header->sizeClass = -1;
+    }
+    return reinterpret_cast<char *>(header) + HeaderSize;
+}
+
+/*
+    Frees a block returned by allocateFrom(). Blocks on the heap are freed without
+    taking any lock.
+*/
+void UndoCommandPoolPrivate::deallocate(void *ptr)
+{
+    if (ptr == 0)
+        return;
+
+    BlockHeader *header = reinterpret_cast<BlockHeader *>(static_cast<char *>(ptr) - HeaderSize);
+    if (UndoCommandPoolPrivate *pool = header->pool) {
+        if (pool->free(header))
+            delete pool;
+        return;
+    }
+    ::operator delete(header);
+}
+
+/*!
+    \class UndoCommandPool
+    \brief The UndoCommandPool class is a memory pool for undo commands.
+    \since 5.7
+
+    Applications that push many small commands spend a noticeable amount of
+    time in the system allocator, both when the commands are created and when
+    the stack deletes them again because they were truncated, evicted by the
+    undo limit or cleared. UndoCommandPool carves commands out of large slabs
+    and recycles the memory of deleted commands for the next ones of the same
+    size.
+
+    Each UndoStack can provide a pool through UndoStack::commandPool().
+    Commands are allocated from it with the placement form of \c new:
+
+    \code
+    stack->push(new (stack->commandPool()) MoveCommand(item, delta));
+    \endcode
+
+    Both LightUndoCommand and UndoCommand subclasses can be allocated this
+    way; the private data of an UndoCommand stays on the heap. The macro
+    commands created by UndoStack::beginMacro() use the stack's pool once it
+    exists. Commands are deleted with plain \c delete as usual, and their
+    memory goes back to the pool they came from.
+
+    Every command carries a small header that records the pool it was
+    allocated from, so deleting a command that does not come from a pool
+    costs no more than a plain heap deletion. Commands larger than 512 bytes
+    are allocated on the heap.
+
+    Memory that has been returned to the pool is kept for reuse until
+    release() is called while no allocation is alive, at which point all slabs
+    are freed at once. UndoStack::clear() does this automatically.
+
+    \sa UndoStack::commandPool()
+*/
+
+/*!
+    Constructs an empty pool.
+*/
+
+UndoCommandPool::UndoCommandPool() :
+    d_ptr(new UndoCommandPoolPrivate)
+{
+}
+
+/*!
+    Destroys the pool.
+
+    If commands allocated from the pool are still alive, a warning is printed
+    and the memory of the pool is released once the last of them is deleted.
+*/
+
+UndoCommandPool::~UndoCommandPool()
+{
+    Q_D(UndoCommandPool);
+    d->mutex.lock();
+    const int liveCount = d->liveCount;
+    d->orphaned = liveCount != 0;
+    d->mutex.unlock();
+
+    if (liveCount == 0) {
+        delete d;
+    } else {
+        qWarning("UndoCommandPool::~UndoCommandPool(): %d allocations are still alive",
+                 liveCount);
+    }
+}
+
+/*!
+    Allocates \a size bytes from the pool. Allocations larger than 512 bytes
+    are forwarded to the heap.
+
+    The memory must be freed with deallocate().
+*/
+
+void *UndoCommandPool::allocate(std::size_t size)
+{
+    Q_D(UndoCommandPool);
+    return UndoCommandPoolPrivate::allocateFrom(d, size);
+}
+
+/*!
+    Frees the memory at \a ptr that was allocated with a \a size of bytes by
+    allocate() of any UndoCommandPool, or by LightUndoCommand::operator new().
+    The pool that owns the memory, if any, is found from \a ptr alone.
+*/
+
+void UndoCommandPool::deallocate(void *ptr, std::size_t size)
+{
+    Q_UNUSED(size);
+    UndoCommandPoolPrivate::deallocate(ptr);
+}
+
+/*!
+    Frees all slabs of the pool at once, if no allocation from the pool is
+    alive. Returns \c true on success; otherwise returns \c false and the
+    pool is left untouched.
+*/
+
+bool UndoCommandPool::release()
+{
+    Q_D(UndoCommandPool);
+    return d->release();
+}
+
+/*!
+    Returns the number of allocations from the pool that have not been freed.
+*/
+
+int UndoCommandPool::liveAllocationCount() const
+{
+    Q_D(const UndoCommandPool);
+    QMutexLocker locker(&d->mutex);
+    return d->liveCount;
+}
+
+/*!
+    Returns the number of slabs that the pool has obtained from the system.
+    Each slab is 64 KiB.
+*/
+
+int UndoCommandPool::slabCount() const
+{
+    Q_D(const UndoCommandPool);
+    QMutexLocker locker(&d->mutex);
+    return d->slabs.size();
+}
+
+/*!
+    Returns the number of bytes currently handed out by the pool, including
+    the rounding of each allocation to the pool's granularity and the header
+    in front of each allocation.
+*/
+
+qint64 UndoCommandPool::bytesInUse() const
+{
+    Q_D(const UndoCommandPool);
+    QMutexLocker locker(&d->mutex);
+    return d->bytesInUse;
+}
+
+/*!
+    Returns the number of bytes the pool has obtained from the system.
+*/
+
+qint64 UndoCommandPool::bytesReserved() const
+{
+    Q_D(const UndoCommandPool);
+    QMutexLocker locker(&d->mutex);
+    return qint64(d->slabs.size()) * UndoCommandPoolPrivate::SlabSize;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,37 @@
+#ifndef UNDOCOMMANDPOOL_H
+#define UNDOCOMMANDPOOL_H
+
+#include <QtCore/qglobal.h>
+#include <QtUndo/undo_global.h>
+
+#include <cstddef>
+
+QT_BEGIN_NAMESPACE
+
+class UndoCommandPoolPrivate;
+
+class Q_UNDO_EXPORT UndoCommandPool
+{
+public:
+    UndoCommandPool();
+    ~UndoCommandPool();
+
+    void *allocate(std::size_t size);
+    static void deallocate(void *ptr, std::size_t size);
+
+    bool release();
+
+    int liveAllocationCount() const;
+    int slabCount() const;
+    qint64 bytesInUse() const;
+    qint64 bytesReserved() const;
+
+private:
+    Q_DISABLE_COPY(UndoCommandPool)
+    Q_DECLARE_PRIVATE(UndoCommandPool)
+    UndoCommandPoolPrivate *d_ptr;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOCOMMANDPOOL_H
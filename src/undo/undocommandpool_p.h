@@ -0,0 +1,77 @@
+#ifndef UNDOCOMMANDPOOL_P_H
+#define UNDOCOMMANDPOOL_P_H
+
+#include <QtCore/qmutex.h>
+#include <QtCore/qvector.h>
+
+#include "undocommandpool.h"
+
+QT_BEGIN_NAMESPACE
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+class UndoCommandPoolPrivate
+{
+public:
+    enum {
+        SlabSize = 64 * 1024,
+        Granularity = 16,
+        HeaderSize = Granularity,
+        MaxPooledSize = 512,
+        SizeClassCount = MaxPooledSize / Granularity
+    };
+
+    // Precedes every block that allocateFrom() hands out, whether it comes from a
+    // pool or from the heap, so that deallocate() finds the owner of a block
+    // without a lookup and without taking a lock for heap blocks.
+    struct BlockHeader
+    {
+        UndoCommandPoolPrivate *pool; // 0 for blocks on the heap
+        int sizeClass;
+    };
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    UndoCommandPoolPrivate();
+    ~UndoCommandPoolPrivate();
+
+    BlockHeader *allocate(std::size_t size);
+    bool free(BlockHeader *block);
+    bool release();
+
+    static UndoCommandPoolPrivate *get(UndoCommandPool *pool) { return pool->d_func(); }
+    static int sizeClass(std::size_t size);
+    static int blockSize(int sizeClass) { return (sizeClass + 1) * Granularity + HeaderSize; }
+
+    // Allocates from pool, or from the heap if pool is 0 or the size is too
+    // large to be pooled.
+    static void *allocateFrom(UndoCommandPoolPrivate *pool, std::size_t size);
+    static void deallocate(void *ptr);
+
+    mutable QMutex mutex;
+    FreeBlock *freeLists[SizeClassCount];
+    char *bumpPointer;
+    char *bumpEnd;
+    QVector<char*> slabs;
+    qint64 bytesInUse;
+    int liveCount;
+    bool orphaned;
+};
+
+Q_STATIC_ASSERT(sizeof(UndoCommandPoolPrivate::BlockHeader) <= UndoCommandPoolPrivate::HeaderSize);
+
+QT_END_NAMESPACE
+
+#endif // UNDOCOMMANDPOOL_P_H
@@ -0,0 +1,237 @@
+#include "undocompression_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qmetaobject.h>
+#include <QtCore/qrunnable.h>
+#include <QtCore/qthreadpool.h>
+
+#include "undocompressioncodec.h"
+#include "undoserializer_p.h"
+
+QT_BEGIN_NAMESPACE
+
+Q_GLOBAL_STATIC(UndoCompressionCodec, zlibCodec)
+
+UndoCompressedCommand::UndoCompressedCommand(const QSharedPointer<UndoCompressedPayload> &payload,
+                                             const UndoCompressionCodec *codec,
+                                             const LightUndoCommand *command) :
+    LightUndoCommand(command->text()),
+    m_payload(payload),
+    m_codec(codec),
+    m_id(command->id()),
+    m_resources(command->resources()),
+    m_command(0)
+{
+}
+
+UndoCompressedCommand::~UndoCompressedCommand()
+{
+    delete m_command;
+}
+
+void UndoCompressedCommand::undo()
+{
+    if (LightUndoCommand *command = this->command())
+        command->undo();
+}
+
+void UndoCompressedCommand::redo()
+{
+    if (LightUndoCommand *command = this->command())
+        command->redo();
+}
+
+int UndoCompressedCommand::id() const
+{
+    return m_command != 0 ? m_command->id() : m_id;
+}
+
+bool UndoCompressedCommand::mergeWith(const LightUndoCommand *other)
+{
+    LightUndoCommand *command = this->command();
+    if (command == 0 || !command->mergeWith(other))
+        return false;
+    setText(command->text());
+    return true;
+}
+
+/*
+    Returns the cost of the command if it is in memory, or else the size of its
+    payload.
+*/
+qint64 UndoCompressedCommand::cost() const
+{
+    if (m_command != 0)
+        return m_command->cost();
+    if (!m_payload)
+        return 0;
+    QMutexLocker locker(&m_payload->mutex);
+    return m_payload->data.size();
+}
+
+QVector<quint64> UndoCompressedCommand::resources() const
+{
+    // Kept uncompressed, so that the resource index does not decompress the command.
+    return m_command != 0 ? m_command->resources() : m_resources;
+}
+
+/*
+    Returns the command, decompressing it first if this has not been done yet.
+    Returns 0 if the command cannot be read back.
+*/
+LightUndoCommand *UndoCompressedCommand::command() const
+{
+    if (m_command == 0 && m_payload) {
+        QByteArray data;
+        bool compressed;
+        {
+            QMutexLocker locker(&m_payload->mutex);
+            data = m_payload->data;
+            compressed = m_payload->compressed;
+            // The compressor drops its result.
+            m_payload->pending = false;
+        }
+        m_payload.reset();
+
+        if (compressed)
+            data = m_codec->decompress(data);
+        QDataStream stream(data);
+        stream.setVersion(QDataStream::Qt_5_6);
+        m_command = UndoCommandSerializer().load(stream);
+    }
+    if (Q_UNLIKELY(m_command == 0))
+        qWarning("UndoStack: cannot decompress command \"%s\"", qPrintable(text()));
+    return m_command;
+}
+
+/*
+    Returns the command, as command() does, and passes its ownership to the caller.
+*/
+LightUndoCommand *UndoCompressedCommand::takeCommand()
+{
+    LightUndoCommand *command = this->command();
+    m_command = 0;
+    return command;
+}
+
+/*
+    Replaces the command, which must be in memory, by \a payload, which holds it in
+    serialized form, to be decompressed with \a codec.
+*/
+void UndoCompressedCommand::compressAgain(const QSharedPointer<UndoCompressedPayload> &payload,
+                                          const UndoCompressionCodec *codec)
+{
+    Q_ASSERT(m_command != 0);
+    setText(m_command->text());
+    m_id = m_command->id();
+    m_resources = m_command->resources();
+    delete m_command;
+    m_command = 0;
+    m_payload = payload;
+    m_codec = codec;
+}
+
+class UndoCompressor::Batch : public QRunnable
+{
+public:
+    Batch(const QVector<QSharedPointer<UndoCompressedPayload> > &payloads,
+          const UndoCompressionCodec *codec, QObject *owner,
+          const QSharedPointer<Tracker> &tracker) :
+        m_payloads(payloads),
+        m_codec(codec),
+        m_owner(owner),
+        m_tracker(tracker)
+    {
+    }
+
+    void run() override
+    {
+        for (const QSharedPointer<UndoCompressedPayload> &payload : qAsConst(m_payloads)) {
+            QByteArray data;
+            {
+                QMutexLocker locker(&payload->mutex);
+                if (!payload->pending)
+                    continue;
+                data = payload->data;
+            }
+
+            const QByteArray compressed = m_codec->compress(data);
+
+            QMutexLocker locker(&payload->mutex);
+            if (!payload->pending)
+                continue;
+            payload->pending = false;
+            if (!compressed.isEmpty() && compressed.size() < data.size()) {
+                payload->data = compressed;
+                payload->compressed = true;
+            }
+        }
+        m_payloads.clear();
+
+        // The owner waits for this batch before it is destroyed.
+        QMetaObject::invokeMethod(m_owner, "_q_compressionFinished", Qt::QueuedConnection);
+        QMutexLocker locker(&m_tracker->mutex);
+        if (--m_tracker->pendingBatches == 0)
+            m_tracker->done.wakeAll();
+    }
+
+private:
+    QVector<QSharedPointer<UndoCompressedPayload> > m_payloads;
+    const UndoCompressionCodec *m_codec;
+    QObject *m_owner;
+    QSharedPointer<Tracker> m_tracker;
+};
+
+UndoCompressor::UndoCompressor(QObject *owner) :
+    m_owner(owner),
+    m_tracker(new Tracker)
+{
+}
+
+UndoCompressor::~UndoCompressor()
+{
+    waitForDone();
+}
+
+void UndoCompressor::add(const QSharedPointer<UndoCompressedPayload> &payload)
+{
+    m_payloads.append(payload);
+}
+
+/*
+    Hands the payloads added since the last call to the thread pool, as one batch
+    that is compressed with \a codec.
+*/
+void UndoCompressor::commit(const UndoCompressionCodec *codec)
+{
+    if (m_payloads.isEmpty())
+        return;
+
+    m_tracker->mutex.lock();
+    ++m_tracker->pendingBatches;
+    m_tracker->mutex.unlock();
+
+    QThreadPool::globalInstance()->start(new Batch(m_payloads, codec, m_owner, m_tracker));
+    m_payloads.clear();
+}
+
+/*
+    Blocks until all batches are compressed. Payloads that were added but not
+    committed stay uncompressed.
+*/
+void UndoCompressor::waitForDone()
+{
+    QMutexLocker locker(&m_tracker->mutex);
+    while (m_tracker->pendingBatches > 0)
+        m_tracker->done.wait(&m_tracker->mutex);
+}
+
+/*
+    Returns the codec used when the stack has none installed.
+*/
+const UndoCompressionCodec *UndoCompressor::defaultCodec()
+{
+    return zlibCodec();
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,109 @@
+#ifndef UNDOCOMPRESSION_P_H
+#define UNDOCOMPRESSION_P_H
+
+#include <QtCore/qbytearray.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qwaitcondition.h>
+
+#include "lightundocommand.h"
+
+QT_BEGIN_NAMESPACE
+
+class QObject;
+class UndoCompressionCodec;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// A command written by UndoCommandSerializer, shared by the UndoCompressedCommand
+// that stands for the command and the compressor that compresses it.
+struct UndoCompressedPayload
+{
+    explicit UndoCompressedPayload(const QByteArray &data) :
+        data(data), compressed(false), pending(true) {}
+
+    QMutex mutex;
+    QByteArray data; // compressed if compressed is true
+    bool compressed;
+    bool pending; // neither compressed nor read back yet
+};
+
+// Takes the place of a command that was compressed in memory. The text, the id and
+// the resources of the command are kept as they are; the command itself is decompressed the first
+// time it is needed, for example when it is undone, and stays in this command so that
+// it can be compressed again.
+class UndoCompressedCommand : public LightUndoCommand
+{
+public:
+    UndoCompressedCommand(const QSharedPointer<UndoCompressedPayload> &payload,
+                          const UndoCompressionCodec *codec, const LightUndoCommand *command);
+    ~UndoCompressedCommand();
+
+    void undo() override;
+    void redo() override;
+    int id() const override;
+    bool mergeWith(const LightUndoCommand *other) override;
+    qint64 cost() const override;
+    QVector<quint64> resources() const override;
+
+    bool isResident() const { return m_command != 0; }
+    LightUndoCommand *command() const;
+    LightUndoCommand *takeCommand();
+    void compressAgain(const QSharedPointer<UndoCompressedPayload> &payload,
+                       const UndoCompressionCodec *codec);
+
+private:
+    mutable QSharedPointer<UndoCompressedPayload> m_payload;
+    const UndoCompressionCodec *m_codec;
+    int m_id;
+    QVector<quint64> m_resources;
+    mutable LightUndoCommand *m_command;
+};
+
+// Compresses payloads in batches on a thread of the global thread pool, and invokes
+// _q_compressionFinished() on the owner after each batch.
+class UndoCompressor
+{
+public:
+    explicit UndoCompressor(QObject *owner);
+    ~UndoCompressor();
+
+    void add(const QSharedPointer<UndoCompressedPayload> &payload);
+    void commit(const UndoCompressionCodec *codec);
+    void waitForDone();
+
+    static const UndoCompressionCodec *defaultCodec();
+
+private:
+    Q_DISABLE_COPY(UndoCompressor)
+
+    // Shared with the batches in flight.
+    struct Tracker
+    {
+        Tracker() : pendingBatches(0) {}
+
+        QMutex mutex;
+        QWaitCondition done;
+        int pendingBatches;
+    };
+
+    class Batch;
+
+    QObject *m_owner;
+    QVector<QSharedPointer<UndoCompressedPayload> > m_payloads;
+    QSharedPointer<Tracker> m_tracker;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOCOMPRESSION_P_H
@@ -0,0 +1,58 @@
+#include "undocompressioncodec.h"
+
+QT_BEGIN_NAMESPACE
+
+/*!
+    \class UndoCompressionCodec
+    \brief The UndoCompressionCodec class compresses the commands that a UndoStack
+    keeps in compressed form.
+    \since 5.7
+
+    When UndoStack::compressionDepth or UndoStack::compressionTimeout is set, the stack
+    writes commands that are unlikely to be undone soon into memory, the same way
+    UndoStack::save() does, and compresses the data on a thread of the global thread
+    pool. A command is read back and decompressed when the stack executes it again.
+
+    The default implementation uses qCompress() and qUncompress() with the fastest
+    compression level, which suits large payloads such as bitmaps and meshes. Install a
+    subclass with UndoStack::setCompressionCodec() to use another algorithm.
+
+    Both functions are called from threads other than the one of the stack, and must be
+    thread-safe.
+
+    \sa UndoStack::setCompressionCodec(), UndoStack::compressionDepth
+*/
+
+/*!
+    Destroys the codec.
+*/
+
+UndoCompressionCodec::~UndoCompressionCodec()
+{
+}
+
+/*!
+    Returns \a data in compressed form, or an empty array if it cannot be compressed.
+    The stack keeps the uncompressed data if the result is not smaller.
+
+    The default implementation calls qCompress() with compression level 1.
+*/
+
+QByteArray UndoCompressionCodec::compress(const QByteArray &data) const
+{
+    return qCompress(data, 1);
+}
+
+/*!
+    Returns the data that compress() turned into \a data, or an empty array if \a data
+    is damaged.
+
+    The default implementation calls qUncompress().
+*/
+
+QByteArray UndoCompressionCodec::decompress(const QByteArray &data) const
+{
+    return qUncompress(data);
+}
+
+QT_END_NAMESPACE
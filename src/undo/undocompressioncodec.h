@@ -0,0 +1,20 @@
+#ifndef UNDOCOMPRESSIONCODEC_H
+#define UNDOCOMPRESSIONCODEC_H
+
+#include <QtCore/qbytearray.h>
+#include <QtUndo/undo_global.h>
+
+QT_BEGIN_NAMESPACE
+
+class Q_UNDO_EXPORT UndoCompressionCodec
+{
+public:
+    virtual ~UndoCompressionCodec();
+
+    virtual QByteArray compress(const QByteArray &data) const;
+    virtual QByteArray decompress(const QByteArray &data) const;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOCOMPRESSIONCODEC_H
@@ -1,21 +1,385 @@
 #include "undogroup.h"
+#include "undogroup_p.h"
 
-#include <QtCore/private/qobject_p.h>
+#include <QtCore/qmetaobject.h>
 
+#include "undoblobstore.h"
+#include "undocommand.h"
+#include "undocommand_p.h"
 #include "undostack.h"
 #include "undostack_p.h"
 
+#include <algorithm>
+
 QT_BEGIN_NAMESPACE
 
-class UndoGroupPrivate : public QObjectPrivate
+static inline bool earlierEntry(const UndoTimelineEntry &a, const UndoTimelineEntry &b)
+{
+    return a.sequence < b.sequence;
+}
+
+static inline bool laterEntry(const UndoTimelineEntry &a, const UndoTimelineEntry &b)
+{
+    return a.sequence > b.sequence;
+}
+
+/*! \internal
+    Emits the state signals of the group whose values differ from the ones that were
+    last emitted, taking the values from the active stack. If \a indexChanged is true,
+    indexChanged() is emitted even if the index is unchanged, as the active stack does
+    after a merge.
+
+    The undo and redo texts are only looked up while their signals are connected, in
+    the same way as in UndoStackPrivate::emitChangedSignals().
+*/
+
+void UndoGroupPrivate::emitActiveStackState(bool indexChanged)
+{
+    Q_Q(UndoGroup);
+
+    static const QMetaMethod undoTextChangedSignal
+            = QMetaMethod::fromSignal(&UndoGroup::undoTextChanged);
+    static const QMetaMethod redoTextChangedSignal
+            = QMetaMethod::fromSignal(&UndoGroup::redoTextChanged);
+
+    const UndoStackPrivate *stack = active != 0 ? UndoStackPrivate::get(active) : 0;
+
+    const int index = stack != 0 ? stack->index : 0;
+    if (indexChanged || index != emittedIndex) {
+        emittedIndex = index;
+        emit q->indexChanged(index);
+    }
+
+    const bool canUndo = stack != 0 && active->canUndo();
+    if (canUndo != emittedCanUndo) {
+        emittedCanUndo = canUndo;
+        emit q->canUndoChanged(canUndo);
+    }
+
+    if (q->isSignalConnected(undoTextChangedSignal)) {
+        const QString undoText = stack != 0 ? active->undoText() : QString();
+        if (!emittedUndoTextValid || undoText != emittedUndoText) {
+            emittedUndoText = undoText;
+            emittedUndoTextValid = true;
+            emit q->undoTextChanged(undoText);
+        }
+    } else if (emittedUndoTextValid) {
+        emittedUndoText.clear();
+        emittedUndoTextValid = false;
+    }
+
+    const bool canRedo = stack != 0 && active->canRedo();
+    if (canRedo != emittedCanRedo) {
+        emittedCanRedo = canRedo;
+        emit q->canRedoChanged(canRedo);
+    }
+
+    if (q->isSignalConnected(redoTextChangedSignal)) {
+        const QString redoText = stack != 0 ? active->redoText() : QString();
+        if (!emittedRedoTextValid || redoText != emittedRedoText) {
+            emittedRedoText = redoText;
+            emittedRedoTextValid = true;
+            emit q->redoTextChanged(redoText);
+        }
+    } else if (emittedRedoTextValid) {
+        emittedRedoText.clear();
+        emittedRedoTextValid = false;
+    }
+
+    const bool isClean = stack == 0 || stack->index == stack->cleanIndex;
+    if (isClean != emittedClean) {
+        emittedClean = isClean;
+        emit q->cleanChanged(isClean);
+    }
+}
+
+/*! \internal
+    Called by the active stack when it emits its state signals, and by setActiveStack().
+    Emits the changed state signals of the group right away, or queues them in
+    QueuedNotification mode.
+*/
+
+void UndoGroupPrivate::activeStackStateChanged(bool indexChanged)
+{
+    Q_Q(UndoGroup);
+
+    if (notificationMode == UndoStack::ImmediateNotification) {
+        emitActiveStackState(indexChanged);
+        return;
+    }
+
+    pendingIndexChange |= indexChanged;
+    if (notificationQueued)
+        return;
+    notificationQueued = true;
+    QMetaObject::invokeMethod(q, "_q_emitQueuedNotifications", Qt::QueuedConnection);
+}
+
+/*! \internal
+    Emits the state signals that were queued in QueuedNotification mode.
+*/
+
+void UndoGroupPrivate::_q_emitQueuedNotifications()
+{
+    if (!notificationQueued)
+        return;
+    notificationQueued = false;
+    const bool indexChanged = pendingIndexChange;
+    pendingIndexChange = false;
+    emitActiveStackState(indexChanged);
+}
+
+/*! \internal
+    Opens a macro for the current transaction on \a stack, unless the stack already
+    takes part in it or there is no transaction.
+*/
+
+void UndoGroupPrivate::joinTransaction(UndoStack *stack)
+{
+    if (!transaction || transaction->participants.contains(stack))
+        return;
+
+    UndoStackPrivate *d = UndoStackPrivate::get(stack);
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoGroup: a stack with an open macro cannot join transaction \"%s\"",
+                 qPrintable(transaction->text));
+        return;
+    }
+
+    // A macro of its own type, so that the stack can still be saved and journaled.
+    UndoCommand *command = new (d->pool) UndoMacroCommand();
+    command->setText(transaction->text);
+    transaction->participants.insert(stack, command);
+    d->transactions.insert(command, transaction);
+    d->openMacro(command);
+}
+
+/*! \internal
+    Ends the macro of the current transaction on \a stack, together with any macros
+    that were left open inside it.
+*/
+
+void UndoGroupPrivate::closeTransactionMacro(UndoStack *stack)
+{
+    LightUndoCommand *command = transaction->participants.value(stack);
+    UndoStackPrivate *d = UndoStackPrivate::get(stack);
+    while (command != 0 && d->macroStack.contains(command))
+        stack->endMacro();
+}
+
+/*! \internal
+    Called by \a stack whenever its state changes. Records that the commands next to
+    its index may have changed, so that the timeline heaps are updated before they are
+    used next, counts its memory usage, and makes it the most recently used stack.
+    Takes constant time.
+*/
+
+void UndoGroupPrivate::stackChanged(UndoStack *stack)
+{
+    Q_Q(UndoGroup);
+
+    UndoStackPrivate *d = UndoStackPrivate::get(stack);
+    if (timelineBuilt && !d->timelineDirty) {
+        d->timelineDirty = true;
+        changedStacks.append(stack);
+    }
+
+    memoryUsage += d->memoryUsage - d->groupMemoryUsage;
+    d->groupMemoryUsage = d->memoryUsage;
+
+    // Evicting commands is not a use of the stack.
+    if (enforcingMemoryLimit)
+        return;
+    unlinkStack(stack);
+    linkStack(stack);
+
+    if (memoryLimit > 0 && memoryUsage > memoryLimit && !memoryCheckQueued) {
+        memoryCheckQueued = true;
+        QMetaObject::invokeMethod(q, "_q_enforceMemoryLimit", Qt::QueuedConnection);
+    }
+}
+
+/*! \internal
+    Appends \a stack to the end of the least recently used list.
+*/
+
+void UndoGroupPrivate::linkStack(UndoStack *stack)
 {
-    Q_DECLARE_PUBLIC(UndoGroup)
-public:
-    UndoGroupPrivate() : active(0) {}
+    UndoStackPrivate *d = UndoStackPrivate::get(stack);
+    d->lruPrev = lruLast;
+    d->lruNext = 0;
+    if (lruLast != 0)
+        UndoStackPrivate::get(lruLast)->lruNext = stack;
+    else
+        lruFirst = stack;
+    lruLast = stack;
+}
+
+/*! \internal
+    Removes \a stack from the least recently used list.
+*/
+
+void UndoGroupPrivate::unlinkStack(UndoStack *stack)
+{
+    UndoStackPrivate *d = UndoStackPrivate::get(stack);
+    if (d->lruPrev != 0)
+        UndoStackPrivate::get(d->lruPrev)->lruNext = d->lruNext;
+    else
+        lruFirst = d->lruNext;
+    if (d->lruNext != 0)
+        UndoStackPrivate::get(d->lruNext)->lruPrev = d->lruPrev;
+    else
+        lruLast = d->lruPrev;
+    d->lruPrev = 0;
+    d->lruNext = 0;
+}
+
+/*! \internal
+    Evicts the oldest commands of the least recently used stacks until the memory usage
+    of the group is within its memory limit. The active stack is left alone.
+*/
+
+void UndoGroupPrivate::enforceMemoryLimit()
+{
+    Q_Q(UndoGroup);
+
+    if (memoryLimit <= 0 || memoryUsage <= memoryLimit || enforcingMemoryLimit)
+        return;
+
+    QVector<UndoEviction> evictions;
+
+    enforcingMemoryLimit = true;
+    UndoStack *stack = lruFirst;
+    while (stack != 0 && memoryUsage > memoryLimit) {
+        UndoStackPrivate *d = UndoStackPrivate::get(stack);
+        UndoStack *next = d->lruNext;
+        if (stack != active) {
+            const qint64 evictedBefore = d->evictedBytes;
+            const int count = d->evictOldest(memoryUsage - memoryLimit);
+            if (count > 0) {
+                const UndoEviction eviction = { stack, count, d->evictedBytes - evictedBefore };
+                evictions.append(eviction);
+                evictedBytes += eviction.bytes;
+                evictedCount += count;
+            }
+        }
+        stack = next;
+    }
+    enforcingMemoryLimit = false;
+
+    for (const UndoEviction &eviction : qAsConst(evictions))
+        emit q->commandsEvicted(eviction.stack, eviction.count, eviction.bytes);
+}
+
+/*! \internal
+    Enforces the memory limit after a stack grew beyond it.
+*/
+
+void UndoGroupPrivate::_q_enforceMemoryLimit()
+{
+    memoryCheckQueued = false;
+    enforceMemoryLimit();
+}
+
+/*! \internal
+    Discards the timeline heaps after the membership of the group changed. They are
+    rebuilt when the timeline is used next.
+*/
+
+void UndoGroupPrivate::invalidateTimeline()
+{
+    if (!timelineBuilt)
+        return;
+    for (UndoStack *stack : qAsConst(changedStacks))
+        UndoStackPrivate::get(stack)->timelineDirty = false;
+    changedStacks.clear();
+    undoHeap.clear();
+    redoHeap.clear();
+    timelineBuilt = false;
+}
+
+/*! \internal
+    Builds the timeline heaps from the current state of all stacks, in linear time.
+*/
+
+void UndoGroupPrivate::rebuildTimeline() const
+{
+    undoHeap.clear();
+    redoHeap.clear();
+    changedStacks.clear();
+    for (UndoStack *stack : stacks) {
+        UndoStackPrivate *d = UndoStackPrivate::get(stack);
+        d->timelineDirty = false;
+        if (const quint64 sequence = d->undoSequence()) {
+            const UndoTimelineEntry entry = { sequence, stack };
+            undoHeap.append(entry);
+        }
+        if (const quint64 sequence = d->redoSequence()) {
+            const UndoTimelineEntry entry = { sequence, stack };
+            redoHeap.append(entry);
+        }
+    }
+    std::make_heap(undoHeap.begin(), undoHeap.end(), earlierEntry);
+    std::make_heap(redoHeap.begin(), redoHeap.end(), laterEntry);
+    timelineBuilt = true;
+}
+
+/*! \internal
+    Adds entries for the stacks that changed since the last update to the timeline
+    heaps, in O(log n) per stack. The old entries of these stacks stay in the heaps
+    until they reach the top; once the stale entries outnumber the stacks, the heaps
+    are rebuilt instead.
+*/
+
+void UndoGroupPrivate::updateTimeline() const
+{
+    if (!timelineBuilt
+            || undoHeap.size() + redoHeap.size() + changedStacks.size() > 4 * stacks.size() + 64) {
+        rebuildTimeline();
+        return;
+    }
 
-    UndoStack *active;
-    QVector<UndoStack*> stacks;
-};
+    for (UndoStack *stack : qAsConst(changedStacks)) {
+        UndoStackPrivate *d = UndoStackPrivate::get(stack);
+        d->timelineDirty = false;
+        if (const quint64 sequence = d->undoSequence()) {
+            const UndoTimelineEntry entry = { sequence, stack };
+            undoHeap.append(entry);
+            std::push_heap(undoHeap.begin(), undoHeap.end(), earlierEntry);
+        }
+        if (const quint64 sequence = d->redoSequence()) {
+            const UndoTimelineEntry entry = { sequence, stack };
+            redoHeap.append(entry);
+            std::push_heap(redoHeap.begin(), redoHeap.end(), laterEntry);
+        }
+    }
+    changedStacks.clear();
+}
+
+/*! \internal
+    Returns the stack whose next command to undo, if \a undo is true, was executed
+    last, or the stack whose next command to redo was executed first, if \a undo is
+    false. Returns 0 if there is no such stack.
+*/
+
+UndoStack *UndoGroupPrivate::timelineStack(bool undo) const
+{
+    updateTimeline();
+
+    QVector<UndoTimelineEntry> &heap = undo ? undoHeap : redoHeap;
+    while (!heap.isEmpty()) {
+        const UndoTimelineEntry &top = heap.first();
+        const UndoStackPrivate *d = UndoStackPrivate::get(top.stack);
+        if (top.sequence == (undo ? d->undoSequence() : d->redoSequence()))
+            return top.stack;
+        if (undo)
+            std::pop_heap(heap.begin(), heap.end(), earlierEntry);
+        else
+            std::pop_heap(heap.begin(), heap.end(), laterEntry);
+        heap.removeLast();
+    }
+    return 0;
+}
 
 /*!
     \class UndoGroup
@@ -74,8 +438,15 @@ UndoGroup::~UndoGroup()
     QVector<UndoStack *>::iterator end = d->stacks.end();
     while (it != end) {
         (*it)->d_func()->group = 0;
+        (*it)->d_func()->groupIndex = -1;
+        (*it)->d_func()->timelineDirty = false;
+        (*it)->d_func()->groupMemoryUsage = 0;
+        (*it)->d_func()->lruPrev = 0;
+        (*it)->d_func()->lruNext = 0;
+        (*it)->d_func()->hibernationTimer.stop();
         ++it;
     }
+    delete d->blobStore;
 }
 
 /*!
@@ -91,19 +462,27 @@ void UndoGroup::addStack(UndoStack *stack)
 {
     Q_D(UndoGroup);
 
-    if (d->stacks.contains(stack))
+    UndoGroup *other = stack->d_func()->group;
+    if (other == this)
         return;
-    d->stacks.append(stack);
-
-    if (UndoGroup *other = stack->d_func()->group)
+    if (other != 0)
         other->removeStack(stack);
+
     stack->d_func()->group = this;
+    stack->d_func()->groupIndex = d->stacks.size();
+    d->stacks.append(stack);
+    d->linkStack(stack);
+    d->stackChanged(stack);
+    stack->d_func()->scheduleHibernation();
 }
 
 /*!
     Removes \a stack from this group. If the stack was the active stack in the group,
     the active stack becomes null.
 
+    The last stack of stacks() takes the place of the removed one, so that adding and
+    removing stacks takes constant time, however many stacks the group has.
+
     \sa addStack(), stacks(), UndoStack::~UndoStack()
 */
 
@@ -111,16 +490,37 @@ void UndoGroup::removeStack(UndoStack *stack)
 {
     Q_D(UndoGroup);
 
-    if (d->stacks.removeAll(stack) == 0)
+    UndoStackPrivate *stackPrivate = stack->d_func();
+    if (stackPrivate->group != this)
         return;
+
+    // Move the last stack into the gap, so that removal takes constant time.
+    UndoStack *last = d->stacks.takeLast();
+    if (last != stack) {
+        d->stacks[stackPrivate->groupIndex] = last;
+        last->d_func()->groupIndex = stackPrivate->groupIndex;
+    }
+    stackPrivate->groupIndex = -1;
+
+    if (d->transaction)
+        d->closeTransactionMacro(stack);
     if (stack == d->active)
         setActiveStack(0);
-    stack->d_func()->group = 0;
+    d->invalidateTimeline();
+    d->unlinkStack(stack);
+    d->memoryUsage -= stackPrivate->groupMemoryUsage;
+    stackPrivate->groupMemoryUsage = 0;
+    stackPrivate->hibernationTimer.stop();
+    stackPrivate->group = 0;
 }
 
 /*!
     Returns a list of stacks in this group.
 
+    The list is shared with the group and is not copied, so calling this function is
+    cheap. The stacks are in the order in which they were added, except that removing
+    a stack moves the last stack into its place.
+
     \sa addStack(), removeStack()
 */
 
@@ -141,6 +541,11 @@ QVector<UndoStack*> UndoGroup::stacks() const
     in the same way as those returned by \a stack's UndoStack::createUndoAction()
     and UndoStack::createRedoAction().
 
+    The group emits only those of its state signals, such as canUndoChanged(), whose
+    values for \a stack differ from the previous active stack. Switching the active
+    stack does not connect or disconnect any signals, so it is cheap even when it
+    happens often.
+
     \sa UndoStack::setActive(), activeStack()
 */
 
@@ -150,50 +555,16 @@ void UndoGroup::setActiveStack(UndoStack *stack)
     if (d->active == stack)
         return;
 
-    if (d->active != 0) {
-        disconnect(d->active, SIGNAL(canUndoChanged(bool)),
-                    this, SIGNAL(canUndoChanged(bool)));
-        disconnect(d->active, SIGNAL(undoTextChanged(QString)),
-                    this, SIGNAL(undoTextChanged(QString)));
-        disconnect(d->active, SIGNAL(canRedoChanged(bool)),
-                    this, SIGNAL(canRedoChanged(bool)));
-        disconnect(d->active, SIGNAL(redoTextChanged(QString)),
-                    this, SIGNAL(redoTextChanged(QString)));
-        disconnect(d->active, SIGNAL(indexChanged(int)),
-                    this, SIGNAL(indexChanged(int)));
-        disconnect(d->active, SIGNAL(cleanChanged(bool)),
-                    this, SIGNAL(cleanChanged(bool)));
-    }
-
+    UndoStack *previous = d->active;
     d->active = stack;
-
-    if (d->active == 0) {
-        emit canUndoChanged(false);
-        emit undoTextChanged(QString());
-        emit canRedoChanged(false);
-        emit redoTextChanged(QString());
-        emit cleanChanged(true);
-        emit indexChanged(0);
-    } else {
-        connect(d->active, SIGNAL(canUndoChanged(bool)),
-                this, SIGNAL(canUndoChanged(bool)));
-        connect(d->active, SIGNAL(undoTextChanged(QString)),
-                this, SIGNAL(undoTextChanged(QString)));
-        connect(d->active, SIGNAL(canRedoChanged(bool)),
-                this, SIGNAL(canRedoChanged(bool)));
-        connect(d->active, SIGNAL(redoTextChanged(QString)),
-                this, SIGNAL(redoTextChanged(QString)));
-        connect(d->active, SIGNAL(indexChanged(int)),
-                this, SIGNAL(indexChanged(int)));
-        connect(d->active, SIGNAL(cleanChanged(bool)),
-                this, SIGNAL(cleanChanged(bool)));
-        emit canUndoChanged(d->active->canUndo());
-        emit undoTextChanged(d->active->undoText());
-        emit canRedoChanged(d->active->canRedo());
-        emit redoTextChanged(d->active->redoText());
-        emit cleanChanged(d->active->isClean());
-        emit indexChanged(d->active->index());
+    if (previous != 0 && previous->d_func()->group == this)
+        previous->d_func()->setActiveInGroup(false);
+    if (stack != 0 && stack->d_func()->group == this) {
+        d->unlinkStack(stack);
+        d->linkStack(stack);
+        stack->d_func()->setActiveInGroup(true);
     }
+    d->activeStackStateChanged(false);
 
     emit activeStackChanged(d->active);
 }
@@ -321,6 +692,293 @@ bool UndoGroup::isClean() const
     return d->active == 0 || d->active->isClean();
 }
 
+/*!
+    \property UndoGroup::notificationMode
+    \brief when the group emits the signals that notify about changes of the state
+    of its active stack.
+    \since 5.7
+
+    In UndoStack::QueuedNotification mode, the group emits canUndoChanged(),
+    undoTextChanged(), canRedoChanged(), redoTextChanged(), cleanChanged() and
+    indexChanged() at most once per iteration of the event loop, with the values
+    of the active stack at that time, no matter how often the active stack changed
+    its state or how often the active stack was switched. activeStackChanged() is
+    still emitted right away. The getters always return the current values.
+
+    The mode of the group is independent of the mode of its stacks. Switching back to
+    UndoStack::ImmediateNotification emits pending signals right away.
+
+    \sa UndoStack::notificationMode
+*/
+
+void UndoGroup::setNotificationMode(UndoStack::NotificationMode mode)
+{
+    Q_D(UndoGroup);
+
+    if (mode == d->notificationMode)
+        return;
+
+    d->notificationMode = mode;
+    if (mode == UndoStack::ImmediateNotification && d->notificationQueued)
+        d->_q_emitQueuedNotifications();
+}
+
+/*!
+    \property UndoGroup::memoryLimit
+    \brief the maximum number of bytes that the commands of all stacks of the group
+    may keep alive together.
+    \since 5.7
+
+    UndoStack::memoryLimit limits a single stack. With many open documents, each with
+    its own stack, the memory limit of the group bounds the total instead. The group
+    adds up UndoStack::memoryUsage of its stacks in memoryUsage(). When the total
+    exceeds the limit, the group evicts the oldest commands of the stack that was least
+    recently activated or changed, then of the next one, and so on, until the total is
+    within the limit again. The active stack is never evicted.
+
+    Commands are evicted at the next iteration of the event loop after a stack grew
+    beyond the limit, so that a burst of pushes is handled at once, and right away when
+    the limit is lowered. Only commands that can be undone are evicted, as with
+    UndoStack::memoryLimit. Evicted commands are counted in UndoStack::evictedBytes of
+    their stack and in evictedBytes() of the group, and announced by
+    commandsEvicted().
+
+    The default value is 0, which means that there is no limit.
+
+    \sa memoryUsage(), evictedBytes(), UndoStack::memoryLimit
+*/
+
+void UndoGroup::setMemoryLimit(qint64 limit)
+{
+    Q_D(UndoGroup);
+
+    if (limit == d->memoryLimit)
+        return;
+    d->memoryLimit = limit;
+    d->enforceMemoryLimit();
+    emit memoryLimitChanged(limit);
+}
+
+qint64 UndoGroup::memoryLimit() const
+{
+    Q_D(const UndoGroup);
+    return d->memoryLimit;
+}
+
+/*!
+    Returns the sum of UndoStack::memoryUsage of all stacks of the group.
+
+    \since 5.7
+    \sa memoryLimit
+*/
+
+qint64 UndoGroup::memoryUsage() const
+{
+    Q_D(const UndoGroup);
+    return d->memoryUsage;
+}
+
+/*!
+    Returns the number of bytes that the group has freed to enforce memoryLimit, over
+    all of its stacks.
+
+    \since 5.7
+    \sa evictedCount(), commandsEvicted()
+*/
+
+qint64 UndoGroup::evictedBytes() const
+{
+    Q_D(const UndoGroup);
+    return d->evictedBytes;
+}
+
+/*!
+    Returns the number of commands that the group has evicted to enforce memoryLimit,
+    over all of its stacks.
+
+    \since 5.7
+    \sa evictedBytes(), commandsEvicted()
+*/
+
+int UndoGroup::evictedCount() const
+{
+    Q_D(const UndoGroup);
+    return d->evictedCount;
+}
+
+/*!
+    Starts a transaction with the given \a text: a change that spans several stacks of
+    the group and is undone and redone as a unit.
+
+    Until the matching endTransaction(), every stack of the group that is changed by
+    UndoStack::push() or UndoStack::beginMacro() first opens a macro named \a text,
+    which collects all commands pushed on that stack during the transaction.
+    endTransaction() closes these macros and links them: undoing or redoing the macro
+    on any of the stacks, with UndoStack::undo(), UndoStack::redo() or the undo() and
+    redo() slots of the group, undoes or redoes it on all of them. Each stack emits
+    its signals once for this.
+
+    A transaction can only be undone while its macro is the next command to undo on
+    every stack that takes part in it, and redone while it is the next command to
+    redo; otherwise, a warning is printed and nothing happens. UndoStack::setIndex()
+    moves a single stack without regard to transactions.
+
+    If the macro of a transaction is removed from one of its stacks, because the stack
+    evicted it to stay within its undo limit or memory limit, truncated it, or was
+    cleared, the transaction is aborted rather than keeping the macro alive against
+    the limits: a warning is printed when a macro is evicted or truncated, and from
+    then on the macros left on the other stacks are undone and redone separately, like
+    ordinary macros.
+
+    Transactions can be nested; only the outermost one has an effect. A stack with an
+    open macro of its own cannot join a transaction. Finding out whether a stack takes
+    part in the transaction takes constant time, so a transaction can span any number
+    of stacks.
+
+    \since 5.7
+    \sa endTransaction(), isInTransaction()
+*/
+
+void UndoGroup::beginTransaction(const QString &text)
+{
+    Q_D(UndoGroup);
+
+    if (d->transactionDepth++ > 0)
+        return;
+    d->transaction.reset(new UndoTransaction);
+    d->transaction->text = text;
+}
+
+/*!
+    Ends a transaction started with beginTransaction().
+
+    \since 5.7
+    \sa beginTransaction()
+*/
+
+void UndoGroup::endTransaction()
+{
+    Q_D(UndoGroup);
+
+    if (Q_UNLIKELY(d->transactionDepth == 0)) {
+        qWarning("UndoGroup::endTransaction(): no matching beginTransaction()");
+        return;
+    }
+    if (--d->transactionDepth > 0)
+        return;
+
+    // Stacks may be removed from the transaction while their macros end.
+    const QList<UndoStack*> participants = d->transaction->participants.keys();
+    for (UndoStack *stack : participants)
+        d->closeTransactionMacro(stack);
+    d->transaction.reset();
+}
+
+/*!
+    Returns the stack whose next command to undo was executed last among the stacks of
+    the group, or 0 if none of the stacks can undo. This is the stack that
+    undoTimeline() acts on.
+
+    \since 5.7
+    \sa undoTimeline(), timelineRedoStack(), UndoStack::sequenceNumber()
+*/
+
+UndoStack *UndoGroup::timelineUndoStack() const
+{
+    Q_D(const UndoGroup);
+    return d->timelineStack(true);
+}
+
+/*!
+    Returns the stack whose next command to redo was executed first among the stacks
+    of the group, or 0 if none of the stacks can redo. This is the stack that
+    redoTimeline() acts on.
+
+    \since 5.7
+    \sa redoTimeline(), timelineUndoStack(), UndoStack::sequenceNumber()
+*/
+
+UndoStack *UndoGroup::timelineRedoStack() const
+{
+    Q_D(const UndoGroup);
+    return d->timelineStack(false);
+}
+
+/*!
+    Returns the payload store shared by the stacks of this group, creating it on first
+    use. A payload that commands on several stacks put into it is stored once.
+
+    The store is owned by the group and deleted with it; payloads still held by
+    commands stay valid until these are deleted.
+
+    \since 5.7
+    \sa UndoStack::blobStore(), UndoBlobStore
+*/
+
+UndoBlobStore *UndoGroup::blobStore()
+{
+    Q_D(UndoGroup);
+    if (d->blobStore == 0)
+        d->blobStore = new UndoBlobStore;
+    return d->blobStore;
+}
+
+/*!
+    Undoes the most recent change in any of the stacks of the group, regardless of which
+    stack is active, by calling UndoStack::undo() on timelineUndoStack(). Calling it
+    repeatedly undoes the changes of all stacks in the reverse order in which they were
+    made, as given by UndoStack::sequenceNumber().
+
+    The group keeps the stacks in a heap ordered by the sequence number of their next
+    command, so finding the stack takes O(log n) time in the number of stacks. The heap
+    is built the first time the timeline is used, and rebuilt after a stack is removed.
+
+    \since 5.7
+    \sa redoTimeline(), timelineUndoStack(), undo()
+*/
+
+void UndoGroup::undoTimeline()
+{
+    Q_D(UndoGroup);
+    if (UndoStack *stack = d->timelineStack(true))
+        stack->undo();
+}
+
+/*!
+    Redoes the earliest undone change in any of the stacks of the group, regardless of
+    which stack is active, by calling UndoStack::redo() on timelineRedoStack(). After
+    undoTimeline(), this redoes the changes in the order in which they were made.
+
+    \since 5.7
+    \sa undoTimeline(), timelineRedoStack(), redo()
+*/
+
+void UndoGroup::redoTimeline()
+{
+    Q_D(UndoGroup);
+    if (UndoStack *stack = d->timelineStack(false))
+        stack->redo();
+}
+
+/*!
+    Returns \c true if a transaction started with beginTransaction() is open.
+
+    \since 5.7
+    \sa beginTransaction()
+*/
+
+bool UndoGroup::isInTransaction() const
+{
+    Q_D(const UndoGroup);
+    return d->transactionDepth > 0;
+}
+
+UndoStack::NotificationMode UndoGroup::notificationMode() const
+{
+    Q_D(const UndoGroup);
+    return d->notificationMode;
+}
+
 /*! \fn void UndoGroup::activeStackChanged(UndoStack *stack)
 
     This signal is emitted whenever the active stack of the group changes. This can happen
@@ -331,10 +989,27 @@ bool UndoGroup::isClean() const
     \sa setActiveStack(), UndoStack::setActive()
 */
 
+/*! \fn void UndoGroup::memoryLimitChanged(qint64 memoryLimit)
+
+    This signal is emitted whenever the value of memoryLimit() changes.
+    \a memoryLimit specifies the new value.
+
+    \since 5.7
+*/
+
+/*! \fn void UndoGroup::commandsEvicted(UndoStack *stack, int count, qint64 bytes)
+
+    This signal is emitted when the group has evicted the \a count oldest commands of
+    \a stack, which freed \a bytes, to enforce its memory limit.
+
+    \since 5.7
+    \sa memoryLimit
+*/
+
 /*! \fn void UndoGroup::indexChanged(int idx)
 
-    This signal is emitted whenever the active stack emits UndoStack::indexChanged()
-    or the active stack changes.
+    This signal is emitted whenever the active stack emits UndoStack::indexChanged(),
+    or the active stack changes to one with a different index.
 
     \a idx is the new current index, or 0 if the active stack is 0.
 
@@ -343,8 +1018,8 @@ bool UndoGroup::isClean() const
 
 /*! \fn void UndoGroup::cleanChanged(bool clean)
 
-    This signal is emitted whenever the active stack emits UndoStack::cleanChanged()
-    or the active stack changes.
+    This signal is emitted whenever the active stack emits UndoStack::cleanChanged(),
+    or the active stack changes to one with a different value.
 
     \a clean is the new state, or true if the active stack is 0.
 
@@ -353,8 +1028,8 @@ bool UndoGroup::isClean() const
 
 /*! \fn void UndoGroup::canUndoChanged(bool canUndo)
 
-    This signal is emitted whenever the active stack emits UndoStack::canUndoChanged()
-    or the active stack changes.
+    This signal is emitted whenever the active stack emits UndoStack::canUndoChanged(),
+    or the active stack changes to one with a different value.
 
     \a canUndo is the new state, or false if the active stack is 0.
 
@@ -363,8 +1038,8 @@ bool UndoGroup::isClean() const
 
 /*! \fn void UndoGroup::canRedoChanged(bool canRedo)
 
-    This signal is emitted whenever the active stack emits UndoStack::canRedoChanged()
-    or the active stack changes.
+    This signal is emitted whenever the active stack emits UndoStack::canRedoChanged(),
+    or the active stack changes to one with a different value.
 
     \a canRedo is the new state, or false if the active stack is 0.
 
@@ -373,8 +1048,8 @@ bool UndoGroup::isClean() const
 
 /*! \fn void UndoGroup::undoTextChanged(const QString &undoText)
 
-    This signal is emitted whenever the active stack emits UndoStack::undoTextChanged()
-    or the active stack changes.
+    This signal is emitted whenever the active stack emits UndoStack::undoTextChanged(),
+    or the active stack changes to one with a different value.
 
     \a undoText is the new state, or an empty string if the active stack is 0.
 
@@ -383,8 +1058,8 @@ bool UndoGroup::isClean() const
 
 /*! \fn void UndoGroup::redoTextChanged(const QString &redoText)
 
-    This signal is emitted whenever the active stack emits UndoStack::redoTextChanged()
-    or the active stack changes.
+    This signal is emitted whenever the active stack emits UndoStack::redoTextChanged(),
+    or the active stack changes to one with a different value.
 
     \a redoText is the new state, or an empty string if the active stack is 0.
 
@@ -392,3 +1067,5 @@ bool UndoGroup::isClean() const
 */
 
 QT_END_NAMESPACE
+
+#include "moc_undogroup.cpp"
@@ -3,15 +3,18 @@
 
 #include <QObject>
 #include <QtUndo/undo_global.h>
+#include <QtUndo/undostack.h>
 
 QT_BEGIN_NAMESPACE
 
+class UndoBlobStore;
 class UndoGroupPrivate;
-class UndoStack;
 
 class Q_UNDO_EXPORT UndoGroup : public QObject
 {
     Q_OBJECT
+    Q_PROPERTY(UndoStack::NotificationMode notificationMode READ notificationMode WRITE setNotificationMode)
+    Q_PROPERTY(qint64 memoryLimit READ memoryLimit WRITE setMemoryLimit NOTIFY memoryLimitChanged)
 public:
     explicit UndoGroup(QObject *parent = nullptr);
     ~UndoGroup();
@@ -27,9 +30,29 @@ public:
     QString redoText() const;
     bool isClean() const;
 
+    void setNotificationMode(UndoStack::NotificationMode mode);
+    UndoStack::NotificationMode notificationMode() const;
+
+    void setMemoryLimit(qint64 limit);
+    qint64 memoryLimit() const;
+    qint64 memoryUsage() const;
+    qint64 evictedBytes() const;
+    int evictedCount() const;
+
+    void beginTransaction(const QString &text);
+    void endTransaction();
+    bool isInTransaction() const;
+
+    UndoStack *timelineUndoStack() const;
+    UndoStack *timelineRedoStack() const;
+
+    UndoBlobStore *blobStore();
+
 public Q_SLOTS:
     void undo();
     void redo();
+    void undoTimeline();
+    void redoTimeline();
     void setActiveStack(UndoStack *stack);
 
 Q_SIGNALS:
@@ -40,10 +63,14 @@ Q_SIGNALS:
     void canRedoChanged(bool canRedo);
     void undoTextChanged(const QString &undoText);
     void redoTextChanged(const QString &redoText);
+    void memoryLimitChanged(qint64 memoryLimit);
+    void commandsEvicted(UndoStack *stack, int count, qint64 bytes);
 
 private:
     Q_DISABLE_COPY(UndoGroup)
     Q_DECLARE_PRIVATE(UndoGroup)
+    Q_PRIVATE_SLOT(d_func(), void _q_emitQueuedNotifications())
+    Q_PRIVATE_SLOT(d_func(), void _q_enforceMemoryLimit())
 };
 
 QT_END_NAMESPACE
@@ -0,0 +1,133 @@
+#ifndef UNDOGROUP_P_H
+#define UNDOGROUP_P_H
+
+#include <QtCore/private/qobject_p.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qstring.h>
+#include <QtCore/qvector.h>
+
+#include "undogroup.h"
+#include "undostack.h"
+
+QT_BEGIN_NAMESPACE
+
+class UndoBlobStore;
+struct UndoTransaction;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// An entry of the timeline heaps of a group: the sequence number of the command next
+// to the index of a stack when the entry was made. Entries that no longer match the
+// stack are stale and are dropped when they reach the top of the heap.
+struct UndoTimelineEntry
+{
+    quint64 sequence;
+    UndoStack *stack;
+};
+
+Q_DECLARE_TYPEINFO(UndoTimelineEntry, Q_PRIMITIVE_TYPE);
+
+// The commands that a group evicted from one of its stacks to enforce its memory limit.
+struct UndoEviction
+{
+    UndoStack *stack;
+    int count;
+    qint64 bytes;
+};
+
+Q_DECLARE_TYPEINFO(UndoEviction, Q_PRIMITIVE_TYPE);
+
+class UndoGroupPrivate : public QObjectPrivate
+{
+    Q_DECLARE_PUBLIC(UndoGroup)
+public:
+    UndoGroupPrivate() :
+        active(0),
+        notificationMode(UndoStack::ImmediateNotification),
+        notificationQueued(false),
+        pendingIndexChange(false),
+        emittedIndex(0),
+        emittedClean(true),
+        emittedCanUndo(false),
+        emittedCanRedo(false),
+        emittedUndoTextValid(true),
+        emittedRedoTextValid(true),
+        transactionDepth(0),
+        timelineBuilt(false),
+        memoryLimit(0),
+        memoryUsage(0),
+        evictedBytes(0),
+        evictedCount(0),
+        lruFirst(0),
+        lruLast(0),
+        enforcingMemoryLimit(false),
+        memoryCheckQueued(false),
+        blobStore(0)
+    {
+    }
+
+    static UndoGroupPrivate *get(UndoGroup *group) { return group->d_func(); }
+
+    UndoStack *active;
+    QVector<UndoStack*> stacks;
+    UndoStack::NotificationMode notificationMode;
+    bool notificationQueued;
+    bool pendingIndexChange;
+    // The values of the state signals that were last emitted.
+    int emittedIndex;
+    QString emittedUndoText;
+    QString emittedRedoText;
+    bool emittedClean;
+    bool emittedCanUndo;
+    bool emittedCanRedo;
+    bool emittedUndoTextValid;
+    bool emittedRedoTextValid;
+    QSharedPointer<UndoTransaction> transaction;
+    int transactionDepth;
+    // A max-heap of the commands to undo and a min-heap of the commands to redo, by
+    // sequence number, and the stacks that changed since the heaps were updated. Built
+    // on first use of the timeline.
+    mutable QVector<UndoTimelineEntry> undoHeap;
+    mutable QVector<UndoTimelineEntry> redoHeap;
+    mutable QVector<UndoStack*> changedStacks;
+    mutable bool timelineBuilt;
+    qint64 memoryLimit;
+    qint64 memoryUsage;
+    qint64 evictedBytes;
+    int evictedCount;
+    // The stacks from the least to the most recently activated or changed one, linked
+    // through UndoStackPrivate::lruPrev and lruNext.
+    UndoStack *lruFirst;
+    UndoStack *lruLast;
+    bool enforcingMemoryLimit;
+    bool memoryCheckQueued;
+    UndoBlobStore *blobStore;
+
+    void emitActiveStackState(bool indexChanged);
+    void activeStackStateChanged(bool indexChanged);
+    void _q_emitQueuedNotifications();
+    void joinTransaction(UndoStack *stack);
+    void closeTransactionMacro(UndoStack *stack);
+    void stackChanged(UndoStack *stack);
+    void linkStack(UndoStack *stack);
+    void unlinkStack(UndoStack *stack);
+    void enforceMemoryLimit();
+    void _q_enforceMemoryLimit();
+    void invalidateTimeline();
+    void rebuildTimeline() const;
+    void updateTimeline() const;
+    UndoStack *timelineStack(bool undo) const;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOGROUP_P_H
@@ -0,0 +1,138 @@
+#include "undohibernation_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qdir.h>
+
+#include "undoserializer_p.h"
+
+QT_BEGIN_NAMESPACE
+
+UndoHibernationFile::UndoHibernationFile() :
+    m_file(QDir::tempPath() + QLatin1String("/qtundo_XXXXXX.hibernate"))
+{
+}
+
+bool UndoHibernationFile::open()
+{
+    return m_file.isOpen() || m_file.open();
+}
+
+/*
+    Appends \a command to the file and returns its offset, or -1 if it cannot be
+    written.
+*/
+qint64 UndoHibernationFile::write(const LightUndoCommand *command)
+{
+    const qint64 offset = m_file.size();
+    if (!m_file.seek(offset))
+        return -1;
+
+    // Serialized in memory first, since the serializer seeks back to patch lengths.
+    QByteArray data;
+    {
+        QDataStream stream(&data, QIODevice::WriteOnly);
+        stream.setVersion(QDataStream::Qt_5_6);
+        UndoCommandSerializer().save(stream, command);
+    }
+    return m_file.write(data) == data.size() ? offset : -1;
+}
+
+bool UndoHibernationFile::flush()
+{
+    return m_file.flush();
+}
+
+/*
+    Returns the command written at \a offset, or 0 if it cannot be read.
+*/
+LightUndoCommand *UndoHibernationFile::read(qint64 offset)
+{
+    if (!m_file.seek(offset))
+        return 0;
+
+    QDataStream stream(&m_file);
+    stream.setVersion(QDataStream::Qt_5_6);
+    return UndoCommandSerializer().load(stream);
+}
+
+UndoHibernatedCommand::UndoHibernatedCommand(const QSharedPointer<UndoHibernationFile> &file,
+                                             qint64 offset, const LightUndoCommand *command) :
+    LightUndoCommand(command->text()),
+    m_file(file),
+    m_offset(offset),
+    m_id(command->id()),
+    m_resources(command->resources()),
+    m_command(0)
+{
+}
+
+UndoHibernatedCommand::~UndoHibernatedCommand()
+{
+    delete m_command;
+}
+
+void UndoHibernatedCommand::undo()
+{
+    if (LightUndoCommand *command = this->command())
+        command->undo();
+}
+
+void UndoHibernatedCommand::redo()
+{
+    if (LightUndoCommand *command = this->command())
+        command->redo();
+}
+
+int UndoHibernatedCommand::id() const
+{
+    return m_command != 0 ? m_command->id() : m_id;
+}
+
+bool UndoHibernatedCommand::mergeWith(const LightUndoCommand *other)
+{
+    LightUndoCommand *command = this->command();
+    if (command == 0 || !command->mergeWith(other))
+        return false;
+    setText(command->text());
+    return true;
+}
+
+qint64 UndoHibernatedCommand::cost() const
+{
+    return m_command != 0 ? m_command->cost() : 0;
+}
+
+QVector<quint64> UndoHibernatedCommand::resources() const
+{
+    // Kept in memory, so that the resource index does not read the command back.
+    return m_command != 0 ? m_command->resources() : m_resources;
+}
+
+/*
+    Returns the hibernated command, reading it from the file first if this has not
+    been done yet. Returns 0 if the command cannot be read.
+*/
+LightUndoCommand *UndoHibernatedCommand::command() const
+{
+    if (m_command == 0 && m_file) {
+        m_command = m_file->read(m_offset);
+        // The file is removed once no command needs it anymore.
+        m_file.reset();
+    }
+    if (Q_UNLIKELY(m_command == 0))
+        qWarning("UndoStack: cannot read hibernated command \"%s\"", qPrintable(text()));
+    return m_command;
+}
+
+/*
+    Returns the hibernated command, as command() does, and passes its ownership to
+    the caller.
+*/
+LightUndoCommand *UndoHibernatedCommand::takeCommand()
+{
+    LightUndoCommand *command = this->command();
+    m_command = 0;
+    return command;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,71 @@
+#ifndef UNDOHIBERNATION_P_H
+#define UNDOHIBERNATION_P_H
+
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qtemporaryfile.h>
+
+#include "lightundocommand.h"
+
+QT_BEGIN_NAMESPACE
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// A temporary file that the hibernated commands of a stack are appended to. It is
+// shared by the commands that still need it and removed with the last of them.
+class UndoHibernationFile
+{
+public:
+    UndoHibernationFile();
+
+    bool open();
+    qint64 write(const LightUndoCommand *command);
+    bool flush();
+    LightUndoCommand *read(qint64 offset);
+
+private:
+    Q_DISABLE_COPY(UndoHibernationFile)
+
+    QTemporaryFile m_file;
+};
+
+// Takes the place of a command that was written to disk. The text, the id and the
+// resources of the command are kept in memory; the command itself is read back the
+// first time it is needed, for example when it is undone, after which the stack puts
+// it in the place of this command again.
+class UndoHibernatedCommand : public LightUndoCommand
+{
+public:
+    UndoHibernatedCommand(const QSharedPointer<UndoHibernationFile> &file, qint64 offset,
+                          const LightUndoCommand *command);
+    ~UndoHibernatedCommand();
+
+    void undo() override;
+    void redo() override;
+    int id() const override;
+    bool mergeWith(const LightUndoCommand *other) override;
+    qint64 cost() const override;
+    QVector<quint64> resources() const override;
+
+    LightUndoCommand *command() const;
+    LightUndoCommand *takeCommand();
+
+private:
+    mutable QSharedPointer<UndoHibernationFile> m_file;
+    qint64 m_offset;
+    int m_id;
+    QVector<quint64> m_resources;
+    mutable LightUndoCommand *m_command;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOHIBERNATION_P_H
@@ -0,0 +1,289 @@
+#include "undojournal_p.h"
+
+#include <QtCore/qrunnable.h>
+#include <QtCore/qsavefile.h>
+#include <QtCore/qthreadpool.h>
+
+#if defined(Q_OS_WIN)
+#  include <io.h>
+#  include <qt_windows.h>
+#else
+#  include <unistd.h>
+#endif
+
+QT_BEGIN_NAMESPACE
+
+static const quint32 journalMagic = 0x51554a4c; // "QUJL"
+static const quint32 journalVersion = 1;
+static const int recordHeaderSize = sizeof(quint32) + sizeof(quint16);
+
+/*
+    Writes the data buffered for \a file to disk and waits until the disk has it.
+*/
+static bool syncToDisk(QFile *file)
+{
+    if (!file->flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return FlushFileBuffers(reinterpret_cast<HANDLE>(_get_osfhandle(file->handle())));
+#else
+    return ::fsync(file->handle()) == 0;
+#endif
+}
+
+class UndoJournal::Writer : public QRunnable
+{
+public:
+    explicit Writer(const QSharedPointer<Shared> &shared) :
+        m_shared(shared)
+    {
+    }
+
+    void run() override
+    {
+        Shared *shared = m_shared.data();
+        QMutexLocker locker(&shared->mutex);
+        for (;;) {
+            QByteArray snapshot;
+            QByteArray records;
+            snapshot.swap(shared->snapshot);
+            records.swap(shared->records);
+            const bool sync = shared->sync;
+            shared->sync = false;
+            if (snapshot.isEmpty() && records.isEmpty() && !sync)
+                break;
+
+            locker.unlock();
+            bool ok = true;
+            if (!snapshot.isEmpty())
+                ok = replaceFile(snapshot);
+            if (ok && !records.isEmpty())
+                ok = shared->file.isOpen() && shared->file.write(records) == records.size();
+            if (ok && sync)
+                ok = shared->file.isOpen() && syncToDisk(&shared->file);
+            locker.relock();
+
+            if (!ok)
+                shared->failed = true;
+        }
+        shared->writing = false;
+        shared->idle.wakeAll();
+    }
+
+private:
+    // Starts the journal over with \a snapshot. The new contents are written to
+    // another file, which replaces the journal only once it is complete and on disk.
+    bool replaceFile(const QByteArray &snapshot)
+    {
+        Shared *shared = m_shared.data();
+        shared->file.close();
+
+        QSaveFile file(shared->fileName);
+        if (!file.open(QIODevice::WriteOnly))
+            return false;
+        QDataStream stream(&file);
+        stream.setVersion(QDataStream::Qt_5_6);
+        stream << journalMagic << journalVersion;
+        if (file.write(snapshot) != snapshot.size() || !file.commit())
+            return false;
+
+        shared->file.setFileName(shared->fileName);
+        return shared->file.open(QIODevice::WriteOnly | QIODevice::Append);
+    }
+
+    QSharedPointer<Shared> m_shared;
+};
+
+UndoJournal::UndoJournal(const QString &fileName) :
+    m_fileName(fileName),
+    m_recordStart(0),
+    m_recordBytes(0),
+    m_snapshotBytes(0),
+    m_unsynced(false),
+    m_shared(new Shared)
+{
+    m_shared->fileName = fileName;
+    m_device.setBuffer(&m_buffer);
+    m_device.open(QIODevice::WriteOnly);
+    m_stream.setDevice(&m_device);
+    m_stream.setVersion(QDataStream::Qt_5_6);
+    m_sinceSync.start();
+}
+
+/*
+    Writes and syncs the records that are still buffered.
+*/
+UndoJournal::~UndoJournal()
+{
+    waitForDone();
+}
+
+/*
+    Starts a record of the given \a type and returns the stream to write its data to.
+    The record is complete once endRecord() is called.
+*/
+QDataStream &UndoJournal::beginRecord(RecordType type)
+{
+    m_recordStart = m_device.pos();
+    m_stream << quint32(0) << quint16(0) << quint8(type);
+    return m_stream;
+}
+
+void UndoJournal::finishRecord()
+{
+    const qint64 end = m_device.pos();
+    const qint64 contentStart = m_recordStart + recordHeaderSize;
+    const quint32 length = quint32(end - contentStart);
+    m_device.seek(m_recordStart);
+    m_stream << length << qChecksum(m_buffer.constData() + contentStart, length);
+    m_device.seek(end);
+}
+
+void UndoJournal::endRecord()
+{
+    finishRecord();
+    m_recordBytes += m_device.pos() - m_recordStart;
+    m_unsynced = true;
+    if (m_buffer.size() >= BatchSize)
+        handOver(false);
+}
+
+/*
+    Starts a snapshot record, which supersedes all records before it, and returns the
+    stream to write the history to.
+*/
+QDataStream &UndoJournal::beginSnapshot()
+{
+    m_buffer.clear();
+    m_device.seek(0);
+    return beginRecord(SnapshotRecord);
+}
+
+/*
+    Completes the snapshot and has the writer replace the file with it.
+*/
+void UndoJournal::endSnapshot()
+{
+    finishRecord();
+    m_snapshotBytes = m_buffer.size();
+    m_recordBytes = 0;
+    m_unsynced = false; // QSaveFile syncs the new file
+    m_sinceSync.restart();
+
+    QMutexLocker locker(&m_shared->mutex);
+    m_shared->snapshot.swap(m_buffer);
+    m_shared->records.clear();
+    locker.unlock();
+    m_buffer.clear();
+    m_device.seek(0);
+    handOver(false);
+}
+
+/*
+    Hands the buffered records to the writer and starts it if it is not running. If
+    \a sync is true, the writer syncs the file to disk afterwards.
+*/
+void UndoJournal::handOver(bool sync)
+{
+    QMutexLocker locker(&m_shared->mutex);
+    if (!m_buffer.isEmpty()) {
+        if (m_shared->records.isEmpty())
+            m_shared->records.swap(m_buffer);
+        else
+            m_shared->records += m_buffer;
+        m_buffer.clear();
+        m_device.seek(0);
+    }
+    m_shared->sync |= sync;
+
+    if (!m_shared->writing && (!m_shared->snapshot.isEmpty() || !m_shared->records.isEmpty()
+                               || m_shared->sync)) {
+        m_shared->writing = true;
+        QThreadPool::globalInstance()->start(new Writer(m_shared));
+    }
+}
+
+/*
+    Hands the buffered records to the writer. If the file has not been synced for
+    SyncInterval milliseconds, the writer syncs it as well.
+*/
+void UndoJournal::flush()
+{
+    const bool sync = m_unsynced && m_sinceSync.hasExpired(SyncInterval);
+    if (sync) {
+        m_unsynced = false;
+        m_sinceSync.restart();
+    }
+    handOver(sync);
+}
+
+/*
+    Writes and syncs all records and blocks until the writer is done.
+*/
+void UndoJournal::waitForDone()
+{
+    handOver(m_unsynced);
+    m_unsynced = false;
+    m_sinceSync.restart();
+
+    QMutexLocker locker(&m_shared->mutex);
+    while (m_shared->writing)
+        m_shared->idle.wait(&m_shared->mutex);
+}
+
+/*
+    Returns \c true if every record is on disk.
+*/
+bool UndoJournal::isIdle() const
+{
+    if (m_unsynced || !m_buffer.isEmpty())
+        return false;
+    QMutexLocker locker(&m_shared->mutex);
+    return !m_shared->writing;
+}
+
+/*
+    Returns \c true if the writer could not write or sync the file.
+*/
+bool UndoJournal::hasFailed() const
+{
+    QMutexLocker locker(&m_shared->mutex);
+    return m_shared->failed;
+}
+
+/*
+    Reads the beginning of a journal from \a stream and returns \c true if it is one
+    that this version can read.
+*/
+bool UndoJournal::readHeader(QDataStream &stream)
+{
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    return stream.status() == QDataStream::Ok && magic == journalMagic
+            && version > 0 && version <= journalVersion;
+}
+
+/*
+    Reads the next record from \a stream into \a contents, which starts with the
+    RecordType. Returns \c false at the end of the journal, which is either the end
+    of the stream or a record that is incomplete or damaged.
+*/
+bool UndoJournal::readRecord(QDataStream &stream, QByteArray *contents)
+{
+    quint32 length;
+    quint16 checksum;
+    stream >> length >> checksum;
+    if (stream.status() != QDataStream::Ok || length == 0)
+        return false;
+
+    QIODevice *device = stream.device();
+    if (length > quint64(device->size() - device->pos()))
+        return false;
+    contents->resize(int(length));
+    if (stream.readRawData(contents->data(), int(length)) != int(length))
+        return false;
+    return qChecksum(contents->constData(), length) == checksum;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,111 @@
+#ifndef UNDOJOURNAL_P_H
+#define UNDOJOURNAL_P_H
+
+#include <QtCore/qbuffer.h>
+#include <QtCore/qbytearray.h>
+#include <QtCore/qdatastream.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qmutex.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qstring.h>
+#include <QtCore/qwaitcondition.h>
+
+QT_BEGIN_NAMESPACE
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// An append-only file of the changes made to a stack; see UndoStack::openJournal().
+// Records are encoded into a buffer on the owner thread and written in batches by a
+// thread of the global thread pool, which also syncs the file to disk at most once
+// per SyncInterval. A snapshot replaces the whole file atomically.
+//
+// The file starts with a magic number and a version. Each record is its length, a
+// CRC-16 of its contents, and its contents: a RecordType followed by the data of the
+// record. A record that was torn by a crash fails the check and ends the journal.
+class UndoJournal
+{
+public:
+    enum RecordType {
+        SnapshotRecord = 1, // the history, as written by UndoStack::save()
+        PushRecord, // a command appended to the stack
+        TruncateRecord, // the number of commands the stack is cut down to
+        EvictRecord, // the number of commands removed from the bottom of the stack
+        IndexRecord, // the new index
+        CleanRecord // the new clean index
+    };
+
+    enum {
+        BatchSize = 64 * 1024, // bytes
+        FlushInterval = 100, // milliseconds
+        SyncInterval = 1000 // milliseconds
+    };
+
+    explicit UndoJournal(const QString &fileName);
+    ~UndoJournal();
+
+    QString fileName() const { return m_fileName; }
+    qint64 recordBytes() const { return m_recordBytes; }
+    qint64 snapshotBytes() const { return m_snapshotBytes; }
+
+    QDataStream &beginRecord(RecordType type);
+    void endRecord();
+    QDataStream &beginSnapshot();
+    void endSnapshot();
+
+    void flush();
+    void waitForDone();
+    bool isIdle() const;
+    bool hasFailed() const;
+
+    static bool readHeader(QDataStream &stream);
+    static bool readRecord(QDataStream &stream, QByteArray *contents);
+
+private:
+    Q_DISABLE_COPY(UndoJournal)
+
+    // Shared with the writer, which may still run when the journal is destroyed.
+    struct Shared
+    {
+        Shared() : writing(false), sync(false), failed(false) {}
+
+        QMutex mutex;
+        QWaitCondition idle;
+        QString fileName;
+        QFile file; // used by the writer only
+        QByteArray snapshot; // replaces the file before the records are written
+        QByteArray records;
+        bool writing;
+        bool sync;
+        bool failed;
+    };
+
+    class Writer;
+
+    void finishRecord();
+    void handOver(bool sync);
+
+    QString m_fileName;
+    QByteArray m_buffer;
+    QBuffer m_device;
+    QDataStream m_stream;
+    qint64 m_recordStart;
+    qint64 m_recordBytes; // written since the last snapshot
+    qint64 m_snapshotBytes;
+    bool m_unsynced;
+    QElapsedTimer m_sinceSync;
+    QSharedPointer<Shared> m_shared;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOJOURNAL_P_H
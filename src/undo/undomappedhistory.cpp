@@ -0,0 +1,213 @@
+#include "undomappedhistory_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qendian.h>
+
+#include "undoserializer_p.h"
+
+QT_BEGIN_NAMESPACE
+
+static const quint32 mappedHistoryMagic = 0x51554d48; // "QUMH"
+static const quint32 mappedHistoryVersion = 1;
+
+UndoMappedHistory::UndoMappedHistory() :
+    m_data(0),
+    m_size(0),
+    m_count(0),
+    m_index(0),
+    m_cleanIndex(-1)
+{
+}
+
+/*
+    Writes \a commands, which must all be savable, \a index and \a cleanIndex to
+    \a device in the format that open() reads. Returns \c false if the device fails.
+*/
+bool UndoMappedHistory::write(QIODevice *device, const QVector<const LightUndoCommand*> &commands,
+                              int index, int cleanIndex)
+{
+    const qint64 recordsStart = HeaderSize + qint64(commands.size()) * qint64(sizeof(quint64));
+    QByteArray header;
+    QByteArray records;
+    {
+        QDataStream headerStream(&header, QIODevice::WriteOnly);
+        headerStream.setVersion(QDataStream::Qt_5_6);
+        headerStream << mappedHistoryMagic << mappedHistoryVersion << qint32(commands.size())
+                     << qint32(index) << qint32(cleanIndex) << quint32(0);
+
+        QDataStream recordStream(&records, QIODevice::WriteOnly);
+        recordStream.setVersion(QDataStream::Qt_5_6);
+        UndoCommandSerializer serializer;
+        for (const LightUndoCommand *command : commands) {
+            headerStream << quint64(recordsStart + recordStream.device()->pos());
+            serializer.save(recordStream, command);
+        }
+    }
+    return device->write(header) == header.size() && device->write(records) == records.size();
+}
+
+/*
+    Maps the file \a fileName and reads its header. Returns \c false, and warns on
+    behalf of \a function, if it cannot be mapped or is not a mapped history. Only the
+    header is read, so this takes the same time for any number of commands.
+*/
+bool UndoMappedHistory::open(const QString &fileName, const char *function)
+{
+    m_file.setFileName(fileName);
+    if (Q_UNLIKELY(!m_file.open(QIODevice::ReadOnly))) {
+        qWarning("%s: cannot open %s", function, qPrintable(fileName));
+        return false;
+    }
+    m_size = m_file.size();
+    m_data = m_size >= HeaderSize ? m_file.map(0, m_size) : 0;
+    if (Q_UNLIKELY(m_data == 0 && m_size >= HeaderSize)) {
+        qWarning("%s: cannot map %s", function, qPrintable(fileName));
+        return false;
+    }
+    if (Q_UNLIKELY(m_data == 0 || qFromBigEndian<quint32>(m_data) != mappedHistoryMagic)) {
+        qWarning("%s: %s is not a mapped undo history", function, qPrintable(fileName));
+        return false;
+    }
+    const quint32 version = qFromBigEndian<quint32>(m_data + 4);
+    if (Q_UNLIKELY(version == 0 || version > mappedHistoryVersion)) {
+        qWarning("%s: unsupported format version %u", function, version);
+        return false;
+    }
+
+    m_count = qFromBigEndian<qint32>(m_data + 8);
+    m_index = qFromBigEndian<qint32>(m_data + 12);
+    m_cleanIndex = qFromBigEndian<qint32>(m_data + 16);
+    if (Q_UNLIKELY(m_count < 0 || m_count > (m_size - HeaderSize) / qint64(sizeof(quint64))
+                   || m_index < 0 || m_index > m_count
+                   || m_cleanIndex < -1 || m_cleanIndex > m_count)) {
+        qWarning("%s: %s is corrupt", function, qPrintable(fileName));
+        return false;
+    }
+    return true;
+}
+
+/*
+    Returns the bytes of the command at \a position, without copying them, or an
+    empty array if its offset is damaged.
+*/
+QByteArray UndoMappedHistory::record(int position) const
+{
+    const quint64 recordsStart = HeaderSize + quint64(m_count) * sizeof(quint64);
+    const uchar *offsets = m_data + HeaderSize;
+    const quint64 start = qFromBigEndian<quint64>(offsets + position * sizeof(quint64));
+    const quint64 end = position + 1 < m_count
+            ? qFromBigEndian<quint64>(offsets + (position + 1) * sizeof(quint64))
+            : quint64(m_size);
+    if (start < recordsStart || start >= end || end > quint64(m_size))
+        return QByteArray();
+    return QByteArray::fromRawData(reinterpret_cast<const char *>(m_data + start),
+                                   int(end - start));
+}
+
+/*
+    Returns the text of the command at \a position, reading nothing else of it.
+*/
+QString UndoMappedHistory::text(int position) const
+{
+    const QByteArray data = record(position);
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
+    qint32 typeId;
+    QString text;
+    stream >> typeId >> text;
+    return stream.status() == QDataStream::Ok ? text : QString();
+}
+
+/*
+    Returns the command at \a position, or 0 if it cannot be read.
+*/
+LightUndoCommand *UndoMappedHistory::load(int position) const
+{
+    const QByteArray data = record(position);
+    if (data.isEmpty())
+        return 0;
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
+    return UndoCommandSerializer().load(stream);
+}
+
+UndoMappedCommand::UndoMappedCommand(UndoMappedHistory *history, int position) :
+    LightUndoCommand(history->text(position)),
+    m_history(history),
+    m_position(position),
+    m_command(0)
+{
+}
+
+UndoMappedCommand::~UndoMappedCommand()
+{
+    delete m_command;
+}
+
+void UndoMappedCommand::undo()
+{
+    if (LightUndoCommand *command = this->command())
+        command->undo();
+}
+
+void UndoMappedCommand::redo()
+{
+    if (LightUndoCommand *command = this->command())
+        command->redo();
+}
+
+int UndoMappedCommand::id() const
+{
+    return m_command != 0 ? m_command->id() : -1;
+}
+
+bool UndoMappedCommand::mergeWith(const LightUndoCommand *other)
+{
+    LightUndoCommand *command = this->command();
+    if (command == 0 || !command->mergeWith(other))
+        return false;
+    setText(command->text());
+    return true;
+}
+
+qint64 UndoMappedCommand::cost() const
+{
+    return m_command != 0 ? m_command->cost() : 0;
+}
+
+QVector<quint64> UndoMappedCommand::resources() const
+{
+    // Without children, a command conflicts with all others.
+    return m_command != 0 ? m_command->resources() : LightUndoCommand::resources();
+}
+
+/*
+    Returns the command, reading it from the file first if this has not been done
+    yet. Returns 0 if the command cannot be read.
+*/
+LightUndoCommand *UndoMappedCommand::command() const
+{
+    if (m_command == 0 && m_history) {
+        m_command = m_history->load(m_position);
+        if (Q_UNLIKELY(m_command == 0)) {
+            qWarning("UndoStack: cannot read the command at index %d of %s",
+                     m_position, qPrintable(m_history->fileName()));
+            return 0;
+        }
+        // The file is unmapped once no command needs it anymore.
+        m_history.reset();
+    }
+    return m_command;
+}
+
+/*
+    Returns the command, as command() does, and passes its ownership to the caller.
+*/
+LightUndoCommand *UndoMappedCommand::takeCommand()
+{
+    LightUndoCommand *command = this->command();
+    m_command = 0;
+    return command;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,95 @@
+#ifndef UNDOMAPPEDHISTORY_P_H
+#define UNDOMAPPEDHISTORY_P_H
+
+#include <QtCore/qfile.h>
+#include <QtCore/qshareddata.h>
+#include <QtCore/qvector.h>
+
+#include "lightundocommand.h"
+
+QT_BEGIN_NAMESPACE
+
+class QIODevice;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// A history file written by UndoStack::saveMapped() and mapped into memory by
+// UndoStack::openMapped(). It is shared by the commands that still need it and
+// unmapped with the last of them.
+//
+// The file starts with a header of HeaderSize bytes: a magic number, a version, the
+// number of commands, the index and the clean index. The header is followed by the
+// file offset of each command as a quint64, and then by the commands, each written
+// by UndoCommandSerializer without a text table. Any command, or its text, can thus
+// be read without reading the ones before it.
+class UndoMappedHistory : public QSharedData
+{
+public:
+    enum { HeaderSize = 24 };
+
+    UndoMappedHistory();
+
+    static bool write(QIODevice *device, const QVector<const LightUndoCommand*> &commands,
+                      int index, int cleanIndex);
+    bool open(const QString &fileName, const char *function);
+
+    QString fileName() const { return m_file.fileName(); }
+    int count() const { return m_count; }
+    int index() const { return m_index; }
+    int cleanIndex() const { return m_cleanIndex; }
+
+    QString text(int position) const;
+    LightUndoCommand *load(int position) const;
+
+private:
+    Q_DISABLE_COPY(UndoMappedHistory)
+
+    QByteArray record(int position) const;
+
+    QFile m_file; // stays open, since closing it unmaps it
+    const uchar *m_data;
+    qint64 m_size;
+    int m_count;
+    int m_index;
+    int m_cleanIndex;
+};
+
+// Takes the place of a command of a mapped history once the stack accesses it; see
+// UndoCommandList. The text is read from the file when the placeholder is created,
+// and the command itself the first time it is needed, for example when it is
+// undone, after which the stack puts it in the place of this command. Until then,
+// the id is -1 and the command conflicts with all others, so that neither reads it.
+class UndoMappedCommand : public LightUndoCommand
+{
+public:
+    UndoMappedCommand(UndoMappedHistory *history, int position);
+    ~UndoMappedCommand();
+
+    void undo() override;
+    void redo() override;
+    int id() const override;
+    bool mergeWith(const LightUndoCommand *other) override;
+    qint64 cost() const override;
+    QVector<quint64> resources() const override;
+
+    LightUndoCommand *command() const;
+    LightUndoCommand *takeCommand();
+
+private:
+    mutable QExplicitlySharedDataPointer<UndoMappedHistory> m_history;
+    int m_position;
+    mutable LightUndoCommand *m_command;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOMAPPEDHISTORY_P_H
@@ -0,0 +1,190 @@
+#include "undoreclaimer_p.h"
+
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qmetaobject.h>
+#include <QtCore/qrunnable.h>
+#include <QtCore/qthreadpool.h>
+
+#include "lightundocommand.h"
+
+QT_BEGIN_NAMESPACE
+
+// Deletes the pending commands until none are left. Commands committed while it
+// runs are picked up by the same task instead of starting another one.
+class UndoReclaimer::Drain : public QRunnable
+{
+public:
+    explicit Drain(const QSharedPointer<Tracker> &tracker) :
+        m_tracker(tracker)
+    {
+    }
+
+    void run() override
+    {
+        QMutexLocker locker(&m_tracker->mutex);
+        while (!m_tracker->pending.isEmpty()) {
+            QVector<LightUndoCommand*> commands;
+            commands.swap(m_tracker->pending);
+            locker.unlock();
+            qDeleteAll(commands);
+            locker.relock();
+        }
+        m_tracker->draining = false;
+        m_tracker->done.wakeAll();
+    }
+
+private:
+    QSharedPointer<Tracker> m_tracker;
+};
+
+UndoReclaimer::UndoReclaimer(QObject *owner) :
+    m_owner(owner),
+    m_queueHead(0),
+    m_slicePosted(false),
+    m_tracker(new Tracker)
+{
+}
+
+/*
+    Deletes the queued commands that are bound to the owner thread right away
+    and hands the others to the thread pool. The drain task finishes on its
+    own.
+*/
+UndoReclaimer::~UndoReclaimer()
+{
+    for (int i = m_queueHead; i < m_queue.size(); ++i) {
+        LightUndoCommand *command = m_queue.at(i);
+        if (isThreadSafe(command))
+            m_threadSafe.append(command);
+        else
+            delete command;
+    }
+    commit();
+}
+
+/*
+    Returns \c true if \a command and all of its children can be deleted on
+    another thread, that is, none of them is a QObject.
+*/
+bool UndoReclaimer::isThreadSafe(const LightUndoCommand *command)
+{
+    if (command->toUndoCommand() != 0)
+        return false;
+    for (int i = 0; i < command->childCount(); ++i) {
+        if (!isThreadSafe(command->child(i)))
+            return false;
+    }
+    return true;
+}
+
+void UndoReclaimer::discard(LightUndoCommand *command)
+{
+    if (isThreadSafe(command)) {
+        m_threadSafe.append(command);
+    } else {
+        m_queue.append(command);
+        postSlice();
+    }
+}
+
+void UndoReclaimer::discardAll(const QVector<LightUndoCommand*> &commands)
+{
+    if (commands.isEmpty())
+        return;
+    if (m_queue.isEmpty())
+        m_queue = commands;
+    else
+        m_queue += commands;
+    postSlice();
+}
+
+/*
+    Appends the thread-safe commands discarded since the last call to the
+    pending list, and starts the drain task unless it is already queued or
+    running.
+*/
+void UndoReclaimer::commit()
+{
+    if (m_threadSafe.isEmpty())
+        return;
+
+    QMutexLocker locker(&m_tracker->mutex);
+    if (m_tracker->pending.isEmpty())
+        m_tracker->pending.swap(m_threadSafe);
+    else
+        m_tracker->pending += m_threadSafe;
+    m_threadSafe.clear();
+    if (m_tracker->draining)
+        return;
+    m_tracker->draining = true;
+    locker.unlock();
+
+    QThreadPool::globalInstance()->start(new Drain(m_tracker));
+}
+
+void UndoReclaimer::postSlice()
+{
+    if (m_slicePosted)
+        return;
+    m_slicePosted = true;
+    QMetaObject::invokeMethod(m_owner, "_q_reclaimSlice", Qt::QueuedConnection);
+}
+
+/*
+    Works through the queue for at most SliceBudget milliseconds, and posts
+    another slice if any commands are left.
+*/
+void UndoReclaimer::runSlice()
+{
+    m_slicePosted = false;
+
+    QElapsedTimer timer;
+    timer.start();
+    while (m_queueHead < m_queue.size()) {
+        LightUndoCommand *command = m_queue.at(m_queueHead++);
+        if (isThreadSafe(command))
+            m_threadSafe.append(command);
+        else
+            delete command;
+        if (timer.hasExpired(SliceBudget))
+            break;
+    }
+    commit();
+
+    if (m_queueHead == m_queue.size()) {
+        m_queue.clear();
+        m_queueHead = 0;
+    } else {
+        postSlice();
+    }
+}
+
+/*
+    Deletes all queued commands on the calling thread, which must be the
+    owner thread, and blocks until the thread pool has deleted the others.
+*/
+void UndoReclaimer::waitForDone()
+{
+    for (int i = m_queueHead; i < m_queue.size(); ++i)
+        delete m_queue.at(i);
+    m_queue.clear();
+    m_queueHead = 0;
+    commit();
+
+    QMutexLocker locker(&m_tracker->mutex);
+    while (m_tracker->draining)
+        m_tracker->done.wait(&m_tracker->mutex);
+}
+
+/*
+    Returns \c true if no discarded command is waiting to be deleted.
+*/
+bool UndoReclaimer::isIdle() const
+{
+    if (m_queueHead < m_queue.size() || !m_threadSafe.isEmpty())
+        return false;
+    QMutexLocker locker(&m_tracker->mutex);
+    return !m_tracker->draining;
+}
+
+QT_END_NAMESPACE
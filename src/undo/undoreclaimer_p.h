@@ -0,0 +1,81 @@
+#ifndef UNDORECLAIMER_P_H
+#define UNDORECLAIMER_P_H
+
+#include <QtCore/qmutex.h>
+#include <QtCore/qsharedpointer.h>
+#include <QtCore/qvector.h>
+#include <QtCore/qwaitcondition.h>
+
+QT_BEGIN_NAMESPACE
+
+class LightUndoCommand;
+class QObject;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// Destroys the commands that a stack has discarded. Commands that contain no
+// UndoCommand are collected in one pending list, which a single task on the
+// global thread pool drains for as long as it is not empty; the others are
+// deleted on the thread of the owner, in slices of bounded duration run from
+// the event loop. Commands discarded in bulk are sorted into the two groups by
+// these slices as well, so that discarding them costs no more than copying the
+// pointers.
+class UndoReclaimer
+{
+public:
+    enum {
+        SliceBudget = 4 // milliseconds
+    };
+
+    explicit UndoReclaimer(QObject *owner);
+    ~UndoReclaimer();
+
+    void discard(LightUndoCommand *command);
+    void discardAll(const QVector<LightUndoCommand*> &commands);
+    void commit();
+    void runSlice();
+    void waitForDone();
+    bool isIdle() const;
+
+    static bool isThreadSafe(const LightUndoCommand *command);
+
+private:
+    Q_DISABLE_COPY(UndoReclaimer)
+
+    // Shared with the drain task, which may outlive the reclaimer.
+    struct Tracker
+    {
+        Tracker() : draining(false) {}
+
+        QMutex mutex;
+        QWaitCondition done;
+        QVector<LightUndoCommand*> pending; // waiting for the drain task
+        bool draining; // a drain task is queued or running
+    };
+
+    class Drain;
+
+    void postSlice();
+
+    QObject *m_owner;
+    QVector<LightUndoCommand*> m_threadSafe;
+    // Commands for the slices: deleted if they are bound to the owner thread,
+    // moved to m_threadSafe otherwise.
+    QVector<LightUndoCommand*> m_queue;
+    int m_queueHead;
+    bool m_slicePosted;
+    QSharedPointer<Tracker> m_tracker;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDORECLAIMER_P_H
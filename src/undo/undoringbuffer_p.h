@@ -0,0 +1,118 @@
+#ifndef UNDORINGBUFFER_P_H
+#define UNDORINGBUFFER_P_H
+
+#include <QtCore/qvector.h>
+
+QT_BEGIN_NAMESPACE
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// A growable circular buffer. Elements are addressed relative to the first
+// one, so removing elements from the front does not move the others and
+// does not change the meaning of the indexes of the remaining elements
+// other than shifting them down. The capacity is always a power of two.
+template <typename T>
+class UndoRingBuffer
+{
+public:
+    UndoRingBuffer() :
+        m_head(0),
+        m_size(0)
+    {
+    }
+
+    int size() const { return m_size; }
+    int count() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    int capacity() const { return m_data.size(); }
+
+    const T &at(int i) const
+    {
+        Q_ASSERT(i >= 0 && i < m_size);
+        return m_data.at(physicalIndex(i));
+    }
+
+    T &operator[](int i)
+    {
+        Q_ASSERT(i >= 0 && i < m_size);
+        return m_data[physicalIndex(i)];
+    }
+
+    const T &first() const { return at(0); }
+    const T &last() const { return at(m_size - 1); }
+
+    void append(const T &value)
+    {
+        if (m_size == m_data.size())
+            grow();
+        m_data[physicalIndex(m_size)] = value;
+        ++m_size;
+    }
+
+    T takeLast()
+    {
+        Q_ASSERT(m_size > 0);
+        --m_size;
+        return m_data.at(physicalIndex(m_size));
+    }
+
+    // Removes the first n elements in constant time.
+    void removeFirst(int n)
+    {
+        Q_ASSERT(n >= 0 && n <= m_size);
+        m_size -= n;
+        m_head = m_size == 0 ? 0 : physicalIndex(n);
+    }
+
+    // Makes room for at least n elements without further reallocation.
+    void reserve(int n)
+    {
+        if (n <= m_data.size())
+            return;
+        int capacity = qMax(16, m_data.size());
+        while (capacity < n)
+            capacity *= 2;
+        reallocate(capacity);
+    }
+
+    void clear()
+    {
+        m_data.clear();
+        m_head = 0;
+        m_size = 0;
+    }
+
+private:
+    int physicalIndex(int i) const { return (m_head + i) & (m_data.size() - 1); }
+
+    void grow()
+    {
+        reallocate(qMax(16, m_data.size() * 2));
+    }
+
+    void reallocate(int capacity)
+    {
+        QVector<T> data(capacity);
+        for (int i = 0; i < m_size; ++i)
+            data[i] = at(i);
+        m_data.swap(data);
+        m_head = 0;
+    }
+
+    QVector<T> m_data;
+    int m_head;
+    int m_size;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDORINGBUFFER_P_H
@@ -0,0 +1,137 @@
+#include "undoserializer_p.h"
+
+#include <QtCore/qdatastream.h>
+#include <QtCore/qreadwritelock.h>
+
+#include "undocommand_p.h"
+
+QT_BEGIN_NAMESPACE
+
+namespace {
+
+struct UndoCommandTypes
+{
+    QReadWriteLock lock;
+    QHash<int, LightUndoCommand::LoadFunction> loadFunctions;
+};
+
+}
+
+Q_GLOBAL_STATIC(UndoCommandTypes, commandTypes)
+
+UndoCommandSerializer::UndoCommandSerializer(bool textTable) :
+    m_textTable(textTable)
+{
+    UndoCommandTypes *types = commandTypes();
+    QReadLocker locker(&types->lock);
+    m_loadFunctions = types->loadFunctions;
+    locker.unlock();
+    m_loadFunctions.insert(UndoMacroCommand::TypeId, UndoMacroCommand::load);
+}
+
+void UndoCommandSerializer::registerType(int typeId, LightUndoCommand::LoadFunction load)
+{
+    UndoCommandTypes *types = commandTypes();
+    QWriteLocker locker(&types->lock);
+    types->loadFunctions.insert(typeId, load);
+}
+
+/*
+    Returns \c true if \a command and all of its children have a type for which a
+    load function is registered. Macros created by UndoStack::beginMacro() have a
+    built-in type.
+*/
+bool UndoCommandSerializer::canSave(const LightUndoCommand *command) const
+{
+    if (!m_loadFunctions.contains(command->typeId()))
+        return false;
+    for (const LightUndoCommand *child : command->m_childCommands) {
+        if (!canSave(child))
+            return false;
+    }
+    return true;
+}
+
+void UndoCommandSerializer::save(QDataStream &stream, const LightUndoCommand *command)
+{
+    stream << qint32(command->typeId());
+    if (m_textTable) {
+        const quint32 textIndex = m_textIndexes.value(command->m_text, quint32(m_texts.size()));
+        if (textIndex == quint32(m_texts.size())) {
+            m_textIndexes.insert(command->m_text, textIndex);
+            m_texts.append(command->m_text);
+        }
+        stream << textIndex;
+    } else {
+        stream << command->m_text;
+    }
+
+    // Written in place and then patched, so that the state is not copied.
+    QIODevice *device = stream.device();
+    const qint64 lengthPos = device->pos();
+    stream << quint32(0);
+    command->save(stream);
+    const qint64 end = device->pos();
+    device->seek(lengthPos);
+    stream << quint32(end - lengthPos - sizeof(quint32));
+    device->seek(end);
+
+    stream << quint32(command->m_childCommands.size());
+    for (const LightUndoCommand *child : command->m_childCommands)
+        save(stream, child);
+}
+
+/*
+    Returns the command read from \a stream, or 0 if it cannot be read, in which case
+    the position of the stream is undefined.
+*/
+LightUndoCommand *UndoCommandSerializer::load(QDataStream &stream)
+{
+    qint32 typeId;
+    QString text;
+    quint32 stateLength;
+    stream >> typeId;
+    if (m_textTable) {
+        quint32 textIndex;
+        stream >> textIndex;
+        if (textIndex >= quint32(m_texts.size()))
+            return 0;
+        text = m_texts.at(textIndex);
+    } else {
+        stream >> text;
+    }
+    stream >> stateLength;
+    if (stream.status() != QDataStream::Ok)
+        return 0;
+
+    const LightUndoCommand::LoadFunction loadState = m_loadFunctions.value(typeId);
+    if (loadState == 0)
+        return 0;
+
+    QIODevice *device = stream.device();
+    const qint64 end = device->pos() + stateLength;
+    LightUndoCommand *command = loadState(stream);
+    if (command == 0)
+        return 0;
+    command->m_text = text;
+    if (device->pos() != end && !device->seek(end))
+        stream.setStatus(QDataStream::ReadPastEnd);
+
+    quint32 childCount;
+    stream >> childCount;
+    if (stream.status() != QDataStream::Ok) {
+        delete command;
+        return 0;
+    }
+    for (quint32 i = 0; i < childCount; ++i) {
+        LightUndoCommand *child = load(stream);
+        if (child == 0) {
+            delete command;
+            return 0;
+        }
+        command->m_childCommands.append(child);
+    }
+    return command;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,57 @@
+#ifndef UNDOSERIALIZER_P_H
+#define UNDOSERIALIZER_P_H
+
+#include <QtCore/qhash.h>
+#include <QtCore/qvector.h>
+
+#include "lightundocommand.h"
+
+QT_BEGIN_NAMESPACE
+
+class QDataStream;
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the Qt API.  It exists for the convenience
+// of qapplication_*.cpp, qwidget*.cpp and qfiledialog.cpp.  This header
+// file may change from version to version without notice, or even be removed.
+//
+// We mean it.
+//
+
+// Writes commands, including their text and children, to a QDataStream and reads
+// them back with the functions registered by LightUndoCommand::registerType().
+// The state written by LightUndoCommand::save() is prefixed with its length, so a
+// command that reads too little or too much does not corrupt the ones after it;
+// the device of the stream must therefore be random-access.
+//
+// A serializer takes a snapshot of the registered types when it is constructed, so
+// reading many commands does not lock the registry for each of them. With a text
+// table, each distinct text is stored once in texts() and commands refer to it by
+// index; the table is written and read by the owner of the serializer.
+class UndoCommandSerializer
+{
+public:
+    explicit UndoCommandSerializer(bool textTable = false);
+
+    static void registerType(int typeId, LightUndoCommand::LoadFunction load);
+
+    bool canSave(const LightUndoCommand *command) const;
+    void save(QDataStream &stream, const LightUndoCommand *command);
+    LightUndoCommand *load(QDataStream &stream);
+
+    const QVector<QString> &texts() const { return m_texts; }
+    void setTexts(const QVector<QString> &texts) { m_texts = texts; }
+
+private:
+    QHash<int, LightUndoCommand::LoadFunction> m_loadFunctions;
+    bool m_textTable;
+    QVector<QString> m_texts;
+    QHash<QString, quint32> m_textIndexes;
+};
+
+QT_END_NAMESPACE
+
+#endif // UNDOSERIALIZER_P_H
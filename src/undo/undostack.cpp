@@ -1,14 +1,203 @@
 #include "undostack.h"
 
 #include <QtCore/private/qobject_p.h>
-
+#include <QtCore/qatomic.h>
+#include <QtCore/qcoreevent.h>
+#include <QtCore/qdatastream.h>
+#include <QtCore/qelapsedtimer.h>
+#include <QtCore/qfile.h>
+#include <QtCore/qmetaobject.h>
+#include <QtCore/qsavefile.h>
+
+#include <algorithm>
+
+#include "lightundocommand.h"
+#include "undoblobstore.h"
+#include "undocheckpointhandler.h"
 #include "undocommand.h"
 #include "undocommand_p.h"
+#include "undocommandpool.h"
+#include "undocompression_p.h"
+#include "undocompressioncodec.h"
 #include "undogroup.h"
+#include "undogroup_p.h"
+#include "undohibernation_p.h"
+#include "undojournal_p.h"
+#include "undomappedhistory_p.h"
+#include "undoreclaimer_p.h"
+#include "undoserializer_p.h"
 #include "undostack_p.h"
 
 QT_BEGIN_NAMESPACE
 
+UndoInverseCommand::UndoInverseCommand(LightUndoCommand *target, qint64 targetCost) :
+    LightUndoCommand(UndoStack::tr("Revert %1").arg(target->text())),
+    m_target(target),
+    m_targetCost(targetCost),
+    m_adopted(false)
+{
+}
+
+void UndoInverseCommand::undo()
+{
+    m_target->redo();
+}
+
+void UndoInverseCommand::redo()
+{
+    m_target->undo();
+}
+
+QVector<quint64> UndoInverseCommand::resources() const
+{
+    return m_target->resources();
+}
+
+UndoCommandList::UndoCommandList() :
+    m_mappedFirst(0),
+    m_mappedCount(0),
+    m_mappedSequence(0),
+    m_pool(0),
+    m_placeholders(0)
+{
+}
+
+UndoCommandList::~UndoCommandList()
+{
+}
+
+const UndoStackEntry &UndoCommandList::at(int i) const
+{
+    Q_ASSERT(i >= 0 && i < size());
+    return i < m_mappedCount ? materialize(i) : m_entries.at(i - m_mappedCount);
+}
+
+UndoStackEntry &UndoCommandList::operator[](int i)
+{
+    Q_ASSERT(i >= 0 && i < size());
+    return i < m_mappedCount ? materialize(i) : m_entries[i - m_mappedCount];
+}
+
+/*
+    Returns \c true if the command at \a i has an entry, which is the case unless it
+    is a mapped command that has not been accessed.
+*/
+bool UndoCommandList::isMaterialized(int i) const
+{
+    return i >= m_mappedCount || m_mapped.contains(m_mappedFirst + i);
+}
+
+/*
+    Returns the cost of the entry at \a i, or 0 for a mapped command without one.
+*/
+qint64 UndoCommandList::costAt(int i) const
+{
+    if (i >= m_mappedCount)
+        return m_entries.at(i - m_mappedCount).cost;
+    const QMap<int, UndoStackEntry>::const_iterator it = m_mapped.constFind(m_mappedFirst + i);
+    return it != m_mapped.constEnd() ? it->cost : 0;
+}
+
+quint64 UndoCommandList::sequenceAt(int i) const
+{
+    if (i >= m_mappedCount)
+        return m_entries.at(i - m_mappedCount).sequence;
+    const QMap<int, UndoStackEntry>::const_iterator it = m_mapped.constFind(m_mappedFirst + i);
+    return it != m_mapped.constEnd() ? it->sequence : m_mappedSequence + quint64(m_mappedFirst + i);
+}
+
+/*
+    Returns the text of the command at \a i, reading it from the mapped history for
+    a mapped command without an entry.
+*/
+QString UndoCommandList::textAt(int i) const
+{
+    if (i >= m_mappedCount)
+        return m_entries.at(i - m_mappedCount).command->text();
+    const QMap<int, UndoStackEntry>::const_iterator it = m_mapped.constFind(m_mappedFirst + i);
+    return it != m_mapped.constEnd() ? it->command->text() : m_history->text(m_mappedFirst + i);
+}
+
+/*
+    Makes the commands of \a history the commands of the list, which must be empty.
+    They get the sequence numbers from \a firstSequence on, and the UndoMappedCommand
+    objects created for them are added to \a placeholders.
+*/
+void UndoCommandList::map(UndoMappedHistory *history, quint64 firstSequence,
+                          QSet<LightUndoCommand*> *placeholders)
+{
+    Q_ASSERT(isEmpty());
+    m_mappedFirst = 0;
+    m_mappedCount = history->count();
+    m_mappedSequence = firstSequence;
+    m_placeholders = placeholders;
+    if (m_mappedCount > 0)
+        m_history = QExplicitlySharedDataPointer<UndoMappedHistory>(history);
+}
+
+UndoStackEntry UndoCommandList::takeLast()
+{
+    if (!m_entries.isEmpty())
+        return m_entries.takeLast();
+
+    Q_ASSERT(m_mappedCount > 0);
+    const int position = m_mappedFirst + --m_mappedCount;
+    UndoStackEntry entry = { 0, 0, m_mappedSequence + quint64(position) };
+    const QMap<int, UndoStackEntry>::iterator it = m_mapped.find(position);
+    if (it != m_mapped.end()) {
+        entry = *it;
+        m_mapped.erase(it);
+    }
+    if (m_mappedCount == 0)
+        m_history.reset();
+    return entry;
+}
+
+/*
+    Removes the first \a n entries. The mapped commands among them take constant
+    time, apart from the entries that were created for them.
+*/
+void UndoCommandList::removeFirst(int n)
+{
+    Q_ASSERT(n >= 0 && n <= size());
+    const int mapped = qMin(n, m_mappedCount);
+    if (mapped > 0) {
+        m_mappedFirst += mapped;
+        m_mappedCount -= mapped;
+        while (!m_mapped.isEmpty() && m_mapped.firstKey() < m_mappedFirst)
+            m_mapped.erase(m_mapped.begin());
+        if (m_mappedCount == 0)
+            m_history.reset();
+    }
+    m_entries.removeFirst(n - mapped);
+}
+
+void UndoCommandList::clear()
+{
+    m_history.reset();
+    m_mappedFirst = 0;
+    m_mappedCount = 0;
+    m_mapped.clear();
+    m_entries.clear();
+}
+
+/*
+    Returns the entry of the mapped command at \a i, creating it, with an
+    UndoMappedCommand in the place of the command, when the command is first accessed.
+*/
+UndoStackEntry &UndoCommandList::materialize(int i) const
+{
+    const int position = m_mappedFirst + i;
+    QMap<int, UndoStackEntry>::iterator it = m_mapped.find(position);
+    if (it == m_mapped.end()) {
+        UndoMappedCommand *placeholder = new (m_pool) UndoMappedCommand(m_history.data(), position);
+        m_placeholders->insert(placeholder);
+        const UndoStackEntry entry = { placeholder, 0, m_mappedSequence + quint64(position) };
+        it = m_mapped.insert(position, entry);
+    }
+    return *it;
+}
+
 /*!
     \class UndoStack
     \brief The UndoStack class is a stack of UndoCommand objects.
@@ -16,585 +205,3899 @@ QT_BEGIN_NAMESPACE
 
     TODO
 
-    \sa UndoCommand
+    Both UndoCommand and the lighter, QObject-free LightUndoCommand can be
+    pushed on the same stack.
+
+    \sa UndoCommand, LightUndoCommand
+*/
+
+/*! \internal
+    Returns a new sequence number for a command that is pushed, merged or completed as a
+    macro, or the first of \a count consecutive ones. Sequence numbers grow across all
+    stacks of the application, so they order the commands of different stacks; 0 is
+    never returned.
 */
 
+quint64 UndoStackPrivate::nextSequence(int count)
+{
+    static QAtomicInteger<quint64> counter;
+    return counter.fetchAndAddRelaxed(count) + 1;
+}
+
 /*! \internal
     Sets the current index to \a idx, emitting appropriate signals. If \a clean is true,
     makes \a idx the clean index as well.
 */
 
-void UndoStackPrivate::setIndex(int idx, bool clean)
+void UndoStackPrivate::setIndex(int idx, bool clean)
+{
+    const bool changed = idx != index;
+    index = idx;
+    if (clean)
+        cleanIndex = index;
+
+    if (changed || clean)
+        notify(changed);
+}
+
+/*! \internal
+    If the number of commands on the stack exceedes the undo limit, or their total cost
+    exceeds the memory limit, deletes commands from the bottom of the stack.
+
+    Returns \c true if commands were deleted.
+*/
+
+bool UndoStackPrivate::checkUndoLimit()
+{
+    if (!macroStack.isEmpty())
+        return false;
+
+    // Commands at or above the index are still needed to redo, so they are never
+    // evicted from the bottom. A checkpoint of the state below an evicted command
+    // can no longer be reached and goes with it.
+    int deletedCount = 0;
+    qint64 usage = memoryUsage;
+    if (undoLimit > 0 && undoLimit < commandList.count()) {
+        deletedCount = qMin(commandList.count() - undoLimit, index);
+        for (int i = 0; i < deletedCount; ++i)
+            usage -= commandList.costAt(i) + checkpointCostAt(i);
+    }
+
+    // The memory limit never evicts the top-most command either, so the command
+    // that was just pushed always survives.
+    if (memoryLimit > 0) {
+        const int evictable = qMin(index, commandList.count() - 1);
+        while (usage > memoryLimit && deletedCount < evictable) {
+            usage -= commandList.costAt(deletedCount) + checkpointCostAt(deletedCount);
+            ++deletedCount;
+        }
+    }
+
+    if (deletedCount == 0)
+        return false;
+
+    evictBottom(deletedCount, memoryUsage - usage);
+    return true;
+}
+
+/*! \internal
+    Deletes the \a count commands at the bottom of the stack, which must all be below
+    the index, together with their checkpoints, which cost \a bytes in total.
+*/
+
+void UndoStackPrivate::evictBottom(int count, qint64 bytes)
+{
+    for (int i = 0; i < count; ++i) {
+        if (commandList.isMaterialized(i))
+            reclaim(commandList.at(i).command);
+    }
+    commitReclamation();
+    commandList.removeFirst(count);
+    dropCheckpoints(0, count);
+    baseIndex += count;
+    evictedBytes += bytes;
+    memoryUsage -= bytes;
+
+    index -= count;
+    if (cleanIndex != -1) {
+        if (cleanIndex < count)
+            cleanIndex = -1; // we've deleted the clean command
+        else
+            cleanIndex -= count;
+    }
+    dropOrphanedBranches();
+
+    // Rebuild the resource index once most of it refers to evicted commands.
+    if (resourceIndexEnd >= 0 && baseIndex - resourceIndexBase > resourceIndexEnd - baseIndex)
+        invalidateResourceIndex();
+}
+
+/*! \internal
+    Deletes commands from the bottom of the stack until their cost, including their
+    checkpoints, adds up to at least \a bytes or no command below the index is left,
+    emitting appropriate signals. Used by UndoGroup to enforce its memory limit.
+
+    Returns the number of commands that were deleted.
+*/
+
+int UndoStackPrivate::evictOldest(qint64 bytes)
+{
+    if (!macroStack.isEmpty())
+        return 0;
+
+    int count = 0;
+    qint64 freed = 0;
+    while (freed < bytes && count < index) {
+        freed += commandList.costAt(count) + checkpointCostAt(count);
+        ++count;
+    }
+    if (count == 0)
+        return 0;
+
+    cancelSeek();
+    evictBottom(count, freed);
+    notify(true);
+    return count;
+}
+
+/*! \internal
+    Enforces the undo limit and the memory limit after one of them was lowered on a
+    non-empty stack, emitting appropriate signals.
+*/
+
+void UndoStackPrivate::applyLimits()
+{
+    if (!macroStack.isEmpty())
+        return;
+
+    cancelSeek();
+
+    bool changed = checkUndoLimit();
+
+    // Only commands below the index can be evicted from the bottom. The limit bounds
+    // the number of commands the stack holds, undone ones included, so if there are
+    // still too many, the undone commands furthest from the index are dropped from
+    // the top.
+    if (undoLimit > 0 && commandList.count() > undoLimit) {
+        const int count = commandList.count();
+        unindexFrom(undoLimit);
+        while (commandList.count() > undoLimit) {
+            const Entry entry = commandList.takeLast();
+            memoryUsage -= entry.cost;
+            evictedBytes += entry.cost;
+            if (entry.command != 0)
+                reclaim(entry.command);
+        }
+        commitReclamation();
+        evictedBytes += dropCheckpoints(undoLimit + 1, count + 1);
+        if (cleanIndex > commandList.count())
+            cleanIndex = -1; // we've deleted the clean state
+        dropOrphanedBranches();
+        changed = true;
+    }
+    checkBranchLimit();
+
+    notify(changed);
+}
+
+/*! \internal
+    Deletes the commands above the current index, which can no longer be redone. In
+    branching mode, they are kept as a new branch instead.
+*/
+
+void UndoStackPrivate::truncate()
+{
+    if (index == commandList.size())
+        return;
+
+    unindexFrom(index);
+
+    if (branching) {
+        detachBranch(index);
+        checkBranchLimit();
+        return;
+    }
+
+    dropCheckpoints(index + 1, commandList.size() + 1);
+    while (index < commandList.size()) {
+        const Entry entry = commandList.takeLast();
+        memoryUsage -= entry.cost;
+        if (entry.command != 0)
+            reclaim(entry.command);
+    }
+    commitReclamation();
+    if (cleanIndex > index)
+        cleanIndex = -1; // we've deleted the clean state
+}
+
+/*! \internal
+    Queries the cost of the command at \a idx again, after it changed by merging or
+    by completing a macro, and updates the memory usage of the stack. If \a renumber is
+    true, the command also gets a new sequence number, since it now stands for the
+    latest change.
+*/
+
+void UndoStackPrivate::updateCost(int idx, bool renumber)
+{
+    Entry &entry = commandList[idx];
+    const qint64 cost = entry.command->cost();
+    memoryUsage += cost - entry.cost;
+    entry.cost = cost;
+    if (renumber)
+        entry.sequence = nextSequence();
+
+    // Merging may have added resources.
+    const qint64 position = baseIndex + idx;
+    if (position < resourceIndexEnd) {
+        const QVector<quint64> keys = entry.command->resources();
+        for (quint64 key : keys) {
+            QVector<qint64> &positions = resourceIndex[key];
+            if (positions.isEmpty() || positions.constLast() != position)
+                positions.append(position);
+        }
+    }
+}
+
+/*! \internal
+    Counts the cost of the target that \a inverse adopted, which the stack no longer
+    counts, towards the stack or the branch that holds \a inverse. Does nothing if
+    \a inverse is being removed itself.
+*/
+
+void UndoStackPrivate::updateInverseCost(UndoInverseCommand *inverse)
+{
+    // The inverse is above its target, so search from the top. It is never one of the
+    // commands of a mapped history.
+    for (int i = commandList.size() - 1; i >= commandList.mappedCount(); --i) {
+        if (commandList.at(i).command == inverse) {
+            updateCost(i, false);
+            return;
+        }
+    }
+    for (QMap<int, UndoStackBranch>::iterator it = branches.begin(); it != branches.end(); ++it) {
+        for (int i = it->commands.size() - 1; i >= 0; --i) {
+            Entry &entry = it->commands[i];
+            if (entry.command == inverse) {
+                const qint64 delta = inverse->cost() - entry.cost;
+                entry.cost += delta;
+                it->cost += delta;
+                branchMemoryUsage += delta;
+                return;
+            }
+        }
+    }
+}
+
+/*! \internal
+    Counts the command with the given \a cost that was just pushed, and saves a
+    checkpoint of the state at \a idx, after the command, if a checkpoint interval
+    has been reached.
+*/
+
+void UndoStackPrivate::maybeSaveCheckpoint(int idx, qint64 cost)
+{
+    if (checkpointHandler == 0)
+        return;
+
+    ++commandsSinceCheckpoint;
+    costSinceCheckpoint += cost;
+    if (!(checkpointInterval > 0 && commandsSinceCheckpoint >= checkpointInterval)
+            && !(checkpointCostInterval > 0 && costSinceCheckpoint >= checkpointCostInterval)) {
+        return;
+    }
+    commandsSinceCheckpoint = 0;
+    costSinceCheckpoint = 0;
+
+    UndoStackCheckpoint checkpoint;
+    checkpoint.snapshot = checkpointHandler->saveCheckpoint();
+    checkpoint.cost = checkpointHandler->checkpointCost(checkpoint.snapshot);
+    dropCheckpoints(idx, idx + 1);
+    checkpoints.insert(baseIndex + idx, checkpoint);
+    checkpointMemoryUsage += checkpoint.cost;
+    memoryUsage += checkpoint.cost;
+}
+
+/*! \internal
+    Returns the cost of the checkpoint of the state at \a idx, or 0 if there is none.
+*/
+
+qint64 UndoStackPrivate::checkpointCostAt(int idx) const
+{
+    if (checkpoints.isEmpty())
+        return 0;
+    QMap<qint64, UndoStackCheckpoint>::const_iterator it = checkpoints.constFind(baseIndex + idx);
+    return it == checkpoints.constEnd() ? 0 : it->cost;
+}
+
+/*! \internal
+    Deletes the checkpoints of the states from \a from up to, but not including, \a to,
+    and returns the number of bytes that were freed.
+*/
+
+qint64 UndoStackPrivate::dropCheckpoints(int from, int to)
+{
+    qint64 freed = 0;
+    QMap<qint64, UndoStackCheckpoint>::iterator it = checkpoints.lowerBound(baseIndex + from);
+    while (it != checkpoints.end() && it.key() < baseIndex + to) {
+        freed += it->cost;
+        it = checkpoints.erase(it);
+    }
+    checkpointMemoryUsage -= freed;
+    memoryUsage -= freed;
+    return freed;
+}
+
+/*! \internal
+    If restoring the nearest checkpoint at or below \a idx and redoing the commands
+    after it is faster than walking from the current index, restores that checkpoint.
+    Returns the index from which the commands must be undone or redone to reach \a idx.
+*/
+
+int UndoStackPrivate::restoreNearestCheckpoint(int idx)
+{
+    if (checkpointHandler == 0 || checkpoints.isEmpty())
+        return index;
+
+    QMap<qint64, UndoStackCheckpoint>::const_iterator it = checkpoints.upperBound(baseIndex + idx);
+    if (it == checkpoints.constBegin())
+        return index;
+    --it;
+
+    const int position = int(it.key() - baseIndex);
+    if (idx - position >= qAbs(idx - index))
+        return index;
+
+    checkpointHandler->restoreCheckpoint(it->snapshot);
+    return position;
+}
+
+/*! \internal
+    Moves the commands at and above \a from, which must not be below the index, from
+    the stack to a new branch that forks at \a from, and returns the id of the branch.
+    Branches that fork from the moved commands are re-parented to the new branch.
+*/
+
+int UndoStackPrivate::detachBranch(int from)
+{
+    Q_ASSERT(from >= index && from < commandList.size());
+    unindexFrom(from);
+
+    const int id = nextBranchId++;
+    UndoStackBranch &branch = branches[id];
+    branch.parent = 0;
+    branch.forkPoint = baseIndex + from;
+    branch.cost = 0;
+    branch.cleanIndex = cleanIndex > from ? baseIndex + cleanIndex : -1;
+    branch.lastUsed = ++branchUseCounter;
+
+    branch.commands.reserve(commandList.size() - from);
+    for (int i = from; i < commandList.size(); ++i) {
+        const Entry &entry = commandList.at(i);
+        branch.commands.append(entry);
+        branch.cost += entry.cost;
+    }
+    dropCheckpoints(from + 1, commandList.size() + 1);
+    while (commandList.size() > from)
+        commandList.takeLast();
+    memoryUsage -= branch.cost;
+    branchMemoryUsage += branch.cost;
+    if (cleanIndex > from)
+        cleanIndex = -1; // the clean state moved to the branch
+
+    // Only the branches that fork from the stack can fork from the moved commands.
+    QVector<int> moved;
+    for (int child : branchChildren.value(0)) {
+        if (branches.constFind(child)->forkPoint > branch.forkPoint)
+            moved.append(child);
+    }
+    if (!moved.isEmpty()) {
+        QSet<int> &roots = branchChildren[0];
+        QSet<int> children;
+        for (int child : qAsConst(moved)) {
+            roots.remove(child);
+            children.insert(child);
+            branches[child].parent = id;
+        }
+        branchChildren.insert(id, children);
+    }
+    branchChildren[0].insert(id);
+
+    return id;
+}
+
+/*! \internal
+    Deletes the branch \a id, its commands, and all branches that fork from it.
+*/
+
+void UndoStackPrivate::deleteBranch(int id)
+{
+    // The children no longer find their parent in branchChildren, so they do not
+    // update it.
+    const QSet<int> children = branchChildren.take(id);
+    for (int child : children)
+        deleteBranch(child);
+
+    const UndoStackBranch branch = branches.take(id);
+    QHash<int, QSet<int> >::iterator siblings = branchChildren.find(branch.parent);
+    if (siblings != branchChildren.end()) {
+        siblings->remove(id);
+        if (siblings->isEmpty())
+            branchChildren.erase(siblings);
+    }
+    for (const Entry &entry : branch.commands)
+        reclaim(entry.command);
+    commitReclamation();
+    branchMemoryUsage -= branch.cost;
+}
+
+/*! \internal
+    Deletes the branches that fork from states of the stack that no longer exist.
+*/
+
+void UndoStackPrivate::dropOrphanedBranches()
+{
+    QVector<int> orphans;
+    for (int id : branchChildren.value(0)) {
+        const qint64 forkPoint = branches.constFind(id)->forkPoint;
+        if (forkPoint < baseIndex || forkPoint > baseIndex + commandList.size())
+            orphans.append(id);
+    }
+    for (int id : qAsConst(orphans))
+        deleteBranch(id);
+}
+
+/*! \internal
+    Deletes the least recently used branches while the branches cost more than
+    branchMemoryLimit.
+*/
+
+void UndoStackPrivate::checkBranchLimit()
+{
+    if (branchMemoryLimit <= 0)
+        return;
+
+    while (branchMemoryUsage > branchMemoryLimit && !branches.isEmpty()) {
+        QMap<int, UndoStackBranch>::const_iterator oldest = branches.constBegin();
+        for (QMap<int, UndoStackBranch>::const_iterator it = oldest; it != branches.constEnd(); ++it) {
+            if (it->lastUsed < oldest->lastUsed)
+                oldest = it;
+        }
+        deleteBranch(oldest.key());
+    }
+}
+
+/*! \internal
+    Makes the branch \a id, which must fork from the stack, part of the stack, and
+    moves the index to \a idx. The commands above the fork point become a new branch.
+
+    Returns \c false and changes nothing if a hibernated command that has to be undone
+    or redone to reach the fork point cannot be read back. The index stops short of
+    \a idx at a hibernated command of the branch that cannot be read back.
+*/
+
+bool UndoStackPrivate::switchBranch(int id, int idx)
+{
+    const int fork = int(branches.value(id).forkPoint - baseIndex);
+
+    // Read back the hibernated commands between the index and the common ancestor
+    // first, so that the stack either gets there or does not switch at all.
+    for (int i = qMin(index, fork); i < qMax(index, fork); ++i) {
+        if (!makeResident(i))
+            return false;
+    }
+
+    const UndoStackBranch branch = branches.take(id);
+    branchChildren[0].remove(id);
+
+    // Go back to the common ancestor.
+    while (index > fork)
+        commandList.at(--index).command->undo();
+    while (index < fork)
+        commandList.at(index++).command->redo();
+
+    if (fork < commandList.size())
+        detachBranch(fork);
+    const QSet<int> children = branchChildren.take(id);
+    for (int child : children) {
+        branches[child].parent = 0;
+        branchChildren[0].insert(child);
+    }
+
+    commandList.reserve(commandList.size() + branch.commands.size());
+    for (const Entry &entry : branch.commands)
+        commandList.append(entry);
+    memoryUsage += branch.cost;
+    branchMemoryUsage -= branch.cost;
+    // The commands of the branch may not have been compressed yet.
+    compressionMark = qMin(compressionMark, branch.forkPoint);
+    if (branch.cleanIndex != -1)
+        cleanIndex = int(branch.cleanIndex - baseIndex);
+
+    if (idx < 0 || idx > commandList.size())
+        idx = commandList.size();
+    while (index < idx && makeResident(index))
+        commandList.at(index++).command->redo();
+    while (index > idx && makeResident(index - 1))
+        commandList.at(--index).command->undo();
+    return true;
+}
+
+/*! \internal
+    Opens \a command as a macro, nested in the current macro if there is one.
+*/
+
+void UndoStackPrivate::openMacro(UndoCommand *command)
+{
+    if (macroStack.isEmpty()) {
+        truncate();
+        const Entry entry = { command, 0, nextSequence() };
+        commandList.append(entry);
+    } else {
+        macroStack.constLast()->m_childCommands.append(command);
+    }
+    macroStack.append(command);
+
+    if (macroStack.count() == 1)
+        notify(false);
+}
+
+/*! \internal
+    Makes the stack take part in the transaction of its group, if one is open, before
+    the stack is changed.
+*/
+
+void UndoStackPrivate::joinGroupTransaction()
+{
+    Q_Q(UndoStack);
+    if (group != 0)
+        UndoGroupPrivate::get(group)->joinTransaction(q);
+}
+
+/*! \internal
+    Undoes or redoes the macros of \a transaction on all stacks that take part in it,
+    each of which emits its signals once. Returns \c false and changes nothing if the
+    macro of one of the stacks is not the next command to undo or redo on that stack.
+*/
+
+bool UndoStackPrivate::replayTransaction(UndoTransaction *transaction, bool undo)
+{
+    typedef QHash<UndoStack*, LightUndoCommand*>::const_iterator Iterator;
+    const Iterator end = transaction->participants.constEnd();
+
+    for (Iterator it = transaction->participants.constBegin(); it != end; ++it) {
+        const UndoStackPrivate *d = get(it.key());
+        const int idx = undo ? d->index - 1 : d->index;
+        if (!d->macroStack.isEmpty() || idx < 0 || idx >= d->commandList.size()
+                || d->commandList.at(idx).command != it.value()) {
+            qWarning("UndoStack::%s(): transaction \"%s\" cannot be %s because another stack"
+                     " has changed since", undo ? "undo" : "redo",
+                     qPrintable(transaction->text), undo ? "undone" : "redone");
+            return false;
+        }
+    }
+
+    // Keep the participants alive in case a slot connected to one of them removes
+    // commands from another.
+    const QHash<UndoStack*, LightUndoCommand*> participants = transaction->participants;
+    transaction->replaying = true;
+    for (Iterator it = participants.constBegin(); it != participants.constEnd(); ++it)
+        it.key()->beginUpdate();
+    for (Iterator it = participants.constBegin(); it != participants.constEnd(); ++it) {
+        if (undo)
+            it.key()->undo();
+        else
+            it.key()->redo();
+    }
+    transaction->replaying = false;
+    for (Iterator it = participants.constBegin(); it != participants.constEnd(); ++it)
+        it.key()->endUpdate();
+    return true;
+}
+
+/*! \internal
+    Returns the resources of the command at \a idx. A command of a mapped history
+    that has not been read conflicts with all others, so that finding conflicts does
+    not read the history.
+*/
+
+QVector<quint64> UndoStackPrivate::resourcesAt(int idx) const
+{
+    if (!commandList.isMaterialized(idx))
+        return QVector<quint64>() << LightUndoCommand::AllResources;
+    return commandList.at(idx).command->resources();
+}
+
+/*! \internal
+    Adds the commands that were pushed since the last call to the resource index, or
+    builds the index if it does not exist. An open macro is added when it ends.
+*/
+
+void UndoStackPrivate::updateResourceIndex() const
+{
+    if (resourceIndexEnd < 0) {
+        resourceIndex.clear();
+        resourceIndexBase = baseIndex;
+        resourceIndexEnd = baseIndex;
+    }
+
+    const int end = commandList.size() - (macroStack.isEmpty() ? 0 : 1);
+    for (int i = int(resourceIndexEnd - baseIndex); i < end; ++i) {
+        const QVector<quint64> keys = resourcesAt(i);
+        for (quint64 key : keys)
+            resourceIndex[key].append(baseIndex + i);
+    }
+    resourceIndexEnd = qMax(resourceIndexEnd, baseIndex + end);
+}
+
+/*! \internal
+    Discards the resource index; it is rebuilt on the next use.
+*/
+
+void UndoStackPrivate::invalidateResourceIndex()
+{
+    resourceIndex.clear();
+    resourceIndexEnd = -1;
+}
+
+/*! \internal
+    Removes the commands at and above \a from from the resource index, before they
+    are removed from the stack.
+*/
+
+void UndoStackPrivate::unindexFrom(int from)
+{
+    const qint64 cut = baseIndex + from;
+    if (cut >= resourceIndexEnd)
+        return;
+
+    for (int i = from; i < resourceIndexEnd - baseIndex; ++i) {
+        // A mapped command that was indexed before it was read is indexed under
+        // AllResources, whatever its resources turned out to be.
+        QVector<quint64> keys = resourcesAt(i);
+        if (i < commandList.mappedCount())
+            keys.append(LightUndoCommand::AllResources);
+        for (quint64 key : keys) {
+            QHash<quint64, QVector<qint64> >::iterator it = resourceIndex.find(key);
+            if (it == resourceIndex.end())
+                continue;
+            while (!it->isEmpty() && it->constLast() >= cut)
+                it->removeLast();
+        }
+    }
+    resourceIndexEnd = cut;
+}
+
+/*! \internal
+    Returns \c true if a command between \a idx and the current index uses one of the
+    resources of the command at \a idx. Takes logarithmic time per resource.
+*/
+
+bool UndoStackPrivate::hasLaterConflict(int idx) const
+{
+    const qint64 position = baseIndex + idx;
+    const qint64 end = baseIndex + index;
+    if (position + 1 >= end)
+        return false;
+
+    QVector<quint64> keys = resourcesAt(idx);
+    if (keys.contains(LightUndoCommand::AllResources))
+        return true;
+    keys.append(LightUndoCommand::AllResources); // commands without resources
+
+    updateResourceIndex();
+    for (quint64 key : qAsConst(keys)) {
+        QHash<quint64, QVector<qint64> >::const_iterator it = resourceIndex.constFind(key);
+        if (it == resourceIndex.constEnd())
+            continue;
+        QVector<qint64>::const_iterator later = std::upper_bound(it->constBegin(), it->constEnd(), position);
+        if (later != it->constEnd() && *later < end)
+            return true;
+    }
+    return false;
+}
+
+/*! \internal
+    Undoes or redoes commands towards seekTarget until it is reached or the time budget
+    of the slice is used up. In the latter case, the next slice is posted to the event
+    loop.
+*/
+
+void UndoStackPrivate::seekSlice()
+{
+    Q_Q(UndoStack);
+
+    // The budget is checked before each step but the first, so that a slice always
+    // makes progress, and a budget of 0 means exactly one step per slice.
+    QElapsedTimer timer;
+    timer.start();
+    for (bool first = true; index != seekTarget; first = false) {
+        if (!first && (seekTimeBudget <= 0 || timer.elapsed() >= seekTimeBudget))
+            break;
+        // A hibernated command that cannot be read back ends the seek.
+        if (!makeResident(index < seekTarget ? index : index - 1)) {
+            seekTarget = index;
+            break;
+        }
+        if (index < seekTarget)
+            commandList.at(index++).command->redo();
+        else
+            commandList.at(--index).command->undo();
+        pendingDocumentChange = true;
+    }
+
+    emit q->seekProgress(index, seekTarget);
+
+    if (index != seekTarget) {
+        if (!seekSlicePosted) {
+            seekSlicePosted = true;
+            QMetaObject::invokeMethod(q, "_q_continueSeek", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    seeking = false;
+    q->endUpdate();
+    emit q->seekFinished();
+}
+
+/*! \internal
+    Runs the next slice of a seek.
+*/
+
+void UndoStackPrivate::_q_continueSeek()
+{
+    seekSlicePosted = false;
+    if (seeking)
+        seekSlice();
+}
+
+/*! \internal
+    Stops seeking at the current index. Called by all functions that change the stack
+    in other ways.
+*/
+
+void UndoStackPrivate::cancelSeek()
+{
+    Q_Q(UndoStack);
+
+    if (!seeking)
+        return;
+    seeking = false;
+    q->endUpdate();
+}
+
+/*! \internal
+    Deletes \a command, which was removed from the stack, or hands it to the reclaimer
+    in DeferredReclamation mode. commitReclamation() must be called after the last
+    command of an operation.
+*/
+
+void UndoStackPrivate::reclaim(LightUndoCommand *command)
+{
+    if (!hibernatedCommands.isEmpty())
+        hibernatedCommands.remove(command);
+    if (!mappedCommands.isEmpty())
+        mappedCommands.remove(command);
+    if (!compressedCommands.isEmpty())
+        compressedCommands.remove(command);
+    if (!inverses.isEmpty()) {
+        // A command reverted by a command that is still alive goes with the latter.
+        if (UndoInverseCommand *inverse = inverses.take(command)) {
+            inverseTargets.remove(inverse);
+            inverse->adoptTarget();
+            updateInverseCost(inverse);
+            return;
+        }
+        if (LightUndoCommand *target = inverseTargets.take(command))
+            inverses.remove(target);
+    }
+    if (!transactions.isEmpty()) {
+        Q_Q(UndoStack);
+        const QSharedPointer<UndoTransaction> transaction = transactions.take(command);
+        if (transaction) {
+            transaction->participants.remove(q);
+            // Replaying the macros left on the other stacks would undo or redo only
+            // part of the change, and keeping this one would defeat the limits.
+            if (!transaction->aborted && !transaction->participants.isEmpty()) {
+                qWarning("UndoStack: transaction \"%s\" was aborted because its macro was"
+                         " removed from one of its stacks", qPrintable(transaction->text));
+            }
+            transaction->aborted = true;
+        }
+    }
+
+    if (reclamationMode == UndoStack::ImmediateReclamation) {
+        delete command;
+        return;
+    }
+
+    Q_Q(UndoStack);
+    if (reclaimer == 0)
+        reclaimer = new UndoReclaimer(q);
+    reclaimer->discard(command);
+}
+
+/*! \internal
+    Returns \c true if \a command can be written with \a serializer and replaced by an
+    UndoHibernatedCommand or an UndoCompressedCommand without the stack noticing.
+    UndoCommand objects may be connected to or referred to by the application and stay
+    in memory, as do commands that the stack refers to by address.
+*/
+
+bool UndoStackPrivate::canHibernate(LightUndoCommand *command,
+                                    const UndoCommandSerializer &serializer) const
+{
+    return command->toUndoCommand() == 0
+            && !inverses.contains(command)
+            && !inverseTargets.contains(command)
+            && !transactions.contains(command)
+            && UndoReclaimer::isThreadSafe(command)
+            && serializer.canSave(command);
+}
+
+/*! \internal
+    Writes the commands on the stack that can be hibernated to a new temporary file,
+    replaces them by UndoHibernatedCommand objects and deletes them, emitting
+    appropriate signals. The file is removed once all of them have been read back or
+    deleted.
+*/
+
+void UndoStackPrivate::hibernate()
+{
+    hibernationTimer.stop();
+    if (!macroStack.isEmpty() || seeking)
+        return;
+
+    QSharedPointer<UndoHibernationFile> file;
+    const UndoCommandSerializer serializer;
+    const qint64 usage = memoryUsage;
+    for (int i = 0; i < commandList.size(); ++i) {
+        // Commands of a mapped history that have not been accessed are on disk already.
+        if (!commandList.isMaterialized(i))
+            continue;
+        Entry &entry = commandList[i];
+        if (!canHibernate(entry.command, serializer))
+            continue;
+
+        if (!file) {
+            file.reset(new UndoHibernationFile);
+            if (Q_UNLIKELY(!file->open())) {
+                qWarning("UndoStack::hibernate(): cannot create a temporary file");
+                return;
+            }
+        }
+        const qint64 offset = file->write(entry.command);
+        if (Q_UNLIKELY(offset < 0)) {
+            qWarning("UndoStack::hibernate(): cannot write to the temporary file");
+            break;
+        }
+
+        UndoHibernatedCommand *hibernated = new UndoHibernatedCommand(file, offset, entry.command);
+        delete entry.command;
+        entry.command = hibernated;
+        memoryUsage -= entry.cost;
+        entry.cost = 0;
+        hibernatedCommands.insert(hibernated);
+    }
+    if (file)
+        file->flush();
+
+    if (memoryUsage != usage)
+        notify(false);
+}
+
+/*! \internal
+    Reads the hibernated commands on the stack back into memory and puts them in the
+    place of their UndoHibernatedCommand objects, emitting appropriate signals.
+    Commands on branches stay hibernated until they are needed.
+*/
+
+void UndoStackPrivate::rehydrate()
+{
+    if (hibernatedCommands.isEmpty())
+        return;
+
+    const qint64 usage = memoryUsage;
+    for (int i = 0; i < commandList.size(); ++i) {
+        if (commandList.isMaterialized(i))
+            rehydrateEntry(commandList[i], &memoryUsage);
+    }
+
+    if (memoryUsage != usage)
+        notify(false);
+}
+
+/*! \internal
+    Reads the command of \a entry back into memory if it is hibernated, puts it in the
+    place of its UndoHibernatedCommand and counts its cost in the entry and in \a usage.
+    Returns \c false, after printing a warning, if the command cannot be read back.
+*/
+
+bool UndoStackPrivate::rehydrateEntry(Entry &entry, qint64 *usage)
+{
+    if (hibernatedCommands.isEmpty() || !hibernatedCommands.contains(entry.command))
+        return true;
+
+    UndoHibernatedCommand *hibernated = static_cast<UndoHibernatedCommand *>(entry.command);
+    LightUndoCommand *command = hibernated->takeCommand();
+    if (command == 0)
+        return false;
+    hibernatedCommands.remove(hibernated);
+    delete hibernated;
+    entry.command = command;
+    const qint64 cost = command->cost();
+    *usage += cost - entry.cost;
+    entry.cost = cost;
+    return true;
+}
+
+/*! \internal
+    Makes sure that the command at \a idx is in memory before it is executed or merged
+    into: reads it back if it is hibernated or part of a mapped history, puts it in the
+    place of its placeholder and counts its cost. A compressed command is decompressed
+    in its UndoCompressedCommand, which can compress it again later. Returns \c false,
+    after printing a warning, if the command cannot be read back.
+*/
+
+bool UndoStackPrivate::makeResident(int idx)
+{
+    Entry &entry = commandList[idx];
+    if (!compressedCommands.isEmpty() && compressedCommands.contains(entry.command)) {
+        UndoCompressedCommand *compressed = static_cast<UndoCompressedCommand *>(entry.command);
+        if (compressed->command() == 0)
+            return false;
+        const qint64 cost = compressed->cost();
+        memoryUsage += cost - entry.cost;
+        entry.cost = cost;
+        return true;
+    }
+    if (mappedCommands.isEmpty() || !mappedCommands.contains(entry.command))
+        return rehydrateEntry(entry, &memoryUsage);
+
+    UndoMappedCommand *mapped = static_cast<UndoMappedCommand *>(entry.command);
+    LightUndoCommand *command = mapped->takeCommand();
+    if (command == 0)
+        return false;
+    mappedCommands.remove(mapped);
+    delete mapped;
+    entry.command = command;
+    const qint64 cost = command->cost();
+    memoryUsage += cost - entry.cost;
+    entry.cost = cost;
+    return true;
+}
+
+/*! \internal
+    Starts the hibernation timer if the stack is an inactive member of a group and
+    hibernationTimeout is set.
+*/
+
+void UndoStackPrivate::scheduleHibernation()
+{
+    Q_Q(UndoStack);
+
+    if (hibernationTimeout > 0 && group != 0 && UndoGroupPrivate::get(group)->active != q)
+        hibernationTimer.start(hibernationTimeout, q);
+    else
+        hibernationTimer.stop();
+}
+
+/*! \internal
+    Called by the group when the stack becomes the active stack, if \a active is true,
+    or stops being the active stack.
+*/
+
+void UndoStackPrivate::setActiveInGroup(bool active)
+{
+    if (active) {
+        hibernationTimer.stop();
+        rehydrate();
+    } else {
+        scheduleHibernation();
+    }
+}
+
+// The first bytes of the data written by UndoStackPrivate::writeHistory(), followed
+// by the version of the format. Version 1 uses the QDataStream::Qt_5_6 serialization.
+static const quint32 undoHistoryMagic = 0x51554e44; // "QUND"
+static const quint32 undoHistoryVersion = 1;
+
+/*! \internal
+    Returns \a command, or the command it stands for if it is hibernated, part of a
+    mapped history or compressed, which is read back. Returns 0 if the command cannot
+    be read back.
+*/
+
+LightUndoCommand *UndoStackPrivate::residentCommand(LightUndoCommand *command) const
+{
+    if (hibernatedCommands.contains(command))
+        return static_cast<UndoHibernatedCommand *>(command)->command();
+    if (mappedCommands.contains(command))
+        return static_cast<UndoMappedCommand *>(command)->command();
+    if (compressedCommands.contains(command))
+        return static_cast<UndoCompressedCommand *>(command)->command();
+    return command;
+}
+
+/*! \internal
+    Returns the index of the first command on the stack that cannot be written to disk,
+    or -1 if all of them can.
+*/
+
+int UndoStackPrivate::firstUnsavable() const
+{
+    const UndoCommandSerializer serializer;
+    for (int i = 0; i < commandList.size(); ++i) {
+        const LightUndoCommand *command = residentCommand(commandList.at(i).command);
+        if (command == 0 || !serializer.canSave(command))
+            return i;
+    }
+    return -1;
+}
+
+/*! \internal
+    Writes the commands on the stack, which must all be savable, the index and the
+    clean index to \a stream, in the format that readHistory() reads.
+*/
+
+void UndoStackPrivate::writeHistory(QDataStream &stream) const
+{
+    UndoCommandSerializer serializer(true);
+    QByteArray records;
+    {
+        QDataStream recordStream(&records, QIODevice::WriteOnly);
+        recordStream.setVersion(stream.version());
+        for (int i = 0; i < commandList.size(); ++i)
+            serializer.save(recordStream, residentCommand(commandList.at(i).command));
+    }
+
+    stream << undoHistoryMagic << undoHistoryVersion << qint32(commandList.size())
+           << qint32(index) << qint32(cleanIndex);
+    const QVector<QString> &texts = serializer.texts();
+    stream << quint32(texts.size());
+    for (const QString &text : texts)
+        stream << text;
+    stream.writeRawData(records.constData(), records.size());
+}
+
+/*! \internal
+    Reads a history written by writeHistory() from \a stream into \a commands, \a idx
+    and \a clean. Returns \c false, and warns on behalf of \a function, if it cannot
+    be read.
+*/
+
+bool UndoStackPrivate::readHistory(QDataStream &stream, const char *function,
+                                   QVector<LightUndoCommand*> *commands, int *idx,
+                                   int *clean) const
+{
+    quint32 magic = 0;
+    quint32 version = 0;
+    stream >> magic >> version;
+    if (Q_UNLIKELY(magic != undoHistoryMagic)) {
+        qWarning("%s: the data is not an undo history", function);
+        return false;
+    }
+    if (Q_UNLIKELY(version == 0 || version > undoHistoryVersion)) {
+        qWarning("%s: unsupported format version %u", function, version);
+        return false;
+    }
+
+    qint32 count;
+    qint32 index;
+    qint32 cleanIndex;
+    quint32 textCount;
+    stream >> count >> index >> cleanIndex >> textCount;
+    // Every record and every text takes at least four bytes.
+    const qint64 size = stream.device()->size();
+    if (Q_UNLIKELY(stream.status() != QDataStream::Ok || count < 0 || count > size / 4
+                   || index < 0 || index > count || cleanIndex < -1 || cleanIndex > count
+                   || textCount > quint64(size / 4))) {
+        qWarning("%s: the data is corrupt", function);
+        return false;
+    }
+
+    QVector<QString> texts(static_cast<int>(textCount));
+    for (quint32 i = 0; i < textCount; ++i)
+        stream >> texts[static_cast<int>(i)];
+    UndoCommandSerializer serializer(true);
+    serializer.setTexts(texts);
+
+    commands->reserve(commands->size() + count);
+    for (int i = 0; i < count; ++i) {
+        LightUndoCommand *command = serializer.load(stream);
+        if (Q_UNLIKELY(command == 0)) {
+            qWarning("%s: cannot read the command at index %d", function, i);
+            qDeleteAll(*commands);
+            commands->clear();
+            return false;
+        }
+        commands->append(command);
+    }
+
+    *idx = index;
+    *clean = cleanIndex;
+    return true;
+}
+
+/*! \internal
+    Replaces the commands on the stack by \a commands without executing them, sets the
+    index to \a idx and the clean index to \a clean, and applies the limits if \a limit
+    is true, emitting appropriate signals.
+*/
+
+void UndoStackPrivate::installHistory(const QVector<LightUndoCommand*> &commands, int idx,
+                                      int clean, bool limit)
+{
+    Q_Q(UndoStack);
+
+    q->beginUpdate();
+    q->clear();
+    commandList.reserve(commands.size());
+    for (LightUndoCommand *command : commands) {
+        const Entry entry = { command, command->cost(), nextSequence() };
+        commandList.append(entry);
+        memoryUsage += entry.cost;
+    }
+    index = idx;
+    cleanIndex = clean;
+    if (limit)
+        checkUndoLimit();
+    notify(true);
+    q->endUpdate();
+}
+
+/*! \internal
+    Replaces the journal file by a snapshot of the history, and remembers the state
+    of the stack that the journal now describes. If a command cannot be written, closes
+    the journal and returns \c false.
+*/
+
+bool UndoStackPrivate::writeJournalSnapshot()
+{
+    const int unsavable = firstUnsavable();
+    if (Q_UNLIKELY(unsavable != -1)) {
+        qWarning("UndoStack: the command at index %d cannot be written to the journal %s",
+                 unsavable, qPrintable(journal->fileName()));
+        closeJournal();
+        return false;
+    }
+
+    writeHistory(journal->beginSnapshot());
+    journal->endSnapshot();
+
+    journaledSequences.clear();
+    journaledSequences.reserve(commandList.size());
+    for (int i = 0; i < commandList.size(); ++i)
+        journaledSequences.append(commandList.sequenceAt(i));
+    journaledBase = baseIndex;
+    journaledIndex = index;
+    journaledCleanIndex = cleanIndex;
+    return true;
+}
+
+/*! \internal
+    Appends records for the changes to the stack since the journal last described it.
+
+    Every change to the commands of the stack either removes commands from its bottom
+    or replaces the commands above some position, and every command that is pushed,
+    merged into or completed as a macro gets a new sequence number. Comparing the
+    sequence numbers from the top down therefore finds the changed commands in time
+    proportional to their number.
+*/
+
+void UndoStackPrivate::writeJournal()
+{
+    Q_Q(UndoStack);
+
+    const qint64 evicted = baseIndex - journaledBase;
+    if (evicted < 0 || evicted > journaledSequences.size()) {
+        writeJournalSnapshot();
+        return;
+    }
+    if (evicted > 0) {
+        journal->beginRecord(UndoJournal::EvictRecord) << qint32(evicted);
+        journal->endRecord();
+        journaledSequences.removeFirst(int(evicted));
+        journaledBase = baseIndex;
+    }
+
+    int common = qMin(journaledSequences.size(), commandList.size());
+    while (common > 0 && journaledSequences.at(common - 1) != commandList.sequenceAt(common - 1))
+        --common;
+    if (journaledSequences.size() > common) {
+        journal->beginRecord(UndoJournal::TruncateRecord) << qint32(common);
+        journal->endRecord();
+        while (journaledSequences.size() > common)
+            journaledSequences.takeLast();
+    }
+
+    if (common < commandList.size()) {
+        UndoCommandSerializer serializer;
+        for (int i = common; i < commandList.size(); ++i) {
+            const LightUndoCommand *command = residentCommand(commandList.at(i).command);
+            if (Q_UNLIKELY(command == 0 || !serializer.canSave(command))) {
+                qWarning("UndoStack: the command at index %d cannot be written to the journal %s",
+                         i, qPrintable(journal->fileName()));
+                closeJournal();
+                return;
+            }
+            serializer.save(journal->beginRecord(UndoJournal::PushRecord), command);
+            journal->endRecord();
+            journaledSequences.append(commandList.sequenceAt(i));
+        }
+    }
+
+    if (index != journaledIndex) {
+        journal->beginRecord(UndoJournal::IndexRecord) << qint32(index);
+        journal->endRecord();
+        journaledIndex = index;
+    }
+    if (cleanIndex != journaledCleanIndex) {
+        journal->beginRecord(UndoJournal::CleanRecord) << qint32(cleanIndex);
+        journal->endRecord();
+        journaledCleanIndex = cleanIndex;
+    }
+
+    // Compacting once the records outgrow the snapshot keeps the cost of writing
+    // snapshots proportional to the cost of writing records.
+    if (journalCompactionThreshold > 0 && journal->recordBytes() > journalCompactionThreshold
+            && journal->recordBytes() > journal->snapshotBytes()) {
+        if (!writeJournalSnapshot())
+            return;
+    }
+
+    if (!journalTimer.isActive() && !journal->isIdle())
+        journalTimer.start(UndoJournal::FlushInterval, q);
+}
+
+/*! \internal
+    Called every UndoJournal::FlushInterval milliseconds while the journal has records
+    that are not on disk. Hands the records to the writer, and closes the journal if
+    the writer failed.
+*/
+
+void UndoStackPrivate::flushJournal()
+{
+    journal->flush();
+    if (Q_UNLIKELY(journal->hasFailed())) {
+        qWarning("UndoStack: cannot write the journal %s", qPrintable(journal->fileName()));
+        closeJournal();
+        return;
+    }
+    if (journal->isIdle())
+        journalTimer.stop();
+}
+
+/*! \internal
+    Writes the remaining records of the journal, if there is one, and closes it.
+*/
+
+void UndoStackPrivate::closeJournal()
+{
+    journalTimer.stop();
+    delete journal;
+    journal = 0;
+    journaledSequences.clear();
+}
+
+/*! \internal
+    Replays the records that follow the header of a journal in \a stream, and returns
+    the history they describe in \a commands, \a idx and \a clean. The commands are not
+    executed. Returns \c false, and warns, if the journal has no valid snapshot.
+*/
+
+bool UndoStackPrivate::replayJournal(QDataStream &stream, QVector<LightUndoCommand*> *commands,
+                                     int *idx, int *clean) const
+{
+    UndoCommandSerializer serializer;
+    bool hasSnapshot = false;
+    QByteArray contents;
+    while (UndoJournal::readRecord(stream, &contents)) {
+        QDataStream record(contents);
+        record.setVersion(stream.version());
+        quint8 type;
+        record >> type;
+        if (type == UndoJournal::SnapshotRecord) {
+            qDeleteAll(*commands);
+            commands->clear();
+            hasSnapshot = readHistory(record, "UndoStack::recoverJournal()", commands, idx, clean);
+            if (!hasSnapshot)
+                return false;
+            continue;
+        }
+        if (!hasSnapshot)
+            break;
+
+        if (type == UndoJournal::PushRecord) {
+            LightUndoCommand *command = serializer.load(record);
+            if (command == 0)
+                break;
+            commands->append(command);
+            continue;
+        }
+
+        qint32 value;
+        record >> value;
+        if (record.status() != QDataStream::Ok)
+            break;
+        if (type == UndoJournal::TruncateRecord && value >= 0 && value <= commands->size()) {
+            while (commands->size() > value)
+                delete commands->takeLast();
+        } else if (type == UndoJournal::EvictRecord && value >= 0 && value <= commands->size()) {
+            for (int i = 0; i < value; ++i)
+                delete commands->at(i);
+            commands->remove(0, value);
+        } else if (type == UndoJournal::IndexRecord) {
+            *idx = value;
+        } else if (type == UndoJournal::CleanRecord) {
+            *clean = value;
+        } else {
+            break;
+        }
+    }
+
+    if (Q_UNLIKELY(!hasSnapshot)) {
+        qWarning("UndoStack::recoverJournal(): the journal has no snapshot");
+        return false;
+    }
+    // A journal that ends early may leave the index past the commands it kept.
+    *idx = qBound(0, *idx, commands->size());
+    if (*clean < -1 || *clean > commands->size())
+        *clean = -1;
+    return true;
+}
+
+/*! \internal
+    Deletes all commands of the stack, or hands them to the reclaimer in
+    DeferredReclamation mode. Unlike reclaim(), this takes constant time per command
+    in either mode; the commands are examined by the reclaimer later.
+*/
+
+void UndoStackPrivate::reclaimAll()
+{
+    // All targets and inverses go together.
+    inverses.clear();
+    inverseTargets.clear();
+    hibernatedCommands.clear();
+    mappedCommands.clear();
+    compressedCommands.clear();
+    invalidateResourceIndex();
+
+    Q_Q(UndoStack);
+    for (const QSharedPointer<UndoTransaction> &transaction : qAsConst(transactions)) {
+        transaction->participants.remove(q);
+        transaction->aborted = true;
+    }
+    transactions.clear();
+
+    if (reclamationMode == UndoStack::ImmediateReclamation) {
+        for (int i = 0; i < commandList.size(); ++i) {
+            if (commandList.isMaterialized(i))
+                delete commandList.at(i).command;
+        }
+        return;
+    }
+
+    QVector<LightUndoCommand*> commands;
+    commands.reserve(commandList.size() - commandList.mappedCount());
+    for (int i = 0; i < commandList.size(); ++i) {
+        if (commandList.isMaterialized(i))
+            commands.append(commandList.at(i).command);
+    }
+    if (reclaimer == 0)
+        reclaimer = new UndoReclaimer(q);
+    reclaimer->discardAll(commands);
+}
+
+/*! \internal
+    Starts destroying the commands passed to reclaim() in the background.
+*/
+
+void UndoStackPrivate::commitReclamation()
+{
+    if (reclaimer != 0)
+        reclaimer->commit();
+}
+
+/*! \internal
+    Deletes the next slice of commands that must be destroyed on the thread of the stack.
+*/
+
+void UndoStackPrivate::_q_reclaimSlice()
+{
+    if (reclaimer != 0)
+        reclaimer->runSlice();
+}
+
+/*! \internal
+    Returns the codec that compresses commands: the installed one, or the default
+    UndoCompressionCodec.
+*/
+
+const UndoCompressionCodec *UndoStackPrivate::activeCodec() const
+{
+    return compressionCodec != 0 ? compressionCodec : UndoCompressor::defaultCodec();
+}
+
+/*! \internal
+    Replaces the commands from \a from up to \a to that can be written to memory by
+    UndoCompressedCommand objects, and hands their data to the compressor. Commands
+    that were compressed before and have been read back since are compressed again.
+    Their cost becomes the size of their data, which finishCompression() updates
+    once the data is compressed.
+*/
+
+void UndoStackPrivate::compressRange(int from, int to)
+{
+    Q_Q(UndoStack);
+
+    from = qMax(from, 0);
+    to = qMin(to, commandList.size());
+    if (from >= to)
+        return;
+
+    const UndoCompressionCodec *codec = activeCodec();
+    UndoCommandSerializer serializer;
+    bool added = false;
+    for (int i = from; i < to; ++i) {
+        if (!commandList.isMaterialized(i))
+            continue;
+        Entry &entry = commandList[i];
+        UndoCompressedCommand *compressed = 0;
+        LightUndoCommand *command = entry.command;
+        if (compressedCommands.contains(command)) {
+            compressed = static_cast<UndoCompressedCommand *>(command);
+            if (!compressed->isResident())
+                continue;
+            command = compressed->command();
+        } else if (!canHibernate(command, serializer)) {
+            continue;
+        }
+
+        QByteArray data;
+        {
+            QDataStream stream(&data, QIODevice::WriteOnly);
+            stream.setVersion(QDataStream::Qt_5_6);
+            serializer.save(stream, command);
+        }
+        const QSharedPointer<UndoCompressedPayload> payload(new UndoCompressedPayload(data));
+        if (compressed != 0) {
+            compressed->compressAgain(payload, codec);
+        } else {
+            compressed = new (pool) UndoCompressedCommand(payload, codec, command);
+            delete command;
+            entry.command = compressed;
+            compressedCommands.insert(compressed);
+        }
+        memoryUsage += data.size() - entry.cost;
+        entry.cost = data.size();
+
+        if (compressor == 0)
+            compressor = new UndoCompressor(q);
+        compressor->add(payload);
+        const UndoCompressionItem item = { baseIndex + i, compressed, payload };
+        compressing.append(item);
+        added = true;
+    }
+    if (added)
+        compressor->commit(codec);
+}
+
+/*! \internal
+    Called by notify(). Updates the costs of the commands the compressor is done
+    with, compresses the commands that fell more than compressionDepth commands below
+    the index, and records the index for compressUntouched().
+*/
+
+void UndoStackPrivate::updateCompression()
+{
+    Q_Q(UndoStack);
+
+    if (!compressing.isEmpty())
+        finishCompression();
+    if (!macroStack.isEmpty() || seeking)
+        return;
+
+    const qint64 current = baseIndex + index;
+    if (compressionDepth > 0) {
+        // Commands below the mark were compressed, unless they were executed since,
+        // which moved the mark down.
+        const qint64 target = current - compressionDepth;
+        if (target > compressionMark)
+            compressRange(int(qMax(compressionMark - baseIndex, qint64(0))), int(target - baseIndex));
+        compressionMark = target;
+    }
+
+    // Changes that leave the index where it was, such as merges, only touch the
+    // command below the index, which stays in memory anyway.
+    if (compressionTimeout > 0 && (current < touchedLow || current > touchedHigh)) {
+        touchedLow = qMin(touchedLow, current);
+        touchedHigh = qMax(touchedHigh, current);
+        touchedSinceTick = true;
+        if (!compressionTimer.isActive())
+            compressionTimer.start(compressionTimeout, q);
+    }
+}
+
+/*! \internal
+    Called every compressionTimeout milliseconds while the index moves. Compresses the
+    commands that the stack did not execute since the last call, that is, the ones
+    outside the range of indexes it has been at. The timer stops after a period in
+    which the index did not move.
+*/
+
+void UndoStackPrivate::compressUntouched()
+{
+    if (!macroStack.isEmpty() || seeking)
+        return;
+
+    const bool touched = touchedSinceTick;
+    const qint64 usage = memoryUsage;
+    // Undo and redo execute the commands just below and at the index.
+    compressRange(0, int(touchedLow - baseIndex) - 1);
+    compressRange(int(touchedHigh - baseIndex) + 1, commandList.size());
+
+    touchedLow = baseIndex + index;
+    touchedHigh = touchedLow;
+    touchedSinceTick = false;
+    if (!touched)
+        compressionTimer.stop();
+
+    if (memoryUsage != usage)
+        notify(false);
+}
+
+/*! \internal
+    Sets the cost of each command that the compressor is done with to the size of its
+    compressed data. Returns \c true if memoryUsage changed.
+*/
+
+bool UndoStackPrivate::finishCompression()
+{
+    const qint64 usage = memoryUsage;
+    int kept = 0;
+    for (int i = 0; i < compressing.size(); ++i) {
+        const UndoCompressionItem item = compressing.at(i);
+        bool pending;
+        {
+            QMutexLocker locker(&item.payload->mutex);
+            pending = item.payload->pending;
+        }
+        if (pending) {
+            compressing[kept++] = item;
+            continue;
+        }
+
+        // The command may have been removed, or moved to a branch.
+        const qint64 idx = item.position - baseIndex;
+        if (idx < 0 || idx >= commandList.size())
+            continue;
+        Entry &entry = commandList[int(idx)];
+        if (entry.command != item.command)
+            continue;
+        const qint64 cost = entry.command->cost();
+        memoryUsage += cost - entry.cost;
+        entry.cost = cost;
+    }
+    compressing.resize(kept);
+    return memoryUsage != usage;
+}
+
+/*! \internal
+    Called on the thread of the stack when the compressor finished a batch.
+*/
+
+void UndoStackPrivate::_q_compressionFinished()
+{
+    if (finishCompression())
+        notify(false);
+}
+
+/*! \internal
+    Reads all compressed commands of the stack and its branches back into memory, and
+    puts them in the place of their UndoCompressedCommand objects, so that the codec
+    they were compressed with is no longer needed. Commands that the stack refers to by
+    address stay in their UndoCompressedCommand objects, decompressed.
+*/
+
+void UndoStackPrivate::decompressAll()
+{
+    if (compressor != 0)
+        compressor->waitForDone();
+    compressing.clear();
+
+    auto decompress = [this](Entry &entry) -> qint64 {
+        if (!compressedCommands.contains(entry.command))
+            return 0;
+        UndoCompressedCommand *compressed = static_cast<UndoCompressedCommand *>(entry.command);
+        if (inverses.contains(compressed) || inverseTargets.contains(compressed)) {
+            compressed->command();
+        } else {
+            LightUndoCommand *command = compressed->takeCommand();
+            if (command == 0)
+                return 0;
+            compressedCommands.remove(compressed);
+            delete compressed;
+            entry.command = command;
+        }
+        const qint64 cost = entry.command->cost();
+        const qint64 delta = cost - entry.cost;
+        entry.cost = cost;
+        return delta;
+    };
+
+    const qint64 usage = memoryUsage;
+    for (int i = 0; i < commandList.size(); ++i) {
+        if (commandList.isMaterialized(i))
+            memoryUsage += decompress(commandList[i]);
+    }
+    for (QMap<int, UndoStackBranch>::iterator it = branches.begin(); it != branches.end(); ++it) {
+        for (int i = 0; i < it->commands.size(); ++i) {
+            const qint64 delta = decompress(it->commands[i]);
+            it->cost += delta;
+            branchMemoryUsage += delta;
+        }
+    }
+
+    if (memoryUsage != usage)
+        notify(false);
+}
+
+/*! \internal
+    Notifies about a change of the state of the stack. If \a documentChanged is true,
+    a command modified the document.
+
+    The signals are emitted right away, unless a batched update is in progress or the
+    stack is in QueuedNotification mode. In the latter case, a single call of
+    _q_emitQueuedNotifications() is posted to the event loop.
+*/
+
+void UndoStackPrivate::notify(bool documentChanged)
+{
+    Q_Q(UndoStack);
+
+    if (compressionDepth > 0 || compressionTimeout > 0 || !compressing.isEmpty())
+        updateCompression();
+    if (group != 0)
+        UndoGroupPrivate::get(group)->stackChanged(q);
+    if (journal != 0 && macroStack.isEmpty())
+        writeJournal();
+
+    if (updateDepth > 0) {
+        pendingDocumentChange |= documentChanged;
+        return;
+    }
+
+    if (notificationMode == UndoStack::QueuedNotification) {
+        pendingDocumentChange |= documentChanged;
+        if (!notificationQueued) {
+            notificationQueued = true;
+            QMetaObject::invokeMethod(q, "_q_emitQueuedNotifications", Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    emitChangedSignals(documentChanged);
+}
+
+/*! \internal
+    Emits the signals whose values differ from the ones that were last emitted. If
+    \a documentChanged is true, indexChanged() is emitted first, even if the index is
+    unchanged, since a merge or an eviction also modifies the state of the document.
+
+    The undo and redo texts are only looked up while their signals are connected. While
+    they are not, the last emitted text is forgotten, so the next emission after connecting
+    happens unconditionally.
+
+    If this is the active stack of a group, the group is told to update its own signals.
+*/
+
+void UndoStackPrivate::emitChangedSignals(bool documentChanged)
+{
+    Q_Q(UndoStack);
+
+    static const QMetaMethod undoTextChangedSignal
+            = QMetaMethod::fromSignal(&UndoStack::undoTextChanged);
+    static const QMetaMethod redoTextChangedSignal
+            = QMetaMethod::fromSignal(&UndoStack::redoTextChanged);
+
+    if (documentChanged)
+        emit q->indexChanged(index);
+
+    const bool canUndo = q->canUndo();
+    if (canUndo != emittedCanUndo) {
+        emittedCanUndo = canUndo;
+        emit q->canUndoChanged(canUndo);
+    }
+
+    if (q->isSignalConnected(undoTextChangedSignal)) {
+        const QString undoText = q->undoText();
+        if (!emittedUndoTextValid || undoText != emittedUndoText) {
+            emittedUndoText = undoText;
+            emittedUndoTextValid = true;
+            emit q->undoTextChanged(undoText);
+        }
+    } else if (emittedUndoTextValid) {
+        emittedUndoText.clear();
+        emittedUndoTextValid = false;
+    }
+
+    const bool canRedo = q->canRedo();
+    if (canRedo != emittedCanRedo) {
+        emittedCanRedo = canRedo;
+        emit q->canRedoChanged(canRedo);
+    }
+
+    if (q->isSignalConnected(redoTextChangedSignal)) {
+        const QString redoText = q->redoText();
+        if (!emittedRedoTextValid || redoText != emittedRedoText) {
+            emittedRedoText = redoText;
+            emittedRedoTextValid = true;
+            emit q->redoTextChanged(redoText);
+        }
+    } else if (emittedRedoTextValid) {
+        emittedRedoText.clear();
+        emittedRedoTextValid = false;
+    }
+
+    // isClean() is false while a macro is being composed, which is not announced.
+    const bool isClean = index == cleanIndex;
+    if (isClean != emittedClean) {
+        emittedClean = isClean;
+        emit q->cleanChanged(isClean);
+    }
+
+    if (memoryUsage != emittedMemoryUsage) {
+        emittedMemoryUsage = memoryUsage;
+        emit q->memoryUsageChanged(memoryUsage);
+    }
+    if (evictedBytes != emittedEvictedBytes) {
+        emittedEvictedBytes = evictedBytes;
+        emit q->evictedBytesChanged(evictedBytes);
+    }
+
+    if (group != 0) {
+        UndoGroupPrivate *g = UndoGroupPrivate::get(group);
+        if (g->active == q)
+            g->activeStackStateChanged(documentChanged);
+    }
+}
+
+/*! \internal
+    Emits the notifications that were queued in QueuedNotification mode.
+*/
+
+void UndoStackPrivate::_q_emitQueuedNotifications()
+{
+    if (!notificationQueued)
+        return;
+    notificationQueued = false;
+
+    // A batched update that started after the notification was queued will
+    // notify when it ends.
+    if (updateDepth > 0)
+        return;
+
+    const bool documentChanged = pendingDocumentChange;
+    pendingDocumentChange = false;
+    emitChangedSignals(documentChanged);
+}
+
+/*!
+    Constructs an empty undo stack with the parent \a parent. The
+    stack will initially be in the clean state. If \a parent is a
+    UndoGroup object, the stack is automatically added to the group.
+
+    \sa push()
+*/
+
+UndoStack::UndoStack(QObject *parent)
+    : QObject(*(new UndoStackPrivate), parent)
+{
+    if (UndoGroup *group = qobject_cast<UndoGroup*>(parent))
+        group->addStack(this);
+}
+
+/*!
+    Destroys the undo stack, deleting any commands that are on it. If the
+    stack is in a UndoGroup, the stack is automatically removed from the group.
+
+    \sa UndoStack()
+*/
+
+UndoStack::~UndoStack()
+{
+    Q_D(UndoStack);
+    if (d->group != 0)
+        d->group->removeStack(this);
+    d->closeJournal();
+    clear();
+    delete d->compressor;
+    delete d->reclaimer;
+    delete d->pool;
+    delete d->blobStore;
+}
+
+/*!
+    Clears the command stack by deleting all commands on it, and returns the stack
+    to the clean state.
+
+    Commands are not undone or redone; the state of the edited object remains
+    unchanged.
+
+    This function is usually used when the contents of the document are
+    abandoned.
+
+    If the stack has a commandPool() and no command allocated from it is alive
+    any more, the memory of the pool is released as a whole.
+
+    In DeferredReclamation mode, the stack is empty and the signals are emitted
+    when this function returns, but the commands are destroyed in bounded slices
+    from the event loop and on the thread pool, so that clearing a very long
+    history does not block the application.
+
+    \sa UndoStack(), reclamationMode, waitForReclamation()
+*/
+
+void UndoStack::clear()
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+
+    if (d->commandList.isEmpty() && d->branches.isEmpty())
+        return;
+
+    d->macroStack.clear();
+    while (!d->branches.isEmpty())
+        d->deleteBranch(d->branches.lastKey());
+    d->branchChildren.clear();
+    d->reclaimAll();
+    d->commandList.clear();
+    d->compressing.clear();
+    if (d->pool != 0)
+        d->pool->release();
+
+    d->index = 0;
+    d->cleanIndex = 0;
+    d->memoryUsage = 0;
+    d->checkpoints.clear();
+    d->checkpointMemoryUsage = 0;
+    d->commandsSinceCheckpoint = 0;
+    d->costSinceCheckpoint = 0;
+    d->baseIndex = 0;
+
+    d->notify(true);
+}
+
+/*!
+    Pushes \a cmd on the stack or merges it with the most recently executed command.
+    In either case, executes \a cmd by calling its redo() function.
+
+    If \a cmd's id is not -1, and if the id is the same as that of the
+    most recently executed command, UndoStack will attempt to merge the two
+    commands by calling UndoCommand::mergeWith() on the most recently executed
+    command. If UndoCommand::mergeWith() returns \c true, \a cmd is deleted.
+
+    In all other cases \a cmd is simply pushed on the stack.
+
+    If commands were undone before \a cmd was pushed, the current command and
+    all commands above it are deleted. Hence \a cmd always ends up being the
+    top-most on the stack.
+
+    Once a command is pushed, the stack takes ownership of it. There
+    are no getters to return the command, since modifying it after it has
+    been executed will almost always lead to corruption of the document's
+    state.
+
+    \a command can be either an UndoCommand or a LightUndoCommand.
+
+    \sa LightUndoCommand::id(), LightUndoCommand::mergeWith()
+*/
+
+void UndoStack::push(LightUndoCommand *command)
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+    d->joinGroupTransaction();
+    command->redo();
+
+    const bool macro = !d->macroStack.isEmpty();
+
+    LightUndoCommand *currentCommand = 0;
+    if (macro) {
+        LightUndoCommand *macroCommand = d->macroStack.constLast();
+        if (!macroCommand->m_childCommands.isEmpty())
+            currentCommand = macroCommand->m_childCommands.constLast();
+    } else {
+        // A command of a mapped history that has not been read is never merged into.
+        if (d->index > 0 && d->commandList.isMaterialized(d->index - 1))
+            currentCommand = d->commandList.at(d->index - 1).command;
+        d->truncate();
+    }
+
+    bool tryMerge = currentCommand != 0
+            && currentCommand->id() != -1
+            && currentCommand->id() == command->id()
+            && (macro || d->index != d->cleanIndex);
+    // A hibernated command is read back before another one is merged into it.
+    if (tryMerge && !macro) {
+        tryMerge = d->makeResident(d->index - 1);
+        currentCommand = d->commandList.at(d->index - 1).command;
+    }
+
+    if (tryMerge && currentCommand->mergeWith(command)) {
+        delete command;
+        if (!macro) {
+            d->updateCost(d->index - 1);
+            // A checkpoint after the merged command no longer matches the document.
+            d->dropCheckpoints(d->index, d->index + 1);
+            d->checkUndoLimit();
+            // The merged command changed the document even though the index did not.
+            d->notify(true);
+        }
+    } else {
+        if (macro) {
+            d->macroStack.constLast()->m_childCommands.append(command);
+        } else {
+            const UndoStackPrivate::Entry entry = { command, command->cost(),
+                                                     UndoStackPrivate::nextSequence() };
+            d->commandList.append(entry);
+            d->memoryUsage += entry.cost;
+            d->maybeSaveCheckpoint(d->index + 1, entry.cost);
+            d->checkUndoLimit();
+            d->setIndex(d->index + 1, false);
+        }
+    }
+}
+
+/*!
+    \overload
+
+    Pushes all \a commands on the stack, in order. The state of the stack afterwards
+    is the same as after calling push() for each command in turn: every command is
+    redone, merged with its predecessor where possible, and the redo tail is deleted
+    before the first one.
+
+    The stack does the bookkeeping only once for the whole sequence, however. The
+    undo and memory limits are enforced after the last command, so the stack holds
+    all of \a commands until then, and the state signals, such as indexChanged(),
+    are emitted at most once. This makes importing or pasting many commands much
+    cheaper than pushing them one by one.
+
+    The stack takes ownership of all \a commands.
+
+    \since 5.7
+*/
+
+void UndoStack::push(const QVector<LightUndoCommand*> &commands)
+{
+    Q_D(UndoStack);
+    if (commands.isEmpty())
+        return;
+
+    d->joinGroupTransaction();
+    if (!d->macroStack.isEmpty()) {
+        for (LightUndoCommand *command : commands)
+            push(command);
+        return;
+    }
+
+    d->cancelSeek();
+
+    for (int i = 0; i < commands.size(); ++i) {
+        LightUndoCommand *command = commands.at(i);
+        command->redo();
+
+        LightUndoCommand *currentCommand = 0;
+        if (d->index > 0 && d->commandList.isMaterialized(d->index - 1))
+            currentCommand = d->commandList.at(d->index - 1).command;
+        if (i == 0) {
+            d->truncate();
+            d->commandList.reserve(d->commandList.size() + commands.size());
+        }
+
+        bool tryMerge = currentCommand != 0
+                && currentCommand->id() != -1
+                && currentCommand->id() == command->id()
+                && d->index != d->cleanIndex;
+        if (tryMerge) {
+            tryMerge = d->makeResident(d->index - 1);
+            currentCommand = d->commandList.at(d->index - 1).command;
+        }
+
+        if (tryMerge && currentCommand->mergeWith(command)) {
+            delete command;
+            d->updateCost(d->index - 1);
+            d->dropCheckpoints(d->index, d->index + 1);
+        } else {
+            const UndoStackPrivate::Entry entry = { command, command->cost(),
+                                                     UndoStackPrivate::nextSequence() };
+            d->commandList.append(entry);
+            d->memoryUsage += entry.cost;
+            ++d->index;
+            d->maybeSaveCheckpoint(d->index, entry.cost);
+        }
+    }
+
+    d->checkUndoLimit();
+    d->notify(true);
+}
+
+/*!
+    Marks the stack as clean and emits cleanChanged() if the stack was
+    not already clean.
+
+    Whenever the stack returns to this state through the use of undo/redo
+    commands, it emits the signal cleanChanged(). This signal is also
+    emitted when the stack leaves the clean state.
+
+    \sa isClean(), cleanIndex()
+*/
+
+void UndoStack::setClean()
+{
+    Q_D(UndoStack);
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::setClean(): cannot set clean in the middle of a macro");
+        return;
+    }
+
+    d->setIndex(d->index, true);
+}
+
+/*!
+    If the stack is in the clean state, returns \c true; otherwise returns \c false.
+
+    \sa setClean(), cleanIndex()
+*/
+
+bool UndoStack::isClean() const
+{
+    Q_D(const UndoStack);
+    if (!d->macroStack.isEmpty())
+        return false;
+    return d->cleanIndex == d->index;
+}
+
+/*!
+    Returns the clean index. This is the index at which setClean() was called.
+
+    A stack may not have a clean index. This happens if a document is saved,
+    some commands are undone, then a new command is pushed. Since
+    push() deletes all the undone commands before pushing the new command, the stack
+    can't return to the clean state again. In this case, this function returns -1.
+
+    \sa isClean(), setClean()
+*/
+
+int UndoStack::cleanIndex() const
+{
+    Q_D(const UndoStack);
+    return d->cleanIndex;
+}
+
+/*!
+    Undoes the command below the current command by calling UndoCommand::undo().
+    Decrements the current command index.
+
+    If the stack is empty, or if the bottom command on the stack has already been
+    undone, this function does nothing.
+
+    \sa redo(), index()
+*/
+
+void UndoStack::undo()
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+    if (d->index == 0)
+        return;
+
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::undo(): cannot undo in the middle of a macro");
+        return;
+    }
+
+    int idx = d->index - 1;
+    if (!d->transactions.isEmpty()) {
+        UndoTransaction *transaction = d->transactions.value(d->commandList.at(idx).command).data();
+        if (transaction != 0 && !transaction->replaying && !transaction->aborted) {
+            UndoStackPrivate::replayTransaction(transaction, true);
+            return;
+        }
+    }
+
+    if (!d->makeResident(idx))
+        return;
+    d->commandList.at(idx).command->undo();
+    d->setIndex(idx, false);
+}
+
+/*!
+    Redoes the current command by calling UndoCommand::redo(). Increments the current
+    command index.
+
+    If the stack is empty, or if the top command on the stack has already been
+    redone, this function does nothing.
+
+    \sa undo(), index()
+*/
+
+void UndoStack::redo()
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+    if (d->index == d->commandList.size())
+        return;
+
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::redo(): cannot redo in the middle of a macro");
+        return;
+    }
+
+    if (!d->transactions.isEmpty()) {
+        UndoTransaction *transaction = d->transactions.value(d->commandList.at(d->index).command).data();
+        if (transaction != 0 && !transaction->replaying && !transaction->aborted) {
+            UndoStackPrivate::replayTransaction(transaction, false);
+            return;
+        }
+    }
+
+    if (!d->makeResident(d->index))
+        return;
+    d->commandList.at(d->index).command->redo();
+    d->setIndex(d->index + 1, false);
+}
+
+/*!
+    Returns the number of commands on the stack. Macro commands are counted as
+    one command.
+
+    \sa index(), setIndex(), command()
+*/
+
+int UndoStack::count() const
+{
+    Q_D(const UndoStack);
+    return d->commandList.size();
+}
+
+/*!
+    Returns the index of the current command. This is the command that will be
+    executed on the next call to redo(). It is not always the top-most command
+    on the stack, since a number of commands may have been undone.
+
+    \sa undo(), redo(), count()
+*/
+
+int UndoStack::index() const
+{
+    Q_D(const UndoStack);
+    return d->index;
+}
+
+/*!
+    Repeatedly calls undo() or redo() until the current command index reaches
+    \a idx. This function can be used to roll the state of the document forwards
+    of backwards. indexChanged() is emitted only once.
+
+    If a checkpoint handler is installed and a checkpoint was saved at or below \a idx,
+    closer to \a idx than the current index, the checkpoint is restored instead and only
+    the commands between it and \a idx are redone.
+
+    \sa index(), count(), undo(), redo(), setCheckpointHandler()
+*/
+
+void UndoStack::setIndex(int idx)
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::setIndex(): cannot set index in the middle of a macro");
+        return;
+    }
+
+    if (idx < 0)
+        idx = 0;
+    else if (idx > d->commandList.size())
+        idx = d->commandList.size();
+
+    // A hibernated command that cannot be read back stops the index short of idx.
+    int i = d->restoreNearestCheckpoint(idx);
+    while (i < idx && d->makeResident(i))
+        d->commandList.at(i++).command->redo();
+    while (i > idx && d->makeResident(i - 1))
+        d->commandList.at(--i).command->undo();
+
+    d->setIndex(i, false);
+}
+
+/*!
+    Moves the current command index towards \a idx without blocking the event loop for
+    longer than the seekTimeBudget at a time. This is meant for history scrubbers, which
+    change the target many times per second.
+
+    Commands are undone or redone in slices. The first slice runs right away, the
+    following ones from the event loop. seekProgress() is emitted after every slice.
+    While seeking, the stack defers its state signals as in beginUpdate(); the getters
+    such as index() and canUndo() reflect the progress. When the target is reached,
+    the deferred signals are emitted once, including a single indexChanged(), followed
+    by seekFinished().
+
+    Calling seekIndex() again while seeking retargets the walk from the current index,
+    restoring a checkpoint first if that is faster. Any other change of the stack, such
+    as push(), undo(), redo() or setIndex(), stops seeking at the current index.
+
+    \since 5.7
+    \sa setIndex(), cancelSeek(), isSeeking(), seekTimeBudget
+*/
+
+void UndoStack::seekIndex(int idx)
+{
+    Q_D(UndoStack);
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::seekIndex(): cannot seek in the middle of a macro");
+        return;
+    }
+
+    if (idx < 0)
+        idx = 0;
+    else if (idx > d->commandList.size())
+        idx = d->commandList.size();
+
+    if (!d->seeking) {
+        if (idx == d->index)
+            return;
+        beginUpdate();
+        d->seeking = true;
+    }
+    d->seekTarget = idx;
+
+    const int start = d->restoreNearestCheckpoint(idx);
+    if (start != d->index) {
+        d->index = start;
+        d->pendingDocumentChange = true;
+    }
+
+    // A slice posted for the previous target simply continues with the new one.
+    if (!d->seekSlicePosted)
+        d->seekSlice();
+}
+
+/*!
+    Stops seeking at the current index and emits the deferred state signals.
+
+    \since 5.7
+    \sa seekIndex()
+*/
+
+void UndoStack::cancelSeek()
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+}
+
+/*!
+    Returns \c true while seekIndex() has not reached its target yet.
+
+    \since 5.7
+    \sa seekIndex(), seekTarget()
+*/
+
+bool UndoStack::isSeeking() const
+{
+    Q_D(const UndoStack);
+    return d->seeking;
+}
+
+/*!
+    Returns the index that seekIndex() is moving towards, or index() if the stack is
+    not seeking.
+
+    \since 5.7
+    \sa seekIndex()
+*/
+
+int UndoStack::seekTarget() const
+{
+    Q_D(const UndoStack);
+    return d->seeking ? d->seekTarget : d->index;
+}
+
+/*!
+    \property UndoStack::seekTimeBudget
+    \brief the time, in milliseconds, that seekIndex() may spend undoing or redoing
+    commands before it returns to the event loop.
+    \since 5.7
+
+    At least one command is undone or redone per slice. A budget of 0 undoes or redoes
+    exactly one command per slice. The default value is 8, which leaves half of a
+    frame at 60 frames per second for rendering.
+
+    \sa seekIndex()
+*/
+
+void UndoStack::setSeekTimeBudget(int msecs)
+{
+    Q_D(UndoStack);
+    d->seekTimeBudget = qMax(0, msecs);
+}
+
+int UndoStack::seekTimeBudget() const
+{
+    Q_D(const UndoStack);
+    return d->seekTimeBudget;
+}
+
+/*!
+    Returns \c true if there is a command available for undo; otherwise returns \c false.
+
+    This function returns \c false if the stack is empty, or if the bottom command
+    on the stack has already been undone.
+
+    Synonymous with index() == 0.
+
+    \sa index(), canRedo()
+*/
+
+bool UndoStack::canUndo() const
+{
+    Q_D(const UndoStack);
+    if (!d->macroStack.isEmpty())
+        return false;
+    return d->index > 0;
+}
+
+/*!
+    Returns \c true if there is a command available for redo; otherwise returns \c false.
+
+    This function returns \c false if the stack is empty or if the top command
+    on the stack has already been redone.
+
+    Synonymous with index() == count().
+
+    \sa index(), canUndo()
+*/
+
+bool UndoStack::canRedo() const
+{
+    Q_D(const UndoStack);
+    if (!d->macroStack.isEmpty())
+        return false;
+    return d->index < d->commandList.size();
+}
+
+/*!
+    Returns the text of the command which will be undone in the next call to undo().
+
+    \sa UndoCommand::text(), redoText()
+*/
+
+QString UndoStack::undoText() const
+{
+    Q_D(const UndoStack);
+    if (!d->macroStack.isEmpty())
+        return QString();
+    if (d->index > 0)
+        return d->commandList.textAt(d->index - 1);
+    return QString();
+}
+
+/*!
+    Returns the text of the command which will be redone in the next call to redo().
+
+    \sa UndoCommand::text(), undoText()
+*/
+
+QString UndoStack::redoText() const
+{
+    Q_D(const UndoStack);
+    if (!d->macroStack.isEmpty())
+        return QString();
+    if (d->index < d->commandList.size())
+        return d->commandList.textAt(d->index);
+    return QString();
+}
+
+/*!
+    Begins composition of a macro command with the given \a text description.
+
+    An empty command described by the specified \a text is pushed on the stack.
+    Any subsequent commands pushed on the stack will be appended to the empty
+    command's children until endMacro() is called.
+
+    Calls to beginMacro() and endMacro() may be nested, but every call to
+    beginMacro() must have a matching call to endMacro().
+
+    While a macro is composed, the stack is disabled. This means that:
+    \list
+    \li indexChanged() and cleanChanged() are not emitted,
+    \li canUndo() and canRedo() return false,
+    \li calling undo() or redo() has no effect,
+    \li the undo/redo actions are disabled.
+    \endlist
+
+    The stack becomes enabled and appropriate signals are emitted when endMacro()
+    is called for the outermost macro.
+
+    \snippet code/src_gui_util_qundostack.cpp 4
+
+    This code is equivalent to:
+
+    \snippet code/src_gui_util_qundostack.cpp 5
+
+    \sa endMacro()
+*/
+
+void UndoStack::beginMacro(const QString &text)
+{
+    Q_D(UndoStack);
+    d->cancelSeek();
+    d->joinGroupTransaction();
+    UndoCommand *command = new (d->pool) UndoMacroCommand();
+    command->setText(text);
+    d->openMacro(command);
+}
+
+/*!
+    Ends composition of a macro command.
+
+    If this is the outermost macro in a set nested macros, this function emits
+    indexChanged() once for the entire macro command.
+
+    \sa beginMacro()
+*/
+
+void UndoStack::endMacro()
+{
+    Q_D(UndoStack);
+    if (Q_UNLIKELY(d->macroStack.isEmpty())) {
+        qWarning("UndoStack::endMacro(): no matching beginMacro()");
+        return;
+    }
+
+    d->macroStack.removeLast();
+
+    if (d->macroStack.isEmpty()) {
+        d->updateCost(d->index);
+        d->maybeSaveCheckpoint(d->index + 1, d->commandList.at(d->index).cost);
+        d->checkUndoLimit();
+        d->setIndex(d->index + 1, false);
+    }
+}
+
+/*!
+    Starts a batched update of the stack. Until the matching endUpdate(), the
+    stack does not emit indexChanged(), cleanChanged(), canUndoChanged(),
+    undoTextChanged(), canRedoChanged(), redoTextChanged(), memoryUsageChanged()
+    or evictedBytesChanged(), no matter how many commands are pushed, undone or
+    redone, or how often setIndex() is called.
+
+    Unlike beginMacro(), the commands pushed during the update stay separate
+    commands on the stack, and canUndo() and canRedo() keep their usual values.
+
+    Calls to beginUpdate() and endUpdate() can be nested. The signals are
+    emitted when the outermost update ends. Prefer UndoStackUpdateScope over
+    calling these functions directly.
+
+    \since 5.7
+    \sa endUpdate(), UndoStackUpdateScope
+*/
+
+void UndoStack::beginUpdate()
+{
+    Q_D(UndoStack);
+
+    ++d->updateDepth;
+}
+
+/*!
+    Ends a batched update started with beginUpdate().
+
+    When the outermost update ends, a single set of signals is emitted for the
+    net change: indexChanged() if any command modified the document, and each
+    of the other signals if its value differs from the one emitted last. Since
+    UndoGroup forwards these signals, the group only sees the final state.
+
+    \since 5.7
+    \sa beginUpdate(), UndoStackUpdateScope
+*/
+
+void UndoStack::endUpdate()
+{
+    Q_D(UndoStack);
+
+    if (Q_UNLIKELY(d->updateDepth == 0)) {
+        qWarning("UndoStack::endUpdate(): no matching beginUpdate()");
+        return;
+    }
+
+    if (--d->updateDepth > 0)
+        return;
+
+    const bool documentChanged = d->pendingDocumentChange;
+    d->pendingDocumentChange = false;
+    d->notify(documentChanged);
+}
+
+/*!
+    Returns \c true if a batched update started with beginUpdate() is in progress.
+
+    \since 5.7
+    \sa beginUpdate()
+*/
+
+bool UndoStack::isUpdating() const
+{
+    Q_D(const UndoStack);
+    return d->updateDepth > 0;
+}
+
+/*!
+    \enum UndoStack::NotificationMode
+    \since 5.7
+
+    This enum describes when the stack emits the signals that notify about changes
+    of its state.
+
+    \value ImmediateNotification The signals are emitted synchronously from push(),
+    undo(), redo() and the other functions that change the stack. This is the default.
+    \value QueuedNotification The stack only remembers that its state changed, and
+    emits the signals once, from the event loop, for all changes made since they were
+    last emitted.
+*/
+
+/*!
+    \property UndoStack::notificationMode
+    \brief when the stack emits the signals that notify about changes of its state.
+    \since 5.7
+
+    In QueuedNotification mode, any number of calls to push(), undo(), redo(),
+    setIndex() and the other functions that change the stack during one iteration
+    of the event loop result in a single set of signals, emitted the next time
+    control returns to the event loop. This avoids re-evaluating bindings on the
+    properties of the stack many times per frame. The getters, such as canUndo()
+    and undoText(), always return the current values.
+
+    Switching back to ImmediateNotification emits pending signals right away.
+
+    \sa beginUpdate(), UndoGroup::notificationMode
+*/
+
+void UndoStack::setNotificationMode(NotificationMode mode)
+{
+    Q_D(UndoStack);
+
+    if (mode == d->notificationMode)
+        return;
+    d->notificationMode = mode;
+
+    if (mode == ImmediateNotification && d->notificationQueued)
+        d->_q_emitQueuedNotifications();
+}
+
+UndoStack::NotificationMode UndoStack::notificationMode() const
+{
+    Q_D(const UndoStack);
+    return d->notificationMode;
+}
+
+/*!
+    \enum UndoStack::ReclamationMode
+    \since 5.7
+
+    This enum describes how the stack destroys the commands it removes.
+
+    \value ImmediateReclamation Commands are deleted synchronously by the function
+    that removes them. This is the default.
+    \value DeferredReclamation Commands are removed from the stack synchronously,
+    but destroyed in the background.
+*/
+
+/*!
+    \property UndoStack::reclamationMode
+    \brief how the stack destroys the commands that it removes.
+    \since 5.7
+
+    The stack deletes commands when push() or beginMacro() truncate the commands that
+    were undone, when the undo limit or the memory limit evict the oldest commands, and
+    in clear(). Commands that own large buffers or deep trees of child commands can
+    make this slow enough to be noticed.
+
+    In DeferredReclamation mode, these commands are removed from the stack right away,
+    so its state and its signals are exactly the same as in ImmediateReclamation mode,
+    but they are destroyed later:
+
+    \list
+    \li A LightUndoCommand without UndoCommand children is deleted on a thread of
+        QThreadPool::globalInstance(). Its destructor must therefore not access
+        objects that live on the thread of the stack without synchronization.
+        Such commands are collected in a single list that one task works through,
+        so frequent truncations do not queue a task each.
+    \li An UndoCommand, or a command that contains one, is deleted on the thread of
+        the stack, from the event loop, a few commands at a time, so that each
+        slice takes only a few milliseconds.
+    \endlist
+
+    When the stack is destroyed, the commands that are still waiting are deleted
+    right away if they are bound to its thread, and handed to the thread pool
+    otherwise. Use waitForReclamation() to make sure that all commands are
+    destroyed, for example in tests or before unloading a plugin that implements
+    them.
+
+    \sa clear(), setUndoLimit(), memoryLimit, isReclaiming()
+*/
+
+void UndoStack::setReclamationMode(ReclamationMode mode)
+{
+    Q_D(UndoStack);
+    d->reclamationMode = mode;
+}
+
+UndoStack::ReclamationMode UndoStack::reclamationMode() const
+{
+    Q_D(const UndoStack);
+    return d->reclamationMode;
+}
+
+/*!
+    Destroys all commands that the stack removed in DeferredReclamation mode and
+    that are still waiting to be destroyed. Commands bound to the thread of the
+    stack are deleted by this function; for the others, it blocks until the thread
+    pool has deleted them.
+
+    Afterwards, the memory of the commandPool() is released if the stack is empty.
+
+    \since 5.7
+    \sa reclamationMode, isReclaiming()
+*/
+
+void UndoStack::waitForReclamation()
+{
+    Q_D(UndoStack);
+    if (d->reclaimer == 0)
+        return;
+
+    d->reclaimer->waitForDone();
+    if (d->pool != 0 && d->commandList.isEmpty())
+        d->pool->release();
+}
+
+/*!
+    Returns \c true if commands removed in DeferredReclamation mode are still
+    waiting to be destroyed.
+
+    \since 5.7
+    \sa waitForReclamation()
+*/
+
+bool UndoStack::isReclaiming() const
+{
+    Q_D(const UndoStack);
+    return d->reclaimer != 0 && !d->reclaimer->isIdle();
+}
+
+/*!
+  \since 4.4
+
+  Returns a const pointer to the command at \a index.
+
+  This function returns a const pointer, because modifying a command,
+  once it has been pushed onto the stack and executed, almost always
+  causes corruption of the state of the document, if the command is
+  later undone or redone.
+
+  Returns 0 if the command at \a index is a LightUndoCommand that is not an
+  UndoCommand.
+
+  \sa UndoCommand::child()
+*/
+const UndoCommand *UndoStack::command(int index) const
+{
+    Q_D(const UndoStack);
+
+    if (index < 0 || index >= d->commandList.count())
+        return 0;
+    const LightUndoCommand *command = d->residentCommand(d->commandList.at(index).command);
+    return command != 0 ? command->toUndoCommand() : 0;
+}
+
+/*!
+    Returns the memory pool of this stack, creating it on first use.
+
+    Commands allocated from the pool with \c{new (stack->commandPool())} avoid
+    most calls to the system allocator, and their memory is recycled when the
+    stack deletes them because they were truncated, exceeded the undo limit
+    or were cleared. Once the pool exists, the macro commands created by
+    beginMacro() are allocated from it as well.
+
+    The pool is owned by the stack and deleted with it.
+
+    \sa UndoCommandPool, LightUndoCommand::operator new()
+*/
+
+UndoCommandPool *UndoStack::commandPool()
+{
+    Q_D(UndoStack);
+    if (d->pool == 0) {
+        d->pool = new UndoCommandPool;
+        d->commandList.setPool(d->pool);
+    }
+    return d->pool;
+}
+
+/*!
+    Returns the payload store of this stack, creating it on first use.
+
+    Commands that put their payloads into the store with UndoBlobStore::insert()
+    share identical payloads instead of each keeping a copy. A payload is freed when
+    the last command holding it is deleted because it was truncated, evicted or
+    cleared. Stacks of the same group can share UndoGroup::blobStore() instead.
+
+    The store is owned by the stack and deleted with it; payloads still held by
+    commands stay valid until these are deleted.
+
+    \since 5.7
+    \sa UndoBlobStore
+*/
+
+UndoBlobStore *UndoStack::blobStore()
+{
+    Q_D(UndoStack);
+    if (d->blobStore == 0)
+        d->blobStore = new UndoBlobStore;
+    return d->blobStore;
+}
+
+/*!
+    Returns the text of the command at index \a idx.
+
+    \sa beginMacro()
+*/
+
+QString UndoStack::text(int idx) const
+{
+    Q_D(const UndoStack);
+
+    if (idx < 0 || idx >= d->commandList.size())
+        return QString();
+    return d->commandList.textAt(idx);
+}
+
+/*!
+    Returns the sequence number of the command at index \a idx, or 0 if \a idx is out
+    of range.
+
+    Every command gets a sequence number when it is pushed, and a new one when another
+    command is merged into it or, for a macro, when endMacro() is called. Sequence
+    numbers grow across all stacks of the application, so they tell in which order
+    the commands of different stacks were executed. UndoGroup::undoTimeline() and
+    UndoGroup::redoTimeline() use them.
+
+    \since 5.7
+    \sa UndoGroup::undoTimeline()
+*/
+
+quint64 UndoStack::sequenceNumber(int idx) const
+{
+    Q_D(const UndoStack);
+
+    if (idx < 0 || idx >= d->commandList.size())
+        return 0;
+    return d->commandList.sequenceAt(idx);
+}
+
+/*!
+    \property UndoStack::undoLimit
+    \brief the maximum number of commands on this stack.
+    \since 4.3
+
+    When the number of commands on a stack exceedes the stack's undoLimit, commands are
+    deleted from the bottom of the stack. Macro commands (commands with child commands)
+    are treated as one command. The default value is 0, which means that there is no
+    limit.
+
+    The limit can be lowered on a non-empty stack. Commands below the current index are
+    deleted from the bottom first, which keeps the document state, index() and the clean
+    state meaningful; index() and cleanIndex() shift down by the number of deleted
+    commands. The limit bounds the total number of commands on the stack, including
+    the ones that can be redone, so if that is not enough, undone commands are deleted
+    from the top of the stack as well, starting with the one furthest from index().
+    Setting the limit while a macro is being composed takes effect when the macro ends.
+*/
+
+void UndoStack::setUndoLimit(int limit)
+{
+    Q_D(UndoStack);
+
+    if (limit == d->undoLimit)
+        return;
+    d->undoLimit = limit;
+    d->applyLimits();
+}
+
+int UndoStack::undoLimit() const
+{
+    Q_D(const UndoStack);
+
+    return d->undoLimit;
+}
+
+/*!
+    \property UndoStack::memoryLimit
+    \brief the maximum total cost of the commands on this stack, in bytes.
+    \since 5.7
+
+    When the sum of LightUndoCommand::cost() over all commands on the stack exceeds
+    the memoryLimit, commands are deleted from the bottom of the stack until the
+    total fits again. Only commands below the current index are deleted, and the
+    most recently pushed command is always kept, even if its cost alone exceeds
+    the limit. The default value is 0, which means that there is no limit.
+
+    Unlike undoLimit, this property can be changed on a non-empty stack. Lowering
+    it evicts commands immediately.
+
+    \sa memoryUsage, evictedBytes, undoLimit
+*/
+
+void UndoStack::setMemoryLimit(qint64 limit)
+{
+    Q_D(UndoStack);
+
+    if (limit == d->memoryLimit)
+        return;
+    d->memoryLimit = limit;
+    d->applyLimits();
+    emit memoryLimitChanged(limit);
+}
+
+qint64 UndoStack::memoryLimit() const
+{
+    Q_D(const UndoStack);
+
+    return d->memoryLimit;
+}
+
+/*!
+    \property UndoStack::memoryUsage
+    \brief the total cost of the commands on this stack, in bytes.
+    \since 5.7
+
+    This is the sum of LightUndoCommand::cost() over all commands on the stack,
+    plus the checkpointMemoryUsage. The cost of a command is queried when it is
+    pushed, when another command is merged into it and, for a macro, when
+    endMacro() is called.
+
+    \sa memoryLimit, evictedBytes
+*/
+
+qint64 UndoStack::memoryUsage() const
+{
+    Q_D(const UndoStack);
+
+    return d->memoryUsage;
+}
+
+/*!
+    \property UndoStack::evictedBytes
+    \brief the total cost of all commands that were deleted from the bottom of this
+    stack because of the undoLimit or the memoryLimit.
+    \since 5.7
+
+    The value accumulates over the lifetime of the stack; clear() does not reset it.
+
+    \sa memoryUsage, memoryLimit
+*/
+
+qint64 UndoStack::evictedBytes() const
+{
+    Q_D(const UndoStack);
+
+    return d->evictedBytes;
+}
+
+/*!
+    Installs \a handler to save and restore checkpoints of the document, or removes
+    the current handler if \a handler is 0. The stack does not take ownership of the
+    handler. All checkpoints saved by the previous handler are deleted.
+
+    While a handler is installed, the stack saves a checkpoint after every
+    checkpointInterval commands or after commands with a total cost of
+    checkpointCostInterval bytes have been pushed, whichever comes first. setIndex()
+    uses the checkpoints to skip over long runs of commands.
+
+    Checkpoints of states that can no longer be reached, because the commands below
+    them were evicted or the commands leading to them were deleted, are deleted as
+    well.
+
+    \since 5.7
+    \sa UndoCheckpointHandler, checkpointCount(), checkpointMemoryUsage()
+*/
+
+void UndoStack::setCheckpointHandler(UndoCheckpointHandler *handler)
+{
+    Q_D(UndoStack);
+
+    if (handler == d->checkpointHandler)
+        return;
+
+    d->dropCheckpoints(0, d->commandList.count() + 1);
+    d->commandsSinceCheckpoint = 0;
+    d->costSinceCheckpoint = 0;
+    d->checkpointHandler = handler;
+    d->notify(false);
+}
+
+/*!
+    Returns the checkpoint handler of the stack, or 0 if none is installed.
+
+    \since 5.7
+    \sa setCheckpointHandler()
+*/
+
+UndoCheckpointHandler *UndoStack::checkpointHandler() const
+{
+    Q_D(const UndoStack);
+    return d->checkpointHandler;
+}
+
+/*!
+    \property UndoStack::checkpointInterval
+    \brief the number of pushed commands after which a checkpoint is saved.
+    \since 5.7
+
+    The default value is 0, which means that checkpoints are not saved based on the
+    number of commands. Checkpoints are only saved while a checkpoint handler is
+    installed.
+
+    \sa checkpointCostInterval, setCheckpointHandler()
+*/
+
+void UndoStack::setCheckpointInterval(int commands)
+{
+    Q_D(UndoStack);
+    d->checkpointInterval = qMax(0, commands);
+}
+
+int UndoStack::checkpointInterval() const
+{
+    Q_D(const UndoStack);
+    return d->checkpointInterval;
+}
+
+/*!
+    \property UndoStack::checkpointCostInterval
+    \brief the total LightUndoCommand::cost() of the pushed commands after which a
+    checkpoint is saved, in bytes.
+    \since 5.7
+
+    The default value is 0, which means that checkpoints are not saved based on the
+    cost of the commands. Checkpoints are only saved while a checkpoint handler is
+    installed.
+
+    \sa checkpointInterval, setCheckpointHandler()
+*/
+
+void UndoStack::setCheckpointCostInterval(qint64 bytes)
 {
-    Q_Q(UndoStack);
+    Q_D(UndoStack);
+    d->checkpointCostInterval = qMax<qint64>(0, bytes);
+}
 
-    bool wasClean = index == cleanIndex;
+qint64 UndoStack::checkpointCostInterval() const
+{
+    Q_D(const UndoStack);
+    return d->checkpointCostInterval;
+}
 
-    if (idx != index) {
-        index = idx;
-        emit q->indexChanged(index);
-        emit q->canUndoChanged(q->canUndo());
-        emit q->undoTextChanged(q->undoText());
-        emit q->canRedoChanged(q->canRedo());
-        emit q->redoTextChanged(q->redoText());
-    }
+/*!
+    Returns the number of checkpoints the stack currently keeps.
 
-    if (clean)
-        cleanIndex = index;
+    \since 5.7
+    \sa setCheckpointHandler()
+*/
 
-    bool isClean = index == cleanIndex;
-    if (isClean != wasClean)
-        emit q->cleanChanged(isClean);
+int UndoStack::checkpointCount() const
+{
+    Q_D(const UndoStack);
+    return d->checkpoints.size();
 }
 
-/*! \internal
-    If the number of commands on the stack exceedes the undo limit, deletes commands from
-    the bottom of the stack.
+/*!
+    Returns the total UndoCheckpointHandler::checkpointCost() of the checkpoints the
+    stack currently keeps. This is included in memoryUsage.
 
-    Returns \c true if commands were deleted.
+    \since 5.7
+    \sa memoryUsage
 */
 
-bool UndoStackPrivate::checkUndoLimit()
+qint64 UndoStack::checkpointMemoryUsage() const
 {
-    if (undoLimit <= 0 || !macroStack.isEmpty() || undoLimit >= commandList.count())
-        return false;
+    Q_D(const UndoStack);
+    return d->checkpointMemoryUsage;
+}
 
-    int deletedCount = commandList.count() - undoLimit;
+/*!
+    \property UndoStack::branchingEnabled
+    \brief whether the stack keeps undone commands as branches of the history.
+    \since 5.7
 
-    for (int i = 0; i < deletedCount; ++i)
-        delete commandList.takeFirst();
+    Normally, push() deletes the commands that were undone, since they can no longer
+    be redone once a new command was pushed on top of the current one. When branching
+    is enabled, these commands are kept instead, as a branch of the history that
+    forks from the current index. The stack itself always holds a single line of
+    commands, from the oldest one to the tip of the active branch; the other branches
+    are listed by branches() and can be brought back with switchToBranch().
 
-    index -= deletedCount;
-    if (cleanIndex != -1) {
-        if (cleanIndex < deletedCount)
-            cleanIndex = -1; // we've deleted the clean command
-        else
-            cleanIndex -= deletedCount;
+    Branches are deleted when the state they fork from is evicted by the undoLimit or
+    the memoryLimit, when they do not fit into the branchMemoryLimit, and by clear().
+    Disabling branching deletes all branches.
+
+    The default is \c false.
+
+    \sa branches(), switchToBranch(), branchMemoryLimit
+*/
+
+void UndoStack::setBranchingEnabled(bool enabled)
+{
+    Q_D(UndoStack);
+    d->branching = enabled;
+    if (!enabled) {
+        while (!d->branches.isEmpty())
+            d->deleteBranch(d->branches.lastKey());
+        d->branchChildren.clear();
     }
+}
 
-    return true;
+bool UndoStack::isBranchingEnabled() const
+{
+    Q_D(const UndoStack);
+    return d->branching;
 }
 
 /*!
-    Constructs an empty undo stack with the parent \a parent. The
-    stack will initially be in the clean state. If \a parent is a
-    UndoGroup object, the stack is automatically added to the group.
+    Returns the ids of all branches of the history other than the active one, in the
+    order in which they were created.
 
-    \sa push()
+    Each branch forks either from the stack itself, at branchForkIndex(), or from
+    another branch, as returned by branchParent(). The ids stay valid until the branch
+    is deleted or switched to.
+
+    \since 5.7
+    \sa branchingEnabled, switchToBranch()
 */
 
-UndoStack::UndoStack(QObject *parent)
-    : QObject(*(new UndoStackPrivate), parent)
+QVector<int> UndoStack::branches() const
 {
-    if (UndoGroup *group = qobject_cast<UndoGroup*>(parent))
-        group->addStack(this);
+    Q_D(const UndoStack);
+    return d->branches.keys().toVector();
 }
 
 /*!
-    Destroys the undo stack, deleting any commands that are on it. If the
-    stack is in a UndoGroup, the stack is automatically removed from the group.
+    Returns the id of the branch that \a branch forks from, or 0 if it forks from the
+    stack itself.
 
-    \sa UndoStack()
+    \since 5.7
+    \sa branches()
 */
 
-UndoStack::~UndoStack()
+int UndoStack::branchParent(int branch) const
 {
-    Q_D(UndoStack);
-    if (d->group != 0)
-        d->group->removeStack(this);
-    clear();
+    Q_D(const UndoStack);
+    return d->branches.value(branch).parent;
 }
 
 /*!
-    Clears the command stack by deleting all commands on it, and returns the stack
-    to the clean state.
-
-    Commands are not undone or redone; the state of the edited object remains
-    unchanged.
-
-    This function is usually used when the contents of the document are
-    abandoned.
+    Returns the index of the state that \a branch forks from. Its first command
+    follows the command at this index minus one; hence, after switchToBranch(), it is
+    the command at this index. Returns -1 if there is no such branch.
 
-    \sa UndoStack()
+    \since 5.7
+    \sa branchCommandCount()
 */
 
-void UndoStack::clear()
+int UndoStack::branchForkIndex(int branch) const
 {
-    Q_D(UndoStack);
+    Q_D(const UndoStack);
+    QMap<int, UndoStackBranch>::const_iterator it = d->branches.constFind(branch);
+    if (it == d->branches.constEnd())
+        return -1;
+    return int(it->forkPoint - d->baseIndex);
+}
 
-    if (d->commandList.isEmpty())
-        return;
+/*!
+    Returns the number of commands on \a branch, or 0 if there is no such branch.
 
-    bool wasClean = isClean();
+    \since 5.7
+    \sa branchCommand()
+*/
 
-    d->macroStack.clear();
-    qDeleteAll(d->commandList);
-    d->commandList.clear();
+int UndoStack::branchCommandCount(int branch) const
+{
+    Q_D(const UndoStack);
+    return d->branches.value(branch).commands.size();
+}
 
-    d->index = 0;
-    d->cleanIndex = 0;
+/*!
+    Returns the command at \a offset on \a branch, or 0 if there is no such command.
+    The first command of the branch has the offset 0.
 
-    emit indexChanged(0);
-    emit canUndoChanged(false);
-    emit undoTextChanged(QString());
-    emit canRedoChanged(false);
-    emit redoTextChanged(QString());
+    \since 5.7
+    \sa command()
+*/
 
-    if (!wasClean)
-        emit cleanChanged(true);
+const LightUndoCommand *UndoStack::branchCommand(int branch, int offset) const
+{
+    Q_D(const UndoStack);
+    QMap<int, UndoStackBranch>::const_iterator it = d->branches.constFind(branch);
+    if (it == d->branches.constEnd() || offset < 0 || offset >= it->commands.size())
+        return 0;
+    return it->commands.at(offset).command;
 }
 
 /*!
-    Pushes \a cmd on the stack or merges it with the most recently executed command.
-    In either case, executes \a cmd by calling its redo() function.
-
-    If \a cmd's id is not -1, and if the id is the same as that of the
-    most recently executed command, UndoStack will attempt to merge the two
-    commands by calling UndoCommand::mergeWith() on the most recently executed
-    command. If UndoCommand::mergeWith() returns \c true, \a cmd is deleted.
-
-    In all other cases \a cmd is simply pushed on the stack.
+    Makes \a branch the active branch of the history and moves the current index to
+    \a idx, which is an index of the stack after the switch; -1 stands for the tip of
+    the branch.
 
-    If commands were undone before \a cmd was pushed, the current command and
-    all commands above it are deleted. Hence \a cmd always ends up being the
-    top-most on the stack.
+    The stack takes the shortest path: it undoes commands down to the state that is
+    common to the current index and the branch, and redoes commands of the branch from
+    there. The commands of the previously active branch above the common state become
+    a new branch. The index of the clean state moves with its branch.
 
-    Once a command is pushed, the stack takes ownership of it. There
-    are no getters to return the command, since modifying it after it has
-    been executed will almost always lead to corruption of the document's
-    state.
+    The state signals are emitted once, after the switch.
 
-    \sa UndoCommand::id(), UndoCommand::mergeWith()
+    \since 5.7
+    \sa branches(), branchingEnabled
 */
 
-void UndoStack::push(UndoCommand *command)
+void UndoStack::switchToBranch(int branch, int idx)
 {
     Q_D(UndoStack);
-    command->redo();
-
-    const bool macro = !d->macroStack.isEmpty();
-
-    UndoCommand *currentCommand = 0;
-    if (macro) {
-        UndoCommand *macroCommand = d->macroStack.constLast();
-        if (!macroCommand->d_func()->childCommands.isEmpty())
-            currentCommand = macroCommand->d_func()->childCommands.constLast();
-    } else {
-        if (d->index > 0)
-            currentCommand = d->commandList.at(d->index - 1);
-        while (d->index < d->commandList.size())
-            delete d->commandList.takeLast();
-        if (d->cleanIndex > d->index)
-            d->cleanIndex = -1; // we've deleted the clean state
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::switchToBranch(): cannot switch branches in the middle of a macro");
+        return;
+    }
+    if (Q_UNLIKELY(!d->branches.contains(branch))) {
+        qWarning("UndoStack::switchToBranch(): no branch with id %d", branch);
+        return;
     }
 
-    bool tryMerge = currentCommand != 0
-            && currentCommand->id() != -1
-            && currentCommand->id() == command->id()
-            && (macro || d->index != d->cleanIndex);
-
-    if (tryMerge && currentCommand->mergeWith(command)) {
-        delete command;
-        if (!macro) {
-            emit indexChanged(d->index);
-            emit canUndoChanged(canUndo());
-            emit undoTextChanged(undoText());
-            emit canRedoChanged(canRedo());
-            emit redoTextChanged(redoText());
-        }
-    } else {
-        if (macro) {
-            d->macroStack.constLast()->d_func()->childCommands.append(command);
-        } else {
-            d->commandList.append(command);
-            d->checkUndoLimit();
-            d->setIndex(d->index + 1, false);
-        }
+    d->cancelSeek();
+
+    // Switch to each ancestor of the branch in turn, walking only as far as the
+    // fork point of the next one.
+    QVector<int> path;
+    for (int id = branch; id != 0; id = d->branches.value(id).parent)
+        path.prepend(id);
+
+    beginUpdate();
+    for (int i = 0; i < path.size(); ++i) {
+        const int target = i + 1 < path.size()
+                ? int(d->branches.value(path.at(i + 1)).forkPoint - d->baseIndex)
+                : idx;
+        if (!d->switchBranch(path.at(i), target))
+            break;
     }
+    d->checkUndoLimit();
+    d->checkBranchLimit();
+    d->notify(true);
+    endUpdate();
 }
 
 /*!
-    Marks the stack as clean and emits cleanChanged() if the stack was
-    not already clean.
+    \property UndoStack::branchMemoryLimit
+    \brief the maximum total cost of the commands kept on inactive branches.
+    \since 5.7
 
-    Whenever the stack returns to this state through the use of undo/redo
-    commands, it emits the signal cleanChanged(). This signal is also
-    emitted when the stack leaves the clean state.
+    When branchMemoryUsage exceeds this limit, the least recently used branches are
+    deleted, together with the branches that fork from them. The default value is 0,
+    which means that there is no limit.
 
-    \sa isClean(), cleanIndex()
+    \sa branchingEnabled, LightUndoCommand::cost()
 */
 
-void UndoStack::setClean()
+void UndoStack::setBranchMemoryLimit(qint64 limit)
 {
     Q_D(UndoStack);
-    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
-        qWarning("UndoStack::setClean(): cannot set clean in the middle of a macro");
-        return;
-    }
+    d->branchMemoryLimit = limit;
+    d->checkBranchLimit();
+}
 
-    d->setIndex(d->index, true);
+qint64 UndoStack::branchMemoryLimit() const
+{
+    Q_D(const UndoStack);
+    return d->branchMemoryLimit;
 }
 
 /*!
-    If the stack is in the clean state, returns \c true; otherwise returns \c false.
+    Returns the total cost of the commands on inactive branches. This is not included
+    in memoryUsage.
 
-    \sa setClean(), cleanIndex()
+    \since 5.7
+    \sa branchMemoryLimit
 */
 
-bool UndoStack::isClean() const
+qint64 UndoStack::branchMemoryUsage() const
 {
     Q_D(const UndoStack);
-    if (!d->macroStack.isEmpty())
-        return false;
-    return d->cleanIndex == d->index;
+    return d->branchMemoryUsage;
 }
 
 /*!
-    Returns the clean index. This is the index at which setClean() was called.
+    Returns \c true if the command at \a idx can be undone by undoSelectively(), that
+    is, if it has been executed and none of the commands executed after it uses any of
+    its LightUndoCommand::resources().
 
-    A stack may not have a clean index. This happens if a document is saved,
-    some commands are undone, then a new command is pushed. Since
-    push() deletes all the undone commands before pushing the new command, the stack
-    can't return to the clean state again. In this case, this function returns -1.
+    The stack keeps an index from resources to commands, so this takes logarithmic
+    rather than linear time in the number of commands.
 
-    \sa isClean(), setClean()
+    \since 5.7
+    \sa undoSelectively()
 */
 
-int UndoStack::cleanIndex() const
+bool UndoStack::canUndoSelectively(int idx) const
 {
     Q_D(const UndoStack);
-    return d->cleanIndex;
+    if (!d->macroStack.isEmpty() || idx < 0 || idx >= d->index)
+        return false;
+    return !d->hasLaterConflict(idx);
 }
 
 /*!
-    Undoes the command below the current command by calling UndoCommand::undo().
-    Decrements the current command index.
+    Undoes the command at \a idx without undoing the commands executed after it, and
+    returns \c true on success. Returns \c false if canUndoSelectively() returns
+    \c false.
 
-    If the stack is empty, or if the bottom command on the stack has already been
-    undone, this function does nothing.
+    The command stays where it is. The stack pushes a new command on top of it, whose
+    redo() calls the undo() function of the command at \a idx and vice versa, so that
+    the selective undo can itself be undone and redone like any other change. Its text
+    is "Revert" followed by the text of the command at \a idx.
 
-    \sa redo(), index()
+    If the command at \a idx is later removed from the stack while the new command is
+    still on it, for example because of the undo limit, it stays alive as long as the
+    new command, and its cost counts towards memoryUsage() as the cost of the latter.
+
+    \since 5.7
+    \sa canUndoSelectively(), LightUndoCommand::resources()
 */
 
-void UndoStack::undo()
+bool UndoStack::undoSelectively(int idx)
 {
     Q_D(UndoStack);
-    if (d->index == 0)
-        return;
-
     if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
-        qWarning("UndoStack::undo(): cannot undo in the middle of a macro");
-        return;
+        qWarning("UndoStack::undoSelectively(): cannot undo selectively in the middle of a macro");
+        return false;
     }
+    if (!canUndoSelectively(idx))
+        return false;
+    // The inverse command refers to the target by address.
+    if (!d->makeResident(idx))
+        return false;
 
-    int idx = d->index - 1;
-    d->commandList.at(idx)->undo();
-    d->setIndex(idx, false);
+    const UndoStackPrivate::Entry &entry = d->commandList.at(idx);
+    LightUndoCommand *target = entry.command;
+    UndoInverseCommand *inverse = new UndoInverseCommand(target, entry.cost);
+    d->inverses.insert(target, inverse);
+    d->inverseTargets.insert(inverse, target);
+    push(inverse);
+    return true;
 }
 
 /*!
-    Redoes the current command by calling UndoCommand::redo(). Increments the current
-    command index.
+    \property UndoStack::hibernationTimeout
+    \brief the time in milliseconds after which an inactive stack hibernates.
+    \since 5.7
 
-    If the stack is empty, or if the top command on the stack has already been
-    redone, this function does nothing.
+    Most documents of an application are idle most of the time, yet their stacks keep
+    all of their commands in memory. If this property is greater than 0 and the stack
+    belongs to a UndoGroup, the stack calls hibernate() once it has not been the active
+    stack of its group for the given time. When the stack becomes active again, it
+    calls rehydrate().
 
-    \sa undo(), index()
+    The default value is 0, which means that the stack never hibernates on its own.
+
+    \sa hibernate(), rehydrate(), hibernatedCount()
 */
 
-void UndoStack::redo()
+void UndoStack::setHibernationTimeout(int msecs)
 {
     Q_D(UndoStack);
-    if (d->index == d->commandList.size())
-        return;
 
-    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
-        qWarning("UndoStack::redo(): cannot redo in the middle of a macro");
+    if (msecs < 0)
+        msecs = 0;
+    if (msecs == d->hibernationTimeout)
         return;
-    }
+    d->hibernationTimeout = msecs;
+    d->scheduleHibernation();
+    if (msecs == 0)
+        d->rehydrate();
+}
 
-    d->commandList.at(d->index)->redo();
-    d->setIndex(d->index + 1, false);
+int UndoStack::hibernationTimeout() const
+{
+    Q_D(const UndoStack);
+    return d->hibernationTimeout;
 }
 
 /*!
-    Returns the number of commands on the stack. Macro commands are counted as
-    one command.
+    Returns the number of commands of the stack and its branches that are hibernated,
+    that is, that are on disk and have not been read back yet.
 
-    \sa index(), setIndex(), command()
+    \since 5.7
+    \sa hibernate()
 */
 
-int UndoStack::count() const
+int UndoStack::hibernatedCount() const
 {
     Q_D(const UndoStack);
-    return d->commandList.size();
+    return d->hibernatedCommands.size();
 }
 
 /*!
-    Returns the index of the current command. This is the command that will be
-    executed on the next call to redo(). It is not always the top-most command
-    on the stack, since a number of commands may have been undone.
+    Writes the commands on the stack to a file in the temporary directory and deletes
+    them from memory, which lowers memoryUsage. Only commands that are plain
+    LightUndoCommand objects, whose type was registered with
+    LightUndoCommand::registerType(), are written, together with their children. The
+    others stay in memory, as do the commands on branches.
+
+    The text and the id of a hibernated command stay in memory, so undoText(), redoText()
+    and text() work as usual. The command itself is read back the first time it is
+    needed, for example when undo() or redo() reaches it or another command is merged
+    into it, and takes the place of its placeholder again, counting towards
+    memoryUsage. rehydrate() reads all of them back at once. If a command cannot be
+    read back, a warning is printed and undo(), redo(), setIndex() and seekIndex()
+    stop at it instead of moving the index past it.
+
+    Nothing is hibernated while a macro is being composed or seekIndex() is seeking.
 
-    \sa undo(), redo(), count()
+    \since 5.7
+    \sa hibernationTimeout, rehydrate(), hibernatedCount()
 */
 
-int UndoStack::index() const
+void UndoStack::hibernate()
+{
+    Q_D(UndoStack);
+    d->hibernate();
+}
+
+/*!
+    Reads all hibernated commands on the stack back into memory. Commands on branches
+    are read back when they are needed.
+
+    \since 5.7
+    \sa hibernate()
+*/
+
+void UndoStack::rehydrate()
+{
+    Q_D(UndoStack);
+    d->rehydrate();
+}
+
+/*!
+    Compresses all commands on the stack that can be compressed, except the ones that
+    undo() and redo() would execute next, and waits until they are compressed. This is
+    useful when the document is put aside, or to measure the effect of compression.
+
+    Nothing is compressed while a macro is being composed or seekIndex() is seeking.
+
+    \since 5.7
+    \sa compressionDepth, compressionTimeout
+*/
+
+void UndoStack::compressCommands()
+{
+    Q_D(UndoStack);
+    if (!d->macroStack.isEmpty() || d->seeking)
+        return;
+
+    const qint64 usage = d->memoryUsage;
+    d->compressRange(0, d->index - 1);
+    d->compressRange(d->index + 1, d->commandList.size());
+    if (d->compressor != 0)
+        d->compressor->waitForDone();
+    d->finishCompression();
+    if (d->memoryUsage != usage)
+        d->notify(false);
+}
+
+/*!
+    Writes the commands on the stack, the index and the clean index to \a device.
+    Returns \c true on success; otherwise returns \c false.
+
+    Every command on the stack, and every child command, must have a type registered
+    with LightUndoCommand::registerType(), or be a macro created by beginMacro(); if
+    one has not, nothing is written. Each distinct command text is written once.
+    Branches and checkpoints are not written.
+
+    The data starts with a format version, and load() reads the data written by this
+    version of the library and by earlier ones.
+
+    \since 5.7
+    \sa load(), LightUndoCommand::save()
+*/
+
+bool UndoStack::save(QIODevice *device) const
 {
     Q_D(const UndoStack);
-    return d->index;
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::save(): cannot save in the middle of a macro");
+        return false;
+    }
+
+    const int unsavable = d->firstUnsavable();
+    if (Q_UNLIKELY(unsavable != -1)) {
+        qWarning("UndoStack::save(): the command at index %d cannot be saved", unsavable);
+        return false;
+    }
+
+    QDataStream stream(device);
+    stream.setVersion(QDataStream::Qt_5_6);
+    d->writeHistory(stream);
+    if (Q_UNLIKELY(stream.status() != QDataStream::Ok)) {
+        qWarning("UndoStack::save(): cannot write to the device");
+        return false;
+    }
+    return true;
 }
 
 /*!
-    Repeatedly calls undo() or redo() until the current command index reaches
-    \a idx. This function can be used to roll the state of the document forwards
-    of backwards. indexChanged() is emitted only once.
+    Replaces the commands on the stack by the ones that save() wrote to \a device and
+    restores the index and the clean index. Returns \c true on success; otherwise
+    returns \c false and leaves the stack unchanged.
 
-    \sa index(), count(), undo(), redo()
+    The commands are recreated with the functions registered with
+    LightUndoCommand::registerType(). They are not executed: the document is expected
+    to be in the state it was in when the history was saved, which is usually ensured
+    by saving the history together with the document. The undo limit and the memory
+    limit apply to the loaded commands.
+
+    \since 5.7
+    \sa save()
 */
 
-void UndoStack::setIndex(int idx)
+bool UndoStack::load(QIODevice *device)
 {
     Q_D(UndoStack);
     if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
-        qWarning("UndoStack::setIndex(): cannot set index in the middle of a macro");
-        return;
+        qWarning("UndoStack::load(): cannot load in the middle of a macro");
+        return false;
     }
 
-    if (idx < 0)
-        idx = 0;
-    else if (idx > d->commandList.size())
-        idx = d->commandList.size();
-
-    int i = d->index;
-    while (i < idx)
-        d->commandList.at(i++)->redo();
-    while (i > idx)
-        d->commandList.at(--i)->undo();
+    // Read at once, so that the records are decoded from memory.
+    const QByteArray data = device->readAll();
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
 
-    d->setIndex(idx, false);
+    QVector<LightUndoCommand*> commands;
+    int index;
+    int cleanIndex;
+    if (!d->readHistory(stream, "UndoStack::load()", &commands, &index, &cleanIndex))
+        return false;
+    d->installHistory(commands, index, cleanIndex);
+    return true;
 }
 
 /*!
-    Returns \c true if there is a command available for undo; otherwise returns \c false.
-
-    This function returns \c false if the stack is empty, or if the bottom command
-    on the stack has already been undone.
+    Writes the commands on the stack, the index and the clean index to the file
+    \a fileName in a format that openMapped() maps into memory. Returns \c true on
+    success; otherwise returns \c false and leaves the file unchanged.
 
-    Synonymous with index() == 0.
+    The commands must be able to be saved, as with save(). Unlike save(), each command
+    is written on its own together with its text, and the file starts with an index of
+    the position of every command, so that openMapped() can find any of them without
+    reading the others. The file is therefore somewhat larger than the data that save()
+    writes.
 
-    \sa index(), canRedo()
+    \since 5.7
+    \sa openMapped(), save()
 */
 
-bool UndoStack::canUndo() const
+bool UndoStack::saveMapped(const QString &fileName) const
 {
     Q_D(const UndoStack);
-    if (!d->macroStack.isEmpty())
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::saveMapped(): cannot save in the middle of a macro");
         return false;
-    return d->index > 0;
+    }
+
+    const int unsavable = d->firstUnsavable();
+    if (Q_UNLIKELY(unsavable != -1)) {
+        qWarning("UndoStack::saveMapped(): the command at index %d cannot be saved", unsavable);
+        return false;
+    }
+
+    QVector<const LightUndoCommand*> commands;
+    commands.reserve(d->commandList.size());
+    for (int i = 0; i < d->commandList.size(); ++i)
+        commands.append(d->residentCommand(d->commandList.at(i).command));
+
+    QSaveFile file(fileName);
+    if (Q_UNLIKELY(!file.open(QIODevice::WriteOnly)
+                   || !UndoMappedHistory::write(&file, commands, d->index, d->cleanIndex)
+                   || !file.commit())) {
+        qWarning("UndoStack::saveMapped(): cannot write %s", qPrintable(fileName));
+        return false;
+    }
+    return true;
 }
 
 /*!
-    Returns \c true if there is a command available for redo; otherwise returns \c false.
+    Replaces the commands on the stack by the ones that saveMapped() wrote to the file
+    \a fileName and restores the index and the clean index. Returns \c true on
+    success; otherwise returns \c false and leaves the stack unchanged.
+
+    The file is mapped into memory instead of being read. Only its header is read when
+    it is opened, so opening takes the same time for any number of commands. The stack
+    holds nothing for a command until it is accessed: text(), undoText() and
+    redoText() read the text of a command from the file, and a small placeholder,
+    allocated from commandPool() if the stack has created its pool, is only created
+    for a command that is undone, redone or returned by command(). The
+    command itself is then recreated with the function registered with
+    LightUndoCommand::registerType(). The memory used by the stack thus grows only
+    with the commands that are actually visited. A command counts towards memoryUsage
+    once it has been undone, redone or merged into. Until a command has been read, its
+    id is -1, so that no command is merged into it, and it conflicts with all other
+    commands for undoSelectively(). Commands that have not been read are not
+    hibernated, since they are already on disk. If a command cannot be read, a warning
+    is printed and undo(), redo() and setIndex() stop at it.
+
+    As with load(), the commands are not executed when the file is opened. The file
+    stays mapped until every command of it has been removed from the stack and its
+    branches, and must not be modified in the meantime; saveMapped() replaces it with
+    a new file, which is safe on systems that allow a mapped file to be replaced.
+    While a journal is open, the stack writes a snapshot of the whole history to it,
+    which reads every command.
 
-    This function returns \c false if the stack is empty or if the top command
-    on the stack has already been redone.
+    \since 5.7
+    \sa saveMapped(), load()
+*/
 
-    Synonymous with index() == count().
+bool UndoStack::openMapped(const QString &fileName)
+{
+    Q_D(UndoStack);
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::openMapped(): cannot open a history in the middle of a macro");
+        return false;
+    }
 
-    \sa index(), canUndo()
+    const QExplicitlySharedDataPointer<UndoMappedHistory> history(new UndoMappedHistory);
+    if (!history->open(fileName, "UndoStack::openMapped()"))
+        return false;
+
+    // As installHistory() does, but the commands only get entries once they are
+    // accessed.
+    beginUpdate();
+    clear();
+    d->commandList.map(history.data(), UndoStackPrivate::nextSequence(history->count()),
+                       &d->mappedCommands);
+    d->index = history->index();
+    d->cleanIndex = history->cleanIndex();
+    d->checkUndoLimit();
+    d->notify(true);
+    endUpdate();
+    return true;
+}
+
+/*!
+    Starts recording the changes to the stack in the journal file \a fileName, so
+    that recoverJournal() can restore the stack and the document after a crash.
+    Returns \c true on success; otherwise returns \c false. Any previous journal of
+    the stack is closed first.
+
+    The file is replaced by a snapshot of the current history, written as by save().
+    After that, every change to the stack, such as a push, a merge, an undo, a redo,
+    a call to setClean() or the eviction of commands, appends a record to the file.
+    The records are encoded in memory and written by a background thread in batches,
+    at least every few hundred milliseconds, and the file is synced to disk about once
+    a second, so push() never waits for the disk. A crash loses at most the changes of
+    the last second. While a macro is being composed, nothing is recorded; the macro
+    is recorded as a whole by endMacro().
+
+    When the records appended since the last snapshot take up more than
+    journalCompactionThreshold bytes, and more than the snapshot itself, the file is
+    replaced by a new snapshot.
+
+    Every command must be able to be saved, as with save(). If a command that cannot
+    be saved is pushed, the journal is closed with a warning; it then still describes
+    the stack as it was before that command. Branches are not recorded.
+
+    \since 5.7
+    \sa closeJournal(), recoverJournal(), journalFileName()
 */
 
-bool UndoStack::canRedo() const
+bool UndoStack::openJournal(const QString &fileName)
 {
-    Q_D(const UndoStack);
-    if (!d->macroStack.isEmpty())
+    Q_D(UndoStack);
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::openJournal(): cannot open a journal in the middle of a macro");
         return false;
-    return d->index < d->commandList.size();
+    }
+
+    d->closeJournal();
+    d->journal = new UndoJournal(fileName);
+    if (!d->writeJournalSnapshot())
+        return false;
+    d->journal->waitForDone();
+    if (Q_UNLIKELY(d->journal->hasFailed())) {
+        qWarning("UndoStack::openJournal(): cannot write %s", qPrintable(fileName));
+        d->closeJournal();
+        return false;
+    }
+    return true;
 }
 
 /*!
-    Returns the text of the command which will be undone in the next call to undo().
+    Writes the records that are not on disk yet to the journal, and stops recording
+    changes. The file is kept; it describes the stack as it is when this function is
+    called. The destructor of the stack closes the journal before it deletes the
+    commands.
 
-    \sa UndoCommand::text(), redoText()
+    \since 5.7
+    \sa openJournal()
 */
 
-QString UndoStack::undoText() const
+void UndoStack::closeJournal()
 {
-    Q_D(const UndoStack);
-    if (!d->macroStack.isEmpty())
-        return QString();
-    if (d->index > 0)
-        return d->commandList.at(d->index - 1)->text();
-    return QString();
+    Q_D(UndoStack);
+    d->closeJournal();
 }
 
 /*!
-    Returns the text of the command which will be redone in the next call to redo().
+    Returns the name of the journal file that the stack records its changes in, or an
+    empty string if it has none.
 
-    \sa UndoCommand::text(), undoText()
+    \since 5.7
+    \sa openJournal()
 */
 
-QString UndoStack::redoText() const
+QString UndoStack::journalFileName() const
 {
     Q_D(const UndoStack);
-    if (!d->macroStack.isEmpty())
-        return QString();
-    if (d->index < d->commandList.size())
-        return d->commandList.at(d->index)->text();
-    return QString();
+    return d->journal != 0 ? d->journal->fileName() : QString();
 }
 
 /*!
-    Begins composition of a macro command with the given \a text description.
-
-    An empty command described by the specified \a text is pushed on the stack.
-    Any subsequent commands pushed on the stack will be appended to the empty
-    command's children until endMacro() is called.
+    \property UndoStack::journalCompactionThreshold
+    \brief the number of bytes of records after which the journal is compacted.
 
-    Calls to beginMacro() and endMacro() may be nested, but every call to
-    beginMacro() must have a matching call to endMacro().
+    When the records appended to the journal since its last snapshot take up more than
+    this number of bytes, and more than the snapshot itself, the stack replaces the
+    file by a new snapshot of its history with the next change. Encoding the snapshot
+    takes time proportional to the length of the history, on the thread of the stack;
+    since it happens only after as many bytes of records, it costs at most as much as
+    encoding the records did.
 
-    While a macro is composed, the stack is disabled. This means that:
-    \list
-    \li indexChanged() and cleanChanged() are not emitted,
-    \li canUndo() and canRedo() return false,
-    \li calling undo() or redo() has no effect,
-    \li the undo/redo actions are disabled.
-    \endlist
+    The default value is 8 MB. A value of 0 or less means the journal is never compacted.
 
-    The stack becomes enabled and appropriate signals are emitted when endMacro()
-    is called for the outermost macro.
+    \since 5.7
+    \sa openJournal()
+*/
 
-    \snippet code/src_gui_util_qundostack.cpp 4
+void UndoStack::setJournalCompactionThreshold(qint64 bytes)
+{
+    Q_D(UndoStack);
+    d->journalCompactionThreshold = bytes;
+}
 
-    This code is equivalent to:
+qint64 UndoStack::journalCompactionThreshold() const
+{
+    Q_D(const UndoStack);
+    return d->journalCompactionThreshold;
+}
 
-    \snippet code/src_gui_util_qundostack.cpp 5
+/*!
+    Replaces the commands on the stack by the history recorded in the journal file
+    \a fileName, and brings the document to the state it was in when the last record
+    was written. Returns \c true on success; otherwise returns \c false and leaves the
+    stack unchanged.
+
+    The document must be in its clean state, that is, the state it was last saved in
+    while the journal was recorded, which is what the application finds on disk after
+    a crash. The stack redoes or undoes the commands between the clean index and the
+    recorded index to reach the state at the time of the crash. If the clean state
+    is no longer part of the recorded history, the document cannot be brought up to
+    date and the function fails. The undo limit and the memory limit apply to the
+    recovered commands once that state is reached.
+
+    Records at the end of the file that were only partly written when the application
+    crashed are ignored.
+
+    \code
+    document->open(fileName);
+    UndoStack *stack = new UndoStack(document);
+    if (QFile::exists(journalName))
+        stack->recoverJournal(journalName);
+    stack->openJournal(journalName);
+    \endcode
 
-    \sa endMacro()
+    \since 5.7
+    \sa openJournal()
 */
 
-void UndoStack::beginMacro(const QString &text)
+bool UndoStack::recoverJournal(const QString &fileName)
 {
     Q_D(UndoStack);
-    UndoCommand *command = new UndoCommand();
-    command->setText(text);
+    if (Q_UNLIKELY(!d->macroStack.isEmpty())) {
+        qWarning("UndoStack::recoverJournal(): cannot recover in the middle of a macro");
+        return false;
+    }
 
-    if (d->macroStack.isEmpty()) {
-        while (d->index < d->commandList.size())
-            delete d->commandList.takeLast();
-        if (d->cleanIndex > d->index)
-            d->cleanIndex = -1; // we've deleted the clean state
-        d->commandList.append(command);
-    } else {
-        d->macroStack.constLast()->d_func()->childCommands.append(command);
+    QFile file(fileName);
+    if (Q_UNLIKELY(!file.open(QIODevice::ReadOnly))) {
+        qWarning("UndoStack::recoverJournal(): cannot open %s", qPrintable(fileName));
+        return false;
+    }
+    const QByteArray data = file.readAll();
+    file.close();
+    QDataStream stream(data);
+    stream.setVersion(QDataStream::Qt_5_6);
+    if (Q_UNLIKELY(!UndoJournal::readHeader(stream))) {
+        qWarning("UndoStack::recoverJournal(): %s is not an undo journal", qPrintable(fileName));
+        return false;
     }
-    d->macroStack.append(command);
 
-    if (d->macroStack.count() == 1) {
-        emit canUndoChanged(false);
-        emit undoTextChanged(QString());
-        emit canRedoChanged(false);
-        emit redoTextChanged(QString());
+    QVector<LightUndoCommand*> commands;
+    int index = 0;
+    int cleanIndex = 0;
+    if (!d->replayJournal(stream, &commands, &index, &cleanIndex))
+        return false;
+    if (Q_UNLIKELY(cleanIndex == -1)) {
+        qWarning("UndoStack::recoverJournal(): the clean state is not part of the journal");
+        qDeleteAll(commands);
+        return false;
     }
+
+    // The document is in the clean state. The limits apply once the recorded index is
+    // reached, since evicting commands from the bottom first would shift that index.
+    beginUpdate();
+    d->installHistory(commands, cleanIndex, cleanIndex, false);
+    setIndex(index);
+    d->checkUndoLimit();
+    d->notify(false);
+    endUpdate();
+    return true;
 }
 
 /*!
-    Ends composition of a macro command.
+    Installs \a codec to compress commands, or restores the default codec if \a codec
+    is 0. The stack does not take ownership of the codec, which must stay alive while
+    it is installed.
 
-    If this is the outermost macro in a set nested macros, this function emits
-    indexChanged() once for the entire macro command.
+    The commands that were compressed with the previous codec are decompressed first,
+    and the function waits for compressions in progress. Install the codec before
+    compression is enabled to avoid this.
 
-    \sa beginMacro()
+    \since 5.7
+    \sa UndoCompressionCodec, compressionDepth, compressionTimeout
 */
 
-void UndoStack::endMacro()
+void UndoStack::setCompressionCodec(UndoCompressionCodec *codec)
 {
     Q_D(UndoStack);
-    if (Q_UNLIKELY(d->macroStack.isEmpty())) {
-        qWarning("UndoStack::endMacro(): no matching beginMacro()");
+    if (codec == d->compressionCodec)
         return;
-    }
-
-    d->macroStack.removeLast();
-
-    if (d->macroStack.isEmpty()) {
-        d->checkUndoLimit();
-        d->setIndex(d->index + 1, false);
-    }
+    d->decompressAll();
+    d->compressionCodec = codec;
 }
 
 /*!
-  \since 4.4
-
-  Returns a const pointer to the command at \a index.
-
-  This function returns a const pointer, because modifying a command,
-  once it has been pushed onto the stack and executed, almost always
-  causes corruption of the state of the document, if the command is
-  later undone or redone.
+    Returns the codec installed with setCompressionCodec(), or 0 if the stack uses the
+    default UndoCompressionCodec.
 
-  \sa UndoCommand::child()
+    \since 5.7
 */
-const UndoCommand *UndoStack::command(int index) const
+
+UndoCompressionCodec *UndoStack::compressionCodec() const
 {
     Q_D(const UndoStack);
-
-    if (index < 0 || index >= d->commandList.count())
-        return 0;
-    return d->commandList.at(index);
+    return d->compressionCodec;
 }
 
 /*!
-    Returns the text of the command at index \a idx.
+    \property UndoStack::compressionDepth
+    \brief the number of commands below the index that are kept uncompressed.
+
+    When this property is greater than 0, a command that falls more than this number
+    of commands below the index is compressed in memory. The stack writes the command
+    as UndoStack::save() does, deletes it, and has a thread of the global thread pool
+    compress the data with the compressionCodec(). When undo() or setIndex() reaches
+    the command again, it is decompressed and recreated with the function registered
+    with LightUndoCommand::registerType(); this adds the time to decompress and read
+    it to the first undo, and the command is compressed again once it falls below the
+    depth again.
+
+    This suits commands with large payloads, such as bitmaps or meshes, that are kept
+    for a long time but seldom undone. Only commands that hibernate() could write to
+    disk are compressed: the types of the command and its children must be registered,
+    and UndoCommand objects are left alone. The text and the id of a compressed
+    command stay in memory. While a command is compressed, the size of its data
+    replaces its cost in memoryUsage.
+
+    The default value is 0, which means that commands are not compressed because of
+    their depth.
 
-    \sa beginMacro()
+    \since 5.7
+    \sa compressionTimeout, compressCommands(), setCompressionCodec()
 */
 
-QString UndoStack::text(int idx) const
+void UndoStack::setCompressionDepth(int depth)
 {
-    Q_D(const UndoStack);
+    Q_D(UndoStack);
+    if (depth < 0)
+        depth = 0;
+    if (depth == d->compressionDepth)
+        return;
+    d->compressionDepth = depth;
+    d->compressionMark = d->baseIndex;
+    if (depth > 0)
+        d->notify(false);
+}
 
-    if (idx < 0 || idx >= d->commandList.size())
-        return QString();
-    return d->commandList.at(idx)->text();
+int UndoStack::compressionDepth() const
+{
+    Q_D(const UndoStack);
+    return d->compressionDepth;
 }
 
 /*!
-    \property UndoStack::undoLimit
-    \brief the maximum number of commands on this stack.
-    \since 4.3
+    \property UndoStack::compressionTimeout
+    \brief the time in milliseconds after which commands that were not executed are
+    compressed.
 
-    When the number of commands on a stack exceedes the stack's undoLimit, commands are
-    deleted from the bottom of the stack. Macro commands (commands with child commands)
-    are treated as one command. The default value is 0, which means that there is no
-    limit.
+    When this property is greater than 0, the stack compresses, as described for
+    compressionDepth, the commands that undo(), redo() and setIndex() have not executed
+    for this long. The commands just below and at the index, which undo() and redo()
+    would execute next, are not compressed. The stack checks for such commands while
+    its index moves, and once more after the index stopped moving.
+
+    The default value is 0, which means that commands are not compressed because of
+    their age.
 
-    This property may only be set when the undo stack is empty, since setting it on a
-    non-empty stack might delete the command at the current index. Calling setUndoLimit()
-    on a non-empty stack prints a warning and does nothing.
+    \since 5.7
+    \sa compressionDepth, compressCommands()
 */
 
-void UndoStack::setUndoLimit(int limit)
+void UndoStack::setCompressionTimeout(int msecs)
 {
     Q_D(UndoStack);
-
-    if (Q_UNLIKELY(!d->commandList.isEmpty())) {
-        qWarning("UndoStack::setUndoLimit(): an undo limit can only be set when the stack is empty");
-        return;
-    }
-
-    if (limit == d->undoLimit)
+    if (msecs < 0)
+        msecs = 0;
+    if (msecs == d->compressionTimeout)
         return;
-    d->undoLimit = limit;
-    d->checkUndoLimit();
+    d->compressionTimeout = msecs;
+    d->touchedLow = d->baseIndex + d->index;
+    d->touchedHigh = d->touchedLow;
+    d->touchedSinceTick = false;
+    if (msecs > 0 && !d->commandList.isEmpty())
+        d->compressionTimer.start(msecs, this);
+    else
+        d->compressionTimer.stop();
 }
 
-int UndoStack::undoLimit() const
+int UndoStack::compressionTimeout() const
 {
     Q_D(const UndoStack);
+    return d->compressionTimeout;
+}
 
-    return d->undoLimit;
+/*!
+    \reimp
+*/
+
+void UndoStack::timerEvent(QTimerEvent *event)
+{
+    Q_D(UndoStack);
+
+    if (event->timerId() == d->hibernationTimer.timerId())
+        d->hibernate();
+    else if (event->timerId() == d->journalTimer.timerId())
+        d->flushJournal();
+    else if (event->timerId() == d->compressionTimer.timerId())
+        d->compressUntouched();
+    else
+        QObject::timerEvent(event);
 }
 
 /*!
@@ -696,4 +4199,104 @@ bool UndoStack::isActive() const
     \a canRedo specifies the new value.
 */
 
+/*!
+    \fn void UndoStack::seekProgress(int index, int target)
+    \since 5.7
+
+    This signal is emitted after every slice of seekIndex(). \a index is the current
+    index and \a target the index that is being moved towards.
+*/
+
+/*!
+    \fn void UndoStack::seekFinished()
+    \since 5.7
+
+    This signal is emitted when seekIndex() has reached its target, after the deferred
+    state signals.
+*/
+
+/*!
+    \fn void UndoStack::memoryLimitChanged(qint64 memoryLimit)
+    \since 5.7
+
+    This signal is emitted whenever the value of memoryLimit() changes.
+    \a memoryLimit specifies the new value.
+*/
+
+/*!
+    \fn void UndoStack::memoryUsageChanged(qint64 memoryUsage)
+    \since 5.7
+
+    This signal is emitted whenever the value of memoryUsage() changes.
+    \a memoryUsage specifies the new value.
+*/
+
+/*!
+    \fn void UndoStack::evictedBytesChanged(qint64 evictedBytes)
+    \since 5.7
+
+    This signal is emitted whenever commands are deleted from the bottom of the
+    stack because of the undo limit or the memory limit.
+    \a evictedBytes specifies the new total.
+*/
+
+/*!
+    \class UndoStackUpdateScope
+    \brief The UndoStackUpdateScope class defers the signals of an UndoStack
+    for the lifetime of a scope.
+    \since 5.7
+
+    UndoStackUpdateScope is an RAII wrapper around UndoStack::beginUpdate() and
+    UndoStack::endUpdate(). It is useful when a single user action pushes many
+    commands that should stay separate on the stack, for example when importing
+    a file and then undoing part of it:
+
+    \code
+    {
+        UndoStackUpdateScope scope(stack);
+        for (const Item &item : items)
+            stack->push(new AddItemCommand(document, item));
+        stack->setIndex(stack->index() - rejectedCount);
+    } // one set of signals is emitted here
+    \endcode
+
+    \sa UndoStack::beginUpdate()
+*/
+
+/*!
+    Starts a batched update of \a stack.
+*/
+
+UndoStackUpdateScope::UndoStackUpdateScope(UndoStack *stack) :
+    m_stack(stack)
+{
+    if (m_stack != 0)
+        m_stack->beginUpdate();
+}
+
+/*!
+    Ends the batched update, unless commit() was called already.
+*/
+
+UndoStackUpdateScope::~UndoStackUpdateScope()
+{
+    commit();
+}
+
+/*!
+    Ends the batched update before the end of the scope, emitting the
+    deferred signals. Calling it more than once has no effect.
+*/
+
+void UndoStackUpdateScope::commit()
+{
+    if (m_stack != 0) {
+        UndoStack *stack = m_stack;
+        m_stack = 0;
+        stack->endUpdate();
+    }
+}
+
 QT_END_NAMESPACE
+
+#include "moc_undostack.cpp"
@@ -2,11 +2,18 @@
 #define UNDOSTACK_H
 
 #include <QObject>
+#include <QtCore/qvector.h>
 #include <QtUndo/undo_global.h>
 
 QT_BEGIN_NAMESPACE
 
+class LightUndoCommand;
+class QIODevice;
+class UndoCheckpointHandler;
 class UndoCommand;
+class UndoBlobStore;
+class UndoCommandPool;
+class UndoCompressionCodec;
 
 class UndoStackPrivate;
 
@@ -18,13 +25,40 @@ class Q_UNDO_EXPORT UndoStack : public QObject
     Q_PROPERTY(QString undoText READ undoText NOTIFY undoTextChanged)
     Q_PROPERTY(QString redoText READ redoText NOTIFY redoTextChanged)
     Q_PROPERTY(bool clean READ isClean NOTIFY cleanChanged)
+    Q_PROPERTY(qint64 memoryLimit READ memoryLimit WRITE setMemoryLimit NOTIFY memoryLimitChanged)
+    Q_PROPERTY(qint64 memoryUsage READ memoryUsage NOTIFY memoryUsageChanged)
+    Q_PROPERTY(qint64 evictedBytes READ evictedBytes NOTIFY evictedBytesChanged)
+    Q_PROPERTY(int checkpointInterval READ checkpointInterval WRITE setCheckpointInterval)
+    Q_PROPERTY(qint64 checkpointCostInterval READ checkpointCostInterval WRITE setCheckpointCostInterval)
+    Q_PROPERTY(bool branchingEnabled READ isBranchingEnabled WRITE setBranchingEnabled)
+    Q_PROPERTY(qint64 branchMemoryLimit READ branchMemoryLimit WRITE setBranchMemoryLimit)
+    Q_PROPERTY(int seekTimeBudget READ seekTimeBudget WRITE setSeekTimeBudget)
+    Q_PROPERTY(NotificationMode notificationMode READ notificationMode WRITE setNotificationMode)
+    Q_PROPERTY(ReclamationMode reclamationMode READ reclamationMode WRITE setReclamationMode)
+    Q_PROPERTY(int hibernationTimeout READ hibernationTimeout WRITE setHibernationTimeout)
+    Q_PROPERTY(qint64 journalCompactionThreshold READ journalCompactionThreshold WRITE setJournalCompactionThreshold)
+    Q_PROPERTY(int compressionDepth READ compressionDepth WRITE setCompressionDepth)
+    Q_PROPERTY(int compressionTimeout READ compressionTimeout WRITE setCompressionTimeout)
 
 public:
+    enum NotificationMode {
+        ImmediateNotification,
+        QueuedNotification
+    };
+    Q_ENUM(NotificationMode)
+
+    enum ReclamationMode {
+        ImmediateReclamation,
+        DeferredReclamation
+    };
+    Q_ENUM(ReclamationMode)
+
     explicit UndoStack(QObject *parent = nullptr);
     ~UndoStack();
 
     void clear();
-    void push(UndoCommand *command);
+    void push(LightUndoCommand *command);
+    void push(const QVector<LightUndoCommand*> &commands);
 
     bool canUndo() const;
     bool canRedo() const;
@@ -34,6 +68,7 @@ public:
     int count() const;
     int index() const;
     QString text(int idx) const;
+    quint64 sequenceNumber(int idx) const;
 
     bool isActive() const;
     bool isClean() const;
@@ -42,17 +77,94 @@ public:
     void beginMacro(const QString &text);
     void endMacro();
 
+    void beginUpdate();
+    void endUpdate();
+    bool isUpdating() const;
+
+    bool isSeeking() const;
+    int seekTarget() const;
+    void setSeekTimeBudget(int msecs);
+    int seekTimeBudget() const;
+
+    void setNotificationMode(NotificationMode mode);
+    NotificationMode notificationMode() const;
+
+    void setReclamationMode(ReclamationMode mode);
+    ReclamationMode reclamationMode() const;
+    void waitForReclamation();
+    bool isReclaiming() const;
+
     void setUndoLimit(int limit);
     int undoLimit() const;
 
+    void setMemoryLimit(qint64 limit);
+    qint64 memoryLimit() const;
+    qint64 memoryUsage() const;
+    qint64 evictedBytes() const;
+
+    void setCheckpointHandler(UndoCheckpointHandler *handler);
+    UndoCheckpointHandler *checkpointHandler() const;
+    void setCheckpointInterval(int commands);
+    int checkpointInterval() const;
+    void setCheckpointCostInterval(qint64 bytes);
+    qint64 checkpointCostInterval() const;
+    int checkpointCount() const;
+    qint64 checkpointMemoryUsage() const;
+
+    void setBranchingEnabled(bool enabled);
+    bool isBranchingEnabled() const;
+    QVector<int> branches() const;
+    int branchParent(int branch) const;
+    int branchForkIndex(int branch) const;
+    int branchCommandCount(int branch) const;
+    const LightUndoCommand *branchCommand(int branch, int offset) const;
+    void switchToBranch(int branch, int idx = -1);
+    void setBranchMemoryLimit(qint64 limit);
+    qint64 branchMemoryLimit() const;
+    qint64 branchMemoryUsage() const;
+
+    bool canUndoSelectively(int idx) const;
+    bool undoSelectively(int idx);
+
+    void setHibernationTimeout(int msecs);
+    int hibernationTimeout() const;
+    int hibernatedCount() const;
+
+    bool save(QIODevice *device) const;
+    bool load(QIODevice *device);
+    bool saveMapped(const QString &fileName) const;
+    bool openMapped(const QString &fileName);
+
+    bool openJournal(const QString &fileName);
+    void closeJournal();
+    QString journalFileName() const;
+    void setJournalCompactionThreshold(qint64 bytes);
+    qint64 journalCompactionThreshold() const;
+    bool recoverJournal(const QString &fileName);
+
+    void setCompressionCodec(UndoCompressionCodec *codec);
+    UndoCompressionCodec *compressionCodec() const;
+    void setCompressionDepth(int depth);
+    int compressionDepth() const;
+    void setCompressionTimeout(int msecs);
+    int compressionTimeout() const;
+
     const UndoCommand *command(int index) const;
 
+    UndoCommandPool *commandPool();
+    UndoBlobStore *blobStore();
+
 public Q_SLOTS:
     void setClean();
     void setIndex(int idx);
+    void seekIndex(int idx);
+    void cancelSeek();
     void undo();
     void redo();
     void setActive(bool active = true);
+    void hibernate();
+    void rehydrate();
+    void compressCommands();
 
 Q_SIGNALS:
     void indexChanged(int idx);
@@ -61,13 +173,38 @@ Q_SIGNALS:
     void canRedoChanged(bool canRedo);
     void undoTextChanged(const QString &undoText);
     void redoTextChanged(const QString &redoText);
+    void memoryLimitChanged(qint64 memoryLimit);
+    void memoryUsageChanged(qint64 memoryUsage);
+    void evictedBytesChanged(qint64 evictedBytes);
+    void seekProgress(int index, int target);
+    void seekFinished();
+
+protected:
+    void timerEvent(QTimerEvent *event) override;
 
 private:
     Q_DISABLE_COPY(UndoStack)
     Q_DECLARE_PRIVATE(UndoStack)
+    Q_PRIVATE_SLOT(d_func(), void _q_emitQueuedNotifications())
+    Q_PRIVATE_SLOT(d_func(), void _q_continueSeek())
+    Q_PRIVATE_SLOT(d_func(), void _q_reclaimSlice())
+    Q_PRIVATE_SLOT(d_func(), void _q_compressionFinished())
     friend class UndoGroup;
 };
 
+class Q_UNDO_EXPORT UndoStackUpdateScope
+{
+public:
+    explicit UndoStackUpdateScope(UndoStack *stack);
+    ~UndoStackUpdateScope();
+
+    void commit();
+
+private:
+    Q_DISABLE_COPY(UndoStackUpdateScope)
+    UndoStack *m_stack;
+};
+
 QT_END_NAMESPACE
 
 #endif // UNDOSTACK_H
@@ -2,16 +2,36 @@
 #define UNDOSTACK_P_H
 
 #include <QtCore/private/qobject_p.h>
+#include <QtCore/qbasictimer.h>
+#include <QtCore/qhash.h>
 #include <QtCore/qlist.h>
+#include <QtCore/qmap.h>
+#include <QtCore/qset.h>
+#include <QtCore/qshareddata.h>
+#include <QtCore/qsharedpointer.h>
 #include <QtCore/qstring.h>
+#include <QtCore/qvariant.h>
 #include <QtWidgets/qaction.h>
 
+#include "lightundocommand.h"
 #include "undostack.h"
+#include "undoringbuffer_p.h"
 
 QT_BEGIN_NAMESPACE
 
-class UndoCommand;
+class LightUndoCommand;
+class UndoBlobStore;
+class QDataStream;
+class UndoCheckpointHandler;
+class UndoCommandPool;
+class UndoCommandSerializer;
+class UndoCompressionCodec;
+class UndoCompressor;
+struct UndoCompressedPayload;
 class UndoGroup;
+class UndoJournal;
+class UndoMappedHistory;
+class UndoReclaimer;
 
 //
 //  W A R N I N G
@@ -24,6 +44,131 @@ class UndoGroup;
 // We mean it.
 //
 
+struct UndoStackEntry
+{
+    LightUndoCommand *command;
+    qint64 cost; // LightUndoCommand::cost() when it was last queried
+    quint64 sequence; // see UndoStackPrivate::nextSequence()
+};
+
+Q_DECLARE_TYPEINFO(UndoStackEntry, Q_PRIMITIVE_TYPE);
+
+// The entries of the commands on the stack, addressed like an UndoRingBuffer. The
+// first mappedCount() commands can be the commands of a mapped history, which take
+// no memory until they are accessed: the entry of one of them, holding an
+// UndoMappedCommand, is only created by at() or operator[](). Their cost, sequence
+// number and text can be queried without creating it. See UndoStack::openMapped().
+class UndoCommandList
+{
+public:
+    UndoCommandList();
+    ~UndoCommandList();
+
+    int size() const { return m_mappedCount + m_entries.size(); }
+    int count() const { return size(); }
+    bool isEmpty() const { return size() == 0; }
+
+    const UndoStackEntry &at(int i) const;
+    UndoStackEntry &operator[](int i);
+
+    int mappedCount() const { return m_mappedCount; }
+    bool isMaterialized(int i) const;
+    qint64 costAt(int i) const;
+    quint64 sequenceAt(int i) const;
+    QString textAt(int i) const;
+
+    void map(UndoMappedHistory *history, quint64 firstSequence,
+             QSet<LightUndoCommand*> *placeholders);
+    void setPool(UndoCommandPool *pool) { m_pool = pool; }
+    void append(const UndoStackEntry &entry) { m_entries.append(entry); }
+    // Returns an entry without a command for a mapped command that has none yet.
+    UndoStackEntry takeLast();
+    void removeFirst(int n);
+    void reserve(int n) { m_entries.reserve(n - m_mappedCount); }
+    void clear();
+
+private:
+    Q_DISABLE_COPY(UndoCommandList)
+
+    UndoStackEntry &materialize(int i) const;
+
+    QExplicitlySharedDataPointer<UndoMappedHistory> m_history;
+    int m_mappedFirst; // the position in the file of the first mapped command
+    int m_mappedCount;
+    quint64 m_mappedSequence; // the sequence number of the command at position 0
+    UndoCommandPool *m_pool;
+    QSet<LightUndoCommand*> *m_placeholders;
+    // The entries that have been created for mapped commands, by position in the
+    // file. A QMap does not move them when others are added.
+    mutable QMap<int, UndoStackEntry> m_mapped;
+    UndoRingBuffer<UndoStackEntry> m_entries;
+};
+
+struct UndoStackCheckpoint
+{
+    QVariant snapshot;
+    qint64 cost; // UndoCheckpointHandler::checkpointCost() of the snapshot
+};
+
+// A line of commands that is not part of the stack. It follows the state at
+// forkPoint of its parent, which is either another branch or the stack.
+struct UndoStackBranch
+{
+    UndoStackBranch() : parent(0), forkPoint(0), cost(0), cleanIndex(-1), lastUsed(0) {}
+
+    int parent; // 0 for the stack
+    qint64 forkPoint; // absolute index, see UndoStackPrivate::checkpoints
+    QVector<UndoStackEntry> commands;
+    qint64 cost;
+    qint64 cleanIndex; // absolute index if the clean state is on the branch, or -1
+    quint64 lastUsed;
+};
+
+// The entry that UndoStack::undoSelectively() pushes: redoing it undoes the target
+// command and vice versa. The target stays on the stack; if the stack removes it
+// while this command is alive, this command adopts it as its only child. Its cost is
+// fixed when it is created: nothing while the target is counted on the stack, and the
+// cost the stack counted for the target once the target is adopted.
+class UndoInverseCommand : public LightUndoCommand
+{
+public:
+    UndoInverseCommand(LightUndoCommand *target, qint64 targetCost);
+
+    void undo() override;
+    void redo() override;
+    QVector<quint64> resources() const override;
+    qint64 cost() const override { return m_adopted ? m_targetCost : 0; }
+
+    LightUndoCommand *target() const { return m_target; }
+    void adoptTarget() { m_childCommands.append(m_target); m_adopted = true; }
+
+private:
+    LightUndoCommand *m_target;
+    qint64 m_targetCost;
+    bool m_adopted;
+};
+
+// A command handed to UndoCompressor, at its absolute index on the stack.
+struct UndoCompressionItem
+{
+    qint64 position;
+    LightUndoCommand *command;
+    QSharedPointer<UndoCompressedPayload> payload;
+};
+
+// A group of macros on several stacks that are undone and redone together; see
+// UndoGroup::beginTransaction(). Once the macro of one of the stacks is removed, the
+// transaction is aborted and the remaining macros are undone and redone separately.
+struct UndoTransaction
+{
+    UndoTransaction() : replaying(false), aborted(false) {}
+
+    QString text;
+    QHash<UndoStack*, LightUndoCommand*> participants;
+    bool replaying;
+    bool aborted;
+};
+
 class UndoStackPrivate : public QObjectPrivate
 {
     Q_DECLARE_PUBLIC(UndoStack)
@@ -33,19 +178,246 @@ public:
         index(0),
         cleanIndex(0),
         group(0),
-        undoLimit(0)
+        groupIndex(-1),
+        groupMemoryUsage(0),
+        lruPrev(0),
+        lruNext(0),
+        undoLimit(0),
+        pool(0),
+        blobStore(0),
+        memoryLimit(0),
+        memoryUsage(0),
+        evictedBytes(0),
+        emittedMemoryUsage(0),
+        emittedEvictedBytes(0),
+        emittedClean(true),
+        emittedCanUndo(false),
+        emittedCanRedo(false),
+        emittedUndoTextValid(true),
+        emittedRedoTextValid(true),
+        updateDepth(0),
+        pendingDocumentChange(false),
+        notificationMode(UndoStack::ImmediateNotification),
+        notificationQueued(false),
+        checkpointHandler(0),
+        checkpointInterval(0),
+        checkpointCostInterval(0),
+        checkpointMemoryUsage(0),
+        commandsSinceCheckpoint(0),
+        costSinceCheckpoint(0),
+        baseIndex(0),
+        seeking(false),
+        seekSlicePosted(false),
+        seekTarget(0),
+        seekTimeBudget(8),
+        reclamationMode(UndoStack::ImmediateReclamation),
+        reclaimer(0),
+        branching(false),
+        branchMemoryLimit(0),
+        branchMemoryUsage(0),
+        nextBranchId(1),
+        branchUseCounter(0),
+        resourceIndexBase(0),
+        resourceIndexEnd(-1),
+        timelineDirty(false),
+        hibernationTimeout(0),
+        journal(0),
+        journalCompactionThreshold(8 * 1024 * 1024),
+        journaledBase(0),
+        journaledIndex(0),
+        journaledCleanIndex(0),
+        compressionCodec(0),
+        compressor(0),
+        compressionDepth(0),
+        compressionTimeout(0),
+        compressionMark(0),
+        touchedLow(0),
+        touchedHigh(0),
+        touchedSinceTick(false)
+    {
+    }
+
+    typedef UndoStackEntry Entry;
+
+    static UndoStackPrivate *get(UndoStack *stack) { return stack->d_func(); }
+    static quint64 nextSequence(int count = 1);
+
+    // The sequence numbers of the commands that undo() and redo() would execute, or
+    // 0 if there is none or a macro is open.
+    quint64 undoSequence() const
+    {
+        return index > 0 && macroStack.isEmpty() ? commandList.sequenceAt(index - 1) : 0;
+    }
+    quint64 redoSequence() const
     {
+        return index < commandList.size() && macroStack.isEmpty()
+                ? commandList.sequenceAt(index) : 0;
     }
 
-    QList<UndoCommand*> commandList;
-    QList<UndoCommand*> macroStack;
+    UndoCommandList commandList;
+    QList<LightUndoCommand*> macroStack;
     int index;
     int cleanIndex;
     UndoGroup *group;
+    int groupIndex; // position in UndoGroupPrivate::stacks
+    qint64 groupMemoryUsage; // memoryUsage as last counted by the group
+    UndoStack *lruPrev; // neighbours in UndoGroupPrivate's least recently used list
+    UndoStack *lruNext;
     int undoLimit;
+    UndoCommandPool *pool;
+    UndoBlobStore *blobStore;
+    qint64 memoryLimit;
+    qint64 memoryUsage;
+    qint64 evictedBytes;
+    qint64 emittedMemoryUsage;
+    qint64 emittedEvictedBytes;
+    QString emittedUndoText;
+    QString emittedRedoText;
+    bool emittedClean;
+    bool emittedCanUndo;
+    bool emittedCanRedo;
+    bool emittedUndoTextValid;
+    bool emittedRedoTextValid;
+    int updateDepth;
+    bool pendingDocumentChange;
+    UndoStack::NotificationMode notificationMode;
+    bool notificationQueued;
+    UndoCheckpointHandler *checkpointHandler;
+    int checkpointInterval;
+    qint64 checkpointCostInterval;
+    qint64 checkpointMemoryUsage;
+    int commandsSinceCheckpoint;
+    qint64 costSinceCheckpoint;
+    // Checkpoints keyed by the absolute index of the state they capture. The absolute
+    // index of a command is its index plus baseIndex, the number of commands evicted
+    // from the bottom of the stack, so evictions do not invalidate the keys.
+    QMap<qint64, UndoStackCheckpoint> checkpoints;
+    qint64 baseIndex;
+    bool seeking;
+    bool seekSlicePosted;
+    int seekTarget;
+    int seekTimeBudget;
+    UndoStack::ReclamationMode reclamationMode;
+    UndoReclaimer *reclaimer;
+    bool branching;
+    qint64 branchMemoryLimit;
+    qint64 branchMemoryUsage;
+    QMap<int, UndoStackBranch> branches;
+    // The ids of the branches that fork from each branch, or from the stack for 0.
+    QHash<int, QSet<int> > branchChildren;
+    int nextBranchId;
+    quint64 branchUseCounter;
+    // Absolute indexes of the commands that use each resource key, in ascending
+    // order, for the commands from resourceIndexBase up to resourceIndexEnd. Entries
+    // below baseIndex are stale and skipped. Built on first use; -1 if not built.
+    mutable QHash<quint64, QVector<qint64> > resourceIndex;
+    mutable qint64 resourceIndexBase;
+    mutable qint64 resourceIndexEnd;
+    // The commands reverted by undoSelectively() that are still on the stack, and
+    // the commands that revert them.
+    QHash<LightUndoCommand*, UndoInverseCommand*> inverses;
+    QHash<LightUndoCommand*, LightUndoCommand*> inverseTargets;
+    // The macros on this stack that belong to a transaction.
+    QHash<LightUndoCommand*, QSharedPointer<UndoTransaction> > transactions;
+    // Whether the group has been told that the commands next to the index changed;
+    // see UndoGroupPrivate::stackChanged().
+    bool timelineDirty;
+    int hibernationTimeout;
+    QBasicTimer hibernationTimer;
+    // The UndoHibernatedCommand objects that stand for hibernated commands on the
+    // stack or on one of its branches.
+    QSet<LightUndoCommand*> hibernatedCommands;
+    // The UndoMappedCommand objects that stand for commands of a mapped history that
+    // have been accessed but not put back on the stack yet.
+    QSet<LightUndoCommand*> mappedCommands;
+    // The UndoCompressedCommand objects on the stack and on its branches.
+    QSet<LightUndoCommand*> compressedCommands;
+    UndoJournal *journal;
+    QBasicTimer journalTimer;
+    qint64 journalCompactionThreshold;
+    // The stack as the journal describes it: the sequence numbers of its commands,
+    // its baseIndex, its index and its clean index.
+    UndoRingBuffer<quint64> journaledSequences;
+    qint64 journaledBase;
+    int journaledIndex;
+    int journaledCleanIndex;
+    UndoCompressionCodec *compressionCodec;
+    UndoCompressor *compressor;
+    int compressionDepth;
+    int compressionTimeout;
+    QBasicTimer compressionTimer;
+    // The absolute index below which compressionDepth has been applied.
+    qint64 compressionMark;
+    // The absolute indexes the stack has been at since the last tick of
+    // compressionTimer.
+    qint64 touchedLow;
+    qint64 touchedHigh;
+    bool touchedSinceTick;
+    // Commands handed to the compressor, whose cost is updated once it is done.
+    QVector<UndoCompressionItem> compressing;
 
     void setIndex(int idx, bool clean);
     bool checkUndoLimit();
+    void evictBottom(int count, qint64 bytes);
+    int evictOldest(qint64 bytes);
+    void applyLimits();
+    void truncate();
+    void updateCost(int idx, bool renumber = true);
+    void updateInverseCost(UndoInverseCommand *inverse);
+    void maybeSaveCheckpoint(int idx, qint64 cost);
+    qint64 checkpointCostAt(int idx) const;
+    qint64 dropCheckpoints(int from, int to);
+    int restoreNearestCheckpoint(int idx);
+    int detachBranch(int from);
+    void deleteBranch(int id);
+    void dropOrphanedBranches();
+    void checkBranchLimit();
+    bool switchBranch(int id, int idx);
+    QVector<quint64> resourcesAt(int idx) const;
+    void updateResourceIndex() const;
+    void invalidateResourceIndex();
+    void unindexFrom(int from);
+    bool hasLaterConflict(int idx) const;
+    void openMacro(UndoCommand *command);
+    void joinGroupTransaction();
+    static bool replayTransaction(UndoTransaction *transaction, bool undo);
+    void seekSlice();
+    void cancelSeek();
+    void _q_continueSeek();
+    void notify(bool documentChanged);
+    void emitChangedSignals(bool documentChanged);
+    void _q_emitQueuedNotifications();
+    bool canHibernate(LightUndoCommand *command, const UndoCommandSerializer &serializer) const;
+    void hibernate();
+    void rehydrate();
+    bool rehydrateEntry(Entry &entry, qint64 *usage);
+    bool makeResident(int idx);
+    void scheduleHibernation();
+    void setActiveInGroup(bool active);
+    LightUndoCommand *residentCommand(LightUndoCommand *command) const;
+    int firstUnsavable() const;
+    void writeHistory(QDataStream &stream) const;
+    bool readHistory(QDataStream &stream, const char *function,
+                     QVector<LightUndoCommand*> *commands, int *idx, int *clean) const;
+    void installHistory(const QVector<LightUndoCommand*> &commands, int idx, int clean,
+                        bool limit = true);
+    bool writeJournalSnapshot();
+    void writeJournal();
+    void flushJournal();
+    void closeJournal();
+    bool replayJournal(QDataStream &stream, QVector<LightUndoCommand*> *commands,
+                       int *idx, int *clean) const;
+    void reclaim(LightUndoCommand *command);
+    void reclaimAll();
+    void commitReclamation();
+    void _q_reclaimSlice();
+    const UndoCompressionCodec *activeCodec() const;
+    void compressRange(int from, int to);
+    void updateCompression();
+    void compressUntouched();
+    bool finishCompression();
+    void _q_compressionFinished();
+    void decompressAll();
 };
 
 QT_END_NAMESPACE
@@ -1,5 +1,6 @@
 #include <QString>
 #include <QtTest>
+#include <QtUndo/lightundocommand.h>
 #include <QtUndo/undocommand.h>
 #include <QtUndo/undogroup.h>
 #include <QtUndo/undostack.h>
@@ -134,6 +135,48 @@ bool AppendCommand::mergeWith(const UndoCommand *other)
     return true;
 }
 
+class CostlyCommand : public LightUndoCommand
+{
+public:
+    CostlyCommand(int *value, qint64 cost) : m_value(value), m_cost(cost) {}
+
+    void undo() override { --*m_value; }
+    void redo() override { ++*m_value; }
+    qint64 cost() const override { return m_cost; }
+
+private:
+    int *m_value;
+    qint64 m_cost;
+};
+
+class HibernatingCommand : public LightUndoCommand
+{
+public:
+    enum { Type = 1 };
+
+    explicit HibernatingCommand(qint64 cost) : m_cost(cost) {}
+
+    void undo() override { --*value; }
+    void redo() override { ++*value; }
+    qint64 cost() const override { return m_cost; }
+    int typeId() const override { return Type; }
+    void save(QDataStream &stream) const override { stream << m_cost; }
+
+    static LightUndoCommand *load(QDataStream &stream)
+    {
+        qint64 cost;
+        stream >> cost;
+        return new HibernatingCommand(cost);
+    }
+
+    static int *value;
+
+private:
+    qint64 m_cost;
+};
+
+int *HibernatingCommand::value = 0;
+
 class CheckStateArgs;
 
 class tst_UndoGroup : public QObject
@@ -151,6 +194,13 @@ private slots:
     void deleteStack();
     void checkSignals();
     void addStackAndDie();
+    void queuedNotifications();
+    void transactions();
+    void journaledTransaction();
+    void timeline();
+    void switchActiveStack();
+    void memoryLimit();
+    void hibernation();
 
 private:
     void checkState(const CheckStateArgs &args);
@@ -162,6 +212,10 @@ private:
     QSignalSpy undoTextChangedSpy;
     QSignalSpy canRedoChangedSpy;
     QSignalSpy redoTextChangedSpy;
+    bool lastCanUndo;
+    QString lastUndoText;
+    bool lastCanRedo;
+    QString lastRedoText;
 };
 
 tst_UndoGroup::tst_UndoGroup() :
@@ -170,7 +224,9 @@ tst_UndoGroup::tst_UndoGroup() :
     canUndoChangedSpy(&group, SIGNAL(canUndoChanged(bool))),
     undoTextChangedSpy(&group, SIGNAL(undoTextChanged(QString))),
     canRedoChangedSpy(&group, SIGNAL(canRedoChanged(bool))),
-    redoTextChangedSpy(&group, SIGNAL(redoTextChanged(QString)))
+    redoTextChangedSpy(&group, SIGNAL(redoTextChanged(QString))),
+    lastCanUndo(false),
+    lastCanRedo(false)
 {
 }
 
@@ -187,6 +243,10 @@ void tst_UndoGroup::cleanup()
     undoTextChangedSpy.clear();
     canRedoChangedSpy.clear();
     redoTextChangedSpy.clear();
+    lastCanUndo = false;
+    lastUndoText.clear();
+    lastCanRedo = false;
+    lastRedoText.clear();
 }
 
 struct CheckStateArgs
@@ -274,6 +334,25 @@ void tst_UndoGroup::addRemoveStack()
 
     group.removeStack(&stack2);
     QCOMPARE(group.stacks(), QVector<UndoStack*>());
+
+    // Removing a stack moves the last one into its place.
+    UndoStack stack3;
+    group.addStack(&stack1);
+    group.addStack(&stack2);
+    group.addStack(&stack3);
+    group.removeStack(&stack1);
+    QCOMPARE(group.stacks(), QVector<UndoStack*>() << &stack3 << &stack2);
+    group.removeStack(&stack2);
+    QCOMPARE(group.stacks(), QVector<UndoStack*>() << &stack3);
+
+    // A stack that is added to another group leaves this one.
+    UndoGroup otherGroup;
+    group.addStack(&stack1);
+    otherGroup.addStack(&stack3);
+    QCOMPARE(group.stacks(), QVector<UndoStack*>() << &stack1);
+    QCOMPARE(otherGroup.stacks(), QVector<UndoStack*>() << &stack3);
+    group.removeStack(&stack3);
+    QCOMPARE(otherGroup.stacks(), QVector<UndoStack*>() << &stack3);
 }
 
 void tst_UndoGroup::deleteStack()
@@ -335,11 +414,22 @@ void tst_UndoGroup::checkState(const CheckStateArgs &args)
     } else {
         QCOMPARE(cleanChangedSpy.count(), 0);
     }
+    // Switching the active stack emits all signals, while the forwarded signals of
+    // the active stack are only emitted when their values change. A value that
+    // changed must have been emitted either way.
     if (args.undoChanged) {
-        QCOMPARE(canUndoChangedSpy.count(), 1);
-        QCOMPARE(canUndoChangedSpy.at(0).at(0).toBool(), args.canUndo);
-        QCOMPARE(undoTextChangedSpy.count(), 1);
-        QCOMPARE(undoTextChangedSpy.at(0).at(0).toString(), QString(args.undoText));
+        QVERIFY(canUndoChangedSpy.count() <= 1);
+        if (args.canUndo != lastCanUndo)
+            QCOMPARE(canUndoChangedSpy.count(), 1);
+        if (canUndoChangedSpy.count() == 1)
+            QCOMPARE(canUndoChangedSpy.at(0).at(0).toBool(), args.canUndo);
+        QVERIFY(undoTextChangedSpy.count() <= 1);
+        if (args.undoText != lastUndoText)
+            QCOMPARE(undoTextChangedSpy.count(), 1);
+        if (undoTextChangedSpy.count() == 1)
+            QCOMPARE(undoTextChangedSpy.at(0).at(0).toString(), QString(args.undoText));
+        lastCanUndo = args.canUndo;
+        lastUndoText = args.undoText;
         canUndoChangedSpy.clear();
         undoTextChangedSpy.clear();
     } else {
@@ -347,10 +437,18 @@ void tst_UndoGroup::checkState(const CheckStateArgs &args)
         QCOMPARE(undoTextChangedSpy.count(), 0);
     }
     if (args.redoChanged) {
-        QCOMPARE(canRedoChangedSpy.count(), 1);
-        QCOMPARE(canRedoChangedSpy.at(0).at(0).toBool(), args.canRedo);
-        QCOMPARE(redoTextChangedSpy.count(), 1);
-        QCOMPARE(redoTextChangedSpy.at(0).at(0).toString(), QString(args.redoText));
+        QVERIFY(canRedoChangedSpy.count() <= 1);
+        if (args.canRedo != lastCanRedo)
+            QCOMPARE(canRedoChangedSpy.count(), 1);
+        if (canRedoChangedSpy.count() == 1)
+            QCOMPARE(canRedoChangedSpy.at(0).at(0).toBool(), args.canRedo);
+        QVERIFY(redoTextChangedSpy.count() <= 1);
+        if (args.redoText != lastRedoText)
+            QCOMPARE(redoTextChangedSpy.count(), 1);
+        if (redoTextChangedSpy.count() == 1)
+            QCOMPARE(redoTextChangedSpy.at(0).at(0).toString(), QString(args.redoText));
+        lastCanRedo = args.canRedo;
+        lastRedoText = args.redoText;
         canRedoChangedSpy.clear();
         redoTextChangedSpy.clear();
     } else {
@@ -545,6 +643,7 @@ void tst_UndoGroup::checkSignals()
     args.redoChanged = false;
     checkState(args);
 
+    // Only the signals whose values differ from the previous active stack are emitted.
     stack2->setActive();
     args.activeStack = stack2;
     args.clean = true;
@@ -552,10 +651,10 @@ void tst_UndoGroup::checkSignals()
     args.undoText = QString();
     args.canRedo = false;
     args.redoText = QString();
-    args.cleanChanged = true;
-    args.indexChanged = true;
-    args.undoChanged = true;
-    args.redoChanged = true;
+    args.cleanChanged = false;
+    args.indexChanged = false;
+    args.undoChanged = false;
+    args.redoChanged = false;
     checkState(args);
 
     stack1->setActive();
@@ -597,6 +696,431 @@ void tst_UndoGroup::addStackAndDie()
     delete stack;
 }
 
+void tst_UndoGroup::queuedNotifications()
+{
+    QString string;
+    UndoStack *stack = new UndoStack(&group);
+    stack->setNotificationMode(UndoStack::QueuedNotification);
+    QSignalSpy stackIndexSpy(stack, SIGNAL(indexChanged(int)));
+    QSignalSpy stackCanUndoSpy(stack, SIGNAL(canUndoChanged(bool)));
+    QSignalSpy stackUndoTextSpy(stack, SIGNAL(undoTextChanged(QString)));
+
+    stack->push(new InsertCommand(&string, 0, "a"));
+    stack->push(new InsertCommand(&string, 1, "b"));
+    stack->undo();
+
+    // The getters are accurate right away, but nothing is emitted yet.
+    QCOMPARE(stack->index(), 1);
+    QVERIFY(stack->canUndo());
+    QVERIFY(stack->canRedo());
+    QCOMPARE(stackIndexSpy.count(), 0);
+    QCOMPARE(stackCanUndoSpy.count(), 0);
+
+    QCoreApplication::processEvents();
+    QCOMPARE(stackIndexSpy.count(), 1);
+    QCOMPARE(stackIndexSpy.at(0).at(0).toInt(), 1);
+    QCOMPARE(stackCanUndoSpy.count(), 1);
+    QCOMPARE(stackUndoTextSpy.count(), 1);
+
+    QCoreApplication::processEvents();
+    QCOMPARE(stackIndexSpy.count(), 1);
+
+    // Switching back emits pending signals right away.
+    stack->redo();
+    stack->setNotificationMode(UndoStack::ImmediateNotification);
+    QCOMPARE(stackIndexSpy.count(), 2);
+    QCoreApplication::processEvents();
+    QCOMPARE(stackIndexSpy.count(), 2);
+
+    // The group coalesces the forwarded signals of its active stack.
+    stack->setActive();
+    indexChangedSpy.clear();
+    canUndoChangedSpy.clear();
+    group.setNotificationMode(UndoStack::QueuedNotification);
+    stack->undo();
+    stack->undo();
+    QCOMPARE(indexChangedSpy.count(), 0);
+    QCOMPARE(canUndoChangedSpy.count(), 0);
+    QCoreApplication::processEvents();
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.at(0).at(0).toInt(), 0);
+    QCOMPARE(canUndoChangedSpy.count(), 1);
+    QCOMPARE(canUndoChangedSpy.at(0).at(0).toBool(), false);
+
+    group.setNotificationMode(UndoStack::ImmediateNotification);
+    stack->redo();
+    QCOMPARE(indexChangedSpy.count(), 2);
+
+    delete stack;
+}
+
+void tst_UndoGroup::transactions()
+{
+    QString str1, str2, str3;
+    UndoStack stack1(&group), stack2(&group), stack3(&group);
+    stack1.push(new InsertCommand(&str1, 0, "a"));
+
+    group.beginTransaction("refactor");
+    QVERIFY(group.isInTransaction());
+    stack1.push(new InsertCommand(&str1, 1, "b"));
+    stack2.push(new InsertCommand(&str2, 0, "c"));
+    stack2.push(new InsertCommand(&str2, 1, "d"));
+    group.endTransaction();
+    QVERIFY(!group.isInTransaction());
+
+    // Only the stacks that were pushed to take part.
+    QCOMPARE(stack1.count(), 2);
+    QCOMPARE(stack2.count(), 1);
+    QCOMPARE(stack3.count(), 0);
+    QCOMPARE(stack1.undoText(), QString("refactor"));
+    QCOMPARE(stack2.undoText(), QString("refactor"));
+
+    // Undoing the transaction on one stack undoes it on all of them, with one
+    // notification per stack.
+    QSignalSpy index1Spy(&stack1, SIGNAL(indexChanged(int)));
+    QSignalSpy index2Spy(&stack2, SIGNAL(indexChanged(int)));
+    stack2.undo();
+    QCOMPARE(str1, QString("a"));
+    QCOMPARE(str2, QString());
+    QCOMPARE(stack1.index(), 1);
+    QCOMPARE(stack2.index(), 0);
+    QCOMPARE(index1Spy.count(), 1);
+    QCOMPARE(index2Spy.count(), 1);
+
+    group.setActiveStack(&stack1);
+    group.redo();
+    QCOMPARE(str1, QString("ab"));
+    QCOMPARE(str2, QString("cd"));
+    QCOMPARE(stack1.index(), 2);
+    QCOMPARE(stack2.index(), 1);
+    QCOMPARE(index1Spy.count(), 2);
+    QCOMPARE(index2Spy.count(), 2);
+
+    // Nested transactions join the outer one.
+    group.beginTransaction("outer");
+    group.beginTransaction("inner");
+    stack3.push(new InsertCommand(&str3, 0, "e"));
+    group.endTransaction();
+    QVERIFY(group.isInTransaction());
+    stack1.push(new InsertCommand(&str1, 2, "f"));
+    group.endTransaction();
+    QCOMPARE(stack3.undoText(), QString("outer"));
+    stack3.undo();
+    QCOMPARE(str1, QString("ab"));
+    QCOMPARE(str3, QString());
+    stack3.redo();
+    QCOMPARE(str1, QString("abf"));
+
+    // Once another change was pushed on a participant, the transaction can no
+    // longer be undone atomically.
+    stack3.push(new InsertCommand(&str3, 1, "g"));
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::undo(): transaction \"outer\" cannot be undone because another stack has changed since");
+    stack1.undo();
+    QCOMPARE(str1, QString("abf"));
+    QCOMPARE(stack1.index(), 3);
+
+    QTest::ignoreMessage(QtWarningMsg, "UndoGroup::endTransaction(): no matching beginTransaction()");
+    group.endTransaction();
+
+    // A transaction whose macro is evicted from one of its stacks is aborted, and its
+    // macros on the other stacks are undone separately.
+    QString str4, str5;
+    UndoStack stack4(&group), stack5(&group);
+    group.beginTransaction("evicted");
+    stack4.push(new InsertCommand(&str4, 0, "h"));
+    stack5.push(new InsertCommand(&str5, 0, "i"));
+    group.endTransaction();
+    stack4.setUndoLimit(1);
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack: transaction \"evicted\" was aborted because its macro was removed from one of its stacks");
+    stack4.push(new InsertCommand(&str4, 1, "j"));
+    QCOMPARE(stack4.count(), 1);
+    stack5.undo();
+    QCOMPARE(str5, QString());
+    QCOMPARE(str4, QString("hj"));
+    QCOMPARE(stack4.index(), 1);
+    stack5.redo();
+    QCOMPARE(str5, QString("i"));
+
+    // Many stacks in one transaction.
+    QVector<UndoStack*> stacks;
+    QVector<QString> strings(100);
+    group.beginTransaction("bulk");
+    for (int i = 0; i < strings.size(); ++i) {
+        stacks.append(new UndoStack(&group));
+        stacks.last()->push(new InsertCommand(&strings[i], 0, "x"));
+    }
+    group.endTransaction();
+    stacks.last()->undo();
+    for (int i = 0; i < strings.size(); ++i) {
+        QCOMPARE(strings.at(i), QString());
+        QCOMPARE(stacks.at(i)->index(), 0);
+    }
+    qDeleteAll(stacks);
+}
+
+void tst_UndoGroup::journaledTransaction()
+{
+    int value = 0;
+    HibernatingCommand::value = &value;
+    LightUndoCommand::registerType(HibernatingCommand::Type, HibernatingCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/history.journal");
+
+    UndoStack stack1(&group), stack2(&group);
+    QVERIFY(stack1.openJournal(fileName));
+    group.beginTransaction("refactor");
+    stack1.push(new HibernatingCommand(1));
+    stack1.push(new HibernatingCommand(1));
+    stack2.push(new HibernatingCommand(1));
+    group.endTransaction();
+    QCOMPARE(value, 3);
+
+    // The macros of a transaction are written like any other macro.
+    QCOMPARE(stack1.journalFileName(), fileName);
+    stack1.closeJournal();
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY(stack2.save(&buffer));
+
+    // After a crash, the document of the first stack is in its clean state, and the
+    // journal brings back its part of the transaction.
+    value = 1;
+    UndoStack recovered;
+    QVERIFY(recovered.recoverJournal(fileName));
+    QCOMPARE(value, 3);
+    QCOMPARE(recovered.count(), 1);
+    QCOMPARE(recovered.index(), 1);
+    QCOMPARE(recovered.text(0), QString("refactor"));
+    recovered.undo();
+    QCOMPARE(value, 1);
+
+    HibernatingCommand::value = 0;
+}
+
+void tst_UndoGroup::timeline()
+{
+    QString str1, str2, str3;
+    UndoStack stack1(&group), stack2(&group), stack3(&group);
+
+    QCOMPARE(group.timelineUndoStack(), (UndoStack*)nullptr);
+    QCOMPARE(group.timelineRedoStack(), (UndoStack*)nullptr);
+
+    stack1.push(new InsertCommand(&str1, 0, "a"));
+    stack2.push(new InsertCommand(&str2, 0, "b"));
+    stack1.push(new InsertCommand(&str1, 1, "c"));
+    stack3.push(new InsertCommand(&str3, 0, "d"));
+    QVERIFY(stack1.sequenceNumber(0) < stack2.sequenceNumber(0));
+    QVERIFY(stack2.sequenceNumber(0) < stack1.sequenceNumber(1));
+    QCOMPARE(stack1.sequenceNumber(2), quint64(0));
+
+    // Undo in the reverse order of the pushes, whichever stack is active.
+    stack2.setActive();
+    QCOMPARE(group.timelineUndoStack(), &stack3);
+    group.undoTimeline();
+    QCOMPARE(str3, QString());
+    group.undoTimeline();
+    QCOMPARE(str1, QString("a"));
+    group.undoTimeline();
+    QCOMPARE(str2, QString());
+    QCOMPARE(group.timelineUndoStack(), &stack1);
+
+    // Redo in the order of the pushes.
+    QCOMPARE(group.timelineRedoStack(), &stack2);
+    group.redoTimeline();
+    QCOMPARE(str2, QString("b"));
+    group.redoTimeline();
+    QCOMPARE(str1, QString("ac"));
+    QCOMPARE(group.timelineRedoStack(), &stack3);
+
+    // Changes made directly on a stack are taken into account.
+    stack2.push(new InsertCommand(&str2, 1, "e"));
+    QCOMPARE(group.timelineUndoStack(), &stack2);
+    stack2.undo();
+    QCOMPARE(group.timelineUndoStack(), &stack1);
+    QCOMPARE(group.timelineRedoStack(), &stack3);
+    stack3.redo();
+    QCOMPARE(group.timelineUndoStack(), &stack3);
+
+    // A merged command counts as the latest change.
+    stack1.push(new AppendCommand(&str1, "f"));
+    stack3.push(new AppendCommand(&str3, "g"));
+    QCOMPARE(group.timelineUndoStack(), &stack3);
+    stack1.push(new AppendCommand(&str1, "h"));
+    QCOMPARE(stack1.count(), 3);
+    QCOMPARE(group.timelineUndoStack(), &stack1);
+
+    // Removing a stack removes it from the timeline.
+    group.removeStack(&stack1);
+    QCOMPARE(group.timelineUndoStack(), &stack3);
+    group.addStack(&stack1);
+    QCOMPARE(group.timelineUndoStack(), &stack1);
+
+    // Many stacks and many changes.
+    QVector<UndoStack*> stacks;
+    QVector<QString> strings(50);
+    for (int i = 0; i < strings.size(); ++i)
+        stacks.append(new UndoStack(&group));
+    for (int i = 0; i < 1000; ++i) {
+        const int s = (i * 7) % strings.size();
+        stacks.at(s)->push(new InsertCommand(&strings[s], strings.at(s).size(), "x"));
+    }
+    for (int i = 999; i >= 0; --i) {
+        const int s = (i * 7) % strings.size();
+        QCOMPARE(group.timelineUndoStack(), stacks.at(s));
+        group.undoTimeline();
+    }
+    QCOMPARE(group.timelineUndoStack(), &stack1);
+    qDeleteAll(stacks);
+}
+
+void tst_UndoGroup::switchActiveStack()
+{
+    QString str1, str2, str3;
+    UndoStack stack1(&group), stack2(&group), stack3(&group);
+    stack1.push(new InsertCommand(&str1, 0, "a"));
+    stack2.push(new InsertCommand(&str2, 0, "b"));
+    stack3.push(new InsertCommand(&str3, 0, "c"));
+    stack3.push(new InsertCommand(&str3, 1, "d"));
+    stack3.undo();
+
+    stack1.setActive();
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(canUndoChangedSpy.count(), 1);
+    QCOMPARE(undoTextChangedSpy.count(), 1);
+    QCOMPARE(cleanChangedSpy.count(), 1);
+    QCOMPARE(canRedoChangedSpy.count(), 0);
+    QCOMPARE(redoTextChangedSpy.count(), 0);
+
+    // A stack in the same state emits nothing but activeStackChanged().
+    QSignalSpy activeStackChangedSpy(&group, SIGNAL(activeStackChanged(UndoStack*)));
+    stack2.setActive();
+    QCOMPARE(activeStackChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(canUndoChangedSpy.count(), 1);
+    QCOMPARE(undoTextChangedSpy.count(), 1);
+    QCOMPARE(cleanChangedSpy.count(), 1);
+
+    // A stack that can also redo only adds the redo signals.
+    stack3.setActive();
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(canUndoChangedSpy.count(), 1);
+    QCOMPARE(undoTextChangedSpy.count(), 1);
+    QCOMPARE(canRedoChangedSpy.count(), 1);
+    QCOMPARE(redoTextChangedSpy.count(), 1);
+    QCOMPARE(group.redoText(), QString("insert"));
+
+    // Only the active stack is forwarded.
+    stack1.undo();
+    QCOMPARE(indexChangedSpy.count(), 1);
+    stack3.redo();
+    QCOMPARE(indexChangedSpy.count(), 2);
+    QCOMPARE(indexChangedSpy.last().at(0).toInt(), 2);
+    QCOMPARE(canRedoChangedSpy.count(), 2);
+}
+
+void tst_UndoGroup::memoryLimit()
+{
+    int value = 0;
+    UndoStack stack1(&group), stack2(&group), stack3(&group);
+    QSignalSpy evictedSpy(&group, SIGNAL(commandsEvicted(UndoStack*,int,qint64)));
+    QSignalSpy limitSpy(&group, SIGNAL(memoryLimitChanged(qint64)));
+
+    for (UndoStack *stack : QVector<UndoStack*>() << &stack1 << &stack2 << &stack3) {
+        for (int i = 0; i < 4; ++i)
+            stack->push(new CostlyCommand(&value, 100));
+    }
+    QCOMPARE(group.memoryUsage(), qint64(1200));
+
+    // The least recently used stack loses its oldest commands first.
+    stack1.setActive();
+    group.setMemoryLimit(1000);
+    QCOMPARE(group.memoryUsage(), qint64(1000));
+    QCOMPARE(limitSpy.count(), 1);
+    QCOMPARE(limitSpy.at(0).at(0).toLongLong(), qint64(1000));
+    group.setMemoryLimit(1000);
+    QCOMPARE(limitSpy.count(), 1);
+    QCOMPARE(stack1.count(), 4);
+    QCOMPARE(stack2.count(), 2);
+    QCOMPARE(stack2.memoryUsage(), qint64(200));
+    QCOMPARE(stack2.evictedBytes(), qint64(200));
+    QCOMPARE(stack3.count(), 4);
+    QCOMPARE(group.evictedBytes(), qint64(200));
+    QCOMPARE(group.evictedCount(), 2);
+    QCOMPARE(evictedSpy.count(), 1);
+    QCOMPARE(evictedSpy.at(0).at(0).value<UndoStack*>(), &stack2);
+    QCOMPARE(evictedSpy.at(0).at(1).toInt(), 2);
+    QCOMPARE(evictedSpy.at(0).at(2).toLongLong(), qint64(200));
+
+    // Growing beyond the limit evicts at the next iteration of the event loop.
+    stack1.push(new CostlyCommand(&value, 250));
+    QCOMPARE(group.memoryUsage(), qint64(1250));
+    QCoreApplication::processEvents();
+    QCOMPARE(group.memoryUsage(), qint64(950));
+    QCOMPARE(stack2.count(), 0);
+    QCOMPARE(stack3.count(), 3);
+    QCOMPARE(group.evictedCount(), 5);
+    QCOMPARE(evictedSpy.count(), 3);
+
+    // Changing a stack makes it the most recently used one.
+    stack2.push(new CostlyCommand(&value, 100));
+    stack2.push(new CostlyCommand(&value, 100));
+    QCoreApplication::processEvents();
+    QCOMPARE(stack2.count(), 2);
+    QCOMPARE(stack3.count(), 1);
+
+    // The active stack is never evicted.
+    group.setMemoryLimit(100);
+    QCOMPARE(stack1.count(), 5);
+    QCOMPARE(stack2.count(), 0);
+    QCOMPARE(stack3.count(), 0);
+    QCOMPARE(group.memoryUsage(), qint64(650));
+
+    group.removeStack(&stack1);
+    QCOMPARE(group.memoryUsage(), qint64(0));
+    group.setMemoryLimit(0);
+}
+
+void tst_UndoGroup::hibernation()
+{
+    int value = 0;
+    HibernatingCommand::value = &value;
+    LightUndoCommand::registerType(HibernatingCommand::Type, HibernatingCommand::load);
+
+    UndoGroup group;
+    UndoStack stack1(&group);
+    UndoStack stack2(&group);
+    stack1.setHibernationTimeout(10);
+    stack2.setHibernationTimeout(10);
+    for (int i = 0; i < 4; ++i)
+        stack1.push(new HibernatingCommand(100));
+    stack2.push(new HibernatingCommand(100));
+
+    // The active stack never hibernates.
+    stack2.setActive();
+    QTRY_COMPARE(stack1.hibernatedCount(), 4);
+    QCOMPARE(stack1.memoryUsage(), qint64(0));
+    QCOMPARE(stack2.hibernatedCount(), 0);
+    QCOMPARE(group.memoryUsage(), qint64(100));
+
+    // Activating a stack reads it back.
+    stack1.setActive();
+    QCOMPARE(stack1.hibernatedCount(), 0);
+    QCOMPARE(stack1.memoryUsage(), qint64(400));
+    QTRY_COMPARE(stack2.hibernatedCount(), 1);
+    stack1.undo();
+    stack1.undo();
+    QCOMPARE(value, 3);
+
+    // A stack removed from the group stops hibernating.
+    group.removeStack(&stack1);
+    stack2.setActive();
+    QTest::qWait(50);
+    QCOMPARE(stack1.hibernatedCount(), 0);
+
+    HibernatingCommand::value = 0;
+}
+
 QTEST_MAIN(tst_UndoGroup)
 
 #include "tst_undogroup.moc"
@@ -1,6 +1,12 @@
 #include <QString>
 #include <QtTest>
+#include <QtUndo/lightundocommand.h>
+#include <QtUndo/undoblobstore.h>
+#include <QtUndo/undocheckpointhandler.h>
 #include <QtUndo/undocommand.h>
+#include <QtUndo/undocommandpool.h>
+#include <QtUndo/undocompressioncodec.h>
+#include <QtUndo/undogroup.h>
 #include <QtUndo/undostack.h>
 
 class InsertCommand : public UndoCommand
@@ -12,6 +18,8 @@ public:
     virtual void undo() override;
     virtual void redo() override;
 
+    static int redoCount;
+
 private:
     QString *m_str;
     int m_idx;
@@ -52,6 +60,8 @@ private:
     QString m_text;
 };
 
+int InsertCommand::redoCount = 0;
+
 InsertCommand::InsertCommand(QString *str, int idx, const QString &text, UndoCommand *parent) :
     UndoCommand(parent),
     m_str(str),
@@ -65,6 +75,7 @@ InsertCommand::InsertCommand(QString *str, int idx, const QString &text, UndoCom
 
 void InsertCommand::redo()
 {
+    ++redoCount;
     QVERIFY(m_str->length() >= m_idx);
 
     m_str->insert(m_idx, m_text);
@@ -148,6 +159,220 @@ bool AppendCommand::mergeWith(const UndoCommand *other)
     return true;
 }
 
+class LightAppendCommand : public LightUndoCommand
+{
+public:
+    LightAppendCommand(QString *str, const QString &text, LightUndoCommand *parent = 0);
+    ~LightAppendCommand();
+
+    virtual void undo() override;
+    virtual void redo() override;
+    virtual int id() const override;
+    virtual bool mergeWith(const LightUndoCommand *other) override;
+    virtual qint64 cost() const override;
+
+    static int deleteCount;
+
+private:
+    QString *m_str;
+    QString m_text;
+};
+
+int LightAppendCommand::deleteCount = 0;
+
+LightAppendCommand::LightAppendCommand(QString *str, const QString &text, LightUndoCommand *parent) :
+    LightUndoCommand(QLatin1String("light append"), parent),
+    m_str(str),
+    m_text(text)
+{
+}
+
+LightAppendCommand::~LightAppendCommand()
+{
+    ++deleteCount;
+}
+
+void LightAppendCommand::redo()
+{
+    m_str->append(m_text);
+}
+
+void LightAppendCommand::undo()
+{
+    QCOMPARE(m_str->mid(m_str->length() - m_text.length()), m_text);
+
+    m_str->truncate(m_str->length() - m_text.length());
+}
+
+int LightAppendCommand::id() const
+{
+    return 2;
+}
+
+bool LightAppendCommand::mergeWith(const LightUndoCommand *other)
+{
+    if (other->id() != id())
+        return false;
+    m_text += static_cast<const LightAppendCommand*>(other)->m_text;
+    return true;
+}
+
+qint64 LightAppendCommand::cost() const
+{
+    return m_text.length();
+}
+
+// Sets one element of a vector; the index of the element is its resource.
+class SetValueCommand : public LightUndoCommand
+{
+public:
+    SetValueCommand(QVector<int> *values, int key, int value) :
+        LightUndoCommand(QLatin1String("set")),
+        m_values(values),
+        m_key(key),
+        m_value(value),
+        m_oldValue(0)
+    {
+    }
+
+    void redo() override
+    {
+        m_oldValue = m_values->at(m_key);
+        (*m_values)[m_key] = m_value;
+    }
+
+    void undo() override { (*m_values)[m_key] = m_oldValue; }
+    QVector<quint64> resources() const override { return QVector<quint64>() << quint64(m_key); }
+
+private:
+    QVector<int> *m_values;
+    int m_key;
+    int m_value;
+    int m_oldValue;
+};
+
+class CostlySetValueCommand : public SetValueCommand
+{
+public:
+    CostlySetValueCommand(QVector<int> *values, int key, int value) :
+        SetValueCommand(values, key, value)
+    {
+    }
+
+    qint64 cost() const override { return 100; }
+};
+
+// Stands in for the document registry an application would look the edited
+// document up in when a command is read back from disk.
+static QString *hibernationDocument = 0;
+
+class HibernatingAppendCommand : public LightUndoCommand
+{
+public:
+    enum { Type = 1 };
+
+    HibernatingAppendCommand(const QString &text, qint64 cost) :
+        LightUndoCommand(QLatin1String("append ") + text),
+        m_text(text),
+        m_cost(cost)
+    {
+    }
+
+    void redo() override { hibernationDocument->append(m_text); }
+    void undo() override { hibernationDocument->chop(m_text.size()); }
+    qint64 cost() const override { return m_cost; }
+    int typeId() const override { return Type; }
+    void save(QDataStream &stream) const override { stream << m_text << m_cost; }
+
+    static LightUndoCommand *load(QDataStream &stream)
+    {
+        QString text;
+        qint64 cost;
+        stream >> text >> cost;
+        return new HibernatingAppendCommand(text, cost);
+    }
+
+private:
+    QString m_text;
+    qint64 m_cost;
+};
+
+// Can be written to disk, but not read back, the way a command whose file was
+// deleted behind the back of the application would.
+class UnreadableCommand : public LightUndoCommand
+{
+public:
+    enum { Type = 2 };
+
+    UnreadableCommand() : LightUndoCommand(QLatin1String("unreadable")) {}
+
+    int typeId() const override { return Type; }
+
+    static LightUndoCommand *load(QDataStream &) { return 0; }
+};
+
+// Replaces a document by a payload, the way a paste of a whole image would.
+class ReplaceBlobCommand : public LightUndoCommand
+{
+public:
+    ReplaceBlobCommand(QByteArray *document, UndoBlobStore *store, const QByteArray &data) :
+        LightUndoCommand(QLatin1String("replace")),
+        m_document(document),
+        m_after(store->insert(data)),
+        m_before(store->insert(*document))
+    {
+    }
+
+    void redo() override { *m_document = m_after.data(); }
+    void undo() override { *m_document = m_before.data(); }
+
+private:
+    QByteArray *m_document;
+    UndoBlob m_after;
+    UndoBlob m_before;
+};
+
+class CountingCodec : public UndoCompressionCodec
+{
+public:
+    QByteArray compress(const QByteArray &data) const override
+    {
+        compressCount.ref();
+        return UndoCompressionCodec::compress(data);
+    }
+
+    QByteArray decompress(const QByteArray &data) const override
+    {
+        decompressCount.ref();
+        return UndoCompressionCodec::decompress(data);
+    }
+
+    mutable QAtomicInt compressCount;
+    mutable QAtomicInt decompressCount;
+};
+
+class StringCheckpointHandler : public UndoCheckpointHandler
+{
+public:
+    explicit StringCheckpointHandler(QString *str) : restoreCount(0), m_str(str) {}
+
+    QVariant saveCheckpoint() override { return *m_str; }
+    void restoreCheckpoint(const QVariant &checkpoint) override
+    {
+        ++restoreCount;
+        *m_str = checkpoint.toString();
+    }
+    qint64 checkpointCost(const QVariant &checkpoint) const override
+    {
+        return checkpoint.toString().length();
+    }
+
+    int restoreCount;
+
+private:
+    QString *m_str;
+};
+
 struct CheckStateArgs
 {
     CheckStateArgs() :
@@ -193,6 +418,27 @@ private slots:
     void macroBeginEnd();
     void compression();
     void undoLimit();
+    void shrinkUndoLimit();
+    void lightCommands();
+    void commandPool();
+    void memoryLimit();
+    void updateScope();
+    void checkpoints();
+    void seekIndex();
+    void pushBatch();
+    void deferredReclamation();
+    void deferredClear();
+    void branches();
+    void selectiveUndo();
+    void selectiveUndoCost();
+    void hibernation();
+    void saveLoad();
+    void journal();
+    void journalFlush();
+    void mappedHistory();
+    void largeMappedHistory();
+    void payloadCompression();
+    void blobStore();
 
 private:
     void checkState(const CheckStateArgs &args);
@@ -204,6 +450,10 @@ private:
     QSignalSpy undoTextChangedSpy;
     QSignalSpy canRedoChangedSpy;
     QSignalSpy redoTextChangedSpy;
+    bool lastCanUndo;
+    QString lastUndoText;
+    bool lastCanRedo;
+    QString lastRedoText;
 };
 
 tst_UndoStack::tst_UndoStack() :
@@ -212,19 +462,29 @@ tst_UndoStack::tst_UndoStack() :
     canUndoChangedSpy(&stack, SIGNAL(canUndoChanged(bool))),
     undoTextChangedSpy(&stack, SIGNAL(undoTextChanged(QString))),
     canRedoChangedSpy(&stack, SIGNAL(canRedoChanged(bool))),
-    redoTextChangedSpy(&stack, SIGNAL(redoTextChanged(QString)))
+    redoTextChangedSpy(&stack, SIGNAL(redoTextChanged(QString))),
+    lastCanUndo(false),
+    lastCanRedo(false)
 {
 }
 
 void tst_UndoStack::cleanup()
 {
     stack.clear();
+    stack.setUndoLimit(0);
+    stack.setCheckpointHandler(0);
+    // Deliver whatever the test left queued before the spies are reset.
+    QCoreApplication::processEvents();
     indexChangedSpy.clear();
     cleanChangedSpy.clear();
     canUndoChangedSpy.clear();
     undoTextChangedSpy.clear();
     canRedoChangedSpy.clear();
     redoTextChangedSpy.clear();
+    lastCanUndo = false;
+    lastUndoText.clear();
+    lastCanRedo = false;
+    lastRedoText.clear();
 }
 
 void tst_UndoStack::checkState(const CheckStateArgs &args)
@@ -250,11 +510,19 @@ void tst_UndoStack::checkState(const CheckStateArgs &args)
     } else {
         QCOMPARE(cleanChangedSpy.count(), 0);
     }
+    // The stack only emits the undo and redo signals whose values differ from
+    // the ones it emitted last.
     if (args.undoChanged) {
-        QCOMPARE(canUndoChangedSpy.count(), 1);
-        QCOMPARE(canUndoChangedSpy.at(0).at(0).toBool(), args.canUndo);
-        QCOMPARE(undoTextChangedSpy.count(), 1);
-        QCOMPARE(undoTextChangedSpy.at(0).at(0).toString(), QString(args.undoText));
+        const bool canUndoChanged = args.canUndo != lastCanUndo;
+        QCOMPARE(canUndoChangedSpy.count(), canUndoChanged ? 1 : 0);
+        if (canUndoChanged)
+            QCOMPARE(canUndoChangedSpy.at(0).at(0).toBool(), args.canUndo);
+        const bool undoTextChanged = args.undoText != lastUndoText;
+        QCOMPARE(undoTextChangedSpy.count(), undoTextChanged ? 1 : 0);
+        if (undoTextChanged)
+            QCOMPARE(undoTextChangedSpy.at(0).at(0).toString(), QString(args.undoText));
+        lastCanUndo = args.canUndo;
+        lastUndoText = args.undoText;
         canUndoChangedSpy.clear();
         undoTextChangedSpy.clear();
     } else {
@@ -262,10 +530,16 @@ void tst_UndoStack::checkState(const CheckStateArgs &args)
         QCOMPARE(undoTextChangedSpy.count(), 0);
     }
     if (args.redoChanged) {
-        QCOMPARE(canRedoChangedSpy.count(), 1);
-        QCOMPARE(canRedoChangedSpy.at(0).at(0).toBool(), args.canRedo);
-        QCOMPARE(redoTextChangedSpy.count(), 1);
-        QCOMPARE(redoTextChangedSpy.at(0).at(0).toString(), QString(args.redoText));
+        const bool canRedoChanged = args.canRedo != lastCanRedo;
+        QCOMPARE(canRedoChangedSpy.count(), canRedoChanged ? 1 : 0);
+        if (canRedoChanged)
+            QCOMPARE(canRedoChangedSpy.at(0).at(0).toBool(), args.canRedo);
+        const bool redoTextChanged = args.redoText != lastRedoText;
+        QCOMPARE(redoTextChangedSpy.count(), redoTextChanged ? 1 : 0);
+        if (redoTextChanged)
+            QCOMPARE(redoTextChangedSpy.at(0).at(0).toString(), QString(args.redoText));
+        lastCanRedo = args.canRedo;
+        lastRedoText = args.redoText;
         canRedoChangedSpy.clear();
         redoTextChangedSpy.clear();
     } else {
@@ -1969,6 +2243,1339 @@ void tst_UndoStack::undoLimit()
     checkState(args);
 }
 
-QTEST_APPLESS_MAIN(tst_UndoStack)
+void tst_UndoStack::shrinkUndoLimit()
+{
+    QString string;
+    UndoStack stack;
+    QSignalSpy indexSpy(&stack, SIGNAL(indexChanged(int)));
+    QSignalSpy cleanSpy(&stack, SIGNAL(cleanChanged(bool)));
+
+    // Push enough commands to wrap the ring buffer around.
+    for (int i = 0; i < 40; ++i)
+        stack.push(new InsertCommand(&string, i, QString(QLatin1Char('a' + i % 26))));
+    stack.setUndoLimit(30);
+    QCOMPARE(stack.count(), 30);
+    QCOMPARE(stack.index(), 30);
+    for (int i = 0; i < 10; ++i)
+        stack.push(new InsertCommand(&string, 40 + i, QLatin1String("b")));
+    QCOMPARE(stack.count(), 30);
+    QCOMPARE(stack.index(), 30);
+    QCOMPARE(string.length(), 50);
+
+    // Shrinking keeps the index pointing at the same command and moves the
+    // clean index along.
+    stack.setIndex(25);
+    stack.setClean();
+    stack.setIndex(28);
+    indexSpy.clear();
+    cleanSpy.clear();
+    stack.setUndoLimit(10);
+    QCOMPARE(stack.undoLimit(), 10);
+    QCOMPARE(stack.count(), 10);
+    QCOMPARE(stack.index(), 8);
+    QCOMPARE(stack.cleanIndex(), 5);
+    QVERIFY(!stack.isClean());
+    QCOMPARE(indexSpy.count(), 1);
+    QCOMPARE(indexSpy.at(0).at(0).toInt(), 8);
+    QCOMPARE(cleanSpy.count(), 0);
+    QCOMPARE(stack.text(7), QString("insert"));
+    stack.setIndex(5);
+    QVERIFY(stack.isClean());
+
+    // Undone commands are dropped from the top once nothing is left to evict
+    // from the bottom.
+    stack.setIndex(2);
+    stack.setUndoLimit(4);
+    QCOMPARE(stack.count(), 4);
+    QCOMPARE(stack.index(), 0);
+    QCOMPARE(stack.cleanIndex(), 3);
+    QVERIFY(!stack.canUndo());
+    QVERIFY(stack.canRedo());
+    stack.setIndex(4);
+    QCOMPARE(string.length(), 46);
+
+    // Lifting the limit keeps the history.
+    stack.setUndoLimit(0);
+    QCOMPARE(stack.count(), 4);
+}
+
+void tst_UndoStack::lightCommands()
+{
+    QString string;
+    LightAppendCommand::deleteCount = 0;
+
+    stack.push(new LightAppendCommand(&string, "a"));
+    QCOMPARE(string, QString("a"));
+    CheckStateArgs args;
+    args.clean = false;
+    args.count = 1;
+    args.index = 1;
+    args.canUndo = true;
+    args.undoText = QLatin1String("light append");
+    args.canRedo = false;
+    args.redoText = QString();
+    args.cleanChanged = true;
+    args.indexChanged = true;
+    args.undoChanged = true;
+    args.redoChanged = true;
+    checkState(args);
+    QCOMPARE(stack.command(0), (const UndoCommand*)0);
+
+    // merged like an UndoCommand would be
+    stack.push(new LightAppendCommand(&string, "b"));
+    QCOMPARE(string, QString("ab"));
+    QCOMPARE(stack.count(), 1);
+    QCOMPARE(LightAppendCommand::deleteCount, 1);
+    args.cleanChanged = false;
+    checkState(args);
+
+    // an UndoCommand is never merged into a light command and vice versa
+    stack.push(new AppendCommand(&string, "c"));
+    QCOMPARE(string, QString("abc"));
+    QCOMPARE(stack.count(), 2);
+    QVERIFY(stack.command(1) != 0);
+    stack.push(new LightAppendCommand(&string, "d"));
+    QCOMPARE(string, QString("abcd"));
+    QCOMPARE(stack.count(), 3);
+
+    // light and QObject-based commands can be children of each other
+    UndoCommand *parent = new UndoCommand(QLatin1String("mixed"));
+    new LightAppendCommand(&string, "e", parent);
+    LightUndoCommand *lightParent = new LightUndoCommand(QLatin1String("light"));
+    new LightAppendCommand(&string, "g", lightParent);
+    stack.push(lightParent);
+    stack.push(parent);
+    QCOMPARE(string, QString("abcdge"));
+    QCOMPARE(stack.count(), 5);
+    QCOMPARE(stack.text(3), QString("light"));
+    QCOMPARE(stack.command(4)->childCount(), 1);
+    QCOMPARE(stack.command(4)->child(0), (const UndoCommand*)0);
+
+    stack.setIndex(1);
+    QCOMPARE(string, QString("ab"));
+    stack.redo();
+    QCOMPARE(string, QString("abc"));
+
+    // pushing truncates light commands as well
+    LightAppendCommand::deleteCount = 0;
+    stack.push(new LightAppendCommand(&string, "h"));
+    QCOMPARE(string, QString("abch"));
+    QCOMPARE(stack.count(), 3);
+    QCOMPARE(LightAppendCommand::deleteCount, 3);
+}
+
+void tst_UndoStack::commandPool()
+{
+    QString string;
+    UndoStack poolStack;
+    UndoCommandPool *pool = poolStack.commandPool();
+    QVERIFY(pool != 0);
+    QCOMPARE(poolStack.commandPool(), pool);
+    QCOMPARE(pool->slabCount(), 0);
+
+    LightAppendCommand::deleteCount = 0;
+    AppendCommand::deleteCount = 0;
+    for (int i = 0; i < 10; ++i)
+        poolStack.push(new (pool) LightAppendCommand(&string, "a"));
+    poolStack.push(new (pool) AppendCommand(&string, "b", true));
+    poolStack.beginMacro("macro");
+    poolStack.push(new (pool) AppendCommand(&string, "c", true));
+    poolStack.endMacro();
+    QCOMPARE(string, QString("aaaaaaaaaabc"));
+    QCOMPARE(poolStack.count(), 3);
+    QCOMPARE(pool->slabCount(), 1);
+    // Merged light commands went back to the pool; the private data of the
+    // UndoCommands and the macro stays on the heap.
+    QCOMPARE(LightAppendCommand::deleteCount, 9);
+    QCOMPARE(pool->liveAllocationCount(), 1 + 3);
+
+    // Truncated commands are returned to the pool.
+    poolStack.setIndex(1);
+    poolStack.push(new (pool) LightAppendCommand(&string, "d"));
+    QCOMPARE(string, QString("aaaaaaaaaad"));
+    QCOMPARE(AppendCommand::deleteCount, 2);
+    QCOMPARE(pool->liveAllocationCount(), 1);
+    const qint64 bytesInUse = pool->bytesInUse();
+    QVERIFY(bytesInUse > 0);
+
+    // Freed blocks are reused before the slab grows.
+    poolStack.push(new (pool) AppendCommand(&string, "e", true));
+    QCOMPARE(pool->slabCount(), 1);
+
+    // Commands that are too large for the pool come from the heap.
+    UndoCommandPool heapPool;
+    void *large = heapPool.allocate(4096);
+    QCOMPARE(heapPool.liveAllocationCount(), 0);
+    UndoCommandPool::deallocate(large, 4096);
+
+    // Freed memory finds its way back to the pool it came from.
+    void *small = heapPool.allocate(16);
+    QCOMPARE(heapPool.liveAllocationCount(), 1);
+    UndoCommandPool::deallocate(small, 16);
+    QCOMPARE(heapPool.liveAllocationCount(), 0);
+    QCOMPARE(heapPool.bytesInUse(), qint64(0));
+
+    poolStack.clear();
+    QCOMPARE(pool->liveAllocationCount(), 0);
+    QCOMPARE(pool->slabCount(), 0);
+    QCOMPARE(pool->bytesReserved(), qint64(0));
+}
+
+void tst_UndoStack::memoryLimit()
+{
+    QString string;
+    UndoStack stack;
+    QSignalSpy usageSpy(&stack, SIGNAL(memoryUsageChanged(qint64)));
+    QSignalSpy evictedSpy(&stack, SIGNAL(evictedBytesChanged(qint64)));
+    QSignalSpy limitSpy(&stack, SIGNAL(memoryLimitChanged(qint64)));
+    QCOMPARE(stack.memoryLimit(), qint64(0));
+
+    stack.push(new LightAppendCommand(&string, "aaaa"));
+    stack.push(new InsertCommand(&string, 0, "x"));
+    stack.push(new LightAppendCommand(&string, "bbbbbb"));
+    QCOMPARE(stack.memoryUsage(), qint64(10));
+    QCOMPARE(usageSpy.count(), 2);
+    QCOMPARE(usageSpy.last().at(0).toLongLong(), qint64(10));
+
+    // Merging re-queries the cost of the merged command.
+    stack.push(new LightAppendCommand(&string, "cc"));
+    QCOMPARE(stack.count(), 3);
+    QCOMPARE(stack.memoryUsage(), qint64(12));
+
+    // Lowering the limit evicts from the bottom right away.
+    stack.setMemoryLimit(9);
+    QCOMPARE(stack.memoryLimit(), qint64(9));
+    QCOMPARE(limitSpy.count(), 1);
+    QCOMPARE(limitSpy.last().at(0).toLongLong(), qint64(9));
+    stack.setMemoryLimit(9);
+    QCOMPARE(limitSpy.count(), 1);
+    QCOMPARE(stack.count(), 2);
+    QCOMPARE(stack.index(), 2);
+    QCOMPARE(stack.memoryUsage(), qint64(8));
+    QCOMPARE(stack.evictedBytes(), qint64(4));
+    QCOMPARE(evictedSpy.count(), 1);
+    QCOMPARE(string, QString("xaaaabbbbbbcc"));
+
+    // The command that was just pushed survives even if it exceeds the limit alone.
+    stack.push(new InsertCommand(&string, 0, "y"));
+    stack.push(new LightAppendCommand(&string, "dddddddddddd"));
+    QCOMPARE(stack.count(), 1);
+    QCOMPARE(stack.memoryUsage(), qint64(12));
+    QCOMPARE(stack.evictedBytes(), qint64(12));
+    QCOMPARE(evictedSpy.count(), 2);
+    QVERIFY(stack.canUndo());
+    QVERIFY(!stack.isClean());
+
+    // Commands above the index are never evicted.
+    stack.setMemoryLimit(0);
+    stack.push(new InsertCommand(&string, 0, "z"));
+    stack.undo();
+    stack.undo();
+    stack.setMemoryLimit(1);
+    QCOMPARE(stack.count(), 2);
+    QCOMPARE(stack.index(), 0);
+
+    // Macros are costed as a whole when they end.
+    stack.setMemoryLimit(0);
+    stack.clear();
+    QCOMPARE(stack.memoryUsage(), qint64(0));
+    stack.beginMacro("macro");
+    stack.push(new LightAppendCommand(&string, "eee"));
+    stack.push(new InsertCommand(&string, 0, "w"));
+    QCOMPARE(stack.memoryUsage(), qint64(0));
+    stack.endMacro();
+    QCOMPARE(stack.memoryUsage(), qint64(3));
+    QCOMPARE(stack.evictedBytes(), qint64(12));
+}
+
+void tst_UndoStack::updateScope()
+{
+    QString string;
+    CheckStateArgs args;
+
+    {
+        UndoStackUpdateScope scope(&stack);
+        QVERIFY(stack.isUpdating());
+        stack.push(new InsertCommand(&string, 0, "a"));
+        stack.push(new InsertCommand(&string, 1, "b"));
+        stack.push(new InsertCommand(&string, 2, "c"));
+        stack.undo();
+        stack.beginUpdate();
+        stack.setIndex(0);
+        stack.setIndex(2);
+        stack.endUpdate();
+        QVERIFY(stack.isUpdating());
+
+        // Nothing is emitted inside the scope, but the getters are up to date.
+        args.clean = false;
+        args.count = 3;
+        args.index = 2;
+        args.canUndo = true;
+        args.undoText = QLatin1String("insert");
+        args.canRedo = true;
+        args.redoText = QLatin1String("insert");
+        args.cleanChanged = false;
+        args.indexChanged = false;
+        args.undoChanged = false;
+        args.redoChanged = false;
+        checkState(args);
+    }
+    QVERIFY(!stack.isUpdating());
+    QCOMPARE(string, QString("ab"));
+    args.cleanChanged = true;
+    args.indexChanged = true;
+    args.undoChanged = true;
+    args.redoChanged = true;
+    checkState(args);
+
+    // A scope that returns to the same index still reports the modification.
+    UndoStackUpdateScope scope(&stack);
+    stack.push(new InsertCommand(&string, 2, "d"));
+    stack.undo();
+    scope.commit();
+    QVERIFY(!stack.isUpdating());
+    QCOMPARE(string, QString("ab"));
+    args.cleanChanged = false;
+    args.indexChanged = true;
+    args.undoChanged = true;
+    args.redoChanged = true;
+    checkState(args);
+
+    // Passing through the clean state inside an update does not emit cleanChanged().
+    stack.beginUpdate();
+    stack.setIndex(0);
+    stack.setIndex(2);
+    stack.endUpdate();
+    args.cleanChanged = false;
+    checkState(args);
+
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::endUpdate(): no matching beginUpdate()");
+    stack.endUpdate();
+}
+
+void tst_UndoStack::checkpoints()
+{
+    QString string;
+    QString history;
+    StringCheckpointHandler handler(&string);
+    stack.setCheckpointHandler(&handler);
+    stack.setCheckpointInterval(10);
+    QCOMPARE(stack.checkpointHandler(), (UndoCheckpointHandler*)&handler);
+
+    for (int i = 0; i < 100; ++i) {
+        const QString text(QLatin1Char('a' + i % 26));
+        history += text;
+        stack.push(new InsertCommand(&string, i, text));
+    }
+    QCOMPARE(stack.checkpointCount(), 10);
+    QCOMPARE(stack.checkpointMemoryUsage(), qint64(10 + 20 + 30 + 40 + 50 + 60 + 70 + 80 + 90 + 100));
+    QCOMPARE(stack.memoryUsage(), stack.checkpointMemoryUsage());
+
+    // Without a checkpoint below the target, the stack walks.
+    stack.setIndex(0);
+    QCOMPARE(string, QString());
+    QCOMPARE(handler.restoreCount, 0);
+
+    // A long jump restores the nearest checkpoint and redoes the rest.
+    InsertCommand::redoCount = 0;
+    stack.setIndex(95);
+    QCOMPARE(string, history.left(95));
+    QCOMPARE(handler.restoreCount, 1);
+    QCOMPARE(InsertCommand::redoCount, 5);
+
+    // A short step walks.
+    stack.setIndex(97);
+    QCOMPARE(string, history.left(97));
+    QCOMPARE(handler.restoreCount, 1);
+
+    // Checkpoints above a truncated command are deleted.
+    stack.setIndex(45);
+    QCOMPARE(string, history.left(45));
+    QCOMPARE(handler.restoreCount, 2);
+    stack.push(new InsertCommand(&string, 45, "Z"));
+    QCOMPARE(stack.checkpointCount(), 4);
+    QCOMPARE(stack.checkpointMemoryUsage(), qint64(10 + 20 + 30 + 40));
+
+    // Checkpoints below evicted commands are deleted, and the keys of the others
+    // follow the shifted indexes.
+    stack.setUndoLimit(30);
+    QCOMPARE(stack.count(), 30);
+    QCOMPARE(stack.checkpointCount(), 3);
+    QCOMPARE(stack.checkpointMemoryUsage(), qint64(20 + 30 + 40));
+    QCOMPARE(stack.evictedBytes(), qint64(10));
+    stack.setIndex(5);
+    QCOMPARE(string, history.left(21));
+    QCOMPARE(handler.restoreCount, 3);
+    stack.setIndex(30);
+    QCOMPARE(string, history.left(45) + QLatin1String("Z"));
+
+    stack.setCheckpointHandler(0);
+    QCOMPARE(stack.checkpointCount(), 0);
+    QCOMPARE(stack.memoryUsage(), qint64(0));
+}
+
+void tst_UndoStack::seekIndex()
+{
+    QString string;
+    for (int i = 0; i < 10; ++i)
+        stack.push(new InsertCommand(&string, i, QString(QLatin1Char('a' + i))));
+    stack.setIndex(0);
+    indexChangedSpy.clear();
+    QSignalSpy progressSpy(&stack, SIGNAL(seekProgress(int,int)));
+    QSignalSpy finishedSpy(&stack, SIGNAL(seekFinished()));
+
+    // A generous budget reaches the target in the first slice.
+    stack.setSeekTimeBudget(60000);
+    stack.seekIndex(8);
+    QVERIFY(!stack.isSeeking());
+    QCOMPARE(stack.index(), 8);
+    QCOMPARE(string, QString("abcdefgh"));
+    QCOMPARE(progressSpy.count(), 1);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.at(0).at(0).toInt(), 8);
+
+    // A budget of 0 steps exactly one command per slice; the first slice runs right
+    // away and the following ones from the event loop.
+    progressSpy.clear();
+    finishedSpy.clear();
+    indexChangedSpy.clear();
+    stack.setSeekTimeBudget(0);
+    stack.seekIndex(2);
+    QVERIFY(stack.isSeeking());
+    QCOMPARE(stack.seekTarget(), 2);
+    QCOMPARE(stack.index(), 7);
+    QCOMPARE(progressSpy.count(), 1);
+    QCOMPARE(progressSpy.at(0).at(1).toInt(), 2);
+    QTRY_VERIFY(!stack.isSeeking());
+    QCOMPARE(stack.index(), 2);
+    QCOMPARE(string, QString("ab"));
+    QCOMPARE(progressSpy.count(), 6);
+    for (int i = 0; i < progressSpy.count(); ++i)
+        QCOMPARE(progressSpy.at(i).at(0).toInt(), 7 - i);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.at(0).at(0).toInt(), 2);
+
+    // Retargeting continues from the current index.
+    progressSpy.clear();
+    finishedSpy.clear();
+    indexChangedSpy.clear();
+    stack.seekIndex(9);
+    QCOMPARE(stack.index(), 3);
+    stack.seekIndex(6);
+    QTRY_VERIFY(!stack.isSeeking());
+    QCOMPARE(stack.index(), 6);
+    QCOMPARE(string, QString("abcdef"));
+    QCOMPARE(progressSpy.count(), 4);
+    QCOMPARE(progressSpy.last().at(0).toInt(), 6);
+    QCOMPARE(finishedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.at(0).at(0).toInt(), 6);
+
+    // Any other change of the stack stops seeking where it is.
+    finishedSpy.clear();
+    indexChangedSpy.clear();
+    stack.seekIndex(0);
+    QCOMPARE(stack.index(), 5);
+    stack.undo();
+    QVERIFY(!stack.isSeeking());
+    QCOMPARE(stack.seekTarget(), 4);
+    QCOMPARE(stack.index(), 4);
+    QCOMPARE(string, QString("abcd"));
+    QCOMPARE(finishedSpy.count(), 0);
+    QCOMPARE(indexChangedSpy.count(), 2);
+    // The slice that was already posted finds nothing left to do.
+    QCoreApplication::processEvents();
+    QCOMPARE(stack.index(), 4);
+
+    stack.setSeekTimeBudget(8);
+}
+
+void tst_UndoStack::pushBatch()
+{
+    QString str1;
+    QString str2;
+    UndoStack reference;
+
+    for (int i = 0; i < 3; ++i) {
+        stack.push(new InsertCommand(&str1, i, "x"));
+        reference.push(new InsertCommand(&str2, i, "x"));
+    }
+    stack.undo();
+    reference.undo();
+    stack.setUndoLimit(6);
+    reference.setUndoLimit(6);
+    indexChangedSpy.clear();
+    cleanChangedSpy.clear();
+
+    QVector<LightUndoCommand*> batch;
+    batch << new AppendCommand(&str1, "a")
+          << new AppendCommand(&str1, "b")
+          << new AppendCommand(&str1, "c")
+          << new InsertCommand(&str1, 0, "1")
+          << new InsertCommand(&str1, 0, "2")
+          << new InsertCommand(&str1, 0, "3")
+          << new InsertCommand(&str1, 0, "4");
+    stack.push(batch);
+
+    reference.push(new AppendCommand(&str2, "a"));
+    reference.push(new AppendCommand(&str2, "b"));
+    reference.push(new AppendCommand(&str2, "c"));
+    reference.push(new InsertCommand(&str2, 0, "1"));
+    reference.push(new InsertCommand(&str2, 0, "2"));
+    reference.push(new InsertCommand(&str2, 0, "3"));
+    reference.push(new InsertCommand(&str2, 0, "4"));
+
+    QCOMPARE(str1, QString("4321xxabc"));
+    QCOMPARE(str1, str2);
+    QCOMPARE(stack.count(), reference.count());
+    QCOMPARE(stack.index(), reference.index());
+    QCOMPARE(stack.cleanIndex(), reference.cleanIndex());
+    QCOMPARE(stack.count(), 6);
+    for (int i = 0; i < stack.count(); ++i)
+        QCOMPARE(stack.text(i), reference.text(i));
+
+    // The signals are emitted once for the whole batch.
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.at(0).at(0).toInt(), 6);
+    QCOMPARE(cleanChangedSpy.count(), 0);
+
+    while (stack.canUndo()) {
+        stack.undo();
+        reference.undo();
+        QCOMPARE(str1, str2);
+    }
+    QCOMPARE(str1, QString("x"));
+}
+
+void tst_UndoStack::deferredReclamation()
+{
+    QString str;
+    LightAppendCommand::deleteCount = 0;
+    AppendCommand::deleteCount = 0;
+    stack.setReclamationMode(UndoStack::DeferredReclamation);
+    QCOMPARE(stack.reclamationMode(), UndoStack::DeferredReclamation);
+
+    stack.push(new LightAppendCommand(&str, "a"));
+    stack.push(new AppendCommand(&str, "b"));
+    stack.push(new LightAppendCommand(&str, "c"));
+    stack.setIndex(0);
+    indexChangedSpy.clear();
+
+    // The truncated commands are gone from the stack right away...
+    stack.push(new InsertCommand(&str, 0, "x"));
+    QCOMPARE(str, QString("x"));
+    QCOMPARE(stack.count(), 1);
+    QCOMPARE(stack.index(), 1);
+    QCOMPARE(indexChangedSpy.count(), 1);
+
+    // ...but destroyed later: the light commands on the thread pool, the
+    // UndoCommand from the event loop.
+    QCOMPARE(AppendCommand::deleteCount, 0);
+    QVERIFY(stack.isReclaiming());
+    QTRY_VERIFY(!stack.isReclaiming());
+    QCOMPARE(LightAppendCommand::deleteCount, 2);
+    QCOMPARE(AppendCommand::deleteCount, 1);
+
+    // Truncations in quick succession are drained together.
+    LightAppendCommand::deleteCount = 0;
+    for (int i = 0; i < 20; ++i) {
+        stack.push(new LightAppendCommand(&str, "d"));
+        stack.push(new InsertCommand(&str, 0, "y"));
+        stack.undo();
+        stack.undo();
+    }
+    QCOMPARE(stack.count(), 3);
+    QTRY_VERIFY(!stack.isReclaiming());
+    QCOMPARE(LightAppendCommand::deleteCount, 19);
+
+    stack.setReclamationMode(UndoStack::ImmediateReclamation);
+}
+
+void tst_UndoStack::deferredClear()
+{
+    QString str;
+    LightAppendCommand::deleteCount = 0;
+    AppendCommand::deleteCount = 0;
+    stack.setReclamationMode(UndoStack::DeferredReclamation);
+
+    for (int i = 0; i < 50; ++i) {
+        stack.push(new AppendCommand(&str, "a"));
+        stack.push(new LightAppendCommand(&str, "b"));
+    }
+    QCOMPARE(stack.count(), 100);
+    cleanChangedSpy.clear();
+    indexChangedSpy.clear();
+
+    stack.clear();
+    QCOMPARE(stack.count(), 0);
+    QCOMPARE(stack.index(), 0);
+    QVERIFY(stack.isClean());
+    QCOMPARE(cleanChangedSpy.count(), 1);
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QVERIFY(stack.isReclaiming());
+    QCOMPARE(AppendCommand::deleteCount, 0);
+
+    stack.waitForReclamation();
+    QVERIFY(!stack.isReclaiming());
+    QCOMPARE(AppendCommand::deleteCount, 50);
+    QCOMPARE(LightAppendCommand::deleteCount, 50);
+
+    stack.setReclamationMode(UndoStack::ImmediateReclamation);
+}
+
+void tst_UndoStack::branches()
+{
+    QString str;
+    stack.setBranchingEnabled(true);
+    QVERIFY(stack.isBranchingEnabled());
+
+    stack.push(new InsertCommand(&str, 0, "a"));
+    stack.push(new InsertCommand(&str, 1, "b"));
+    stack.push(new InsertCommand(&str, 2, "c"));
+    stack.setClean();
+    stack.setIndex(1);
+    stack.push(new InsertCommand(&str, 1, "x"));
+    QCOMPARE(str, QString("ax"));
+    QCOMPARE(stack.count(), 2);
+    QCOMPARE(stack.cleanIndex(), -1);
+    QCOMPARE(stack.branches(), QVector<int>() << 1);
+    QCOMPARE(stack.branchParent(1), 0);
+    QCOMPARE(stack.branchForkIndex(1), 1);
+    QCOMPARE(stack.branchCommandCount(1), 2);
+    QVERIFY(stack.branchCommand(1, 1) != 0);
+    QVERIFY(stack.branchCommand(1, 2) == 0);
+
+    stack.push(new InsertCommand(&str, 2, "y"));
+    stack.setIndex(2);
+    stack.push(new InsertCommand(&str, 2, "z"));
+    QCOMPARE(str, QString("axz"));
+    QCOMPARE(stack.branches(), QVector<int>() << 1 << 2);
+    QCOMPARE(stack.branchForkIndex(2), 2);
+
+    // Switching moves the clean state along, and re-parents the branch that forks
+    // from the commands that were replaced.
+    indexChangedSpy.clear();
+    stack.switchToBranch(1);
+    QCOMPARE(str, QString("abc"));
+    QCOMPARE(stack.index(), 3);
+    QVERIFY(stack.isClean());
+    QCOMPARE(indexChangedSpy.count(), 1);
+    QCOMPARE(stack.branches(), QVector<int>() << 2 << 3);
+    QCOMPARE(stack.branchParent(2), 3);
+    QCOMPARE(stack.branchForkIndex(3), 1);
+
+    // A nested branch is reached through its parent, taking the shortest path.
+    InsertCommand::redoCount = 0;
+    stack.switchToBranch(2);
+    QCOMPARE(str, QString("axy"));
+    QCOMPARE(InsertCommand::redoCount, 2);
+    QCOMPARE(stack.index(), 3);
+    QVERIFY(!stack.isClean());
+    QCOMPARE(stack.branches(), QVector<int>() << 4 << 5);
+    QCOMPARE(stack.branchParent(4), 0);
+    QCOMPARE(stack.branchParent(5), 0);
+
+    // Switching to an index inside the branch.
+    stack.switchToBranch(4, 2);
+    QCOMPARE(str, QString("ab"));
+    QCOMPARE(stack.index(), 2);
+    QCOMPARE(stack.count(), 3);
+    QCOMPARE(stack.cleanIndex(), 3);
+
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::switchToBranch(): no branch with id 4");
+    stack.switchToBranch(4);
+
+    stack.clear();
+    QVERIFY(stack.branches().isEmpty());
+
+    // The least recently used branches are deleted to stay within the budget.
+    stack.push(new LightAppendCommand(&str, "aaaa"));
+    stack.push(new AppendCommand(&str, "-"));
+    stack.setIndex(0);
+    stack.push(new AppendCommand(&str, "x"));
+    stack.push(new LightAppendCommand(&str, "bbbbbb"));
+    stack.setIndex(0);
+    stack.push(new AppendCommand(&str, "y"));
+    QCOMPARE(stack.branches().size(), 2);
+    QCOMPARE(stack.branchMemoryUsage(), qint64(10));
+    QCOMPARE(stack.memoryUsage(), qint64(0));
+    stack.setBranchMemoryLimit(8);
+    QCOMPARE(stack.branches().size(), 1);
+    QCOMPARE(stack.branchMemoryUsage(), qint64(6));
+    stack.switchToBranch(stack.branches().constFirst());
+    QCOMPARE(str, QString("abxbbbbbb"));
+    QCOMPARE(stack.memoryUsage(), qint64(6));
+    QCOMPARE(stack.branchMemoryUsage(), qint64(0));
+
+    stack.setBranchMemoryLimit(0);
+    stack.setBranchingEnabled(false);
+    QVERIFY(stack.branches().isEmpty());
+
+    // Deleting a branch deletes the branches that fork from it, and the ones that
+    // fork from the stack keep their parent.
+    stack.setBranchingEnabled(true);
+    stack.clear();
+    str.clear();
+    stack.push(new InsertCommand(&str, 0, "a"));
+    stack.push(new InsertCommand(&str, 0, "b"));
+    stack.setIndex(1);
+    stack.push(new InsertCommand(&str, 0, "c"));
+    stack.setIndex(0);
+    stack.push(new InsertCommand(&str, 0, "d"));
+    stack.push(new InsertCommand(&str, 0, "e"));
+    stack.setIndex(1);
+    stack.push(new InsertCommand(&str, 0, "f"));
+    QCOMPARE(str, QString("fd"));
+    const QVector<int> ids = stack.branches();
+    QCOMPARE(ids.size(), 3);
+    QCOMPARE(stack.branchParent(ids.at(0)), ids.at(1));
+    QCOMPARE(stack.branchParent(ids.at(1)), 0);
+    QCOMPARE(stack.branchParent(ids.at(2)), 0);
+    stack.switchToBranch(ids.at(2));
+    QCOMPARE(str, QString("ed"));
+    stack.switchToBranch(ids.at(0));
+    QCOMPARE(str, QString("ba"));
+    const QVector<int> newIds = stack.branches();
+    QCOMPARE(newIds.size(), 3);
+    QCOMPARE(stack.branchParent(newIds.at(0)), newIds.at(1));
+    QCOMPARE(stack.branchParent(newIds.at(1)), 0);
+    QCOMPARE(stack.branchParent(newIds.at(2)), 0);
+    stack.setBranchingEnabled(false);
+    QVERIFY(stack.branches().isEmpty());
+}
+
+void tst_UndoStack::selectiveUndo()
+{
+    QVector<int> values(3, 0);
+    QString str;
+    stack.push(new SetValueCommand(&values, 0, 1));
+    stack.push(new SetValueCommand(&values, 1, 2));
+    stack.push(new SetValueCommand(&values, 0, 3));
+    stack.push(new SetValueCommand(&values, 2, 4));
+    QCOMPARE(values, QVector<int>() << 3 << 2 << 4);
+
+    QVERIFY(!stack.canUndoSelectively(0));
+    QVERIFY(stack.canUndoSelectively(1));
+    QVERIFY(stack.canUndoSelectively(2));
+    QVERIFY(stack.canUndoSelectively(3));
+    QVERIFY(!stack.canUndoSelectively(4));
+    QVERIFY(!stack.undoSelectively(0));
+    QCOMPARE(stack.count(), 4);
+
+    // The command is undone in place, and the undo becomes a new command.
+    QVERIFY(stack.undoSelectively(1));
+    QCOMPARE(values, QVector<int>() << 3 << 0 << 4);
+    QCOMPARE(stack.count(), 5);
+    QCOMPARE(stack.index(), 5);
+    QCOMPARE(stack.undoText(), QString("Revert set"));
+    QVERIFY(!stack.canUndoSelectively(1));
+    QVERIFY(stack.canUndoSelectively(4));
+    stack.undo();
+    QCOMPARE(values, QVector<int>() << 3 << 2 << 4);
+    stack.redo();
+    QCOMPARE(values, QVector<int>() << 3 << 0 << 4);
+
+    // A command without resources conflicts with every command before it.
+    stack.push(new InsertCommand(&str, 0, "a"));
+    QVERIFY(!stack.canUndoSelectively(3));
+    QVERIFY(stack.canUndoSelectively(5));
+
+    // A reverted command that is evicted stays alive as long as its revert.
+    stack.setUndoLimit(4);
+    QCOMPARE(stack.count(), 4);
+    stack.undo();
+    stack.undo();
+    QCOMPARE(values, QVector<int>() << 3 << 2 << 4);
+    stack.redo();
+    QCOMPARE(values, QVector<int>() << 3 << 0 << 4);
+
+    // Truncated commands leave the index.
+    stack.setIndex(1);
+    QCOMPARE(values, QVector<int>() << 3 << 2 << 0);
+    stack.push(new SetValueCommand(&values, 1, 5));
+    QCOMPARE(stack.count(), 2);
+    QVERIFY(stack.canUndoSelectively(0));
+    QVERIFY(stack.undoSelectively(0));
+    QCOMPARE(values, QVector<int>() << 1 << 5 << 0);
+}
+
+void tst_UndoStack::selectiveUndoCost()
+{
+    QVector<int> values(3, 0);
+    stack.push(new CostlySetValueCommand(&values, 0, 1));
+    stack.push(new CostlySetValueCommand(&values, 1, 2));
+    stack.push(new CostlySetValueCommand(&values, 2, 3));
+    QCOMPARE(stack.memoryUsage(), qint64(300));
+
+    // The revert costs nothing while the reverted command is counted on the stack.
+    QVERIFY(stack.undoSelectively(1));
+    QCOMPARE(stack.memoryUsage(), qint64(300));
+
+    // An evicted command that stays alive with its revert is counted with the latter.
+    stack.setUndoLimit(2);
+    QCOMPARE(stack.count(), 2);
+    QCOMPARE(stack.memoryUsage(), qint64(200));
+    stack.undo();
+    QCOMPARE(values, QVector<int>() << 1 << 2 << 3);
+
+    // Both go together.
+    stack.undo();
+    stack.push(new CostlySetValueCommand(&values, 2, 5));
+    QCOMPARE(stack.count(), 1);
+    QCOMPARE(stack.memoryUsage(), qint64(100));
+    QCOMPARE(values, QVector<int>() << 1 << 2 << 5);
+}
+
+void tst_UndoStack::hibernation()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+
+    for (int i = 0; i < 10; ++i)
+        stack.push(new HibernatingAppendCommand(QString::number(i), 1000));
+    // Commands that cannot be written to disk stay in memory.
+    stack.push(new LightUndoCommand(QLatin1String("plain")));
+    QCOMPARE(str, QString("0123456789"));
+    QCOMPARE(stack.memoryUsage(), qint64(10000));
+
+    stack.hibernate();
+    QCOMPARE(stack.hibernatedCount(), 10);
+    QCOMPARE(stack.memoryUsage(), qint64(0));
+    QCOMPARE(stack.count(), 11);
+    QCOMPARE(stack.text(3), QString("append 3"));
+    QCOMPARE(stack.undoText(), QString("plain"));
+
+    // Hibernated commands are read back when they are undone or redone.
+    stack.undo();
+    stack.undo();
+    QCOMPARE(str, QString("012345678"));
+    QCOMPARE(stack.redoText(), QString("append 9"));
+    stack.redo();
+    QCOMPARE(str, QString("0123456789"));
+    // The command that was read back takes the place of its placeholder.
+    QCOMPARE(stack.hibernatedCount(), 9);
+    QCOMPARE(stack.memoryUsage(), qint64(1000));
+
+    stack.rehydrate();
+    QCOMPARE(stack.hibernatedCount(), 0);
+    QCOMPARE(stack.memoryUsage(), qint64(10000));
+    stack.setIndex(0);
+    QCOMPARE(str, QString());
+    stack.setIndex(10);
+    QCOMPARE(str, QString("0123456789"));
+
+    // Commands that are hibernated already are not written again.
+    stack.hibernate();
+    stack.undo();
+    stack.hibernate();
+    QCOMPARE(stack.hibernatedCount(), 10);
+    stack.setIndex(5);
+    QCOMPARE(str, QString("01234"));
+    stack.clear();
+    QCOMPARE(stack.hibernatedCount(), 0);
+
+    // A command that cannot be read back stops the index rather than being skipped.
+    LightUndoCommand::registerType(UnreadableCommand::Type, UnreadableCommand::load);
+    str.clear();
+    stack.push(new HibernatingAppendCommand(QLatin1String("a"), 1000));
+    stack.push(new UnreadableCommand);
+    stack.push(new HibernatingAppendCommand(QLatin1String("b"), 1000));
+    stack.hibernate();
+    QCOMPARE(stack.hibernatedCount(), 3);
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack: cannot read hibernated command \"unreadable\"");
+    stack.setIndex(0);
+    QCOMPARE(stack.index(), 2);
+    QCOMPARE(str, QString("a"));
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack: cannot read hibernated command \"unreadable\"");
+    stack.undo();
+    QCOMPARE(stack.index(), 2);
+    QCOMPARE(stack.hibernatedCount(), 2);
+    QCOMPARE(stack.memoryUsage(), qint64(1000));
+    stack.redo();
+    QCOMPARE(str, QString("ab"));
+    stack.clear();
+
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::saveLoad()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+
+    for (int i = 0; i < 5; ++i)
+        stack.push(new HibernatingAppendCommand(QString::number(i), 10));
+    stack.undo();
+    stack.setClean();
+
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(stack.save(&buffer));
+
+    // The commands are restored without being executed.
+    UndoStack loaded;
+    buffer.seek(0);
+    QVERIFY(loaded.load(&buffer));
+    QCOMPARE(str, QString("0123"));
+    QCOMPARE(loaded.count(), 5);
+    QCOMPARE(loaded.index(), 4);
+    QCOMPARE(loaded.cleanIndex(), 4);
+    QVERIFY(loaded.isClean());
+    QCOMPARE(loaded.text(2), QString("append 2"));
+    QCOMPARE(loaded.redoText(), QString("append 4"));
+    QCOMPARE(loaded.memoryUsage(), qint64(50));
+    loaded.redo();
+    QCOMPARE(str, QString("01234"));
+    loaded.setIndex(0);
+    QCOMPARE(str, QString());
+    loaded.setIndex(4);
+
+    // Hibernated commands are saved as well.
+    stack.hibernate();
+    QBuffer hibernatedBuffer;
+    hibernatedBuffer.open(QIODevice::ReadWrite);
+    QVERIFY(stack.save(&hibernatedBuffer));
+    QCOMPARE(hibernatedBuffer.data(), buffer.data());
+
+    // Invalid data leaves the stack unchanged.
+    QByteArray garbage("garbage");
+    QBuffer garbageBuffer(&garbage);
+    garbageBuffer.open(QIODevice::ReadOnly);
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::load(): the data is not an undo history");
+    QVERIFY(!loaded.load(&garbageBuffer));
+    QByteArray truncated = buffer.data();
+    truncated.chop(3);
+    QBuffer truncatedBuffer(&truncated);
+    truncatedBuffer.open(QIODevice::ReadOnly);
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::load(): cannot read the command at index 4");
+    QVERIFY(!loaded.load(&truncatedBuffer));
+    QCOMPARE(loaded.count(), 5);
+    QCOMPARE(loaded.index(), 4);
+
+    // A stack with a command that cannot be saved writes nothing.
+    stack.push(new LightUndoCommand(QLatin1String("plain")));
+    QBuffer unsavedBuffer;
+    unsavedBuffer.open(QIODevice::ReadWrite);
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::save(): the command at index 4 cannot be saved");
+    QVERIFY(!stack.save(&unsavedBuffer));
+    QCOMPARE(unsavedBuffer.size(), qint64(0));
+
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::journal()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/history.journal");
+
+    stack.push(new HibernatingAppendCommand(QLatin1String("a"), 1));
+    stack.setClean();
+    QVERIFY(stack.openJournal(fileName));
+    QCOMPARE(stack.journalFileName(), fileName);
+
+    for (int i = 0; i < 5; ++i)
+        stack.push(new HibernatingAppendCommand(QString::number(i), 1));
+    stack.undo();
+    stack.undo();
+    stack.beginMacro(QLatin1String("macro"));
+    stack.push(new HibernatingAppendCommand(QLatin1String("x"), 1));
+    stack.push(new HibernatingAppendCommand(QLatin1String("y"), 1));
+    stack.endMacro();
+    QCOMPARE(str, QString("a012xy"));
+    stack.undo();
+    stack.closeJournal();
+    QVERIFY(stack.journalFileName().isEmpty());
+
+    // After a crash, the document is opened in the state it was saved in, and the
+    // journal brings it up to date.
+    str = QLatin1String("a");
+    UndoStack recovered;
+    QVERIFY(recovered.recoverJournal(fileName));
+    QCOMPARE(str, QString("a012"));
+    QCOMPARE(recovered.count(), 5);
+    QCOMPARE(recovered.index(), 4);
+    QCOMPARE(recovered.cleanIndex(), 1);
+    QCOMPARE(recovered.text(4), QString("macro"));
+    recovered.redo();
+    QCOMPARE(str, QString("a012xy"));
+    recovered.setIndex(1);
+    QCOMPARE(str, QString("a"));
+
+    // The limits apply once the recorded state is reached.
+    UndoStack limited;
+    limited.setUndoLimit(2);
+    QVERIFY(limited.recoverJournal(fileName));
+    QCOMPARE(str, QString("a012"));
+    QCOMPARE(limited.count(), 2);
+    QCOMPARE(limited.index(), 1);
+    QCOMPARE(limited.cleanIndex(), -1);
+    QCOMPARE(limited.undoText(), QString("append 2"));
+    QCOMPARE(limited.redoText(), QString("macro"));
+    str = QLatin1String("a");
+
+    // A record that was torn by the crash is ignored.
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    QVERIFY(file.resize(file.size() - 2));
+    file.close();
+    UndoStack torn;
+    QVERIFY(torn.recoverJournal(fileName));
+    QCOMPARE(torn.index(), 5);
+    QCOMPARE(str, QString("a012xy"));
+    torn.setIndex(1);
+
+    // The journal is compacted into a snapshot once its records outgrow the threshold.
+    str = QLatin1String("a012");
+    QVERIFY(stack.openJournal(fileName));
+    stack.setJournalCompactionThreshold(1024);
+    for (int i = 0; i < 1000; ++i) {
+        stack.undo();
+        stack.redo();
+    }
+    stack.setClean();
+    stack.closeJournal();
+    QVERIFY(QFileInfo(fileName).size() < 2048);
+    QVERIFY(recovered.recoverJournal(fileName));
+    QCOMPARE(recovered.index(), 4);
+    QCOMPARE(str, QString("a012"));
+
+    // A command that cannot be written closes the journal.
+    QVERIFY(stack.openJournal(fileName));
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QLatin1String("cannot be written to the journal")));
+    stack.push(new LightUndoCommand(QLatin1String("plain")));
+    QVERIFY(stack.journalFileName().isEmpty());
+
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::journalFlush()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/history.journal");
+
+    QVERIFY(stack.openJournal(fileName));
+    QTRY_VERIFY(QFileInfo(fileName).size() > 0);
+    const qint64 snapshotSize = QFileInfo(fileName).size();
+
+    // Records reach the file from the event loop while the journal stays open.
+    stack.push(new HibernatingAppendCommand(QLatin1String("a"), 1));
+    stack.push(new HibernatingAppendCommand(QLatin1String("b"), 1));
+    QTRY_VERIFY(QFileInfo(fileName).size() > snapshotSize);
+    QCOMPARE(stack.journalFileName(), fileName);
+
+    str.clear();
+    UndoStack recovered;
+    QVERIFY(recovered.recoverJournal(fileName));
+    QCOMPARE(recovered.count(), 2);
+    QCOMPARE(recovered.index(), 2);
+    QCOMPARE(str, QString("ab"));
+
+    stack.closeJournal();
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::mappedHistory()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/history.mapped");
+
+    for (int i = 0; i < 5; ++i)
+        stack.push(new HibernatingAppendCommand(QString::number(i), 10));
+    stack.undo();
+    stack.setClean();
+    QVERIFY(stack.saveMapped(fileName));
+
+    // Opening reads no command; they are read as they are touched.
+    UndoStack mapped;
+    QVERIFY(mapped.openMapped(fileName));
+    QCOMPARE(str, QString("0123"));
+    QCOMPARE(mapped.count(), 5);
+    QCOMPARE(mapped.index(), 4);
+    QCOMPARE(mapped.cleanIndex(), 4);
+    QVERIFY(mapped.isClean());
+    QCOMPARE(mapped.memoryUsage(), qint64(0));
+    QCOMPARE(mapped.text(2), QString("append 2"));
+    QCOMPARE(mapped.undoText(), QString("append 3"));
+    QCOMPARE(mapped.redoText(), QString("append 4"));
+    QCOMPARE(mapped.command(1), static_cast<const UndoCommand *>(0));
+    mapped.redo();
+    QCOMPARE(str, QString("01234"));
+    // A command that was read takes the place of its placeholder.
+    QCOMPARE(mapped.memoryUsage(), qint64(10));
+    mapped.setIndex(1);
+    QCOMPARE(str, QString("0"));
+    mapped.undo();
+    QCOMPARE(str, QString());
+    mapped.setIndex(4);
+    QCOMPARE(str, QString("0123"));
+    QCOMPARE(mapped.memoryUsage(), qint64(50));
+
+    // A mapped history is saved like any other.
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(stack.save(&buffer));
+    QBuffer mappedBuffer;
+    mappedBuffer.open(QIODevice::ReadWrite);
+    QVERIFY(mapped.save(&mappedBuffer));
+    QCOMPARE(mappedBuffer.data(), buffer.data());
+
+    // Pushing truncates the mapped commands above the index.
+    mapped.push(new HibernatingAppendCommand(QLatin1String("x"), 10));
+    QCOMPARE(mapped.count(), 5);
+    QCOMPARE(mapped.text(4), QString("append x"));
+    QCOMPARE(str, QString("0123x"));
+    mapped.clear();
+
+    // Invalid files leave the stack unchanged.
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QLatin1String("^UndoStack::openMapped\\(\\): cannot open ")));
+    QVERIFY(!mapped.openMapped(dir.path() + QLatin1String("/missing.mapped")));
+    const QString garbageName = dir.path() + QLatin1String("/garbage.mapped");
+    QFile garbage(garbageName);
+    QVERIFY(garbage.open(QIODevice::WriteOnly));
+    garbage.write(QByteArray(64, 'x'));
+    garbage.close();
+    QTest::ignoreMessage(QtWarningMsg, QRegularExpression(QLatin1String("is not a mapped undo history$")));
+    QVERIFY(!stack.openMapped(garbageName));
+    QCOMPARE(stack.count(), 5);
+    QCOMPARE(stack.index(), 4);
+
+    // A stack with a command that cannot be saved writes nothing.
+    stack.push(new LightUndoCommand(QLatin1String("plain")));
+    QTest::ignoreMessage(QtWarningMsg, "UndoStack::saveMapped(): the command at index 4 cannot be saved");
+    QVERIFY(!stack.saveMapped(fileName));
+    QVERIFY(mapped.openMapped(fileName));
+    QCOMPARE(mapped.count(), 5);
+
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::largeMappedHistory()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/large.mapped");
+
+    const int count = 100000;
+    QVector<LightUndoCommand*> commands;
+    commands.reserve(count);
+    for (int i = 0; i < count; ++i)
+        commands.append(new HibernatingAppendCommand(QString::number(i % 10), 1));
+    stack.push(commands);
+    QVERIFY(stack.saveMapped(fileName));
+    stack.clear();
+    str.clear();
+
+    // Opening creates no placeholder, and texts are read from the file when asked for.
+    UndoStack mapped;
+    const UndoCommandPool *pool = mapped.commandPool();
+    QVERIFY(mapped.openMapped(fileName));
+    QCOMPARE(mapped.count(), count);
+    QCOMPARE(mapped.index(), count);
+    QCOMPARE(pool->liveAllocationCount(), 0);
+    QCOMPARE(mapped.undoText(), QString("append 9"));
+    QCOMPARE(mapped.text(12345), QString("append 5"));
+    QCOMPARE(mapped.sequenceNumber(count - 1) - mapped.sequenceNumber(0), quint64(count - 1));
+    // Finding conflicts does not read the commands either.
+    QVERIFY(!mapped.canUndoSelectively(count - 2));
+    QCOMPARE(pool->liveAllocationCount(), 0);
+    QCOMPARE(mapped.memoryUsage(), qint64(0));
+
+    // Only the commands that are accessed get a placeholder.
+    QCOMPARE(mapped.command(5), static_cast<const UndoCommand *>(0));
+    QCOMPARE(pool->liveAllocationCount(), 1);
+    str = QLatin1String("xy");
+    mapped.undo();
+    mapped.undo();
+    QCOMPARE(str, QString());
+    QCOMPARE(mapped.memoryUsage(), qint64(2));
+    QCOMPARE(pool->liveAllocationCount(), 1);
+
+    // Evicting and truncating the mapped commands creates nothing either.
+    mapped.setUndoLimit(10);
+    QCOMPARE(mapped.count(), 10);
+    QCOMPARE(mapped.index(), 8);
+    QCOMPARE(mapped.text(0), QString("append 0"));
+    QCOMPARE(pool->liveAllocationCount(), 0);
+    mapped.setIndex(3);
+    mapped.push(new HibernatingAppendCommand(QLatin1String("z"), 1));
+    QCOMPARE(mapped.count(), 4);
+    QCOMPARE(mapped.text(3), QString("append z"));
+    QCOMPARE(pool->liveAllocationCount(), 0);
+
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::payloadCompression()
+{
+    QString str;
+    hibernationDocument = &str;
+    LightUndoCommand::registerType(HibernatingAppendCommand::Type, HibernatingAppendCommand::load);
+
+    // Commands more than two below the index are compressed as they are pushed.
+    stack.setCompressionDepth(2);
+    for (int i = 0; i < 10; ++i)
+        stack.push(new HibernatingAppendCommand(QString::number(i), 1000));
+    QCOMPARE(str, QString("0123456789"));
+    QVERIFY(stack.memoryUsage() > 2000);
+    QVERIFY(stack.memoryUsage() < 3000);
+    QCOMPARE(stack.text(3), QString("append 3"));
+    QCOMPARE(stack.redoText(), QString());
+
+    // Undo reaches the compressed commands; redo compresses them again.
+    for (int i = 0; i < 5; ++i)
+        stack.undo();
+    QCOMPARE(str, QString("01234"));
+    stack.setIndex(0);
+    QCOMPARE(str, QString());
+    stack.setIndex(10);
+    QCOMPARE(str, QString("0123456789"));
+    QVERIFY(stack.memoryUsage() < 3000);
+
+    // Compressed commands are saved like any other.
+    QBuffer buffer;
+    buffer.open(QIODevice::ReadWrite);
+    QVERIFY(stack.save(&buffer));
+    UndoStack loaded;
+    buffer.seek(0);
+    QVERIFY(loaded.load(&buffer));
+    QCOMPARE(loaded.count(), 10);
+    QCOMPARE(loaded.text(0), QString("append 0"));
+
+    stack.setCompressionDepth(0);
+    stack.clear();
+
+    // The codec is pluggable and only called for data that is worth compressing.
+    CountingCodec codec;
+    stack.setCompressionCodec(&codec);
+    QCOMPARE(stack.compressionCodec(), static_cast<UndoCompressionCodec *>(&codec));
+    const QString payload(1000, QLatin1Char('x'));
+    for (int i = 0; i < 3; ++i)
+        stack.push(new HibernatingAppendCommand(payload, 10000));
+    QCOMPARE(stack.memoryUsage(), qint64(30000));
+    stack.compressCommands();
+    QCOMPARE(codec.compressCount.load(), 2);
+    QVERIFY(stack.memoryUsage() < 11000);
+    stack.setIndex(0);
+    QCOMPARE(codec.decompressCount.load(), 2);
+    QVERIFY(str.isEmpty());
+    // Decompressed commands count with their own cost until they are compressed again.
+    QCOMPARE(stack.memoryUsage(), qint64(30000));
+    stack.setIndex(3);
+    QCOMPARE(str, payload + payload + payload);
+
+    // Changing the codec decompresses the commands compressed with the old one.
+    stack.compressCommands();
+    QCOMPARE(codec.compressCount.load(), 4);
+    stack.setCompressionCodec(0);
+    QCOMPARE(codec.decompressCount.load(), 4);
+    QCOMPARE(stack.memoryUsage(), qint64(30000));
+    stack.setIndex(0);
+    QCOMPARE(codec.decompressCount.load(), 4);
+    QVERIFY(str.isEmpty());
+
+    hibernationDocument = 0;
+}
+
+void tst_UndoStack::blobStore()
+{
+    const QByteArray red(4096, 'r');
+    const QByteArray green(4096, 'g');
+    QByteArray document = red;
+    UndoStack blobStack;
+    UndoBlobStore *store = blobStack.blobStore();
+    QVERIFY(store != 0);
+    QCOMPARE(blobStack.blobStore(), store);
+    QCOMPARE(store->count(), 0);
+    QCOMPARE(store->dedupeRatio(), qreal(1));
+
+    // Identical payloads, including the before and after states of successive
+    // commands, are stored once.
+    for (int i = 0; i < 4; ++i)
+        blobStack.push(new ReplaceBlobCommand(&document, store, i % 2 ? red : green));
+    QCOMPARE(document, red);
+    QCOMPARE(store->count(), 2);
+    QCOMPARE(store->referenceCount(), 8);
+    QCOMPARE(store->storedBytes(), qint64(2 * 4096));
+    QCOMPARE(store->referencedBytes(), qint64(8 * 4096));
+    QCOMPARE(store->savedBytes(), qint64(6 * 4096));
+    QCOMPARE(store->dedupeRatio(), qreal(4));
+    QVERIFY(store->insert(red) == store->insert(QByteArray(4096, 'r')));
+    QVERIFY(store->insert(red) != store->insert(green));
+    QCOMPARE(store->referenceCount(), 8);
+
+    blobStack.setIndex(1);
+    QCOMPARE(document, green);
+
+    // Truncation frees a payload with the last command that holds it.
+    const QByteArray blue(100, 'b');
+    blobStack.push(new ReplaceBlobCommand(&document, store, blue));
+    QCOMPARE(document, blue);
+    QCOMPARE(store->count(), 3);
+    QCOMPARE(store->referenceCount(), 4);
+    blobStack.setIndex(0);
+    blobStack.push(new ReplaceBlobCommand(&document, store, red));
+    QCOMPARE(store->count(), 1);
+    QCOMPARE(store->storedBytes(), qint64(4096));
+    QCOMPARE(store->savedBytes(), qint64(4096));
+
+    // So does eviction by the undo limit.
+    blobStack.push(new ReplaceBlobCommand(&document, store, blue));
+    blobStack.setUndoLimit(1);
+    QCOMPARE(blobStack.count(), 1);
+    QCOMPARE(store->count(), 2);
+    QCOMPARE(store->referenceCount(), 2);
+    QCOMPARE(store->savedBytes(), qint64(0));
+
+    // A handle keeps its payload alive after clear(), and after the store is gone.
+    UndoBlob kept = store->insert(blue);
+    blobStack.clear();
+    QCOMPARE(store->count(), 1);
+    QCOMPARE(store->storedBytes(), qint64(100));
+    UndoBlob copy;
+    QVERIFY(copy.isNull());
+    QCOMPARE(copy.size(), 0);
+    copy = kept;
+    QCOMPARE(store->referenceCount(), 2);
+
+    UndoBlobStore *orphan = new UndoBlobStore;
+    UndoBlob orphaned = orphan->insert(green);
+    delete orphan;
+    QCOMPARE(orphaned.data(), green);
+    orphaned = copy;
+    QCOMPARE(orphaned.data(), blue);
+
+    // The stacks of a group can share one store.
+    UndoGroup group;
+    UndoStack first(&group);
+    UndoStack second(&group);
+    QCOMPARE(group.blobStore(), group.blobStore());
+    QByteArray other = blue;
+    first.push(new ReplaceBlobCommand(&document, group.blobStore(), red));
+    second.push(new ReplaceBlobCommand(&other, group.blobStore(), red));
+    QCOMPARE(group.blobStore()->count(), 2);
+    QCOMPARE(group.blobStore()->referenceCount(), 4);
+    QCOMPARE(group.blobStore()->savedBytes(), qint64(2 * 4096));
+}
+
+QTEST_GUILESS_MAIN(tst_UndoStack)
 
 #include "tst_undostack.moc"
@@ -0,0 +1,95 @@
+#include <QtTest>
+#include <QtUndo/lightundocommand.h>
+#include <QtUndo/undogroup.h>
+#include <QtUndo/undostack.h>
+
+class IncrementCommand : public LightUndoCommand
+{
+public:
+    explicit IncrementCommand(int *value) :
+        LightUndoCommand(QLatin1String("increment")), m_value(value) {}
+
+    void undo() override { --*m_value; }
+    void redo() override { ++*m_value; }
+
+private:
+    int *m_value;
+};
+
+class tst_bench_UndoGroup : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void addRemoveStacks_data();
+    void addRemoveStacks();
+    void switchActiveStack();
+};
+
+void tst_bench_UndoGroup::addRemoveStacks_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<bool>("removeInOrder");
+
+    QTest::newRow("10k, in order") << 10000 << true;
+    QTest::newRow("10k, reverse order") << 10000 << false;
+    QTest::newRow("50k, in order") << 50000 << true;
+    QTest::newRow("50k, reverse order") << 50000 << false;
+}
+
+// Opening and closing a project with one stack per editor.
+void tst_bench_UndoGroup::addRemoveStacks()
+{
+    QFETCH(int, count);
+    QFETCH(bool, removeInOrder);
+
+    QVector<UndoStack*> stacks;
+    stacks.reserve(count);
+    for (int i = 0; i < count; ++i)
+        stacks.append(new UndoStack);
+
+    QBENCHMARK {
+        UndoGroup group;
+        for (UndoStack *stack : qAsConst(stacks))
+            group.addStack(stack);
+        QCOMPARE(group.stacks().size(), count);
+        if (removeInOrder) {
+            for (UndoStack *stack : qAsConst(stacks))
+                group.removeStack(stack);
+        } else {
+            for (int i = count - 1; i >= 0; --i)
+                group.removeStack(stacks.at(i));
+        }
+        QVERIFY(group.stacks().isEmpty());
+    }
+
+    qDeleteAll(stacks);
+}
+
+// Moving the focus across many editors, with the undo and redo actions of the
+// application listening to the group.
+void tst_bench_UndoGroup::switchActiveStack()
+{
+    const int count = 1000;
+    int value = 0;
+    UndoGroup group;
+    QVector<UndoStack*> stacks;
+    for (int i = 0; i < count; ++i) {
+        UndoStack *stack = new UndoStack(&group);
+        stack->push(new IncrementCommand(&value));
+        stacks.append(stack);
+    }
+    QSignalSpy undoTextChangedSpy(&group, SIGNAL(undoTextChanged(QString)));
+    QSignalSpy canRedoChangedSpy(&group, SIGNAL(canRedoChanged(bool)));
+
+    QBENCHMARK {
+        for (UndoStack *stack : qAsConst(stacks))
+            group.setActiveStack(stack);
+    }
+
+    qDeleteAll(stacks);
+}
+
+QTEST_MAIN(tst_bench_UndoGroup)
+
+#include "tst_bench_undogroup.moc"
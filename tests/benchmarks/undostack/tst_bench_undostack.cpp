@@ -0,0 +1,604 @@
+#include <QtTest>
+#include <QtUndo/lightundocommand.h>
+#include <QtUndo/undoblobstore.h>
+#include <QtUndo/undocheckpointhandler.h>
+#include <QtUndo/undocommand.h>
+#include <QtUndo/undocommandpool.h>
+#include <QtUndo/undostack.h>
+
+#include <cstdlib>
+#include <new>
+
+// Count every allocation made through operator new, including the ones made
+// by the library, so that the memory cost of a command can be reported.
+static qint64 allocatedBytes = 0;
+
+void *operator new(std::size_t size)
+{
+    allocatedBytes += size;
+    if (void *ptr = std::malloc(size))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) Q_DECL_NOTHROW
+{
+    std::free(ptr);
+}
+
+class IncrementCommand : public UndoCommand
+{
+public:
+    explicit IncrementCommand(int *value) : m_value(value) {}
+
+    void undo() override { --*m_value; }
+    void redo() override { ++*m_value; }
+
+private:
+    int *m_value;
+};
+
+class LightIncrementCommand : public LightUndoCommand
+{
+public:
+    explicit LightIncrementCommand(int *value) : m_value(value) {}
+
+    void undo() override { --*m_value; }
+    void redo() override { ++*m_value; }
+
+private:
+    int *m_value;
+};
+
+// Merges into the previous command, like one command per keystroke.
+class MergingIncrementCommand : public LightUndoCommand
+{
+public:
+    explicit MergingIncrementCommand(int *value) :
+        LightUndoCommand(QLatin1String("typing")), m_value(value), m_delta(1) {}
+
+    void undo() override { *m_value -= m_delta; }
+    void redo() override { *m_value += m_delta; }
+    int id() const override { return 1; }
+    bool mergeWith(const LightUndoCommand *other) override
+    {
+        m_delta += static_cast<const MergingIncrementCommand *>(other)->m_delta;
+        return true;
+    }
+
+private:
+    int *m_value;
+    int m_delta;
+};
+
+class IntCheckpointHandler : public UndoCheckpointHandler
+{
+public:
+    explicit IntCheckpointHandler(int *value) : m_value(value) {}
+
+    QVariant saveCheckpoint() override { return *m_value; }
+    void restoreCheckpoint(const QVariant &checkpoint) override { *m_value = checkpoint.toInt(); }
+
+private:
+    int *m_value;
+};
+
+// A command that keeps a payload alive and can be hibernated.
+class PayloadCommand : public LightUndoCommand
+{
+public:
+    enum { Type = 1 };
+
+    explicit PayloadCommand(const QByteArray &payload) : m_payload(payload) {}
+
+    void undo() override { --value; }
+    void redo() override { ++value; }
+    qint64 cost() const override { return m_payload.size(); }
+    int typeId() const override { return Type; }
+    void save(QDataStream &stream) const override { stream << m_payload; }
+
+    static LightUndoCommand *load(QDataStream &stream)
+    {
+        QByteArray payload;
+        stream >> payload;
+        return new PayloadCommand(payload);
+    }
+
+    static int value;
+
+private:
+    QByteArray m_payload;
+};
+
+int PayloadCommand::value = 0;
+
+// A command that keeps its payload in a blob store.
+class BlobPayloadCommand : public LightUndoCommand
+{
+public:
+    BlobPayloadCommand(UndoBlobStore *store, const QByteArray &payload) :
+        m_payload(store->insert(payload)) {}
+
+    void undo() override { --PayloadCommand::value; }
+    void redo() override { ++PayloadCommand::value; }
+    qint64 cost() const override { return m_payload.size(); }
+
+private:
+    UndoBlob m_payload;
+};
+
+enum CommandType {
+    ObjectCommand,
+    LightCommand
+};
+Q_DECLARE_METATYPE(CommandType)
+
+static LightUndoCommand *createCommand(CommandType type, int *value, UndoCommandPool *pool = 0)
+{
+    if (type == LightCommand)
+        return new (pool) LightIncrementCommand(value);
+    return new (pool) IncrementCommand(value);
+}
+
+class tst_bench_UndoStack : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void push_data();
+    void push();
+    void memoryPerCommand_data();
+    void memoryPerCommand();
+    void pooledChurn_data();
+    void pooledChurn();
+    void signalsPerPush_data();
+    void signalsPerPush();
+    void setIndexJump_data();
+    void setIndexJump();
+    void pushBatch_data();
+    void pushBatch();
+    void hibernation_data();
+    void hibernation();
+    void lazyRehydration();
+    void saveHistory_data();
+    void saveHistory();
+    void loadHistory_data();
+    void loadHistory();
+    void openMappedHistory_data();
+    void openMappedHistory();
+    void pushJournaled_data();
+    void pushJournaled();
+    void undoCompressed_data();
+    void undoCompressed();
+    void pushDeduplicated_data();
+    void pushDeduplicated();
+};
+
+void tst_bench_UndoStack::push_data()
+{
+    QTest::addColumn<CommandType>("type");
+    QTest::addColumn<bool>("pooled");
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("UndoCommand, 10k") << ObjectCommand << false << 10000;
+    QTest::newRow("LightUndoCommand, 10k") << LightCommand << false << 10000;
+    QTest::newRow("UndoCommand, pooled, 10k") << ObjectCommand << true << 10000;
+    QTest::newRow("LightUndoCommand, pooled, 10k") << LightCommand << true << 10000;
+}
+
+void tst_bench_UndoStack::push()
+{
+    QFETCH(CommandType, type);
+    QFETCH(bool, pooled);
+    QFETCH(int, count);
+
+    int value = 0;
+    QBENCHMARK {
+        UndoStack stack;
+        UndoCommandPool *pool = pooled ? stack.commandPool() : 0;
+        for (int i = 0; i < count; ++i)
+            stack.push(createCommand(type, &value, pool));
+    }
+}
+
+void tst_bench_UndoStack::memoryPerCommand_data()
+{
+    push_data();
+}
+
+void tst_bench_UndoStack::memoryPerCommand()
+{
+    QFETCH(CommandType, type);
+    QFETCH(bool, pooled);
+    QFETCH(int, count);
+
+    int value = 0;
+    UndoStack stack;
+    UndoCommandPool *pool = pooled ? stack.commandPool() : 0;
+    const qint64 bytesBefore = allocatedBytes;
+    for (int i = 0; i < count; ++i)
+        stack.push(createCommand(type, &value, pool));
+
+    QTest::setBenchmarkResult(qreal(allocatedBytes - bytesBefore) / count, QTest::BytesAllocated);
+}
+
+void tst_bench_UndoStack::pooledChurn_data()
+{
+    QTest::addColumn<CommandType>("type");
+    QTest::addColumn<bool>("pooled");
+
+    QTest::newRow("UndoCommand") << ObjectCommand << false;
+    QTest::newRow("UndoCommand, pooled") << ObjectCommand << true;
+    QTest::newRow("LightUndoCommand") << LightCommand << false;
+    QTest::newRow("LightUndoCommand, pooled") << LightCommand << true;
+}
+
+// A long session with an undo limit: every push evicts the oldest command and
+// every few pushes follow an undo, truncating the redo tail.
+void tst_bench_UndoStack::pooledChurn()
+{
+    QFETCH(CommandType, type);
+    QFETCH(bool, pooled);
+
+    int value = 0;
+    UndoStack stack;
+    stack.setUndoLimit(1000);
+    UndoCommandPool *pool = pooled ? stack.commandPool() : 0;
+
+    QBENCHMARK {
+        for (int i = 0; i < 100000; ++i) {
+            if (i % 8 == 0)
+                stack.undo();
+            stack.push(createCommand(type, &value, pool));
+        }
+    }
+}
+
+void tst_bench_UndoStack::signalsPerPush_data()
+{
+    QTest::addColumn<bool>("merging");
+
+    QTest::newRow("append") << false;
+    QTest::newRow("merge") << true;
+}
+
+// Counts the state signals emitted by push(), with a receiver on each of them
+// as a QML binding would have.
+void tst_bench_UndoStack::signalsPerPush()
+{
+    QFETCH(bool, merging);
+
+    const int count = 10000;
+    int value = 0;
+    UndoStack stack;
+    QSignalSpy indexChangedSpy(&stack, SIGNAL(indexChanged(int)));
+    QSignalSpy cleanChangedSpy(&stack, SIGNAL(cleanChanged(bool)));
+    QSignalSpy canUndoChangedSpy(&stack, SIGNAL(canUndoChanged(bool)));
+    QSignalSpy undoTextChangedSpy(&stack, SIGNAL(undoTextChanged(QString)));
+    QSignalSpy canRedoChangedSpy(&stack, SIGNAL(canRedoChanged(bool)));
+    QSignalSpy redoTextChangedSpy(&stack, SIGNAL(redoTextChanged(QString)));
+
+    for (int i = 0; i < count; ++i) {
+        if (merging)
+            stack.push(new MergingIncrementCommand(&value));
+        else
+            stack.push(new LightIncrementCommand(&value));
+    }
+
+    const int emissions = indexChangedSpy.count() + cleanChangedSpy.count()
+            + canUndoChangedSpy.count() + undoTextChangedSpy.count()
+            + canRedoChangedSpy.count() + redoTextChangedSpy.count();
+    QTest::setBenchmarkResult(qreal(emissions) / count, QTest::Events);
+}
+
+void tst_bench_UndoStack::setIndexJump_data()
+{
+    QTest::addColumn<int>("checkpointInterval");
+
+    QTest::newRow("no checkpoints") << 0;
+    QTest::newRow("checkpoint every 1000") << 1000;
+}
+
+// A history slider jumping between both ends of 200k commands.
+void tst_bench_UndoStack::setIndexJump()
+{
+    QFETCH(int, checkpointInterval);
+
+    int value = 0;
+    IntCheckpointHandler handler(&value);
+    UndoStack stack;
+    stack.setCheckpointHandler(&handler);
+    stack.setCheckpointInterval(checkpointInterval);
+    for (int i = 0; i < 200000; ++i)
+        stack.push(new LightIncrementCommand(&value));
+
+    QBENCHMARK {
+        stack.setIndex(1500);
+        stack.setIndex(stack.count() - 1);
+    }
+    QCOMPARE(value, stack.count() - 1);
+}
+
+void tst_bench_UndoStack::pushBatch_data()
+{
+    QTest::addColumn<bool>("batched");
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("push(), 10k") << false << 10000;
+    QTest::newRow("push(QVector), 10k") << true << 10000;
+    QTest::newRow("push(), 1M") << false << 1000000;
+    QTest::newRow("push(QVector), 1M") << true << 1000000;
+}
+
+// An import that pushes one command per element, with an undo limit and a
+// receiver on indexChanged() as an undo view would have.
+void tst_bench_UndoStack::pushBatch()
+{
+    QFETCH(bool, batched);
+    QFETCH(int, count);
+
+    int value = 0;
+    QBENCHMARK {
+        UndoStack stack;
+        stack.setUndoLimit(1000);
+        QSignalSpy indexChangedSpy(&stack, SIGNAL(indexChanged(int)));
+        if (batched) {
+            QVector<LightUndoCommand*> commands;
+            commands.reserve(count);
+            for (int i = 0; i < count; ++i)
+                commands.append(new LightIncrementCommand(&value));
+            stack.push(commands);
+        } else {
+            for (int i = 0; i < count; ++i)
+                stack.push(new LightIncrementCommand(&value));
+        }
+    }
+}
+
+void tst_bench_UndoStack::hibernation_data()
+{
+    QTest::addColumn<int>("count");
+    QTest::addColumn<int>("payload");
+
+    QTest::newRow("10k x 64 bytes") << 10000 << 64;
+    QTest::newRow("10k x 4 KB") << 10000 << 4096;
+    QTest::newRow("1k x 64 KB") << 1000 << 65536;
+}
+
+// Writing an idle document's history to disk and reading all of it back, as
+// when the document is activated again.
+void tst_bench_UndoStack::hibernation()
+{
+    QFETCH(int, count);
+    QFETCH(int, payload);
+
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    UndoStack stack;
+    for (int i = 0; i < count; ++i)
+        stack.push(new PayloadCommand(QByteArray(payload, 'x')));
+
+    stack.hibernate();
+    QCOMPARE(stack.memoryUsage(), qint64(0));
+
+    QBENCHMARK {
+        stack.rehydrate();
+        stack.hibernate();
+    }
+    QCOMPARE(stack.hibernatedCount(), count);
+}
+
+// Undoing into a hibernated history, which reads one command per step.
+void tst_bench_UndoStack::lazyRehydration()
+{
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    UndoStack stack;
+    for (int i = 0; i < 10000; ++i)
+        stack.push(new PayloadCommand(QByteArray(4096, 'x')));
+
+    QBENCHMARK {
+        stack.hibernate();
+        for (int i = 0; i < 100; ++i)
+            stack.undo();
+        stack.setIndex(stack.count());
+        stack.rehydrate();
+    }
+}
+
+void tst_bench_UndoStack::saveHistory_data()
+{
+    QTest::addColumn<int>("count");
+
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+}
+
+void tst_bench_UndoStack::saveHistory()
+{
+    QFETCH(int, count);
+
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    UndoStack stack;
+    QVector<LightUndoCommand*> commands;
+    for (int i = 0; i < count; ++i)
+        commands.append(new PayloadCommand(QByteArray(8, 'x')));
+    stack.push(commands);
+
+    QBENCHMARK {
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(stack.save(&buffer));
+    }
+}
+
+void tst_bench_UndoStack::loadHistory_data()
+{
+    saveHistory_data();
+}
+
+// Reopening a document with a long history.
+void tst_bench_UndoStack::loadHistory()
+{
+    QFETCH(int, count);
+
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    QByteArray data;
+    {
+        UndoStack stack;
+        QVector<LightUndoCommand*> commands;
+        for (int i = 0; i < count; ++i)
+            commands.append(new PayloadCommand(QByteArray(8, 'x')));
+        stack.push(commands);
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        QVERIFY(stack.save(&buffer));
+    }
+
+    QBENCHMARK {
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::ReadOnly);
+        UndoStack stack;
+        QVERIFY(stack.load(&buffer));
+    }
+}
+
+void tst_bench_UndoStack::openMappedHistory_data()
+{
+    saveHistory_data();
+}
+
+// Reopening the same history as loadHistory() from a mapped file, and undoing the
+// last few commands, which are the only ones read.
+void tst_bench_UndoStack::openMappedHistory()
+{
+    QFETCH(int, count);
+
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    const QString fileName = dir.path() + QLatin1String("/bench.mapped");
+    {
+        UndoStack stack;
+        QVector<LightUndoCommand*> commands;
+        for (int i = 0; i < count; ++i)
+            commands.append(new PayloadCommand(QByteArray(8, 'x')));
+        stack.push(commands);
+        QVERIFY(stack.saveMapped(fileName));
+    }
+
+    QBENCHMARK {
+        UndoStack stack;
+        QVERIFY(stack.openMapped(fileName));
+        for (int i = 0; i < 10; ++i)
+            stack.undo();
+    }
+}
+
+void tst_bench_UndoStack::pushJournaled_data()
+{
+    QTest::addColumn<bool>("journaled");
+
+    QTest::newRow("no journal") << false;
+    QTest::newRow("journal") << true;
+}
+
+// The cost that recording a journal adds to push(), undo() and redo(). The writes
+// happen on another thread; closing the journal waits for them.
+void tst_bench_UndoStack::pushJournaled()
+{
+    QFETCH(bool, journaled);
+
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+
+    QBENCHMARK {
+        UndoStack stack;
+        if (journaled)
+            QVERIFY(stack.openJournal(dir.path() + QLatin1String("/bench.journal")));
+        for (int i = 0; i < 100000; ++i) {
+            stack.push(new PayloadCommand(QByteArray(16, 'x')));
+            if (i % 10 == 9) {
+                stack.undo();
+                stack.redo();
+            }
+        }
+        stack.closeJournal();
+    }
+}
+
+void tst_bench_UndoStack::undoCompressed_data()
+{
+    QTest::addColumn<bool>("compressed");
+
+    QTest::newRow("in memory") << false;
+    QTest::newRow("compressed") << true;
+}
+
+// Undoing cold commands that have to be decompressed first, against undoing them in
+// memory. The payloads resemble bitmap edits: runs of equal bytes with some noise.
+void tst_bench_UndoStack::undoCompressed()
+{
+    QFETCH(bool, compressed);
+
+    LightUndoCommand::registerType(PayloadCommand::Type, PayloadCommand::load);
+    UndoStack stack;
+    const int count = 200;
+    std::srand(1);
+    for (int i = 0; i < count; ++i) {
+        QByteArray bitmap(64 * 1024, 0);
+        for (int j = 0; j < bitmap.size(); ++j)
+            bitmap[j] = char(j / 256 + (std::rand() % 16 == 0 ? std::rand() % 4 : 0));
+        stack.push(new PayloadCommand(bitmap));
+    }
+
+    const qint64 usage = stack.memoryUsage();
+    if (compressed) {
+        stack.compressCommands();
+        QVERIFY(stack.memoryUsage() < usage);
+    }
+
+    QBENCHMARK_ONCE {
+        stack.setIndex(0);
+    }
+}
+
+void tst_bench_UndoStack::pushDeduplicated_data()
+{
+    QTest::addColumn<bool>("deduplicated");
+
+    QTest::newRow("copied") << false;
+    QTest::newRow("deduplicated") << true;
+}
+
+// The time taken by commands that paste one of a few assets over and over.
+// Each paste brings its own copy of the asset, as if read from the clipboard.
+void tst_bench_UndoStack::pushDeduplicated()
+{
+    QFETCH(bool, deduplicated);
+
+    const int count = 1000;
+    const int assetCount = 8;
+    QVector<QByteArray> assets;
+    for (int i = 0; i < assetCount; ++i)
+        assets.append(QByteArray(16 * 1024, char('a' + i)));
+
+    UndoStack stack;
+    UndoBlobStore *store = stack.blobStore();
+    QBENCHMARK_ONCE {
+        for (int i = 0; i < count; ++i) {
+            const QByteArray &asset = assets.at(i % assetCount);
+            const QByteArray pasted(asset.constData(), asset.size());
+            if (deduplicated)
+                stack.push(new BlobPayloadCommand(store, pasted));
+            else
+                stack.push(new PayloadCommand(pasted));
+        }
+    }
+
+    if (deduplicated)
+        QCOMPARE(store->storedBytes(), qint64(assetCount) * 16 * 1024);
+}
+
+QTEST_MAIN(tst_bench_UndoStack)
+
+#include "tst_bench_undostack.moc"
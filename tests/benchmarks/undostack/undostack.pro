@@ -0,0 +1,11 @@
+QT += testlib undo
+QT -= gui
+
+TARGET = tst_bench_undostack
+CONFIG += console release
+CONFIG -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += \
+    tst_bench_undostack.cpp